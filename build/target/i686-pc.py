@@ -34,6 +34,7 @@ with AddTarget("kernel", type=ProgType.KERNEL):
 	Config('ASAN', "CONFIG_YES")
 	Config('UBSAN', "CONFIG_YES")
 	Config('STACKCHK', "CONFIG_YES")
+	Config('LOCKSTAT', "CONFIG_NO")
 
 	Config('STATIC_MODULES', [
 		"elf32",
@@ -17,5 +17,6 @@
 #define CONFIG_ASAN CONFIG_YES
 #define CONFIG_UBSAN CONFIG_YES
 #define CONFIG_STACKCHK CONFIG_YES
+#define CONFIG_LOCKSTAT CONFIG_NO
 
 #endif
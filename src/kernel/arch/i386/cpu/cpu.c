@@ -29,8 +29,11 @@
 #include <kern/syscall.h>
 #include <kern/sched.h>
 #include <kern/mp.h>
+#include <kern/user.h>
+#include <kern/vdso.h>
 #include <lib/string.h>
 #include <arch/fpu.h>
+#include <arch/msr.h>
 #include <arch/kwp.h>
 #include <arch/frame.h>
 #include <arch/interrupt.h>
@@ -52,6 +55,17 @@ uint32_t cpu_feature2;
 uint32_t cpuid_high;
 uint32_t cpuid_exthigh;
 
+/*
+ * The userspace address sysexit returns to (vdso_sysenter_return),
+ * used by interrupt.sx.
+ */
+vm_vaddr_t sysenter_return;
+extern const char vdso_sysenter_return[];
+
+ASSERT(offsetof(arch_cpu_t, tss) == offsetof(arch_cpu_t, sysenter_stack) +
+	sizeof(((arch_cpu_t *)0)->sysenter_stack), "sysenter_stack has to be "
+	"followed by the tss");
+
 static void cpu_nmi_handler(__unused int num, __unused trapframe_t *tf,
 	__unused void *arg)
 {
@@ -124,6 +138,29 @@ void asmlinkage cpu_intr_handler(trapframe_t *regs) {
 	}
 }
 
+/*
+ * Called from interrupt.sx
+ */
+void asmlinkage cpu_sysenter_handler(trapframe_t *regs) {
+	thread_t *thread = cur_thread();
+	uint32_t arg;
+
+	thread->trapframe = regs;
+
+	/*
+	 * The user stack pointer points to the %ebp saved by
+	 * __kernel_vsyscall, which is the 6th argument.
+	 */
+	if(copyin(&arg, (void *)regs->useresp, sizeof(arg))) {
+		tf_set_retval(regs, -EFAULT);
+	} else {
+		regs->ebp = arg;
+		syscall();
+	}
+
+	thread_uret();
+}
+
 uint32_t getgs(void) {
 	gdt_entry_t *entry = &cur_cpu()->arch.gdt[SEG_GS];
 	return (uint32_t) entry->base_lo << 0 | (uint32_t) entry->base_hi << 24;
@@ -197,6 +234,17 @@ static void cpu_seg_init(arch_cpu_t * c) {
 	ltr(SEG_SEL(SEG_TSS, DPL_KERN));
 }
 
+static void cpu_sysenter_init(arch_cpu_t *c) {
+	/*
+	 * sysenter uses SYSENTER_CS + 8 as the kernel stack segment, sysexit
+	 * uses SYSENTER_CS + 16 and + 24 as user code and stack segments,
+	 * which matches the layout of the gdt.
+	 */
+	wrmsr64(MSR_IA32_SYSENTER_CS, KCODE_SEL);
+	wrmsr64(MSR_IA32_SYSENTER_ESP, (uintptr_t)&c->tss.esp0);
+	wrmsr64(MSR_IA32_SYSENTER_EIP, (uintptr_t)sysenter_entry);
+}
+
 static void setidt(int num, void *func, uint16_t cs, uint8_t type,
 	uint8_t dpl)
 {
@@ -234,10 +282,6 @@ static __init void idt_init(void) {
 		DPL_USER);
 }
 
-#if notyet
-#include <arch/delay.h>
-#endif
-
 static void cpu_detect(void) {
 	char vendor[13];
 	size_t i;
@@ -271,23 +315,6 @@ static void cpu_detect(void) {
 		cpu_model[48] = '\0';
 	}
 
-#if notyet
-	/*
-	 * Get the TSC frequency.
-	 */
-	uint64_t tsc1, tsc2;
-
-	early_delay_setup();
-	tsc1 = rdtsc();
-	early_delay(MILLI2NANO(1));
-	tsc2 = rdtsc();
-
-	uint64_t freq = tsc2 - tsc1;
-	kprintf("KHZ: %lld\n", freq);
-	kprintf("MHZ: %lld\n", freq / 1000);
-	kprintf("GHZ: %lld\n", freq / 1000000);
-#endif
-
 	kprintf("[cpu] processor information:\n");
 	kprintf("\tvendor: %s\n", cpu_vendor_str(cpu_vendor));
 	kprintf("\tmodel: %s\n", cpu_model);
@@ -307,6 +334,14 @@ void arch_cpu_init(arch_cpu_t *cpu) {
 		cpu_detect();
 	}
 
+	cpu_sysenter_init(cpu);
 	fpu_cpu_init();
 	kwp_enable();
 }
+
+static __init int cpu_sysenter_return_init(void) {
+	sysenter_return = vdso_text_addr(vdso_sysenter_return);
+	return INIT_OK;
+}
+
+late_initcall(cpu_sysenter_return_init);
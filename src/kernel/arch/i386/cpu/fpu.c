@@ -26,13 +26,46 @@
 #include <kern/fault.h>
 #include <kern/user.h>
 #include <kern/proc.h>
+#include <kern/cpu.h>
+#include <kern/critical.h>
 #include <lib/string.h>
 #include <arch/fpu.h>
 #include <arch/x86.h>
+#include <arch/frame.h>
+#include <arch/interrupt.h>
+
+/*
+ * The fpu is switched lazily: CR0.TS is set when switching threads, so
+ * that the first fpu instruction of a thread raises #NM. The state of
+ * the thread is restored then and it is saved again when switching away
+ * from the thread. The state is not restored if the cpu still has the
+ * registers of the thread loaded, i.e. if the thread is the fpu_owner
+ * of the cpu and did not restore its state on another cpu since. Kernel
+ * threads never use the fpu and thus never save or restore anything.
+ */
 
 static fpstate_t fpu_default __align(FPU_ALIGN);
 static bool fpu_default_init = false;
 
+static void fpu_set_ts(arch_cpu_t *cpu, bool ts) {
+	if(cpu->fpu_ts != ts) {
+		cpu->fpu_ts = ts;
+		if(ts) {
+			cr0_set(cr0_get() | CR0_TS);
+		} else {
+			clts();
+		}
+	}
+}
+
+static void fpu_nm_handler(__unused int intr, trapframe_t *tf,
+	__unused void *arg)
+{
+	kassert(!thread_is_kern(cur_thread()), "[fpu] kernel thread used the "
+		"fpu at 0x%x", tf->eip);
+	fpu_activate();
+}
+
 void fpu_cpu_init(void) {
 	/* TODO check whether the CPU supports fxsave */
 
@@ -49,14 +82,70 @@ void fpu_cpu_init(void) {
 	if(!fpu_default_init) {
 		fpu_default_init = true;
 		fpu_save(&fpu_default);
+		cpu_set_intr_handler(INT_NM, fpu_nm_handler, NULL);
 	}
+
+	/*
+	 * The fpu is enabled by the first user of the fpu.
+	 */
+	cur_cpu()->arch.fpu_owner = NULL;
+	cur_cpu()->arch.fpu_ts = false;
+	fpu_set_ts(&cur_cpu()->arch, true);
 }
 
 void fpu_init(arch_thread_t *thread) {
 	thread->fpu = ALIGN_PTR(&thread->fpubuf, FPU_ALIGN);
+	thread->fpu_cpu = NULL;
 	fpu_clone(thread->fpu, &fpu_default);
 }
 
+void fpu_switch(__unused thread_t *to, thread_t *from) {
+	arch_cpu_t *cpu = &cur_cpu()->arch;
+
+	/*
+	 * The fpu is only enabled if the previous thread used the fpu
+	 * since it was switched to.
+	 */
+	if(!cpu->fpu_ts) {
+		assert(cpu->fpu_owner == from);
+		if(from->state != THREAD_EXIT) {
+			fxsave(from->arch.fpu);
+		}
+		fpu_set_ts(cpu, true);
+	}
+
+	if(cpu->fpu_owner == from && from->state == THREAD_EXIT) {
+		cpu->fpu_owner = NULL;
+	}
+}
+
+void fpu_activate(void) {
+	thread_t *thread = cur_thread();
+	arch_cpu_t *cpu;
+
+	critical_enter();
+	cpu = &cur_cpu()->arch;
+	if(cpu->fpu_ts) {
+		fpu_set_ts(cpu, false);
+		if(cpu->fpu_owner != thread || thread->arch.fpu_cpu != cpu) {
+			fxrstor(thread->arch.fpu);
+			cpu->fpu_owner = thread;
+			thread->arch.fpu_cpu = cpu;
+		}
+	}
+	critical_leave();
+}
+
+void fpu_sync(void) {
+	thread_t *thread = cur_thread();
+
+	critical_enter();
+	if(!cur_cpu()->arch.fpu_ts) {
+		fxsave(thread->arch.fpu);
+	}
+	critical_leave();
+}
+
 void fpu_clone(fpstate_t *dst, fpstate_t *src) {
 	memcpy(dst, src, FPU_REGS_SZ);
 }
@@ -69,12 +158,35 @@ void fpu_restore(fpstate_t *fpu) {
 	fxrstor(fpu);
 }
 
+void fpu_kern_begin(void) {
+	arch_cpu_t *cpu;
+
+	critical_enter();
+	cpu = &cur_cpu()->arch;
+	if(!cpu->fpu_ts) {
+		fxsave(cur_thread()->arch.fpu);
+	}
+
+	/*
+	 * The registers will not contain the state of any thread
+	 * afterwards.
+	 */
+	cpu->fpu_owner = NULL;
+	fpu_set_ts(cpu, false);
+}
+
+void fpu_kern_end(void) {
+	fpu_set_ts(&cur_cpu()->arch, true);
+	critical_leave();
+}
+
 int copyout_fpu(fpstate_t *fp) {
 	if(!PTR_ALIGNED(fp, FPU_ALIGN)) {
 		goto error;
 	}
 
 	if(user_io_check(fp, sizeof(*fp), NULL) == 0) {
+		fpu_activate();
 		mayfault(error) {
 			fxsave(fp);
 		}
@@ -92,6 +204,7 @@ int copyin_fpu(fpstate_t *fp) {
 	}
 
 	if(user_io_check(fp, sizeof(*fp), NULL) == 0) {
+		fpu_activate();
 		mayfault(error) {
 			fxrstor(fp);
 		}
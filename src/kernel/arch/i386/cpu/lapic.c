@@ -298,7 +298,7 @@ static void lapic_timer_config(__unused evtimer_t *timer, evtimer_mode_t mode,
 }
 
 static void lapic_timer_stop(__unused evtimer_t *timer) {
-	lapic_write(LAPIC_TDCR, INT_APIC_TIMER | LAPIC_LVT_DM_FIXED |
+	lapic_write(LAPIC_LVT_TIMER, INT_APIC_TIMER | LAPIC_LVT_DM_FIXED |
 		LAPIC_LVT_EDGE | LAPIC_LVT_ACTIVE_HI | LAPIC_LVT_MASKED |
 		LAPIC_LVT_ONESHOT);
 }
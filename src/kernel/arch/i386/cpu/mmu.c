@@ -27,6 +27,7 @@
 #include <kern/cpu.h>
 #include <kern/fault.h>
 #include <kern/mp.h>
+#include <kern/critical.h>
 #include <lib/string.h>
 #include <vm/vm.h>
 #include <vm/phys.h>
@@ -567,10 +568,71 @@ void mmu_ctx_create(mmu_ctx_t *ctx) {
 }
 
 void mmu_ctx_destroy(mmu_ctx_t *ctx) {
+	vm_page_batch_t batch = VM_PAGE_BATCH_INIT;
+	vm_page_t *page;
+	bool ipi = false;
+	cpu_t *cpu;
+
+	/*
+	 * The scheduler does not switch the context when switching to a
+	 * kernel thread, so processors running kernel threads might still
+	 * have this context loaded. Nobody can load the context again,
+	 * because there are no threads using it anymore.
+	 */
+	critical {
+		if(ctx == mmu_cur_ctx) {
+			vm_vas_switch(&vm_kern_vas);
+		}
+
+		foreach_cpu(cpu) {
+			if(cpu != cur_cpu() &&
+				&atomic_load_relaxed(&cpu->vm_vas)->mmu == ctx)
+			{
+				ipi = true;
+			}
+		}
+
+		if(ipi) {
+			ipi_ctx_leave(ctx);
+		}
+	}
+
+	/*
+	 * Since the context is not loaded anywhere, no processor
+	 * can have TLB entries of this context. The remaining page tables
+	 * are simply thrown away, instead of clearing every PTE.
+	 */
+	assert(ctx != mmu_cur_ctx);
+	for(size_t i = 0; i < PDE_KERN; i++) {
+		if(ctx->pgdir[i] & PG_P) {
+			page = vm_phys_to_page(ctx->pgdir[i] & PAGE_MASK);
+
+			/*
+			 * The pin count is the number of valid PTEs.
+			 */
+			atomic_store_relaxed(&page->pincnt, 0);
+			vm_page_batch_add(&batch, page);
+		}
+	}
+
+	vm_page_batch_flush(&batch);
 	vmem_free_backed(ctx->pgdir, PAGE_SZ);
 	sync_destroy(&ctx->lock);
 }
 
+size_t mmu_ctx_mapped(mmu_ctx_t *ctx) {
+	size_t num = 0;
+
+	sync_scope_acquire(&ctx->lock);
+	for(size_t i = 0; i < PDE_KERN; i++) {
+		if(ctx->pgdir[i] & PG_P) {
+			num += vm_phys_to_page(ctx->pgdir[i] & PAGE_MASK)->pincnt;
+		}
+	}
+
+	return num;
+}
+
 void mmu_map_ap(void) {
 	/*
 	 * Identity map the lowest 4MB.
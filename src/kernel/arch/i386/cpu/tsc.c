@@ -0,0 +1,242 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ *
+ * Copyright (c) 2017, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <kern/system.h>
+#include <kern/init.h>
+#include <kern/atomic.h>
+#include <kern/time.h>
+#include <kern/vdso.h>
+#include <kern/workqueue.h>
+#include <device/timecounter.h>
+#include <arch/x86.h>
+#include <arch/cpu.h>
+#include <arch/tsc.h>
+
+#define TSC_CALIB_TIME	MILLI2NANO(50)
+#define TSC_SYNC_LOOPS	100000
+#define TSC_CHECK_TIME	SEC2NANO(1)
+#define TSC_MAX_DRIFT	1000 /* 1 / TSC_MAX_DRIFT of the elapsed time */
+
+static timecounter_t tsc_tc;
+static bool tsc_registered = false;
+static bool tsc_unstable = false;
+
+/*
+ * The drift of the TSC is compared against the counter, which was used
+ * before the TSC was registered.
+ */
+static timecounter_t *tsc_ref;
+static uint64_t tsc_ref_last, tsc_last;
+static delayed_work_t tsc_check_work;
+
+/*
+ * The state of the synchronization check.
+ */
+static size_t tsc_sync_arrive;
+static size_t tsc_sync_lock;
+static uint64_t tsc_sync_last;
+static uint64_t tsc_sync_maxwarp;
+
+static uint64_t tsc_read(__unused timecounter_t *tc) {
+	return rdtsc();
+}
+
+static void tsc_mark_unstable(const char *reason) {
+	if(atomic_xchg(&tsc_unstable, true)) {
+		return;
+	}
+
+	kprintf("[tsc] unstable: %s\n", reason);
+	if(tc_unregister(&tsc_tc)) {
+		kprintf("[tsc] warning: no other counter left\n");
+	}
+}
+
+/**
+ * @brief Measure the frequency of the TSC using the current counter.
+ */
+static frequency_t tsc_calibrate(void) {
+	uint64_t tsc1, tsc2;
+	nanosec_t start, end;
+	bool intr;
+
+	intr = cpu_intr_enabled();
+	cpu_intr_set(false);
+
+	start = nanouptime();
+	tsc1 = rdtsc();
+	do {
+		end = nanouptime();
+	} while(end - start < TSC_CALIB_TIME);
+	tsc2 = rdtsc();
+
+	cpu_intr_set(intr);
+
+	return (tsc2 - tsc1) * SEC_NANOSECS / (end - start);
+}
+
+/**
+ * @brief Compare the progress of the TSC with the reference counter.
+ */
+static void tsc_check(__unused void *arg) {
+	uint64_t ref, tsc;
+	nanosec_t ns_ref, ns_tsc, diff;
+	bool intr;
+
+	if(atomic_load_relaxed(&tsc_unstable)) {
+		return;
+	}
+
+	intr = cpu_intr_enabled();
+	cpu_intr_set(false);
+	ref = tc_read(tsc_ref);
+	tsc = rdtsc();
+	cpu_intr_set(intr);
+
+	ns_ref = ((ref - tsc_ref_last) & tsc_ref->mask) * SEC_NANOSECS /
+		tsc_ref->freq;
+	ns_tsc = (tsc - tsc_last) * SEC_NANOSECS / tsc_tc.freq;
+	tsc_ref_last = ref;
+	tsc_last = tsc;
+
+	diff = ns_ref > ns_tsc ? ns_ref - ns_tsc : ns_tsc - ns_ref;
+	if(diff > ns_ref / TSC_MAX_DRIFT) {
+		tsc_mark_unstable("drift against the reference counter");
+	} else {
+		delayed_work_queue(system_wq, &tsc_check_work, TSC_CHECK_TIME);
+	}
+}
+
+/**
+ * @brief Read the TSC concurrently on two cpus and check that the TSC
+ *	  never goes backwards when observed from the other cpu.
+ */
+static void tsc_sync_warp(void) {
+	uint64_t prev, now;
+
+	/*
+	 * Wait for the other cpu.
+	 */
+	atomic_inc(&tsc_sync_arrive);
+	while(atomic_load_relaxed(&tsc_sync_arrive) != 2) {
+		cpu_relax();
+	}
+
+	for(size_t i = 0; i < TSC_SYNC_LOOPS; i++) {
+		while(atomic_xchg(&tsc_sync_lock, 1)) {
+			cpu_relax();
+		}
+
+		prev = tsc_sync_last;
+		now = rdtsc();
+		tsc_sync_last = now;
+		atomic_store_release(&tsc_sync_lock, 0);
+
+		if(now < prev && prev - now > tsc_sync_maxwarp) {
+			tsc_sync_maxwarp = prev - now;
+		}
+	}
+}
+
+void tsc_sync_bsp(void) {
+	if(!tsc_registered || atomic_load_relaxed(&tsc_unstable)) {
+		return;
+	}
+
+	tsc_sync_warp();
+
+	/*
+	 * Wait for the AP to finish.
+	 */
+	while(atomic_load_relaxed(&tsc_sync_arrive) != 3) {
+		cpu_relax();
+	}
+
+	if(tsc_sync_maxwarp) {
+		kprintf("[tsc] warp of %lld cycles\n", tsc_sync_maxwarp);
+		tsc_mark_unstable("not synchronized between cpus");
+	}
+
+	tsc_sync_maxwarp = 0;
+	tsc_sync_last = 0;
+	atomic_store(&tsc_sync_arrive, 0);
+}
+
+void tsc_sync_ap(void) {
+	if(!tsc_registered || atomic_load_relaxed(&tsc_unstable)) {
+		return;
+	}
+
+	tsc_sync_warp();
+	atomic_inc(&tsc_sync_arrive);
+}
+
+static __init int tsc_init(void) {
+	uint32_t edx = 0;
+
+	if(cpuid_exthigh >= 0x80000007) {
+		cpuid(0x80000007, NULL, NULL, NULL, &edx);
+	}
+
+	/*
+	 * Only an invariant TSC runs at a constant rate in every
+	 * power state.
+	 */
+	if(!(cpu_feature & FEAT_TSC) || !(edx & FEAT_INVTSC)) {
+		kprintf("[tsc] not invariant\n");
+		return INIT_OK;
+	}
+
+	tsc_tc.name = "tsc";
+	tsc_tc.freq = tsc_calibrate();
+	tsc_tc.mask = UINT64_MAX;
+	tsc_tc.quality = 1000;
+	tsc_tc.priv = NULL;
+	tsc_tc.read = tsc_read;
+
+	/*
+	 * The vDSO needs lfence for ordering rdtsc.
+	 */
+	if(cpu_feature & FEAT_SSE2) {
+		tsc_tc.vdso = VDSO_CLOCK_TSC;
+	} else {
+		tsc_tc.vdso = VDSO_CLOCK_NONE;
+	}
+
+	kprintf("[tsc] frequency: %lld kHz\n", tsc_tc.freq / 1000);
+
+	tsc_ref = tc_get();
+	tsc_ref_last = tc_read(tsc_ref);
+	tsc_last = rdtsc();
+	tc_register(&tsc_tc);
+	tsc_registered = true;
+
+	delayed_work_init(&tsc_check_work, tsc_check, NULL);
+	delayed_work_queue(system_wq, &tsc_check_work, TSC_CHECK_TIME);
+
+	return INIT_OK;
+}
+
+late_initcall(tsc_init);
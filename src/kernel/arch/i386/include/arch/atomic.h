@@ -0,0 +1,51 @@
+#ifndef ARCH_ATOMIC_H
+#define ARCH_ATOMIC_H
+
+/*
+ * 64-bit atomics. The kernel is compiled without x87 and SSE, so GCC
+ * cannot use a single 8-byte load/store and emits calls to libatomic
+ * instead (even for cmpxchg, because uint64_t is only 4-byte aligned
+ * on i386). Everything is therefore built around cmpxchg8b.
+ */
+
+static inline uint64_t atomic64_cmpxchg_val(uint64_t *ptr, uint64_t old,
+	uint64_t new)
+{
+	uint64_t prev;
+
+	asm volatile ("lock; cmpxchg8b %1"
+		: "=A" (prev), "+m" (*ptr)
+		: "b" ((uint32_t)new), "c" ((uint32_t)(new >> 32)),
+		  "0" (old)
+		: "memory");
+	return prev;
+}
+
+static inline uint64_t atomic64_load(uint64_t *ptr) {
+	/* Writes 0 if the value is 0, which is harmless */
+	return atomic64_cmpxchg_val(ptr, 0, 0);
+}
+
+static inline uint64_t atomic64_add(uint64_t *ptr, uint64_t val) {
+	uint64_t old, cur = *(volatile uint64_t *)ptr;
+
+	do {
+		old = cur;
+		cur = atomic64_cmpxchg_val(ptr, old, old + val);
+	} while(cur != old);
+
+	return old;
+}
+
+static inline void atomic64_store(uint64_t *ptr, uint64_t val) {
+	uint64_t old, cur = *(volatile uint64_t *)ptr;
+
+	do {
+		old = cur;
+		cur = atomic64_cmpxchg_val(ptr, old, val);
+	} while(cur != old);
+}
+
+#define atomic64_inc(ptr) atomic64_add(ptr, 1)
+
+#endif
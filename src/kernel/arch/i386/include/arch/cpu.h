@@ -6,6 +6,7 @@
 #include <arch/stack.h>
 
 struct trapframe;
+struct thread;
 struct cpu;
 
 typedef enum cpu_vendor {
@@ -15,8 +16,16 @@ typedef enum cpu_vendor {
 typedef struct arch_cpu {
 	struct cpu *self; /* Needed for cpu-local storage */
 	gdt_entry_t gdt[NGDT];
+	/*
+	 * MSR_IA32_SYSENTER_ESP points to tss.esp0, so that the sysenter
+	 * entry can load the kernel stack of the current thread. This
+	 * stack is only used if an NMI arrives before that.
+	 */
+	uint32_t sysenter_stack[64];
 	tss_entry_t tss;
 	stack_canary_t canary; /* loaded in gs segment */
+	struct thread *fpu_owner; /* the last thread restoring its fpu state */
+	bool fpu_ts; /* CR0.TS */
 } arch_cpu_t;
 
 typedef void (cpu_intr_hand_t) (int intr, struct trapframe *, void *arg);
@@ -85,6 +94,16 @@ static inline void cpu_relax(void) {
 	asm volatile ("pause");
 }
 
+/**
+ * @brief Read a cheap, lock-free cycle counter of the current cpu.
+ *
+ * The frequency of the counter is unknown and the counters of different
+ * cpus are not necessarily synchronized.
+ */
+static inline uint64_t cpu_ticks(void) {
+	return rdtsc();
+}
+
 static inline const char *cpu_vendor_str(cpu_vendor_t vendor) {
 	kassert(vendor == CPU_VEN_INTEL, "[cpu] unknown cpu vendor: %d",
 		vendor);
@@ -5,6 +5,7 @@
 #define FPU_ALIGN		16
 
 struct arch_thread;
+struct thread;
 
 typedef struct fpubuf {
 	uint8_t regs[FPU_REGS_SZ + FPU_ALIGN];
@@ -70,6 +71,35 @@ void fpu_clone(fpstate_t *dst, fpstate_t *src);
 void fpu_save(fpstate_t *fpu);
 void fpu_restore(fpstate_t *fpu);
 
+/**
+ * @brief Switch the fpu from one thread to another.
+ *
+ * The fpu state of @p from is saved if it used the fpu and the fpu is
+ * disabled (CR0.TS) until @p to uses it. Called with interrupts disabled.
+ */
+void fpu_switch(struct thread *to, struct thread *from);
+
+/**
+ * @brief Make sure the fpu registers contain the state of the current
+ *	  thread and enable the fpu.
+ */
+void fpu_activate(void);
+
+/**
+ * @brief Write the fpu registers of the current thread back to its
+ *	  fpu state, if they are loaded.
+ */
+void fpu_sync(void);
+
+/**
+ * @brief Allow the kernel to use the fpu/sse registers.
+ *
+ * The state of the current thread is saved if necessary. The caller
+ * must not sleep until fpu_kern_end() is called.
+ */
+void fpu_kern_begin(void);
+void fpu_kern_end(void);
+
 int copyout_fpu(fpstate_t *fp);
 int copyin_fpu(fpstate_t *fp);
 
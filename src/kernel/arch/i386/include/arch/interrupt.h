@@ -42,6 +42,7 @@
 #define 	INT_IPI_BITMAP		(INT_IPI_INTS + 0)
 #define		INT_IPI_INVLPG		(INT_IPI_INTS + 1)
 #define		INT_IPI_INVLTLB		(INT_IPI_INTS + 2)
+#define		INT_IPI_LEAVE		(INT_IPI_INTS + 3)
 #define INT_NMI_PANIC		255
 #define INT_APIC_SPURIOUS	255
 
@@ -49,6 +50,7 @@
 /* interrupt.S */
 extern void asmlinkage int_return(void);
 extern void asmlinkage syscall_idt(void);
+extern void asmlinkage sysenter_entry(void);
 extern void asmlinkage lapic_spurious(void);
 #endif
 
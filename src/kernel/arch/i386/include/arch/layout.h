@@ -15,6 +15,16 @@
 #define KERNEL_VM_BASE		0xC0000000
 #define KERNEL_VM_START		KERNEL_VM_BASE
 
+/**
+ * @brief The size of the direct map.
+ *
+ * Physical memory below VM_DMAP_SIZE is permanently mapped at
+ * KERNEL_VM_BASE + physical address. The rest of the kernel space is
+ * managed by vmem.
+ */
+#define VM_DMAP_SIZE		0x30000000 /* 768 MB */
+#define VM_DMAP_END		(KERNEL_VM_BASE + VM_DMAP_SIZE)
+
 /**
  * @brief The virtual end address size of the kernel.
  */
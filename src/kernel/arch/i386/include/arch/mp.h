@@ -23,6 +23,7 @@ static inline void ap_tramp_arg(uintptr_t arg, uintptr_t value) {
 #if CONFIGURED(MP)
 bool mp_nmi_handler(void);
 void ipi_invlpg(struct mmu_ctx *ctx, vm_vaddr_t addr, vm_vsize_t size);
+void ipi_ctx_leave(struct mmu_ctx *ctx);
 #else
 static inline void mp_nmi_handler(void) { return; }
 static inline void ipi_invlpg(struct mmu_ctx *ctx, vm_vaddr_t addr,
@@ -32,6 +33,10 @@ static inline void ipi_invlpg(struct mmu_ctx *ctx, vm_vaddr_t addr,
 	(void) addr;
 	(void) size;
 }
+
+static inline void ipi_ctx_leave(struct mmu_ctx *ctx) {
+	(void) ctx;
+}
 #endif
 
 void arch_mp_init(void);
@@ -6,6 +6,9 @@
 #define 	MSR_IA32_APIC_BASE_EXTENDED		(1U << 10)
 #define 	MSR_IA32_APIC_BASE_ENABLE		(1U << 11)
 #define 	MSR_IA32_APIC_BASE_BASE_MASK		(0xfffffU << 12)
+#define MSR_IA32_SYSENTER_CS			0x174
+#define MSR_IA32_SYSENTER_ESP			0x175
+#define MSR_IA32_SYSENTER_EIP			0x176
 #define MSR_IA32_MTRR_CAP			0xfe
 #define MSR_IA32_MTRR_DEF_TYPE			0x2ff
 #define MSR_IA32_MTRR_PHYSBASE(n)		(0x200 + 2*(n))
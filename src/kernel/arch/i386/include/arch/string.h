@@ -0,0 +1,14 @@
+#ifndef ARCH_STRING_H
+#define ARCH_STRING_H
+
+/**
+ * @brief Zero a page aligned, page sized buffer.
+ */
+void page_zero(void *page);
+
+/**
+ * @brief Copy a page aligned, page sized buffer.
+ */
+void page_copy(void *dst, const void *src);
+
+#endif
@@ -19,6 +19,7 @@ typedef struct context {
 typedef struct arch_thread {
 	fpubuf_t fpubuf;
 	fpstate_t *fpu;
+	struct arch_cpu *fpu_cpu; /* the cpu the fpu state was last restored on */
 
 	uintptr_t kern_esp; /* kernel stack top */
 	context_t *context;
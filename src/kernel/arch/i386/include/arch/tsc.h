@@ -0,0 +1,19 @@
+#ifndef ARCH_TSC_H
+#define ARCH_TSC_H
+
+/**
+ * @brief Check the TSC of an application processor against the TSC of
+ *	  the boot processor.
+ *
+ * Called by the boot processor after the AP has started. The AP calls
+ * tsc_sync_ap() at the same time. If the counters are not synchronized,
+ * the TSC timecounter is unregistered.
+ */
+void tsc_sync_bsp(void);
+
+/**
+ * @brief The part of the TSC synchronization check running on the AP.
+ */
+void tsc_sync_ap(void);
+
+#endif
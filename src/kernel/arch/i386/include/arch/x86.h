@@ -6,17 +6,30 @@
  */
 #define FEAT_FPU	(1U << 0)
 #define FEAT_PSE	(1U << 3)
+#define FEAT_TSC	(1U << 4)
 #define FEAT_PAE	(1U << 6)
 #define FEAT_APIC	(1U << 9)
+#define FEAT_SEP	(1U << 11) /* sysenter/sysexit */
 #define FEAT_MTRR	(1U << 12)
 #define FEAT_PAT	(1U << 16)
 #define FEAT_X2APIC	(1U << 21)
+#define FEAT_SSE2	(1U << 26)
+
+/*
+ * Features returned by cpuid 0x80000007 (edx)
+ */
+#define FEAT_INVTSC	(1U << 8) /* invariant TSC */
+
+/*
+ * Features returned by cpuid 7 (ebx)
+ */
+#define FEAT_ERMS	(1U << 9) /* enhanced rep movsb/stosb */
 
 /*
  * Technically the kernel could live without APIC, however
  * ...
  */
-#define CPU_FEAT 	(FEAT_FPU | FEAT_PSE | FEAT_APIC)
+#define CPU_FEAT 	(FEAT_FPU | FEAT_PSE | FEAT_APIC | FEAT_SEP)
 
 /*
  * EFLAGS register bits
@@ -118,6 +131,17 @@ static inline int cpuid(uint32_t op, uint32_t *eax, uint32_t *ebx,
 	return 1;
 }
 
+/**
+ * @brief Execute cpuid for a leaf with subleaves (ecx).
+ */
+static inline void cpuid_count(uint32_t op, uint32_t sub, uint32_t *eax,
+	uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+	asm("cpuid\n\t"
+		: "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+		: "0" (op), "2" (sub));
+}
+
 static inline __always_inline void cli(void) {
 	asm volatile("cli");
 }
@@ -146,6 +170,11 @@ static inline __always_inline void cr0_set(uint32_t value) {
 	asm volatile("mov %0, %%cr0" : : "r" (value));
 }
 
+/* clear CR0.TS */
+static inline __always_inline void clts(void) {
+	asm volatile("clts");
+}
+
 /* page fault address */
 static inline __always_inline uint32_t cr2_get(void) {
 	uint32_t cr2;
@@ -233,11 +262,11 @@ static inline __always_inline void fninit(void) {
 }
 
 static inline __always_inline void fxsave(void *fpu) {
-	asm volatile ("fxsave (%0)" :: "r" (fpu));
+	asm volatile ("fxsave (%0)" :: "r" (fpu) : "memory");
 }
 
 static inline __always_inline void fxrstor(void *fpu) {
-	asm volatile ("fxrstor (%0)" :: "r" (fpu));
+	asm volatile ("fxrstor (%0)" :: "r" (fpu) : "memory");
 }
 
 static inline __always_inline void invlpg(uintptr_t addr) {
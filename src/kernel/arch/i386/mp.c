@@ -37,6 +37,7 @@
 #include <lib/string.h>
 #include <arch/lapic.h>
 #include <arch/x86.h>
+#include <arch/tsc.h>
 #include <vm/layout.h>
 #include <vm/vas.h>
 #include <vm/mmu.h>
@@ -85,6 +86,38 @@ static void ipi_invlpg_handler(__unused int intr, __unused struct trapframe *tf,
 	lapic_eoi();
 }
 
+/*
+ * Make the other processors switch to the kernel context if they still
+ * have @p ctx loaded.
+ */
+void ipi_ctx_leave(mmu_ctx_t *ctx) {
+	size_t target = cpu_num() - 1;
+
+	if(ipi_enabled) {
+		sync_scope_acquire(&ipi_lock);
+		ipi_done = 0;
+		ipi_inval_ctx = ctx;
+		lapic_ipi(INT_IPI_LEAVE, LAPIC_IPI_OTHERS);
+
+		while(atomic_load_relaxed(&ipi_done) < target) {
+			cpu_relax();
+		}
+
+		ipi_done = 0;
+	}
+}
+
+static void ipi_ctx_leave_handler(__unused int intr,
+	__unused struct trapframe *tf, __unused void *arg)
+{
+	if(ipi_inval_ctx == mmu_cur_ctx) {
+		vm_vas_switch(&vm_kern_vas);
+	}
+
+	atomic_inc_relaxed(&ipi_done);
+	lapic_eoi();
+}
+
 void ipi_panic(void) {
 	if(ipi_enabled) {
 		/*
@@ -132,6 +165,7 @@ void __init __noreturn asmlinkage arch_ap_main(cpu_t *cpu) {
 	init_timer();
 	sched_init_ap(cpu);
 	atomic_store(&cpu->running, true);
+	tsc_sync_ap();
 
 	/*
 	 * Wait until all the processors are started up.
@@ -159,6 +193,7 @@ void __init arch_mp_init(void) {
 
 	cpu_set_intr_handler(INT_IPI_BITMAP, arch_ipi_bitmap_handler, NULL);
 	cpu_set_intr_handler(INT_IPI_INVLPG, ipi_invlpg_handler, NULL);
+	cpu_set_intr_handler(INT_IPI_LEAVE, ipi_ctx_leave_handler, NULL);
 
 	kprintf("[cpu] launching application processors\n");
 
@@ -232,6 +267,8 @@ void __init arch_mp_init(void) {
 			cpu_relax();
 		}
 
+		tsc_sync_bsp();
+
 		kprintf("[cpu] launched cpu %d\n", cpu->id);
 	}
 
@@ -0,0 +1,253 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ *
+ * Copyright (c) 2017, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <kern/system.h>
+#include <kern/symbol.h>
+#include <kern/init.h>
+#include <kern/cpu.h>
+#include <lib/string.h>
+#include <arch/x86.h>
+#include <arch/fpu.h>
+#include <arch/string.h>
+
+#define PAGE_BENCH_LOOPS	32
+
+typedef struct page_func {
+	const char *name;
+	uint32_t feat; /* required cpuid 1 features (edx) */
+	void (*zero) (void *page);
+	void (*copy) (void *dst, const void *src);
+} page_func_t;
+
+static bool string_erms = false;
+static void (*page_zero_func) (void *page);
+static void (*page_copy_func) (void *dst, const void *src);
+static uint8_t page_bench[2][PAGE_SZ] __align(PAGE_SZ);
+
+#undef memcpy
+void *memcpy(void *dst, const void *src, size_t len) {
+	void *d = dst;
+	size_t n;
+
+	/*
+	 * rep movsb is at least as fast as rep movsd on cpus supporting
+	 * enhanced rep movsb/stosb.
+	 */
+	if(string_erms) {
+		asm volatile("rep movsb" : "+D" (d), "+S" (src), "+c" (len)
+			:: "memory");
+	} else {
+		n = len >> 2;
+		len &= 3;
+		asm volatile("rep movsl\n\t"
+			"movl %3, %%ecx\n\t"
+			"rep movsb"
+			: "+D" (d), "+S" (src), "+c" (n)
+			: "r" (len)
+			: "memory");
+	}
+
+	return dst;
+}
+
+export(memcpy);
+
+#undef memset
+void *memset(void *ptr, int c, size_t len) {
+	uint32_t val = (uint8_t)c * 0x01010101U;
+	void *p = ptr;
+	size_t n;
+
+	if(string_erms) {
+		asm volatile("rep stosb" : "+D" (p), "+c" (len) : "a" (val)
+			: "memory");
+	} else {
+		n = len >> 2;
+		len &= 3;
+		asm volatile("rep stosl\n\t"
+			"movl %3, %%ecx\n\t"
+			"rep stosb"
+			: "+D" (p), "+c" (n)
+			: "a" (val), "r" (len)
+			: "memory");
+	}
+
+	return ptr;
+}
+
+export(memset);
+
+static void page_zero_rep(void *page) {
+	size_t n = PAGE_SZ / 4;
+
+	asm volatile("rep stosl" : "+D" (page), "+c" (n) : "a" (0)
+		: "memory");
+}
+
+static void page_copy_rep(void *dst, const void *src) {
+	size_t n = PAGE_SZ / 4;
+
+	asm volatile("rep movsl" : "+D" (dst), "+S" (src), "+c" (n)
+		:: "memory");
+}
+
+/*
+ * The non-temporal variants do not pollute the cache with the page,
+ * which is usually not accessed right away (e.g. fork).
+ */
+static void page_zero_nt(void *page) {
+	size_t n = PAGE_SZ / 64;
+
+	fpu_kern_begin();
+	asm volatile("pxor %%xmm0, %%xmm0\n\t"
+		"1: movntdq %%xmm0, 0(%0)\n\t"
+		"movntdq %%xmm0, 16(%0)\n\t"
+		"movntdq %%xmm0, 32(%0)\n\t"
+		"movntdq %%xmm0, 48(%0)\n\t"
+		"addl $64, %0\n\t"
+		"decl %1\n\t"
+		"jnz 1b\n\t"
+		"sfence"
+		: "+r" (page), "+r" (n)
+		:: "memory");
+	fpu_kern_end();
+}
+
+static void page_copy_nt(void *dst, const void *src) {
+	size_t n = PAGE_SZ / 64;
+
+	fpu_kern_begin();
+	asm volatile("1: prefetchnta 256(%1)\n\t"
+		"movdqa 0(%1), %%xmm0\n\t"
+		"movdqa 16(%1), %%xmm1\n\t"
+		"movdqa 32(%1), %%xmm2\n\t"
+		"movdqa 48(%1), %%xmm3\n\t"
+		"movntdq %%xmm0, 0(%0)\n\t"
+		"movntdq %%xmm1, 16(%0)\n\t"
+		"movntdq %%xmm2, 32(%0)\n\t"
+		"movntdq %%xmm3, 48(%0)\n\t"
+		"addl $64, %1\n\t"
+		"addl $64, %0\n\t"
+		"decl %2\n\t"
+		"jnz 1b\n\t"
+		"sfence"
+		: "+r" (dst), "+r" (src), "+r" (n)
+		:: "memory");
+	fpu_kern_end();
+}
+
+static const page_func_t page_funcs[] = {
+	{ "rep", 0, page_zero_rep, page_copy_rep },
+	{ "sse2-nt", FEAT_SSE2, page_zero_nt, page_copy_nt },
+};
+
+void page_zero(void *page) {
+	if(page_zero_func) {
+		page_zero_func(page);
+	} else {
+		page_zero_rep(page);
+	}
+}
+
+void page_copy(void *dst, const void *src) {
+	if(page_copy_func) {
+		page_copy_func(dst, src);
+	} else {
+		page_copy_rep(dst, src);
+	}
+}
+
+static uint64_t page_bench_zero(const page_func_t *func) {
+	uint64_t start, time, best = UINT64_MAX;
+
+	for(size_t i = 0; i < PAGE_BENCH_LOOPS; i++) {
+		start = cpu_ticks();
+		func->zero(page_bench[0]);
+		time = cpu_ticks() - start;
+		best = min(best, time);
+	}
+
+	return best;
+}
+
+static uint64_t page_bench_copy(const page_func_t *func) {
+	uint64_t start, time, best = UINT64_MAX;
+
+	for(size_t i = 0; i < PAGE_BENCH_LOOPS; i++) {
+		start = cpu_ticks();
+		func->copy(page_bench[0], page_bench[1]);
+		time = cpu_ticks() - start;
+		best = min(best, time);
+	}
+
+	return best;
+}
+
+/**
+ * @brief Select the string functions supported by the cpu. The page
+ *	  functions are chosen by comparing the best time of a few runs.
+ */
+static __init int string_init(void) {
+	const page_func_t *zero = NULL, *copy = NULL;
+	uint64_t zero_time = UINT64_MAX, copy_time = UINT64_MAX;
+	uint32_t eax, ebx, ecx, edx;
+
+	if(cpuid_high >= 7) {
+		cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+		string_erms = !!(ebx & FEAT_ERMS);
+	}
+
+	for(size_t i = 0; i < NELEM(page_funcs); i++) {
+		const page_func_t *func = &page_funcs[i];
+		uint64_t ztime, ctime;
+
+		if((cpu_feature & func->feat) != func->feat) {
+			continue;
+		}
+
+		ztime = page_bench_zero(func);
+		if(ztime < zero_time) {
+			zero_time = ztime;
+			zero = func;
+		}
+
+		ctime = page_bench_copy(func);
+		if(ctime < copy_time) {
+			copy_time = ctime;
+			copy = func;
+		}
+
+		kprintf("[string] %s: zero: %lld copy: %lld ticks\n",
+			func->name, ztime, ctime);
+	}
+
+	kprintf("[string] page zero: %s, page copy: %s%s\n", zero->name,
+		copy->name, string_erms ? ", erms" : "");
+	page_zero_func = zero->zero;
+	page_copy_func = copy->copy;
+
+	return INIT_OK;
+}
+
+early_initcall(string_init);
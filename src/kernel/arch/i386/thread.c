@@ -156,6 +156,12 @@ void arch_thread_fork(thread_t *dst, thread_t *src, uintptr_t stack,
 	}
 
 	tf_set_retval(dst->trapframe, 0);
+
+	/*
+	 * The fpu registers of src might be newer than its fpu state.
+	 */
+	assert(src == cur_thread());
+	fpu_sync();
 	fpu_clone(dst->arch.fpu, src->arch.fpu);
 }
 
@@ -164,14 +170,7 @@ void arch_thread_exit(__unused thread_t *thread) {
 }
 
 void arch_thread_switch(thread_t *to, thread_t *from) {
-	if(!thread_is_kern(from) && from->state != THREAD_EXIT) {
-		fpu_save(from->arch.fpu);
-	}
-
-	if(!thread_is_kern(to)) {
-		fpu_restore(to->arch.fpu);
-	}
-
+	fpu_switch(to, from);
 	setgs(to->arch.gs_base);
 	cpu_set_kernel_stack(to->arch.kern_esp);
 	context_switch(&from->arch.context, to->arch.context);
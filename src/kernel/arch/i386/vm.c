@@ -39,47 +39,81 @@
 #include <vm/page.h>
 #include <vm/kern.h>
 #include <arch/mp.h>
+#include <arch/string.h>
 #include <config.h>
 
 typedef struct vm_percpu {
 	vm_vaddr_t pgcpy_src;
 	vm_vaddr_t pgcpy_dst;
+	vm_paddr_t pgcpy_src_phys; /* 0 if not mapped */
+	vm_paddr_t pgcpy_dst_phys;
 	sync_t quick_lock;
 	vm_vaddr_t quick_map;
 } vm_percpu_t;
 
 extern vm_vaddr_t end;
-extern vm_vaddr_t init_start_addr;
 static DEFINE_PERCPU(vm_percpu_t, vm_percpu);
-static vm_vaddr_t kern_end = (vm_vaddr_t)&end;
+
+/*
+ * Early mappings of physical memory outside of the direct map are
+ * placed right after the direct map.
+ */
+static vm_vaddr_t kern_end = VM_DMAP_END;
+
+/*
+ * The end of the physical memory in the direct map. Only the kernel
+ * binary is mapped until vm_vmem_init() sets up the direct map.
+ */
+static vm_paddr_t vm_dmap_end;
 
 static vm_percpu_t *vm_percpu_get(void) {
 	return PERCPU(&vm_percpu);
 }
 
+static inline vm_paddr_t vm_dmap_limit(void) {
+	if(vm_dmap_end == 0) {
+		return vm_kern_phys_end();
+	} else {
+		return vm_dmap_end;
+	}
+}
+
+static inline bool vm_dmap_contains(vm_paddr_t addr, vm_psize_t size) {
+	return addr < vm_dmap_limit() && vm_dmap_limit() - addr >= size;
+}
+
+/*
+ * Only RAM is part of the direct map (except for everything below the end
+ * of the kernel binary, which is mapped during boot). vm_dmap_contains
+ * is enough for physical pages.
+ */
+static inline bool vm_dmap_contains_any(vm_paddr_t addr, vm_psize_t size) {
+	if(!vm_dmap_contains(addr, size)) {
+		return false;
+	} else if(addr + size <= vm_kern_phys_end()) {
+		return true;
+	} else {
+		return vm_phys_is_ram(addr, size);
+	}
+}
+
+static inline bool vm_dmap_is_virt(void *ptr) {
+	return (vm_vaddr_t)ptr >= KERNEL_VM_BASE &&
+		(vm_vaddr_t)ptr - KERNEL_VM_BASE < vm_dmap_limit();
+}
+
+static inline void *vm_dmap_ptr(vm_paddr_t addr) {
+	return (void *)(addr + KERNEL_VM_BASE);
+}
+
 int vm_kern_map_phys_attr(vm_paddr_t addr, vm_vsize_t size, vm_flags_t flags,
 	vm_memattr_t attr, void **out)
 {
-	vm_vaddr_t map_end;
-
 	kassert(ALIGNED(addr, PAGE_SZ) && ALIGNED(size, PAGE_SZ),
 		"[vm] map_phys_addr: invalid range: 0x%x - 0x%x", addr, size);
 
-	if(init_get_level() == INIT_FINISHED) {
-		/*
-		 * init-memory is freed at this point in time, thus the
-		 * mapping from &init_start_addr until &end cannot be used
-		 * here.
-		 */
-		map_end = (vm_vaddr_t)&init_start_addr;
-	} else {
-		map_end = (vm_vaddr_t)&end;
-	}
-
-	if(addr + size <= map_end - KERNEL_VM_BASE &&
-		attr == VM_MEMATTR_DEFAULT)
-	{
-		*out = (void *)addr + KERNEL_VM_BASE;
+	if(vm_dmap_contains_any(addr, size) && attr == VM_MEMATTR_DEFAULT) {
+		*out = vm_dmap_ptr(addr);
 		return 0;
 	} else {
 		return vm_kern_generic_map_phys(addr, size, flags, attr, out);
@@ -87,20 +121,33 @@ int vm_kern_map_phys_attr(vm_paddr_t addr, vm_vsize_t size, vm_flags_t flags,
 }
 
 void vm_kern_unmap_phys(void *ptr, vm_vsize_t size) {
-	vm_vaddr_t end = (vm_vaddr_t)&end;
-	if(ptr >= (void *)&end) {
+	if(!vm_dmap_is_virt(ptr)) {
 		vm_kern_generic_unmap_phys(ptr, size);
 	}
 }
 
+void vm_kern_free_image(void *ptr, vm_vsize_t size) {
+	vm_page_t *page;
+
+	/*
+	 * The kernel image is part of the direct map, which is never
+	 * unmapped. Only the physical memory is freed.
+	 */
+	for(vm_vsize_t i = 0; i < size; i += PAGE_SZ) {
+		page = vm_phys_to_page((vm_vaddr_t)ptr + i - KERNEL_VM_BASE);
+		vm_page_set_state(page, VM_PG_NORMAL);
+		vm_page_free(page);
+	}
+}
+
 void *vm_kern_map_phys_early(vm_paddr_t addr, vm_vsize_t size) {
-	vm_vaddr_t map = (vm_vaddr_t)&end;
+	vm_vaddr_t map;
 
 	kassert(ALIGNED(addr, PAGE_SZ) && ALIGNED(size, PAGE_SZ),
 		"[vm] map_phys_early: invalid range: 0x%x - 0x%x", addr, size);
 
-	if(addr + size <= map - KERNEL_VM_BASE) {
-		return (void *)addr + KERNEL_VM_BASE;
+	if(vm_dmap_contains_any(addr, size)) {
+		return vm_dmap_ptr(addr);
 	} else {
 		map = kern_end;
 		kern_end += size;
@@ -116,9 +163,11 @@ void vm_kern_unmap_phys_early(void *ptr, vm_vsize_t size) {
 
 	kassert(ALIGNED(addr, PAGE_SZ) && ALIGNED(size, PAGE_SZ),
 		"[vm] unmap_phys_early: invalid range: 0x%x - 0x%x", addr, size);
-	assert(addr + size == kern_end);
 
-	kern_end = addr;
+	if(!vm_dmap_is_virt(ptr)) {
+		assert(addr + size == kern_end);
+		kern_end = addr;
+	}
 }
 
 void *vm_mapdev(vm_paddr_t phys, vm_vsize_t size, vm_memattr_t attr) {
@@ -138,6 +187,10 @@ void vm_unmapdev(void *ptr, vm_vsize_t size) {
 void *vm_kern_map_quick(vm_paddr_t phys) {
 	vm_percpu_t *pcpu;
 
+	if(vm_dmap_contains(phys, PAGE_SZ)) {
+		return vm_dmap_ptr(phys);
+	}
+
 	kassert(ALIGNED(phys, PAGE_SZ), "[vm] map quick: unaligned "
 		"address: 0x%x", phys);
 
@@ -151,41 +204,63 @@ void *vm_kern_map_quick(vm_paddr_t phys) {
 	return (void *)pcpu->quick_map;
 }
 
-void vm_kern_unmap_quick(__unused void *ptr) {
+void vm_kern_unmap_quick(void *ptr) {
+	if(vm_dmap_is_virt(ptr)) {
+		return;
+	}
+
 	sync_release(&vm_percpu_get()->quick_lock);
 	sched_unpin();
 }
 
+/**
+ * @brief Get a kernel address of a physical page for vm_page_cpy_partial.
+ *
+ * Pages outside of the direct map are mapped in a per-cpu window, which
+ * is only remapped if it currently maps a different page.
+ */
+static void *vm_pgcpy_map(vm_vaddr_t window, vm_paddr_t *cur, vm_paddr_t phys,
+	vm_flags_t prot)
+{
+	if(vm_dmap_contains(phys, PAGE_SZ)) {
+		return vm_dmap_ptr(phys);
+	}
+
+	if(*cur != phys) {
+		mmu_map_kern(window, PAGE_SZ, phys, MMU_MAP_CPULOCAL |
+			VM_PROT_KERN | prot, VM_MEMATTR_DEFAULT);
+		*cur = phys;
+	}
+
+	return (void *)window;
+}
+
 void vm_page_cpy_partial(vm_page_t *dst_page, vm_page_t *src_page,
 	size_t size)
 {
 	vm_percpu_t *pcpu;
-	vm_paddr_t dst, src;
+	void *dst, *src;
 
 	kassert(size <= PAGE_SZ, "[vm] page copy partial: invalid size: 0x%x",
 		size);
 	vm_page_assert_not_busy(src_page);
 
-	dst = vm_page_phys(dst_page);
-	src = vm_page_phys(src_page);
-
 	critical_enter();
 	pcpu = vm_percpu_get();
+	src = vm_pgcpy_map(pcpu->pgcpy_src, &pcpu->pgcpy_src_phys,
+		vm_page_phys(src_page), VM_PROT_RD);
+	dst = vm_pgcpy_map(pcpu->pgcpy_dst, &pcpu->pgcpy_dst_phys,
+		vm_page_phys(dst_page), VM_PROT_RW);
 
-	/*
-	 * TODO cache the current physical addresses of pgcpy regions.
-	 */
-	mmu_map_kern(pcpu->pgcpy_src, PAGE_SZ, src, MMU_MAP_CPULOCAL |
-		VM_PROT_KERN | VM_PROT_RD, VM_MEMATTR_DEFAULT);
-	mmu_map_kern(pcpu->pgcpy_dst, PAGE_SZ, dst, MMU_MAP_CPULOCAL |
-		VM_PROT_KERN | VM_PROT_RW, VM_MEMATTR_DEFAULT);
-	memcpy((void *)pcpu->pgcpy_dst, (void *)pcpu->pgcpy_src, size);
+	if(size == PAGE_SZ) {
+		page_copy(dst, src);
+	} else {
+		memcpy(dst, src, size);
 
-	/*
-	 * Zero fill the rest of the page.
-	 */
-	if(size < PAGE_SZ) {
-		memset((void *)pcpu->pgcpy_dst + size, 0x0, PAGE_SZ - size);
+		/*
+		 * Zero fill the rest of the page.
+		 */
+		memset(dst + size, 0x0, PAGE_SZ - size);
 	}
 	critical_leave();
 }
@@ -198,6 +273,8 @@ void vm_init_cpu(void) {
 	pcpu->pgcpy_src = vmem_alloc(3 * PAGE_SZ, VM_WAIT);
 	pcpu->pgcpy_dst = pcpu->pgcpy_src + PAGE_SZ;
 	pcpu->quick_map = pcpu->pgcpy_dst + PAGE_SZ;
+	pcpu->pgcpy_src_phys = 0;
+	pcpu->pgcpy_dst_phys = 0;
 }
 
 vm_paddr_t vm_kern_phys_end(void) {
@@ -234,6 +311,44 @@ void __init vm_detect_mem(void) {
 }
 
 void __init vm_vmem_init(void) {
+	vm_paddr_t kend = ALIGN(vm_kern_phys_end(), PAGE_SZ);
+	vm_pgaddr_t start, end;
+	vm_npages_t size;
+	vm_paddr_t dend;
+
+	/*
+	 * Map as much physical memory as fits into the direct map. The
+	 * kernel binary (and everything below it) is already mapped.
+	 */
+	if(vm_phys_end() >= atop(VM_DMAP_SIZE)) {
+		dend = VM_DMAP_SIZE;
+	} else {
+		dend = ptoa(vm_phys_end());
+	}
+
+	if(dend <= kend) {
+		dend = kend;
+	}
+
+	/*
+	 * Holes between the segments might contain device memory, which
+	 * must not be mapped write-back, so only the segments are mapped.
+	 */
+	for(size_t i = 0; vm_physeg_range(i, &start, &size); i++) {
+		end = start + size;
+		start = max(start, atop(kend));
+		end = min(end, atop(dend));
+		if(start < end) {
+			mmu_map_kern(KERNEL_VM_BASE + ptoa(start),
+				ptoa(end - start), ptoa(start),
+				VM_PROT_RW | VM_PROT_KERN, VM_MEMATTR_DEFAULT);
+		}
+	}
+
+	vm_dmap_end = dend;
+	kprintf("[vm] direct map: 0x%x - 0x%x\n", KERNEL_VM_BASE,
+		KERNEL_VM_BASE + dend);
+
 	/*
 	 * Start up the kernel's virtual memory manager.
 	 */
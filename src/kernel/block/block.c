@@ -50,6 +50,7 @@ blk_object_t *blk_object_new(blk_class_t *class, void *priv) {
 	obj->class = class;
 	obj->priv = priv;
 	obj->depth = 0;
+	obj->max_cnt = 0;
 
 	return obj;
 }
@@ -301,9 +302,22 @@ void blk_handler_init(blk_handler_t *hand, int flags) {
 
 void blk_handler_uninit(blk_handler_t *hand) {
 	assert(hand->flags & BLK_HAND_SETUP);
+	if(F_ISSET(hand->flags, BLK_HAND_EVENT)) {
+		blk_event_destroy(&hand->event);
+	}
 	sync_destroy(&hand->lock);
 }
 
+void blk_handler_async(blk_handler_t *hand, blk_callback_t callback,
+	void *arg)
+{
+	assert(!F_ISSET(hand->flags, BLK_HAND_SETUP));
+	assert(hand->num == 0);
+
+	blk_event_create(&hand->event, callback, arg);
+	F_SET(hand->flags, BLK_HAND_ASYNC | BLK_HAND_EVENT);
+}
+
 blk_handler_t *blk_handler_new(int flags) {
 	blk_handler_t *hand;
 
@@ -472,10 +486,8 @@ int blk_io(blk_provider_t *pr, blk_rtype_t type, blkno_t no, blkcnt_t cnt,
 }
 
 void __init init_block(void) {
-	/* TODO */
-	extern void blk_cache_init(void);
-	blk_cache_init();
-
 	extern void blk_event_init(void);
+	extern void blk_cache_init(void);
 	blk_event_init();
+	blk_cache_init();
 }
@@ -23,24 +23,40 @@
  */
 
 #include <kern/system.h>
+#include <kern/init.h>
 #include <kern/atomic.h>
 #include <kern/futex.h>
+#include <kern/time.h>
+#include <kern/sched.h>
+#include <kern/workqueue.h>
 #include <block/block.h>
 #include <vm/slab.h>
 #include <vm/reclaim.h>
 #include <vm/malloc.h>
-#include <lib/hashtab.h>
+#include <lib/rhashtab.h>
 #include <lib/string.h>
 #include <sys/limits.h>
 
-#define BLKHASH_SIZE (1U << 16)
-#define BLKHASH(cache, blk) ((uintptr_t)(cache) ^ (blk))
+#define BLKHASH(blk) ((size_t)(blk))
+
+/*
+ * Writes only modify the cache buffers, which are written back by the
+ * flusher. The flusher runs every BLK_FLUSH_INTERVAL and writes the buffers
+ * dirty for longer than BLK_DIRTY_EXPIRE. Once more than BLK_DIRTY_MAX
+ * buffers are dirty, every dirty buffer is written back immediately.
+ */
+#define BLK_FLUSH_INTERVAL	SEC2NANO(5)
+#define BLK_DIRTY_EXPIRE	SEC2NANO(30)
+#define BLK_DIRTY_MAX		512
+#define BLK_FLUSH_BATCH		32 /* buffers written back at once */
+#define BLK_FLUSH_RUN		(64 << KB_SHIFT) /* max size of one write */
 
 typedef struct blk_cache {
 	blk_provider_t *pr;
 	list_node_t node;
 	rwlock_t lock;
 	sync_t lru_lock;
+	rhashtab_t ht; /* protected by lock */
 
 	/**
 	 * A list for keeping track of the block-cache entry usage.
@@ -48,6 +64,18 @@ typedef struct blk_cache {
 	 */
 	list_t lru;
 	size_t entry_num;
+
+	/**
+	 * The dirty buffers, the buffers dirty for the longest time are at
+	 * the front of the list. Protected by lru_lock.
+	 */
+	list_t dirty;
+
+	/**
+	 * Serializes writing back the buffers, so that a buffer is on the
+	 * disk once a flush returns.
+	 */
+	sync_t flush_lock;
 } blk_cache_t;
 
 /**
@@ -59,7 +87,7 @@ typedef struct blk_cache {
  */
 typedef struct blk_cbuf {
 	blk_cache_t *cache;
-	list_node_t hnode; /* hash node */
+	rhash_node_t hnode; /* hash node */
 	list_node_t lnode; /* provider node */
 	rwlock_t lock;
 	size_t ref;
@@ -69,13 +97,23 @@ typedef struct blk_cbuf {
 #define BLK_CBUF_OK	0
 #define BLK_CBUF_ERR	1
 	int status;
+
+	/*
+	 * Protected by the lru_lock of the cache.
+	 */
+	list_node_t dnode; /* dirty list node */
+	nanosec_t dirtied; /* the time the buffer became dirty */
+	bool dirty;
 } blk_cbuf_t;
 
 static DEFINE_VM_SLAB(blk_cbuf_cache, sizeof(blk_cbuf_t), 0);
 static DEFINE_LIST(blk_cache_list);
 static sync_t blk_cache_lock = SYNC_INIT(MUTEX);
 static size_t blk_cache_bufs = 0;
-static hashtab_t blk_cache_ht;
+static size_t blk_cache_dirty = 0;
+static struct workqueue *blk_flush_wq;
+static delayed_work_t blk_flush_dwork;
+static work_t blk_flush_work;
 
 static inline blk_cbuf_t *blk_cbuf_alloc(blk_cache_t *cache, blkno_t no) {
 	blk_cbuf_t *new;
@@ -92,12 +130,14 @@ static inline blk_cbuf_t *blk_cbuf_alloc(blk_cache_t *cache, blkno_t no) {
 	 */
 	new->data = kmalloc(1 << cache->pr->obj->pblk_shift, VM_WAIT);
 
-	list_node_init(new, &new->hnode);
+	rhash_node_init(new, &new->hnode);
 	list_node_init(new, &new->lnode);
+	list_node_init(new, &new->dnode);
 	rwlock_init(&new->lock);
 	new->cache = cache;
 	new->ref = 1;
 	new->no = no;
+	new->dirty = false;
 
 	atomic_inc_relaxed(&blk_cache_bufs);
 	return new;
@@ -106,8 +146,10 @@ static inline blk_cbuf_t *blk_cbuf_alloc(blk_cache_t *cache, blkno_t no) {
 static inline void blk_cbuf_free(blk_cbuf_t *cbuf) {
 	atomic_dec_relaxed(&blk_cache_bufs);
 
-	list_node_destroy(&cbuf->hnode);
+	assert(!cbuf->dirty);
+	rhash_node_destroy(&cbuf->hnode);
 	list_node_destroy(&cbuf->lnode);
+	list_node_destroy(&cbuf->dnode);
 	rwlock_destroy(&cbuf->lock);
 
 	kfree(cbuf->data);
@@ -124,13 +166,18 @@ static inline size_t blk_cbuf_count(blk_cbuf_t *cbuf) {
 	}
 }
 
-static void blk_cbuf_ref(blk_cbuf_t *cbuf) {
-	sync_scope_acquire(&cbuf->cache->lru_lock);
+static void blk_cbuf_ref_locked(blk_cbuf_t *cbuf) {
+	sync_assert(&cbuf->cache->lru_lock);
 	if(cbuf->ref++ == 0) {
 		list_remove(&cbuf->cache->lru, &cbuf->lnode);
 	}
 }
 
+static void blk_cbuf_ref(blk_cbuf_t *cbuf) {
+	sync_scope_acquire(&cbuf->cache->lru_lock);
+	blk_cbuf_ref_locked(cbuf);
+}
+
 static void blk_cbuf_unref(blk_cbuf_t *cbuf) {
 	sync_scope_acquire(&cbuf->cache->lru_lock);
 	if(--cbuf->ref == 0) {
@@ -138,14 +185,243 @@ static void blk_cbuf_unref(blk_cbuf_t *cbuf) {
 	}
 }
 
+/*
+ * Mark a buffer dirty. Returns true if the buffer was clean.
+ */
+static bool blk_cbuf_set_dirty(blk_cbuf_t *cbuf) {
+	blk_cache_t *cache = cbuf->cache;
+
+	sync_scope_acquire(&cache->lru_lock);
+	if(cbuf->dirty) {
+		return false;
+	}
+
+	cbuf->dirty = true;
+	cbuf->dirtied = getnanouptime();
+	list_append(&cache->dirty, &cbuf->dnode);
+	atomic_inc_relaxed(&blk_cache_dirty);
+
+	return true;
+}
+
+static void blk_cbuf_clean(blk_cbuf_t *cbuf) {
+	blk_cache_t *cache = cbuf->cache;
+
+	sync_scope_acquire(&cache->lru_lock);
+	if(cbuf->dirty) {
+		cbuf->dirty = false;
+		list_remove(&cache->dirty, &cbuf->dnode);
+		atomic_dec_relaxed(&blk_cache_dirty);
+	}
+}
+
+/*
+ * Wake up the flusher after a buffer became dirty.
+ */
+static void blk_flush_kick(void) {
+	if(atomic_load_relaxed(&blk_cache_dirty) > BLK_DIRTY_MAX) {
+		work_queue(blk_flush_wq, &blk_flush_work);
+	} else {
+		delayed_work_queue(blk_flush_wq, &blk_flush_dwork,
+			BLK_FLUSH_INTERVAL);
+	}
+}
+
+/*
+ * Write buffers with consecutive block numbers back to disk. The buffers
+ * are copied into one temporary buffer, so that a single request is
+ * enough. The buffers are marked clean before being written, so a write
+ * racing with the flush makes them dirty again.
+ */
+static int blk_cache_write_run(blk_cache_t *cache, blk_cbuf_t **bufs,
+	size_t num)
+{
+	blk_provider_t *pr = cache->pr;
+	size_t bufsz = 1 << pr->obj->pblk_shift;
+	void *data = NULL;
+	int err = 0;
+
+	if(num > 1) {
+		data = kmalloc(num * bufsz, VM_NOFLAG);
+	}
+
+	if(data == NULL) {
+		/*
+		 * Fall back to writing the buffers one by one.
+		 */
+		for(size_t i = 0; i < num; i++) {
+			blk_cbuf_t *cbuf = bufs[i];
+			int res;
+
+			rdlock(&cbuf->lock);
+			blk_cbuf_clean(cbuf);
+			res = blk_write(pr, cbuf->no, blk_cbuf_count(cbuf),
+				cbuf->data);
+			if(res) {
+				blk_cbuf_set_dirty(cbuf);
+				err = res;
+			}
+			rwunlock(&cbuf->lock);
+		}
+
+		return err;
+	}
+
+	for(size_t i = 0; i < num; i++) {
+		rdlock(&bufs[i]->lock);
+		blk_cbuf_clean(bufs[i]);
+		memcpy(data + i * bufsz, bufs[i]->data, bufsz);
+		rwunlock(&bufs[i]->lock);
+	}
+
+	err = blk_write(pr, bufs[0]->no, num * blk_cbuf_count(bufs[0]), data);
+	if(err) {
+		for(size_t i = 0; i < num; i++) {
+			blk_cbuf_set_dirty(bufs[i]);
+		}
+	}
+
+	kfree(data);
+	return err;
+}
+
+/*
+ * Write the buffers of a cache, which became dirty at or before @p before,
+ * back to disk. The oldest buffers are written first, sorted by their block
+ * number and buffers with consecutive block numbers are merged into one
+ * request.
+ */
+static int blk_cache_writeback(blk_cache_t *cache, nanosec_t before) {
+	blk_cbuf_t *bufs[BLK_FLUSH_BATCH], *cbuf;
+	blk_object_t *obj = cache->pr->obj;
+	size_t num, start, max;
+	int err = 0;
+
+	/*
+	 * The maximum number of buffers per request, which has to respect
+	 * the transfer limit of the device.
+	 */
+	max = BLK_FLUSH_RUN >> obj->pblk_shift;
+	if(obj->max_cnt) {
+		max = min(max, obj->max_cnt >>
+			(obj->pblk_shift - obj->blk_shift));
+	}
+	if(max == 0) {
+		max = 1;
+	}
+	sync_scope_acquire(&cache->flush_lock);
+
+	do {
+		num = 0;
+		synchronized(&cache->lru_lock) {
+			foreach(cbuf, &cache->dirty) {
+				if(num == BLK_FLUSH_BATCH ||
+					cbuf->dirtied > before)
+				{
+					break;
+				}
+
+				blk_cbuf_ref_locked(cbuf);
+				bufs[num++] = cbuf;
+			}
+		}
+
+		/*
+		 * Sort the buffers by their block number.
+		 */
+		for(size_t i = 1; i < num; i++) {
+			size_t j;
+
+			cbuf = bufs[i];
+			for(j = i; j > 0 && bufs[j - 1]->no > cbuf->no; j--) {
+				bufs[j] = bufs[j - 1];
+			}
+			bufs[j] = cbuf;
+		}
+
+		start = 0;
+		for(size_t i = 1; i <= num; i++) {
+			blk_cbuf_t *prev = bufs[i - 1];
+			int res;
+
+			if(i < num && i - start < max &&
+				bufs[i]->no == prev->no + blk_cbuf_count(prev))
+			{
+				continue;
+			}
+
+			res = blk_cache_write_run(cache, &bufs[start],
+				i - start);
+			if(res) {
+				err = res;
+			}
+
+			start = i;
+		}
+
+		for(size_t i = 0; i < num; i++) {
+			blk_cbuf_unref(bufs[i]);
+		}
+	} while(num == BLK_FLUSH_BATCH && err == 0);
+
+	return err;
+}
+
+static int blk_cache_writeback_all(nanosec_t before) {
+	blk_cache_t *cache;
+	int err = 0, res;
+
+	sync_scope_acquire(&blk_cache_lock);
+	foreach(cache, &blk_cache_list) {
+		res = blk_cache_writeback(cache, before);
+		if(res) {
+			err = res;
+		}
+	}
+
+	return err;
+}
+
+/*
+ * The periodic flush writing the buffers dirty for too long.
+ */
+static void blk_flush_expired(__unused void *arg) {
+	nanosec_t now = getnanouptime();
+
+	if(now >= BLK_DIRTY_EXPIRE) {
+		blk_cache_writeback_all(now - BLK_DIRTY_EXPIRE);
+	}
+
+	if(atomic_load_relaxed(&blk_cache_dirty) > 0) {
+		delayed_work_queue(blk_flush_wq, &blk_flush_dwork,
+			BLK_FLUSH_INTERVAL);
+	}
+}
+
+/*
+ * Too many buffers are dirty, write all of them.
+ */
+static void blk_flush_all(__unused void *arg) {
+	blk_cache_writeback_all(getnanouptime());
+}
+
+int blk_cache_flush(blk_provider_t *pr) {
+	assert(pr->cache);
+	return blk_cache_writeback(pr->cache, getnanouptime());
+}
+
+int blk_cache_flush_all(void) {
+	return blk_cache_writeback_all(getnanouptime());
+}
+
 static blk_cbuf_t *blk_cache_lookup(blk_cache_t *cache, blkno_t no) {
 	blk_cbuf_t *cbuf;
 	size_t hash;
 
 	rwlock_assert(&cache->lock, RWLOCK_RD);
 
-	hash = BLKHASH(cache, no);
-	hashtab_search(cbuf, hash, &blk_cache_ht) {
+	hash = BLKHASH(no);
+	rhashtab_search(cbuf, hash, &cache->ht) {
 		if(cbuf->cache == cache && cbuf->no == no) {
 			blk_cbuf_ref(cbuf);
 			return cbuf;
@@ -196,7 +472,7 @@ static int blk_cache_get(blk_cache_t *cache, blkno_t no, blk_cbuf_t **bufp) {
 	 * Add the buffer to the hashtable.
 	 */
 	cache->entry_num++;
-	hashtab_set(&blk_cache_ht, BLKHASH(cache, no), &new->hnode);
+	rhashtab_set(&cache->ht, BLKHASH(no), &new->hnode);
 	rwunlock(&cache->lock);
 
 	/*
@@ -290,16 +566,15 @@ int bio(blk_provider_t *pr, blk_rtype_t type, off_t off, size_t size,
 			err = -EIO;
 		} else if(type == BLK_WR) {
 			memcpy(cbuf->data + blkoff, ptr, cur);
+			if(cur == blksz) {
+				cbuf->status = BLK_CBUF_OK;
+			}
 
 			/*
-			 * Writes happen immediately.
+			 * The buffer is written back by the flusher.
 			 */
-			err = blk_write(pr, cbuf->no, blk_cbuf_count(cbuf),
-				cbuf->data);
-			if(err) {
-				cbuf->status = BLK_CBUF_ERR;
-			} else {
-				cbuf->status = BLK_CBUF_OK;
+			if(blk_cbuf_set_dirty(cbuf)) {
+				blk_flush_kick();
 			}
 		} else {
 			memcpy(ptr, cbuf->data + blkoff, cur);
@@ -320,6 +595,33 @@ int bio(blk_provider_t *pr, blk_rtype_t type, off_t off, size_t size,
 	return 0;
 }
 
+void blk_cache_discard(blk_provider_t *pr, off_t off, size_t size) {
+	blk_cache_t *cache = pr->cache;
+	blk_object_t *obj = pr->obj;
+	blkno_t start, end;
+	blk_cbuf_t *cbuf;
+
+	assert(cache);
+	start = ALIGN(off, 1 << obj->pblk_shift) >> obj->pblk_shift;
+	end = (off + size) >> obj->pblk_shift;
+
+	/*
+	 * Wait for a writeback, which might be writing the buffers.
+	 */
+	sync_scope_acquire(&cache->flush_lock);
+	for(blkno_t i = start; i < end; i++) {
+		rdlock(&cache->lock);
+		cbuf = blk_cache_lookup(cache,
+			i << (obj->pblk_shift - obj->blk_shift));
+		rwunlock(&cache->lock);
+
+		if(cbuf) {
+			blk_cbuf_clean(cbuf);
+			blk_cbuf_unref(cbuf);
+		}
+	}
+}
+
 void blk_cache_add(blk_provider_t *pr) {
 	blk_cache_t *cache;
 
@@ -328,8 +630,11 @@ void blk_cache_add(blk_provider_t *pr) {
 
 	list_node_init(cache, &cache->node);
 	list_init(&cache->lru);
+	list_init(&cache->dirty);
 	rwlock_init(&cache->lock);
 	sync_init(&cache->lru_lock, SYNC_MUTEX);
+	sync_init(&cache->flush_lock, SYNC_MUTEX);
+	rhashtab_alloc(&cache->ht, RHASHTAB_MIN, VM_WAIT);
 	cache->entry_num = 0;
 	cache->pr = pr;
 
@@ -347,19 +652,33 @@ void blk_cache_rem(blk_provider_t *pr) {
 		list_remove(&blk_cache_list, &cache->node);
 	}
 
+	/*
+	 * Write the dirty buffers back. The data of the buffers, which
+	 * could not be written, is lost.
+	 */
+	if(blk_cache_writeback(cache, getnanouptime())) {
+		kprintf("[block] warning: could not write back the cache of "
+			"%s\n", pr->name);
+		foreach(cbuf, &cache->dirty) {
+			blk_cbuf_clean(cbuf);
+		}
+	}
+
 	/*
 	 * Since no buffer should be in use anymore, all the
 	 * blocks should be on the lru.
 	 */
 	foreach(cbuf, &cache->lru) {
-		hashtab_remove(&blk_cache_ht, BLKHASH(cache, cbuf->no),
- 			&cbuf->hnode);
+		rhashtab_remove(&cache->ht, BLKHASH(cbuf->no), &cbuf->hnode);
 		list_remove(&cache->lru, &cbuf->lnode);
 		blk_cbuf_free(cbuf);
 		cache->entry_num--;
 	}
 
 	assert(cache->entry_num == 0);
+	rhashtab_free(&cache->ht);
+	list_destroy(&cache->dirty);
+	sync_destroy(&cache->flush_lock);
 	kfree(cache);
 	pr->cache = NULL;
 }
@@ -375,6 +694,8 @@ static bool blk_cache_reclaim(void) {
 
 	foreach(cache, &blk_cache_list) {
 		blk_cbuf_t *cbuf = NULL;
+		bool dirty = false;
+		int err;
 
 		wrlock(&cache->lock);
 
@@ -383,22 +704,42 @@ static bool blk_cache_reclaim(void) {
 		 */
 		synchronized(&cache->lru_lock) {
 			cbuf = list_pop_front(&cache->lru);
+			if(cbuf && cbuf->dirty) {
+				/*
+				 * Keep the buffer while writing it back.
+				 */
+				cbuf->ref++;
+				dirty = true;
+			}
 		}
 
-		if(cbuf) {
+		if(dirty) {
+			rwunlock(&cache->lock);
+
+			/*
+			 * The buffer has to be written back before it can
+			 * be freed. Write back the other dirty buffers too,
+			 * they are freed by the next calls.
+			 */
+			err = blk_cache_writeback(cache, getnanouptime());
+			blk_cbuf_unref(cbuf);
+			sync_release(&blk_cache_lock);
+
+			return err == 0;
+		} else if(cbuf) {
 			/*
 			 * Remove the item from the cache.
 			 */
 			cache->entry_num--;
-			hashtab_remove(&blk_cache_ht, BLKHASH(cache, cbuf->no),
+			rhashtab_remove(&cache->ht, BLKHASH(cbuf->no),
 				&cbuf->hnode);
 
 			rwunlock(&cache->lock);
 			sync_release(&blk_cache_lock);
 
 			/*
-			 * Free the block. The block does not need to be written
-			 * to disk, because writes are performed immediately.
+			 * Free the block. The block is clean and thus does not
+			 * need to be written to disk.
 			 */
 			blk_cbuf_free(cbuf);
 			return true;
@@ -417,6 +758,8 @@ static bool blk_cache_reclaim(void) {
 }
 vm_reclaim("blkdev-cache", blk_cache_reclaim);
 
-void blk_cache_init(void) {
-	hashtab_alloc(&blk_cache_ht, BLKHASH_SIZE, VM_WAIT);
+void __init blk_cache_init(void) {
+	blk_flush_wq = workqueue_create("blk_flush", SCHED_IO, 1);
+	delayed_work_init(&blk_flush_dwork, blk_flush_expired, NULL);
+	work_init(&blk_flush_work, blk_flush_all, NULL);
 }
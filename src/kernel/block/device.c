@@ -149,6 +149,7 @@ blk_dev_t *blk_dev_alloc(void) {
 	dev->name = NULL;
 	dev->start = NULL;
 	dev->req_queue = NULL;
+	dev->max_cnt = 0;
 
 	return dev;
 }
@@ -190,6 +191,7 @@ void blk_dev_register(blk_dev_t *dev) {
 	obj = blk_object_new(&blk_dev_class, dev);
 	obj->blk_shift = dev->blk_shift;
 	obj->pblk_shift = dev->pblk_shift;
+	obj->max_cnt = dev->max_cnt;
 	snprintf(obj->name, sizeof(obj->name), "%s%d", dev->name, dev->unit);
 
 	dev->obj = obj;
@@ -23,28 +23,42 @@
  */
 
 #include <kern/system.h>
-#include <kern/proc.h>
 #include <kern/init.h>
 #include <kern/sched.h>
-#include <kern/futex.h>
-#include <kern/sync.h>
+#include <kern/workqueue.h>
 #include <block/block.h>
 #include <vm/slab.h>
 
-static thread_t *blk_event_thread;
+/*
+ * Block events are run by the worker threads of the block workqueue
+ * on the cpu, which added the event (usually the cpu handling the
+ * interrupt of the device completing a request).
+ */
+#define BLK_EVENT_WORKERS 2
+
+static struct workqueue *blk_event_wq;
 static DEFINE_VM_SLAB(blk_event_slab, sizeof(blk_event_t), 0);
-static DEFINE_LIST(blk_event_queue);
-static sync_t blk_event_lock = SYNC_INIT(SPINLOCK);
-static size_t blk_event_count = 0;
+
+static void blk_event_work(void *arg) {
+	blk_event_t *event = arg;
+	blk_callback_t callback = event->callback;
+
+	/*
+	 * The callback might free the event.
+	 */
+	rdlocked(&blk_lock) {
+		callback(event->arg);
+	}
+}
 
 void blk_event_create(blk_event_t *event, blk_callback_t callback, void *arg) {
-	list_node_init(event, &event->node);
+	work_init(&event->work, blk_event_work, event);
 	event->callback = callback;
 	event->arg = arg;
 }
 
 void blk_event_destroy(blk_event_t *event) {
-	list_node_destroy(&event->node);
+	work_destroy(&event->work);
 }
 
 blk_event_t *blk_event_alloc(blk_callback_t callback, void *arg) {
@@ -59,50 +73,11 @@ void blk_event_free(blk_event_t *event) {
 }
 
 void blk_event_add(blk_event_t *event) {
-	synchronized(&blk_event_lock) {
-		list_append(&blk_event_queue, &event->node);
+	if(!work_queue(blk_event_wq, &event->work)) {
+		kpanic("[block] event added twice");
 	}
-
-	/*
-	 * Wakeup the event handling thread.
-	 */
-	atomic_inc_relaxed(&blk_event_count);
-	kern_wake(&blk_event_count, 1, 0);
-}
-
-static int blk_event_loop(__unused void *arg) {
-	sync_acquire(&blk_event_lock);
-
-	while(true) {
-		blk_event_t *event;
-
-		/*
-		 * Wait for any pending events, which need to be handled.
-		 */
-		while(atomic_load_relaxed(&blk_event_count) == 0) {
-			sync_release(&blk_event_lock);
-			kern_wait(&blk_event_count, 0U, 0);
-			sync_acquire(&blk_event_lock);
-		}
-
-		/*
-		 * Handle the events.
-		 */
-		while((event = list_pop_front(&blk_event_queue))) {
-			sync_release(&blk_event_lock);
-
-			atomic_dec_relaxed(&blk_event_count);
-			rdlocked(&blk_lock) {
-				event->callback(event->arg);
-			}
-
-			sync_acquire(&blk_event_lock);
-		}
-	}
-
-	notreached();
 }
 
 void __init blk_event_init(void) {
-	blk_event_thread = kthread_spawn_prio(blk_event_loop, NULL, SCHED_IO);
+	blk_event_wq = workqueue_create("block", SCHED_IO, BLK_EVENT_WORKERS);
 }
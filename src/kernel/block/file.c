@@ -91,10 +91,14 @@ int blk_mount_get(file_t *file, blk_provider_t **prp) {
 }
 
 void blk_mount_put(blk_provider_t *pr) {
-	wrlock_scope(&blk_lock);
-
+	/*
+	 * Removing the cache writes the dirty buffers back, which needs
+	 * blk_lock.
+	 */
 	extern void blk_cache_rem(blk_provider_t *pr);
 	blk_cache_rem(pr);
+
+	wrlock_scope(&blk_lock);
 	blk_disuse_provider(pr);
 }
 
@@ -25,6 +25,7 @@
 #include <kern/system.h>
 #include <device/device.h>
 #include <device/dma.h>
+#include <block/block.h>
 #include <arch/barrier.h>
 #include <vm/mmu.h> /* vtophys */
 #include <vm/malloc.h>
@@ -103,18 +104,16 @@ static void bus_dma_bounce_free_mem(bus_dma_buf_t *buf) {
 	kfree(buf->segs);
 }
 
-static int bus_dma_bounce_prep(bus_dma_buf_t *buf, uint64_t start,
-	size_t size)
-{
-	bus_size_t nseg;
+/*
+ * Calculate the number of pages involved in a buffer.
+ */
+static bus_size_t bus_dma_bounce_npages(uint64_t start, size_t size) {
+	return atop(ALIGN(start + size, PAGE_SZ) - (start & PAGE_MASK));
+}
 
+static int bus_dma_bounce_prep(bus_dma_buf_t *buf, bus_size_t nseg) {
 	assert(buf->segsz_max >= PAGE_SZ);
 
-	/*
-	 * Calculate the number of pages involved in the buffer.
-	 * Is there an easier way to do this?
-	 */
-	nseg = atop(ALIGN(start + size, PAGE_SZ) - (start & PAGE_MASK));
 	if(nseg > buf->nseg_max) {
 		return -E2BIG;
 	}
@@ -139,13 +138,40 @@ static int bus_dma_bounce_prep(bus_dma_buf_t *buf, uint64_t start,
 	return 0;
 }
 
+/*
+ * Fill the segments of a buffer starting at segment @p i with a range of
+ * physical memory. Returns the index of the next segment.
+ */
+static bus_size_t bus_dma_bounce_fill(bus_dma_buf_t *buf, bus_size_t i,
+	vm_paddr_t phys, size_t size)
+{
+	size_t off;
+
+	off = phys & PAGE_MASK;
+	while(size) {
+		size_t len = min(PAGE_SZ - off, size);
+
+		assert(i < buf->nseg);
+		assert(phys >= buf->start && phys < buf->end);
+		buf->segs[i].addr = phys;
+		buf->segs[i].size = len;
+
+		phys += len;
+		size -= len;
+		off = 0;
+		i++;
+	}
+
+	return i;
+}
+
 static int bus_dma_bounce_load(bus_dma_buf_t *buf, void *ptr, size_t size) {
 	uintptr_t start = (uintptr_t) ptr;
 	bus_size_t i;
 	size_t off;
 	int err;
 
-	err = bus_dma_bounce_prep(buf, start, size);
+	err = bus_dma_bounce_prep(buf, bus_dma_bounce_npages(start, size));
 	if(err) {
 		return err;
 	}
@@ -170,26 +196,33 @@ static int bus_dma_bounce_load(bus_dma_buf_t *buf, void *ptr, size_t size) {
 }
 
 static int bus_dma_load_phys(bus_dma_buf_t *buf, vm_paddr_t phys, size_t size) {
-	bus_size_t i;
-	size_t off;
 	int err;
 
-	err = bus_dma_bounce_prep(buf, phys, size);
+	err = bus_dma_bounce_prep(buf, bus_dma_bounce_npages(phys, size));
 	if(err) {
 		return err;
 	}
 
-	off = phys & PAGE_MASK;
-	for(i = 0; i < buf->nseg; i++) {
-		size_t len = min(PAGE_SZ - off, size);
+	bus_dma_bounce_fill(buf, 0, phys, size);
 
-		assert(phys >= buf->start && phys < buf->end);
-		buf->segs[i].addr = phys;
-		buf->segs[i].size = len;
+	return 0;
+}
 
-		phys += len;
-		size -= len;
-		off = 0;
+static int bus_dma_load_sg(bus_dma_buf_t *buf, blk_seg_t *seg, size_t nseg) {
+	bus_size_t i, num = 0;
+	int err;
+
+	for(i = 0; i < nseg; i++) {
+		num += bus_dma_bounce_npages(seg[i].paddr, seg[i].size);
+	}
+
+	err = bus_dma_bounce_prep(buf, num);
+	if(err) {
+		return err;
+	}
+
+	for(i = 0, num = 0; i < nseg; i++) {
+		num = bus_dma_bounce_fill(buf, num, seg[i].paddr, seg[i].size);
 	}
 
 	return 0;
@@ -221,6 +254,7 @@ bus_dma_ops_t bus_dma_bounce_ops = {
 	.free_mem = bus_dma_bounce_free_mem,
 	.load = bus_dma_bounce_load,
 	.load_phys = bus_dma_load_phys,
+	.load_sg = bus_dma_load_sg,
 	.unload = bus_dma_bounce_unload,
 	.sync = bus_dma_bounce_sync,
 };
@@ -132,7 +132,10 @@ int bus_dma_load(bus_dma_buf_t *buf, void *ptr, size_t size) {
 int bus_dma_load_blk(bus_dma_buf_t *buf, blk_req_t *req) {
 	assert(req->type == BLK_RD || req->type == BLK_WR);
 
-	if(req->flags & BLK_REQ_PHYS) {
+	if(req->flags & BLK_REQ_SG) {
+		return buf->dma->ops->load_sg(buf, req->io.seg,
+			req->io.nseg);
+	} else if(req->flags & BLK_REQ_PHYS) {
 		return buf->dma->ops->load_phys(buf, req->io.paddr,
 			req->io.cnt << blk_get_blkshift(req->pr));
 	} else if(req->io.map) {
@@ -28,6 +28,7 @@
 #include <kern/proc.h>
 #include <kern/random.h>
 #include <kern/init.h>
+#include <kern/vdso.h>
 #include <vm/malloc.h>
 #include <vm/object.h>
 #include <vm/vas.h>
@@ -564,6 +565,8 @@ static int elf_initaux(exec_img_t *image, kstack_t *stack) {
 	elf_aux(stack, AT_SECURE, 0); /* TODO */
 	elf_aux(stack, AT_RANDOM, (uintptr_t)urand);
 	elf_aux(stack, AT_EXECFN, (uintptr_t)binary);
+	elf_aux(stack, AT_SYSINFO, vdso_sym("__kernel_vsyscall"));
+	elf_aux(stack, AT_SYSINFO_EHDR, vdso_addr());
 #undef elf_aux
 
 	return 0;
@@ -510,6 +510,7 @@ static void ata_dev_probe(device_t *device, ata_dev_t *dev,
 	bdev->priv = dev;
 	bdev->blk_shift = ATA_SECT_LG; /* 512 byte logical sectors */
 	bdev->pblk_shift = ATA_SECT_LG + pblk; /* physical sector size */
+	bdev->max_cnt = dev->io_max_sect;
 	bdev->blkcnt = blkcnt;
 	dev->blkdev = bdev;
 	bdev->flags = 0; /* TODO atapi */
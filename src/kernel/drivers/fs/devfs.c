@@ -207,6 +207,7 @@ devfs_node_t *devfs_mknodat(devfs_node_t *parent, dev_t dev, mode_t mode,
 	size_t blksz_shift, const char *name)
 {
 	devfs_node_t *node;
+	size_t namelen;
 
 	if(parent == NULL) {
 		parent = &devfs_root;
@@ -214,8 +215,10 @@ devfs_node_t *devfs_mknodat(devfs_node_t *parent, dev_t dev, mode_t mode,
 
 	node = kmalloc(sizeof(*node), VM_WAIT);
 	devfs_node_init(node, dev, mode, blksz_shift);
-	node->dirent = vdirent_alloc(devfs_fs, name, strlen(name),
-		parent->vnode.ino, node->vnode.ino, VD_PERM, VM_WAIT);
+	namelen = strlen(name);
+	node->dirent = vdirent_alloc(devfs_fs, name, namelen,
+		vdirent_hash(name, namelen), parent->vnode.ino,
+		node->vnode.ino, VD_PERM, VM_WAIT);
 
 	/*
 	 * Insert the new node into the devfs tree.
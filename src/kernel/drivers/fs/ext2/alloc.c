@@ -5,7 +5,7 @@
  * ██╔══╝  ██║     ██║   ██║╚════██║
  * ███████╗███████╗╚██████╔╝███████║
  * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
- * 
+ *
  * Copyright (c) 2017, Elias Zell
  *
  * Permission to use, copy, modify, and/or distribute this software for any
@@ -22,245 +22,842 @@
  *
  */
 
+
 #include <kern/system.h>
+#include <kern/atomic.h>
 #include <vm/malloc.h>
+#include <lib/string.h>
 #include <ext2/ext2.h>
 
-/**
- * @brief Allocate a bit from a bitmap block.
+/*
+ * The block and inode bitmaps of a block group are read once and kept in
+ * memory. Every group has its own lock protecting its bitmaps, its
+ * summary and the free counts of its group descriptor, so allocations in
+ * different groups do not serialize. fs->alloc_lock only protects the
+ * free counts of the superblock.
+ *
+ * Regular files allocate their blocks from a reservation window, a range
+ * of blocks reserved ahead of the writer. The window grows every time it
+ * is used up, so that files written concurrently end up in large
+ * contiguous pieces. Reservations only exist in memory: group->rmap
+ * contains the allocated and the reserved blocks and is used when
+ * searching for free blocks. If every free block of the filesystem is
+ * reserved, blocks are taken from the windows of other files.
+ */
+
+/*
+ * Prefer starting a new file in a free extent of at least this many
+ * blocks, so that it has room to grow.
+ */
+#define EXT2_EXTENT_MIN	8
+
+/*
+ * The minimum and maximum size of a reservation window in blocks.
+ */
+#define EXT2_RSV_MIN	8U
+#define EXT2_RSV_MAX	1024U
+
+#define EXT2_BIT_TEST(map, bit)	((map)[(bit) >> 5] & (1U << ((bit) & 31)))
+
+/*
+ * Find the first clear bit in [start, end) or return end.
  */
-static int ext2_bitmap_alloc(ext2_fs_t *fs, uint32_t bitmap, uint32_t min,
-	uint32_t *buf, uint32_t *res)
+static uint32_t ext2_find_zero(const uint32_t *map, uint32_t start,
+	uint32_t end)
 {
+	uint32_t val;
+
+	while(start < end) {
+		val = ~map[start >> 5] & (~0U << (start & 31));
+		if(val) {
+			return min(end, (start & ~31U) + ffs(val) - 1);
+		}
+
+		start = (start & ~31U) + 32;
+	}
+
+	return end;
+}
+
+/*
+ * Find the first set bit in [start, end) or return end.
+ */
+static uint32_t ext2_find_one(const uint32_t *map, uint32_t start,
+	uint32_t end)
+{
+	uint32_t val;
+
+	while(start < end) {
+		val = map[start >> 5] & (~0U << (start & 31));
+		if(val) {
+			return min(end, (start & ~31U) + ffs(val) - 1);
+		}
+
+		start = (start & ~31U) + 32;
+	}
+
+	return end;
+}
+
+/*
+ * Return the first bit of the run of clear bits containing @p bit.
+ */
+static uint32_t ext2_zero_run_start(const uint32_t *map, uint32_t bit) {
+	uint32_t val;
+
+	while(bit > 0) {
+		val = map[(bit - 1) >> 5];
+		if(((bit - 1) & 31) != 31) {
+			val &= (1U << (bit & 31)) - 1;
+		}
+
+		if(val) {
+			return (((bit - 1) & ~31U) + 32 - __builtin_clz(val));
+		}
+
+		bit = (bit - 1) & ~31U;
+	}
+
+	return 0;
+}
+
+static inline uint32_t ext2_group_first(ext2_fs_t *fs, uint32_t group) {
+	return fs->super.s_first_data_block + group *
+		fs->super.s_blocks_per_group;
+}
+
+static inline uint32_t ext2_blk_group(ext2_fs_t *fs, uint32_t blk) {
+	return (blk - fs->super.s_first_data_block) /
+		fs->super.s_blocks_per_group;
+}
+
+/*
+ * Find the largest run of clear bits.
+ */
+static uint32_t ext2_max_extent(const uint32_t *map, uint32_t nbits) {
+	uint32_t start, end, max = 0;
+
+	for(start = ext2_find_zero(map, 0, nbits); start < nbits;
+		start = ext2_find_zero(map, end, nbits))
+	{
+		end = ext2_find_one(map, start, nbits);
+		max = max(max, end - start);
+	}
+
+	return max;
+}
+
+static int ext2_read_bitmap(ext2_fs_t *fs, uint32_t blk, uint32_t **mapp) {
+	uint32_t *map;
 	int err;
 
-	sync_assert(&fs->alloc_lock);
+	map = kmalloc(fs->blksz, VM_WAIT);
+	err = bread(fs->dev, EXT2_BOFF(fs, blk, 0), fs->blksz, map);
+	if(err) {
+		kfree(map);
+	} else {
+		*mapp = map;
+	}
+
+	return err;
+}
 
-	/*
-	 * Read the bitmap block.
-	 */
-	err = bread(fs->dev, EXT2_BOFF(fs, bitmap, 0), fs->blksz,
-		buf);
+static int ext2_group_bitmap(ext2_fs_t *fs, uint32_t id) {
+	ext2_group_t *group = &fs->groups[id];
+	int err;
+
+	sync_assert(&group->lock);
+	if(group->bmap) {
+		return 0;
+	}
+
+	err = ext2_read_bitmap(fs, fs->bgds[id].bg_block_bitmap, &group->bmap);
 	if(err) {
 		return err;
 	}
 
-	/*
-	 * Try to find bits, which are not set in the bitmap.
-	 */
-	for(uint32_t i = 0; i < fs->super.s_blocks_per_group >> 5; i++) {
-		uint32_t bit, idx, val = ~buf[i];
-		if(i == 0 && min) {
-			/*
-			 * Clear the lowest bits, if a minimum was provided.
-			 */
-			val &= (1U << min) - 1;
+	group->rmap = kmalloc(fs->blksz, VM_WAIT);
+	memcpy(group->rmap, group->bmap, fs->blksz);
+	group->bfirst = ext2_find_zero(group->rmap, 0, group->nblocks);
+	group->bextent = ext2_max_extent(group->rmap, group->nblocks);
+
+	return 0;
+}
+
+static int ext2_group_imap(ext2_fs_t *fs, uint32_t id) {
+	ext2_group_t *group = &fs->groups[id];
+
+	sync_assert(&group->lock);
+	if(group->imap) {
+		return 0;
+	}
+
+	return ext2_read_bitmap(fs, fs->bgds[id].bg_inode_bitmap, &group->imap);
+}
+
+/*
+ * Write the word of a bitmap containing @p bit.
+ */
+static int ext2_bitmap_sync(ext2_fs_t *fs, uint32_t blk, uint32_t *map,
+	uint32_t bit)
+{
+	uint32_t idx = bit >> 5;
+	return bwrite(fs->dev, EXT2_BOFF(fs, blk, idx << 2), sizeof(*map),
+		&map[idx]);
+}
+
+/*
+ * Find a block in a group, which is neither allocated nor reserved,
+ * preferring the blocks right after @p goal, then the start of a free
+ * extent and finally any free block.
+ */
+static uint32_t ext2_group_search(ext2_group_t *group, uint32_t goal) {
+	uint32_t *map = group->rmap, nbits = group->nblocks;
+	uint32_t start, end, bit, max = 0;
+
+	if(goal < nbits) {
+		if(!EXT2_BIT_TEST(map, goal)) {
+			return goal;
 		}
 
 		/*
-		 * Search for a free bit.
+		 * Search for a block close to the goal.
 		 */
-		bit = ffs(val);
-		if(bit == 0) {
-			/*
-			 * Nothing found here...
-			 */
-			continue;
-		}
-
-		bit--; /* ffs returns bit+1 */
-		idx = bit + (i << 5);
-		if(idx > fs->super.s_blocks_per_group) {
-			return -ENOSPC;
+		bit = ext2_find_zero(map, goal, min(nbits, ALIGN(goal + 1, 64)));
+		if(bit < nbits && bit < ALIGN(goal + 1, 64)) {
+			return bit;
 		}
+	} else {
+		goal = 0;
+	}
 
+	goal = max(goal, group->bfirst);
+	if(group->bextent >= EXT2_EXTENT_MIN) {
 		/*
-		 * Set the bit in order to indicate that the block/inode is not
-		 * free.
+		 * Search for the start of a free extent beginning at the goal,
+		 * wrapping around to the start of the group.
 		 */
-		bset(&buf[i], bit);
-		*res = idx;
+		for(start = ext2_find_zero(map, goal, nbits); start < nbits;
+			start = ext2_find_zero(map, end, nbits))
+		{
+			end = ext2_find_one(map, start, nbits);
+			if(end - start >= EXT2_EXTENT_MIN) {
+				return start;
+			}
+
+			max = max(max, end - start);
+		}
+
+		for(start = ext2_find_zero(map, group->bfirst, goal);
+			start < goal; start = ext2_find_zero(map, end, goal))
+		{
+			end = ext2_find_one(map, start, nbits);
+			if(end - start >= EXT2_EXTENT_MIN) {
+				return start;
+			}
+
+			max = max(max, end - start);
+		}
 
 		/*
-		 * Try to write the bitmap again
+		 * The whole group was searched, update the summary.
 		 */
-		return bwrite(fs->dev, EXT2_BOFF(fs, bitmap, i << 2), 4,
-			&buf[i]);
+		group->bextent = max;
 	}
 
-	return -ENOSPC;
+	bit = ext2_find_zero(map, goal, nbits);
+	if(bit == nbits) {
+		bit = ext2_find_zero(map, group->bfirst, goal);
+		if(bit == goal) {
+			return nbits;
+		}
+	}
+
+	return bit;
 }
 
-static int ext2_bitmap_free(ext2_fs_t *fs, uint32_t bitmap, uint32_t idx) {
-	uint8_t val, mask;
-	uint32_t byte;
+/*
+ * Mark a block as allocated.
+ */
+static int ext2_group_take(ext2_fs_t *fs, uint32_t id, uint32_t bit) {
+	ext2_group_t *group = &fs->groups[id];
 	int err;
 
-	sync_assert(&fs->alloc_lock);
-	byte = idx >> 3;
-	mask = 1 << (idx & 0x7);
+	sync_assert(&group->lock);
+	bset(&group->bmap[bit >> 5], bit & 31);
+	err = ext2_bitmap_sync(fs, fs->bgds[id].bg_block_bitmap, group->bmap,
+		bit);
+	if(err) {
+		bclr(&group->bmap[bit >> 5], bit & 31);
+		return err;
+	}
 
-	/*
-	 * Read the bitmap.
-	 */
-	err = bread(fs->dev, EXT2_BOFF(fs, bitmap, byte), 1, &val);
-	if(err == 0) {
+	bset(&group->rmap[bit >> 5], bit & 31);
+	fs->bgds[id].bg_free_blocks_count--;
+
+	return 0;
+}
+
+static int ext2_group_balloc(ext2_fs_t *fs, uint32_t id, uint32_t goal,
+	uint32_t *blkp)
+{
+	ext2_group_t *group = &fs->groups[id];
+	uint32_t bit;
+	int err;
+
+	sync_scope_acquire(&group->lock);
+	if(fs->bgds[id].bg_free_blocks_count == 0) {
+		return -ENOSPC;
+	}
+
+	err = ext2_group_bitmap(fs, id);
+	if(err) {
+		return err;
+	}
+
+	bit = ext2_group_search(group, goal);
+	if(bit == group->nblocks) {
 		/*
-		 * Clear the bit and write the bitmap again.
+		 * Every free block is reserved, take one of another file.
 		 */
-		kassert(val & mask, "[ext2] freeing block which is already "
-			"free");
-		val &= ~mask;
-		err = bwrite(fs->dev, EXT2_BOFF(fs, bitmap, byte), 1, &val);
+		bit = ext2_find_zero(group->bmap, 0, group->nblocks);
+		if(bit == group->nblocks) {
+			/*
+			 * bg_free_blocks_count was wrong for some reason...
+			 */
+			fs->bgds[id].bg_free_blocks_count = 0;
+			return -ENOSPC;
+		}
 	}
 
-	return err;
+	err = ext2_group_take(fs, id, bit);
+	if(err) {
+		return err;
+	}
+
+	if(bit == group->bfirst) {
+		group->bfirst = ext2_find_zero(group->rmap, bit + 1,
+			group->nblocks);
+	}
+
+	*blkp = ext2_group_first(fs, id) + bit;
+
+	return 0;
 }
 
-int ext2_balloc(ext2_fs_t *fs, vnode_t *node, uint32_t *blkp) {
-	uint32_t *buf, blk = 0, start;
-	int err = 0;
+/*
+ * Reserve a new window of up to rsv->size blocks in a group and allocate
+ * its first block.
+ */
+static int ext2_group_rsv_new(ext2_fs_t *fs, uint32_t id, uint32_t goal,
+	ext2_rsv_t *rsv, uint32_t *blkp)
+{
+	ext2_group_t *group = &fs->groups[id];
+	uint32_t start, end;
+	int err;
 
-	buf = kmalloc(fs->blksz, VM_WAIT);
+	sync_scope_acquire(&group->lock);
+	if(fs->bgds[id].bg_free_blocks_count == 0) {
+		return -ENOSPC;
+	}
 
-	/*
-	 * Prefer the block group of the inode to avoid unnecessary seeking.
-	 */
-	start = (node->ino - 1) / fs->super.s_inodes_per_group;
+	err = ext2_group_bitmap(fs, id);
+	if(err) {
+		return err;
+	}
 
-	sync_acquire(&fs->alloc_lock);
-	if(fs->super.s_free_blocks_count == 0) {
-		err = -ENOSPC;
-		goto out;
+	start = ext2_group_search(group, goal);
+	if(start == group->nblocks) {
+		return -ENOSPC;
 	}
 
-	for(size_t i = 0; i < fs->nbgd; i++) {
-		uint32_t bgd_id = start + i;
-		if(bgd_id >= fs->nbgd) {
-			bgd_id -= fs->nbgd;
-		}
+	err = ext2_group_take(fs, id, start);
+	if(err) {
+		return err;
+	}
+
+	end = ext2_find_one(group->rmap, start + 1, min(group->nblocks,
+		start + rsv->size));
+	for(uint32_t bit = start + 1; bit < end; bit++) {
+		bset(&group->rmap[bit >> 5], bit & 31);
+	}
 
-		if(fs->bgds[bgd_id].bg_free_inodes_count == 0) {
-			continue;
+	if(start == group->bfirst) {
+		group->bfirst = ext2_find_zero(group->rmap, end,
+			group->nblocks);
+	}
+
+	rsv->group = id;
+	rsv->start = start;
+	rsv->end = end;
+	*blkp = ext2_group_first(fs, id) + start;
+
+	return 0;
+}
+
+/*
+ * Allocate a block of the reservation window at or after @p goal.
+ */
+static int ext2_rsv_take(ext2_fs_t *fs, ext2_rsv_t *rsv, uint32_t goal,
+	uint32_t *blkp)
+{
+	ext2_group_t *group = &fs->groups[rsv->group];
+	uint32_t bit;
+	int err;
+
+	sync_scope_acquire(&group->lock);
+	bit = ext2_find_zero(group->bmap, goal, rsv->end);
+	if(bit == rsv->end) {
+		return -ENOSPC;
+	}
+
+	err = ext2_group_take(fs, rsv->group, bit);
+	if(err) {
+		return err;
+	}
+
+	*blkp = ext2_group_first(fs, rsv->group) + bit;
+
+	return 0;
+}
+
+static void ext2_rsv_release(ext2_fs_t *fs, ext2_rsv_t *rsv) {
+	ext2_group_t *group = &fs->groups[rsv->group];
+	uint32_t first = rsv->end;
+
+	if(rsv->start == rsv->end) {
+		return;
+	}
+
+	synchronized(&group->lock) {
+		for(uint32_t bit = rsv->start; bit < rsv->end; bit++) {
+			if(!EXT2_BIT_TEST(group->bmap, bit)) {
+				bclr(&group->rmap[bit >> 5], bit & 31);
+				first = min(first, bit);
+			}
 		}
 
-		/*
-		 * Try to allocate a block.
-		 */
-		err = ext2_bitmap_alloc(fs, fs->bgds[bgd_id].bg_block_bitmap, 0,
-			buf, &blk);
-		if(err == -ENOSPC) {
+		if(first != rsv->end) {
 			/*
-			 * bgd.bg_free_blocks_count was wrong for some reason...
+			 * Keep the upper bound of the largest extent valid.
 			 */
-			fs->bgds[bgd_id].bg_free_blocks_count = 0;
+			group->bfirst = min(group->bfirst, first);
+			group->bextent = max(group->bextent,
+				ext2_find_one(group->rmap, rsv->end,
+				group->nblocks) - ext2_zero_run_start(
+				group->rmap, first));
+		}
+	}
 
-			/*
-			 * Search in another block group.
-			 */
-			continue;
-		} else if(err) {
-			break;
+	rsv->start = rsv->end = 0;
+}
+
+void ext2_rsv_discard(ext2_fs_t *fs, vnode_t *node) {
+	ext2_rsv_release(fs, &EXT2_VTOPRIV(node)->rsv);
+}
+
+/*
+ * Allocate a block from the reservation window of a file, reserving a
+ * new window if the old one is used up. @p bit is the goal in group
+ * @p id if @p hint is true. Returns -EAGAIN if the goal lies outside of
+ * the window, i.e. the file is not written sequentially.
+ */
+static int ext2_rsv_balloc(ext2_fs_t *fs, ext2_rsv_t *rsv, uint32_t id,
+	uint32_t bit, bool hint, uint32_t *blkp)
+{
+	int err;
+
+	if(rsv->size == 0) {
+		rsv->size = EXT2_RSV_MIN;
+	}
+
+	if(rsv->start != rsv->end) {
+		if(!hint) {
+			id = rsv->group;
+			bit = rsv->start;
+		} else if(id != rsv->group || bit < rsv->start ||
+			bit > rsv->end)
+		{
+			return -EAGAIN;
+		}
+
+		err = ext2_rsv_take(fs, rsv, bit, blkp);
+		if(err != -ENOSPC) {
+			return err;
 		}
 
 		/*
-		 * Calculate the block number.
+		 * The window is used up, the next one is larger and
+		 * preferably follows the old one.
 		 */
-		blk += bgd_id * fs->super.s_blocks_per_group;
-		fs->bgds[bgd_id].bg_free_blocks_count--;
-		fs->super.s_free_blocks_count--;
-		break;
+		bit = max(bit, rsv->end);
+		ext2_rsv_release(fs, rsv);
+		rsv->size = min(rsv->size << 1, EXT2_RSV_MAX);
 	}
 
-out:
-	sync_release(&fs->alloc_lock);
-	kfree(buf);
-	*blkp = blk;
+	err = -ENOSPC;
+	for(size_t i = 0; i < fs->nbgd && err == -ENOSPC; i++) {
+		err = ext2_group_rsv_new(fs, (id + i) % fs->nbgd,
+			i == 0 ? bit : 0, rsv, blkp);
+	}
 
 	return err;
 }
 
+int ext2_balloc(ext2_fs_t *fs, vnode_t *node, uint32_t goal, uint32_t *blkp) {
+	uint32_t start, bit;
+	bool hint = false;
+	int err = -ENOSPC;
+
+	if(fs->super.s_free_blocks_count == 0) {
+		return -ENOSPC;
+	}
+
+	/*
+	 * Without a goal prefer the block group of the inode to avoid
+	 * unnecessary seeking.
+	 */
+	if(goal >= fs->super.s_first_data_block &&
+		goal < fs->super.s_blocks_count)
+	{
+		start = ext2_blk_group(fs, goal);
+		bit = goal - ext2_group_first(fs, start);
+		hint = true;
+	} else {
+		start = (node->ino - 1) / fs->super.s_inodes_per_group;
+		bit = 0;
+	}
+
+	if(VN_ISREG(node)) {
+		VN_ASSERT_LOCK_VM(node);
+		err = ext2_rsv_balloc(fs, &EXT2_VTOPRIV(node)->rsv, start, bit,
+			hint, blkp);
+		if(err == 0) {
+			goto out;
+		} else if(err != -EAGAIN && err != -ENOSPC) {
+			return err;
+		}
+	}
+
+	for(size_t i = 0; i < fs->nbgd; i++) {
+		uint32_t id = (start + i) % fs->nbgd;
+
+		err = ext2_group_balloc(fs, id, i == 0 ? bit : 0, blkp);
+		if(err != -ENOSPC) {
+			break;
+		}
+	}
+
+	if(err) {
+		return err;
+	}
+
+out:
+	synchronized(&fs->alloc_lock) {
+		fs->super.s_free_blocks_count--;
+	}
+
+	return 0;
+}
+
 void ext2_bfree(ext2_fs_t *fs, uint32_t blk) {
-	uint32_t bgd, off;
+	ext2_group_t *group;
+	uint32_t id, bit, start, end;
 	int err;
 
-	bgd = blk / fs->super.s_blocks_per_group;
-	off = blk - bgd * fs->super.s_blocks_per_group;
+	kassert(blk >= fs->super.s_first_data_block &&
+		blk < fs->super.s_blocks_count, "[ext2] freeing invalid "
+		"block: %d", blk);
+	id = ext2_blk_group(fs, blk);
+	bit = blk - ext2_group_first(fs, id);
+	group = &fs->groups[id];
+
+	/*
+	 * The block might have been metadata with a dirty cache buffer,
+	 * which must not be written over the next user of the block.
+	 */
+	blk_cache_discard(fs->dev, EXT2_BOFF(fs, blk, 0), fs->blksz);
+
+	synchronized(&group->lock) {
+		err = ext2_group_bitmap(fs, id);
+		if(err) {
+			break;
+		}
+
+		kassert(EXT2_BIT_TEST(group->bmap, bit), "[ext2] freeing block "
+			"which is already free: %d", blk);
+		bclr(&group->bmap[bit >> 5], bit & 31);
+		err = ext2_bitmap_sync(fs, fs->bgds[id].bg_block_bitmap,
+			group->bmap, bit);
+		if(err) {
+			bset(&group->bmap[bit >> 5], bit & 31);
+			break;
+		}
+
+		/*
+		 * Update the summary with the extent the block is now part of.
+		 */
+		bclr(&group->rmap[bit >> 5], bit & 31);
+		start = ext2_zero_run_start(group->rmap, bit);
+		end = ext2_find_one(group->rmap, bit, group->nblocks);
+		group->bextent = max(group->bextent, end - start);
+		group->bfirst = min(group->bfirst, bit);
+		fs->bgds[id].bg_free_blocks_count++;
+	}
 
-	sync_scope_acquire(&fs->alloc_lock);
-	err = ext2_bitmap_free(fs, fs->bgds[bgd].bg_block_bitmap, off);
 	if(err == 0) {
-		fs->bgds[bgd].bg_free_blocks_count++;
-		fs->super.s_free_blocks_count++;
+		synchronized(&fs->alloc_lock) {
+			fs->super.s_free_blocks_count++;
+		}
 	}
 }
 
-/**
- * TODO alloc the inode in the bgd of its directory
+static inline bool ext2_group_usable(ext2_bgd_t *bgd) {
+	return bgd->bg_free_inodes_count && bgd->bg_free_blocks_count;
+}
+
+/*
+ * Choose the block group of a new directory (Orlov allocator). Top-level
+ * directories are spread across the groups with the fewest directories,
+ * other directories are kept close to their parent as long as the groups
+ * are not too full.
  */
-int ext2_ialloc(ext2_fs_t *fs, uint32_t *res) {
-	uint32_t *buf, ino = 0;
-	int err = 0;
+static uint32_t ext2_group_dir(ext2_fs_t *fs, vnode_t *parent) {
+	uint32_t ngroups = fs->nbgd, pgroup, ndirs = 0, id;
+	uint32_t ipg = fs->super.s_inodes_per_group;
+	uint32_t avefreei, avefreeb, maxdirs, mininodes, minblocks;
+	ext2_bgd_t *bgd;
+
+	pgroup = (parent->ino - 1) / ipg;
+	avefreei = fs->super.s_free_inodes_count / ngroups;
+	avefreeb = fs->super.s_free_blocks_count / ngroups;
+	for(size_t i = 0; i < ngroups; i++) {
+		ndirs += fs->bgds[i].bg_used_dirs_count;
+	}
 
-	buf = kmalloc(fs->blksz, VM_WAIT);
+	if(parent->ino == EXT2_INO_ROOT) {
+		uint32_t best = ngroups, bestdirs = ipg;
+		uint32_t start = atomic_inc_relaxed(&fs->orlov_rotor);
+
+		for(size_t i = 0; i < ngroups; i++) {
+			id = (start + i) % ngroups;
+			bgd = &fs->bgds[id];
+			if(bgd->bg_used_dirs_count >= bestdirs ||
+				bgd->bg_free_inodes_count < max(avefreei, 1U) ||
+				bgd->bg_free_blocks_count < avefreeb)
+			{
+				continue;
+			}
+
+			best = id;
+			bestdirs = bgd->bg_used_dirs_count;
+		}
 
-	sync_acquire(&fs->alloc_lock);
-	if(fs->super.s_free_inodes_count == 0) {
-		err = -ENOSPC;
-		goto out;
+		if(best != ngroups) {
+			return best;
+		}
+	} else {
+		maxdirs = ndirs / ngroups + ipg / 16;
+		mininodes = avefreei > ipg / 4 ? avefreei - ipg / 4 : 1;
+		minblocks = avefreeb > fs->super.s_blocks_per_group / 4 ?
+			avefreeb - fs->super.s_blocks_per_group / 4 : 1;
+
+		for(size_t i = 0; i < ngroups; i++) {
+			id = (pgroup + i) % ngroups;
+			bgd = &fs->bgds[id];
+			if(bgd->bg_used_dirs_count < maxdirs &&
+				bgd->bg_free_inodes_count >= mininodes &&
+				bgd->bg_free_blocks_count >= minblocks)
+			{
+				return id;
+			}
+		}
 	}
 
 	/*
-	 * Search through the block group descriptors to find any inode.
+	 * Fall back to any group with an average number of free inodes.
 	 */
-	for(size_t bgd_id = 0; bgd_id < fs->nbgd; bgd_id++) {
-		uint32_t min = 0;
-
-		if(fs->bgds[bgd_id].bg_free_inodes_count == 0) {
-			continue;
+	for(size_t i = 0; i < ngroups; i++) {
+		id = (pgroup + i) % ngroups;
+		if(fs->bgds[id].bg_free_inodes_count >= max(avefreei, 1U)) {
+			return id;
 		}
+	}
 
-		if(bgd_id == 0 && fs->super.s_rev_level > EXT2_GOOD_OLD_REV) {
-			min = fs->super.s_first_ino;
+	return pgroup;
+}
+
+/*
+ * Choose the block group of a new file: the group of its directory if
+ * possible, otherwise a quadratic hash search for a group with free
+ * inodes and blocks.
+ */
+static uint32_t ext2_group_file(ext2_fs_t *fs, vnode_t *parent) {
+	uint32_t ngroups = fs->nbgd, pgroup, id;
+
+	pgroup = (parent->ino - 1) / fs->super.s_inodes_per_group;
+	if(ext2_group_usable(&fs->bgds[pgroup])) {
+		return pgroup;
+	}
+
+	id = (pgroup + parent->ino) % ngroups;
+	for(size_t i = 1; i < ngroups; i <<= 1) {
+		id = (id + i) % ngroups;
+		if(ext2_group_usable(&fs->bgds[id])) {
+			return id;
 		}
+	}
 
-		/*
-		 * Try to allocate the inode.
-		 */
-		err = ext2_bitmap_alloc(fs, fs->bgds[bgd_id].bg_inode_bitmap,
-			min, buf, &ino);
-		if(err == -ENOSPC) {
-			fs->bgds[bgd_id].bg_free_inodes_count = 0;
-			continue;
-		} else if(err) {
+	return pgroup;
+}
+
+static int ext2_group_ialloc(ext2_fs_t *fs, uint32_t id, bool dir,
+	uint32_t *res)
+{
+	ext2_group_t *group = &fs->groups[id];
+	uint32_t bit, min = 0;
+	int err;
+
+	if(id == 0 && fs->super.s_rev_level > EXT2_GOOD_OLD_REV) {
+		min = fs->super.s_first_ino - 1;
+	}
+
+	sync_scope_acquire(&group->lock);
+	if(fs->bgds[id].bg_free_inodes_count == 0) {
+		return -ENOSPC;
+	}
+
+	err = ext2_group_imap(fs, id);
+	if(err) {
+		return err;
+	}
+
+	bit = ext2_find_zero(group->imap, min, fs->super.s_inodes_per_group);
+	if(bit == fs->super.s_inodes_per_group) {
+		fs->bgds[id].bg_free_inodes_count = 0;
+		return -ENOSPC;
+	}
+
+	bset(&group->imap[bit >> 5], bit & 31);
+	err = ext2_bitmap_sync(fs, fs->bgds[id].bg_inode_bitmap, group->imap,
+		bit);
+	if(err) {
+		bclr(&group->imap[bit >> 5], bit & 31);
+		return err;
+	}
+
+	fs->bgds[id].bg_free_inodes_count--;
+	if(dir) {
+		fs->bgds[id].bg_used_dirs_count++;
+	}
+
+	*res = id * fs->super.s_inodes_per_group + bit + 1;
+	return 0;
+}
+
+int ext2_ialloc(ext2_fs_t *fs, vnode_t *parent, mode_t mode, uint32_t *res) {
+	uint32_t start;
+	int err = -ENOSPC;
+
+	if(fs->super.s_free_inodes_count == 0) {
+		return -ENOSPC;
+	}
+
+	if(S_ISDIR(mode)) {
+		start = ext2_group_dir(fs, parent);
+	} else {
+		start = ext2_group_file(fs, parent);
+	}
+
+	for(size_t i = 0; i < fs->nbgd; i++) {
+		err = ext2_group_ialloc(fs, (start + i) % fs->nbgd,
+			S_ISDIR(mode), res);
+		if(err != -ENOSPC) {
 			break;
 		}
+	}
 
-		ino += bgd_id * fs->super.s_inodes_per_group + 1;
-		fs->bgds[bgd_id].bg_free_inodes_count--;
-		fs->super.s_free_inodes_count--;
-		break;
+	if(err == 0) {
+		synchronized(&fs->alloc_lock) {
+			fs->super.s_free_inodes_count--;
+		}
 	}
 
-out:
-	sync_release(&fs->alloc_lock);
-	kfree(buf);
-	*res = ino;
 	return err;
 }
 
-void ext2_ifree(ext2_fs_t *fs, uint32_t ino) {
-	uint32_t bgd, off;
+void ext2_ifree(ext2_fs_t *fs, uint32_t ino, bool dir) {
+	ext2_group_t *group;
+	uint32_t id, bit;
 	int err;
 
 	ino--;
-	bgd = ino / fs->super.s_inodes_per_group;
-	off = ino - bgd * fs->super.s_inodes_per_group;
+	id = ino / fs->super.s_inodes_per_group;
+	bit = ino % fs->super.s_inodes_per_group;
+	group = &fs->groups[id];
+
+	synchronized(&group->lock) {
+		err = ext2_group_imap(fs, id);
+		if(err) {
+			break;
+		}
+
+		kassert(EXT2_BIT_TEST(group->imap, bit), "[ext2] freeing inode "
+			"which is already free: %d", ino + 1);
+		bclr(&group->imap[bit >> 5], bit & 31);
+		err = ext2_bitmap_sync(fs, fs->bgds[id].bg_inode_bitmap,
+			group->imap, bit);
+		if(err) {
+			bset(&group->imap[bit >> 5], bit & 31);
+			break;
+		}
+
+		fs->bgds[id].bg_free_inodes_count++;
+		if(dir) {
+			fs->bgds[id].bg_used_dirs_count--;
+		}
+	}
 
-	sync_scope_acquire(&fs->alloc_lock);
-	err = ext2_bitmap_free(fs, fs->bgds[bgd].bg_inode_bitmap, off);
 	if(err == 0) {
-		fs->bgds[bgd].bg_free_inodes_count++;
-		fs->super.s_free_inodes_count++;
+		synchronized(&fs->alloc_lock) {
+			fs->super.s_free_inodes_count++;
+		}
 	}
 }
+
+void ext2_alloc_init(ext2_fs_t *fs) {
+	uint32_t blocks = fs->super.s_blocks_count -
+		fs->super.s_first_data_block;
+
+	fs->orlov_rotor = 0;
+	fs->groups = kmalloc(sizeof(ext2_group_t) * fs->nbgd, VM_WAIT);
+	for(size_t i = 0; i < fs->nbgd; i++) {
+		ext2_group_t *group = &fs->groups[i];
+
+		sync_init(&group->lock, SYNC_MUTEX);
+		group->bmap = NULL;
+		group->rmap = NULL;
+		group->imap = NULL;
+		group->nblocks = min(fs->super.s_blocks_per_group, blocks -
+			i * fs->super.s_blocks_per_group);
+		group->bfirst = 0;
+		group->bextent = 0;
+	}
+}
+
+void ext2_alloc_destroy(ext2_fs_t *fs) {
+	for(size_t i = 0; i < fs->nbgd; i++) {
+		ext2_group_t *group = &fs->groups[i];
+
+		if(group->bmap) {
+			kfree(group->bmap);
+			kfree(group->rmap);
+		}
+		if(group->imap) {
+			kfree(group->imap);
+		}
+		sync_destroy(&group->lock);
+	}
+
+	kfree(fs->groups);
+}
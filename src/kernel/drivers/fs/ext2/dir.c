@@ -27,7 +27,7 @@
 #include <ext2/ext2.h>
 #include <lib/string.h>
 
-static uint8_t ext2_dt_from_mode(mode_t mode) {
+uint8_t ext2_dt_from_mode(mode_t mode) {
 	assert((mode & ~S_IFMT) == 0);
 	switch(mode) {
 	case S_IFDIR:
@@ -178,6 +178,38 @@ int ext2_add_dent(ext2_fs_t *fs, vnode_t *dir, const char *name, size_t namelen,
 	int err;
 
 	VN_ASSERT_LOCK_WR(dir);
+	if(namei->hole_blk == 0) {
+		/*
+		 * Index a directory as soon as it needs a second block.
+		 */
+		if(!ext2_dx_indexed(fs, dir) && dir->size == fs->blksz &&
+			(fs->super.s_feature_compat &
+			EXT2_FEATURE_COMPAT_DIR_INDEX))
+		{
+			err = ext2_dx_create(fs, dir);
+			if(err && err != -EAGAIN) {
+				return err;
+			}
+		}
+
+		if(ext2_dx_indexed(fs, dir)) {
+			err = ext2_dx_add_dent(fs, dir, name, namelen, node);
+			if(err != -EAGAIN) {
+				return err;
+			}
+		}
+	}
+
+	/*
+	 * The index is not maintained if the filesystem does not support
+	 * it.
+	 */
+	if(!ext2_dx_indexed(fs, dir) &&
+		(EXT2_VTOI(dir)->i_flags & EXT2_INDEX_FL))
+	{
+		ext2_dx_clear(dir);
+	}
+
 	rec_len = EXT2_RECLEN(namelen);
 
 	/*
@@ -244,7 +276,7 @@ int ext2_add_dent(ext2_fs_t *fs, vnode_t *dir, const char *name, size_t namelen,
 			dent = buf + dent->rec_len;
 		}
 	} else {
-		vnode_size_t length = ALIGN(node->size, fs->blksz);
+		vnode_size_t length = ALIGN(dir->size, fs->blksz);
 
 		/*
 		 * Allocate a new block at the end of the node.
@@ -258,7 +290,7 @@ int ext2_add_dent(ext2_fs_t *fs, vnode_t *dir, const char *name, size_t namelen,
 		vnode_set_size(dir, length + fs->blksz);
 		err = vnode_sync(dir);
 		if(err) {
-			return err;
+			goto out;
 		}
 
 		/*
@@ -299,7 +331,13 @@ int ext2_rmdent(ext2_fs_t *fs, vnode_t *node) {
 	 * function is pretty straightforward.
 	 */
 	if(ALIGNED(namei->off, fs->blksz)) {
-		if(namei->off + namei->size == node->size) {
+		/*
+		 * The last block of an indexed directory is still referenced
+		 * by the index.
+		 */
+		if(namei->off + namei->size == node->size &&
+			!(EXT2_VTOI(node)->i_flags & EXT2_INDEX_FL))
+		{
 			return ext2_inode_truncate(fs, node, node->size -
 				fs->blksz);
 		} else {
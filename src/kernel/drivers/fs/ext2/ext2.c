@@ -41,6 +41,9 @@ vnode_t *ext2_valloc(filesys_t *fs) {
 	vnode_init(node, fs, &ext2_vnops);
 	node->priv = (void *)node + sizeof(*node);
 	node->blksz_shift = ext2->blkshift;
+	EXT2_VTOPRIV(node)->alloc_lbn = 0;
+	EXT2_VTOPRIV(node)->alloc_pbn = 0;
+	ext2_rsv_init(&EXT2_VTOPRIV(node)->rsv);
 
 	return node;
 }
@@ -151,13 +154,14 @@ static void ext2_vput(filesys_t *fs, vnode_t *node) {
 			ext2_inode_truncate(ext2, node, 0);
 		}
 
-		ext2_ifree(ext2, node->ino);
-
+		ext2_ifree(ext2, node->ino, VN_ISDIR(node));
+	} else {
 		/*
-		 * Directories have been truncated to zero in unlink.
+		 * A file written using a shared mapping may still have a
+		 * reservation window.
 		 */
-		if(VN_ISDIR(node)) {
-			ext2_ino_bgd(ext2, node->ino)->bg_used_dirs_count--;
+		synchronized(&VNTOVM(node)->lock) {
+			ext2_rsv_discard(ext2, node);
 		}
 	}
 
@@ -236,6 +240,16 @@ static bool ext2_parse_super(ext2_fs_t *ext2, ext2_sblock_t *sblock) {
 
 	ext2->ino_per_blk = ext2->blksz / ext2->ino_sz;
 
+	/*
+	 * Names in HTree directories are hashed as signed chars unless the
+	 * filesystem says otherwise.
+	 */
+	if(sblock->s_flags & EXT2_FLAGS_UNSIGNED_HASH) {
+		ext2->dx_unsigned = EXT2_DX_UNSIGNED;
+	} else {
+		ext2->dx_unsigned = 0;
+	}
+
 	/*
 	 * TODO That's taken from FreeBSD, but doesn't that value depend on
 	 * block size?
@@ -299,6 +313,8 @@ static int ext2_mount(filesys_t *fs, ino_t *root) {
 		}
 	}
 
+	ext2_alloc_init(ext2);
+
 	/*
 	 * Mark ext2 dirty TODO NOT IF READ ONLY.
 	 */
@@ -321,6 +337,7 @@ err_sb:
 
 static void ext2_unmount(filesys_t *fs) {
 	ext2_fs_t *ext2 = filesys_get_priv(fs);
+	ext2_alloc_destroy(ext2);
 	sync_destroy(&ext2->alloc_lock);
 	kpanic("unmount");
 }
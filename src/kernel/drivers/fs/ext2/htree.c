@@ -0,0 +1,1119 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ *
+ * Copyright (c) 2017, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <kern/system.h>
+#include <vfs/lookup.h>
+#include <vm/malloc.h>
+#include <ext2/ext2.h>
+#include <lib/string.h>
+
+/*
+ * A lookup hashes the name and does a binary search on the index nodes
+ * from the root down to the leaf, which has to contain the name if it
+ * is present. The lower bit of the hash in an index entry is set if the
+ * entries in the leaf with the lowest hash continue the previous leaf
+ * (i.e. two leaves contain names with the same hash), in which case the
+ * next leaf has to be searched as well. A new entry is added to the leaf
+ * the name hashes to, which is split in half if it is full.
+ */
+
+#define EXT2_DX_ROOT_LIMIT(fs, root) (((fs)->blksz - sizeof(ext2_dx_root_t) + \
+	sizeof((root)->info) - (root)->info.info_length) /		\
+	sizeof(ext2_dx_entry_t))
+#define EXT2_DX_NODE_LIMIT(fs) (((fs)->blksz - sizeof(ext2_dx_node_t)) / \
+	sizeof(ext2_dx_entry_t))
+#define EXT2_DX_CL(entries)	((ext2_dx_countlimit_t *)(entries))
+#define EXT2_DX_HASH_EOF	0x7fffffffU
+#define EXT2_DX_OFF(fs, lbn, off) (((vnode_size_t)(lbn) << (fs)->blkshift) + \
+	(off))
+
+typedef struct ext2_dx_frame {
+	void *buf; /* the index block */
+	blkno_t pbn;
+	ext2_dx_entry_t *entries;
+	ext2_dx_entry_t *at; /* the entry followed */
+} ext2_dx_frame_t;
+
+typedef struct ext2_dx_path {
+	ext2_dx_frame_t frame[EXT2_DX_MAXLEVELS];
+	size_t levels; /* number of frames in use */
+	uint8_t version;
+	uint32_t hash;
+} ext2_dx_path_t;
+
+/*
+ * A directory entry of a leaf, used for splitting leaves.
+ */
+typedef struct ext2_dx_map {
+	uint32_t hash;
+	uint16_t off;
+	uint16_t size;
+} ext2_dx_map_t;
+
+/*
+ * The hash functions have to produce exactly the same values as the ones
+ * used by Linux and e2fsprogs.
+ */
+#define EXT2_DX_ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define EXT2_DX_F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define EXT2_DX_G(x, y, z)	(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT2_DX_H(x, y, z)	((x) ^ (y) ^ (z))
+#define EXT2_DX_ROUND(f, a, b, c, d, x, s) \
+	((a) += f(b, c, d) + (x), (a) = EXT2_DX_ROL(a, s))
+#define EXT2_DX_K1		0
+#define EXT2_DX_K2		013240474631U
+#define EXT2_DX_K3		015666365641U
+#define EXT2_DX_TEA_DELTA	0x9e3779b9
+
+static void ext2_dx_half_md4(uint32_t buf[4], const uint32_t in[8]) {
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	EXT2_DX_ROUND(EXT2_DX_F, a, b, c, d, in[0] + EXT2_DX_K1,  3);
+	EXT2_DX_ROUND(EXT2_DX_F, d, a, b, c, in[1] + EXT2_DX_K1,  7);
+	EXT2_DX_ROUND(EXT2_DX_F, c, d, a, b, in[2] + EXT2_DX_K1, 11);
+	EXT2_DX_ROUND(EXT2_DX_F, b, c, d, a, in[3] + EXT2_DX_K1, 19);
+	EXT2_DX_ROUND(EXT2_DX_F, a, b, c, d, in[4] + EXT2_DX_K1,  3);
+	EXT2_DX_ROUND(EXT2_DX_F, d, a, b, c, in[5] + EXT2_DX_K1,  7);
+	EXT2_DX_ROUND(EXT2_DX_F, c, d, a, b, in[6] + EXT2_DX_K1, 11);
+	EXT2_DX_ROUND(EXT2_DX_F, b, c, d, a, in[7] + EXT2_DX_K1, 19);
+
+	EXT2_DX_ROUND(EXT2_DX_G, a, b, c, d, in[1] + EXT2_DX_K2,  3);
+	EXT2_DX_ROUND(EXT2_DX_G, d, a, b, c, in[3] + EXT2_DX_K2,  5);
+	EXT2_DX_ROUND(EXT2_DX_G, c, d, a, b, in[5] + EXT2_DX_K2,  9);
+	EXT2_DX_ROUND(EXT2_DX_G, b, c, d, a, in[7] + EXT2_DX_K2, 13);
+	EXT2_DX_ROUND(EXT2_DX_G, a, b, c, d, in[0] + EXT2_DX_K2,  3);
+	EXT2_DX_ROUND(EXT2_DX_G, d, a, b, c, in[2] + EXT2_DX_K2,  5);
+	EXT2_DX_ROUND(EXT2_DX_G, c, d, a, b, in[4] + EXT2_DX_K2,  9);
+	EXT2_DX_ROUND(EXT2_DX_G, b, c, d, a, in[6] + EXT2_DX_K2, 13);
+
+	EXT2_DX_ROUND(EXT2_DX_H, a, b, c, d, in[3] + EXT2_DX_K3,  3);
+	EXT2_DX_ROUND(EXT2_DX_H, d, a, b, c, in[7] + EXT2_DX_K3,  9);
+	EXT2_DX_ROUND(EXT2_DX_H, c, d, a, b, in[2] + EXT2_DX_K3, 11);
+	EXT2_DX_ROUND(EXT2_DX_H, b, c, d, a, in[6] + EXT2_DX_K3, 15);
+	EXT2_DX_ROUND(EXT2_DX_H, a, b, c, d, in[1] + EXT2_DX_K3,  3);
+	EXT2_DX_ROUND(EXT2_DX_H, d, a, b, c, in[5] + EXT2_DX_K3,  9);
+	EXT2_DX_ROUND(EXT2_DX_H, c, d, a, b, in[0] + EXT2_DX_K3, 11);
+	EXT2_DX_ROUND(EXT2_DX_H, b, c, d, a, in[4] + EXT2_DX_K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+static void ext2_dx_tea(uint32_t buf[4], const uint32_t in[4]) {
+	uint32_t sum = 0, b0 = buf[0], b1 = buf[1];
+
+	for(size_t i = 0; i < 16; i++) {
+		sum += EXT2_DX_TEA_DELTA;
+		b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+		b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+	}
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+static uint32_t ext2_dx_legacy(const char *name, size_t len, bool usign) {
+	uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	int c;
+
+	for(size_t i = 0; i < len; i++) {
+		c = usign ? (int)(unsigned char)name[i] :
+			(int)(signed char)name[i];
+		hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+		if(hash & 0x80000000) {
+			hash -= 0x7fffffff;
+		}
+
+		hash1 = hash0;
+		hash0 = hash;
+	}
+
+	return hash0 << 1;
+}
+
+/*
+ * Fill @p num words of @p buf with the next chunk of the name, padding
+ * the rest with the length of the name.
+ */
+static void ext2_dx_str2buf(const char *name, size_t len, uint32_t *buf,
+	size_t num, bool usign)
+{
+	uint32_t pad, val;
+	int c;
+
+	pad = (uint32_t)len | ((uint32_t)len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	len = min(len, num * 4);
+	for(size_t i = 0; i < len; i++) {
+		c = usign ? (int)(unsigned char)name[i] :
+			(int)(signed char)name[i];
+		val = (uint32_t)c + (val << 8);
+		if((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+
+	if(num > 0) {
+		*buf++ = val;
+		num--;
+	}
+
+	while(num-- > 0) {
+		*buf++ = pad;
+	}
+}
+
+static uint32_t ext2_dx_hash(ext2_fs_t *fs, uint8_t version, const char *name,
+	size_t len)
+{
+	bool usign = version >= EXT2_DX_UNSIGNED;
+	uint32_t buf[4], in[8], hash;
+
+	buf[0] = 0x67452301;
+	buf[1] = 0xefcdab89;
+	buf[2] = 0x98badcfe;
+	buf[3] = 0x10325476;
+
+	for(size_t i = 0; i < 4; i++) {
+		if(fs->super.s_hash_seed[i]) {
+			memcpy(buf, fs->super.s_hash_seed, sizeof(buf));
+			break;
+		}
+	}
+
+	switch(version % EXT2_DX_UNSIGNED) {
+	case EXT2_DX_LEGACY:
+		hash = ext2_dx_legacy(name, len, usign);
+		break;
+	case EXT2_DX_HALF_MD4:
+		for(size_t i = 0; i < len; i += 32) {
+			ext2_dx_str2buf(name + i, len - i, in, 8, usign);
+			ext2_dx_half_md4(buf, in);
+		}
+		hash = buf[1];
+		break;
+	case EXT2_DX_TEA:
+		for(size_t i = 0; i < len; i += 16) {
+			ext2_dx_str2buf(name + i, len - i, in, 4, usign);
+			ext2_dx_tea(buf, in);
+		}
+		hash = buf[0];
+		break;
+	default:
+		notreached();
+	}
+
+	/*
+	 * The lowest bit is the continuation flag in the index.
+	 */
+	hash &= ~1;
+	if(hash == (EXT2_DX_HASH_EOF << 1)) {
+		hash = (EXT2_DX_HASH_EOF - 1) << 1;
+	}
+
+	return hash;
+}
+
+static bool ext2_dx_dotname(const char *name, size_t namelen) {
+	return name[0] == '.' && (namelen == 1 || (namelen == 2 &&
+		name[1] == '.'));
+}
+
+static uint8_t ext2_dx_def_version(ext2_fs_t *fs) {
+	if(fs->super.s_def_hash_version > EXT2_DX_TEA) {
+		return EXT2_DX_HALF_MD4;
+	} else {
+		return fs->super.s_def_hash_version;
+	}
+}
+
+void ext2_dx_clear(vnode_t *dir) {
+	ext2_inode_t *inode = EXT2_VTOI(dir);
+
+	wrlocked(&dir->statlock) {
+		inode->i_flags &= ~EXT2_INDEX_FL;
+		vnode_dirty(dir);
+	}
+}
+
+/*
+ * Read a block of the directory referenced by the index.
+ */
+static int ext2_dx_bread(ext2_fs_t *fs, vnode_t *dir, uint32_t lbn,
+	blkno_t *pbn, void *buf)
+{
+	int err;
+
+	if(lbn >= dir->size >> fs->blkshift) {
+		kprintf("[ext2] htree: block out of bounds: ino: %lld, blk: "
+			"%d\n", dir->ino, lbn);
+		return -EAGAIN;
+	}
+
+	err = ext2_inode_bmap(fs, dir, false, lbn, pbn);
+	if(err) {
+		return err;
+	} else if(*pbn == 0) {
+		kprintf("[ext2] htree: directory has a hole: ino: %lld\n",
+			dir->ino);
+		return -EAGAIN;
+	}
+
+	return bread(fs->dev, EXT2_BOFF(fs, *pbn, 0), fs->blksz, buf);
+}
+
+static inline int ext2_dx_bwrite(ext2_fs_t *fs, blkno_t pbn, void *buf) {
+	return bwrite(fs->dev, EXT2_BOFF(fs, pbn, 0), fs->blksz, buf);
+}
+
+/*
+ * Add a new block to the end of a directory.
+ */
+static int ext2_dx_append(ext2_fs_t *fs, vnode_t *dir, uint32_t *lbn,
+	blkno_t *pbn)
+{
+	vnode_size_t size = dir->size;
+	int err;
+
+	*lbn = size >> fs->blkshift;
+	err = ext2_inode_bmap(fs, dir, true, *lbn, pbn);
+	if(err) {
+		return err;
+	}
+
+	vnode_set_size(dir, size + fs->blksz);
+	return 0;
+}
+
+static void ext2_dx_release(ext2_dx_path_t *path) {
+	for(size_t i = 0; i < path->levels; i++) {
+		kfree(path->frame[i].buf);
+	}
+}
+
+static int ext2_dx_read_frame(ext2_fs_t *fs, vnode_t *dir,
+	ext2_dx_path_t *path, uint32_t lbn)
+{
+	ext2_dx_frame_t *frame = &path->frame[path->levels++];
+
+	frame->buf = kmalloc(fs->blksz, VM_WAIT);
+	return ext2_dx_bread(fs, dir, lbn, &frame->pbn, frame->buf);
+}
+
+/*
+ * Find the last entry of an index node with a hash less than or equal
+ * to @p hash.
+ */
+static ext2_dx_entry_t *ext2_dx_search(ext2_dx_entry_t *entries,
+	uint32_t hash)
+{
+	ext2_dx_entry_t *p, *q, *m;
+
+	p = entries + 1;
+	q = entries + EXT2_DX_CL(entries)->count - 1;
+	while(p <= q) {
+		m = p + (q - p) / 2;
+		if(m->hash > hash) {
+			q = m - 1;
+		} else {
+			p = m + 1;
+		}
+	}
+
+	return p - 1;
+}
+
+static bool ext2_dx_bad_node(ext2_dx_entry_t *entries, size_t limit) {
+	ext2_dx_countlimit_t *cl = EXT2_DX_CL(entries);
+	return cl->limit != limit || cl->count == 0 || cl->count > limit;
+}
+
+/*
+ * Walk the index from the root down to the leaf @p name hashes to.
+ */
+static int ext2_dx_probe(ext2_fs_t *fs, vnode_t *dir, const char *name,
+	size_t namelen, ext2_dx_path_t *path)
+{
+	ext2_dx_frame_t *frame = path->frame;
+	ext2_dx_root_t *root;
+	ext2_dx_node_t *node;
+	uint8_t levels;
+	int err;
+
+	path->levels = 0;
+	err = ext2_dx_read_frame(fs, dir, path, 0);
+	if(err) {
+		return err;
+	}
+
+	root = frame->buf;
+	path->version = root->info.hash_version;
+	if(path->version <= EXT2_DX_TEA) {
+		path->version += fs->dx_unsigned;
+	}
+
+	levels = root->info.indirect_levels;
+	frame->entries = (void *)&root->info + root->info.info_length;
+	if(root->info.reserved_zero != 0 ||
+		path->version > EXT2_DX_TEA_UNSIGNED ||
+		(root->info.unused_flags & 1) ||
+		levels >= EXT2_DX_MAXLEVELS ||
+		root->info.info_length < sizeof(root->info) ||
+		(void *)frame->entries + sizeof(ext2_dx_entry_t) >
+			frame->buf + fs->blksz ||
+		ext2_dx_bad_node(frame->entries, EXT2_DX_ROOT_LIMIT(fs, root)))
+	{
+		goto bad;
+	}
+
+	path->hash = ext2_dx_hash(fs, path->version, name, namelen);
+	frame->at = ext2_dx_search(frame->entries, path->hash);
+
+	while(levels--) {
+		err = ext2_dx_read_frame(fs, dir, path, frame->at->block);
+		if(err) {
+			return err;
+		}
+
+		frame++;
+		node = frame->buf;
+		frame->entries = node->entries;
+		if(ext2_dx_bad_node(frame->entries, EXT2_DX_NODE_LIMIT(fs))) {
+			goto bad;
+		}
+
+		frame->at = ext2_dx_search(frame->entries, path->hash);
+	}
+
+	return 0;
+
+bad:
+	kprintf("[ext2] htree: bad index: ino: %lld\n", dir->ino);
+	return -EAGAIN;
+}
+
+/*
+ * Advance the path to the next leaf, if that leaf may contain entries
+ * with the hash @p hash.
+ *
+ * @return	< 0	error
+ *		0	the next leaf cannot contain @p hash
+ *		1	the path points to the next leaf
+ */
+static int ext2_dx_next(ext2_fs_t *fs, vnode_t *dir, ext2_dx_path_t *path,
+	uint32_t hash)
+{
+	ext2_dx_frame_t *frame = &path->frame[path->levels - 1];
+	ext2_dx_node_t *node;
+	size_t num = 0;
+	int err;
+
+	while(++frame->at == frame->entries +
+		EXT2_DX_CL(frame->entries)->count)
+	{
+		if(frame == path->frame) {
+			return 0;
+		}
+
+		frame--;
+		num++;
+	}
+
+	if((frame->at->hash & ~1) != hash) {
+		return 0;
+	}
+
+	/*
+	 * Read the index nodes below the entry advanced.
+	 */
+	while(num--) {
+		blkno_t lbn = frame->at->block;
+
+		frame++;
+		err = ext2_dx_bread(fs, dir, lbn, &frame->pbn, frame->buf);
+		if(err) {
+			return err;
+		}
+
+		node = frame->buf;
+		frame->at = frame->entries = node->entries;
+		if(ext2_dx_bad_node(frame->entries, EXT2_DX_NODE_LIMIT(fs))) {
+			kprintf("[ext2] htree: bad index: ino: %lld\n",
+				dir->ino);
+			return -EAGAIN;
+		}
+	}
+
+	return 1;
+}
+
+static int ext2_dx_check_leaf(ext2_fs_t *fs, vnode_t *dir, void *leaf) {
+	ext2_dent_t *dent;
+	size_t off;
+
+	for(off = 0; off < fs->blksz; off += dent->rec_len) {
+		dent = leaf + off;
+		if(dent->rec_len < EXT2_DENT_SZ ||
+			dent->rec_len > fs->blksz - off ||
+			!ALIGNED(dent->rec_len, 4) ||
+			dent->name_len > dent->rec_len - EXT2_DENT_SZ ||
+			dent->inode > fs->super.s_inodes_count)
+		{
+			kprintf("[ext2] broken directory entry: ino: %lld, "
+				"off: %d\n", dir->ino, off);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Search a leaf for a name, see ext2_namei.
+ */
+static int ext2_dx_leaf_namei(ext2_fs_t *fs, vnode_t *dir, void *leaf,
+	uint32_t lbn, blkno_t pbn, const char *name, size_t namelen,
+	vnamei_op_t op, bool first, ino_t *ino)
+{
+	vnamei_aux_t *aux = EXT2_VTONAMEI(dir);
+	ext2_dent_t *dent;
+	size_t off, hole;
+
+	for(off = 0; off < fs->blksz; off += dent->rec_len) {
+		dent = leaf + off;
+		if(dent->inode != 0 && dent->name_len == namelen &&
+			!memcmp(dent->name, name, namelen))
+		{
+			*ino = dent->inode;
+			if(op == VNAMEI_RENAME) {
+				aux->hole_off = EXT2_DX_OFF(fs, lbn, off);
+				aux->hole_blk = pbn;
+			} else if(op != VNAMEI_LOOKUP) {
+				aux->off = EXT2_DX_OFF(fs, lbn, off);
+				aux->size = dent->rec_len;
+				aux->blkno = pbn;
+			}
+
+			return 0;
+		}
+
+		/*
+		 * A new entry has to be added to the first leaf the name
+		 * hashes to.
+		 */
+		if(first && aux->hole_blk == 0 && (op == VNAMEI_CREATE ||
+			op == VNAMEI_RENAME))
+		{
+			if(dent->inode == 0) {
+				hole = dent->rec_len;
+			} else {
+				hole = EXT2_DENT_HOLE(dent);
+			}
+
+			if(hole >= EXT2_RECLEN(namelen)) {
+				aux->hole_off = EXT2_DX_OFF(fs, lbn, off);
+				aux->hole_blk = pbn;
+			}
+		}
+
+		if(op != VNAMEI_LOOKUP && op != VNAMEI_RENAME) {
+			aux->prev_off = EXT2_DX_OFF(fs, lbn, off);
+			aux->prev_size = dent->rec_len;
+		}
+	}
+
+	return -ENOENT;
+}
+
+int ext2_dx_namei(ext2_fs_t *fs, vnode_t *dir, const char *name,
+	size_t namelen, vnamei_op_t op, ino_t *ino)
+{
+	vnamei_aux_t *aux = EXT2_VTONAMEI(dir);
+	ext2_dx_path_t path;
+	bool first = true;
+	uint32_t lbn;
+	blkno_t pbn;
+	void *leaf;
+	int err;
+
+	/*
+	 * "." and ".." are part of the root block.
+	 */
+	if(ext2_dx_dotname(name, namelen)) {
+		return -EAGAIN;
+	}
+
+	err = ext2_dx_probe(fs, dir, name, namelen, &path);
+	if(err) {
+		goto out;
+	}
+
+	if(op != VNAMEI_RENAME) {
+		aux->prev_off = 0;
+		aux->prev_size = 0;
+	}
+
+	aux->hole_blk = 0;
+	leaf = kmalloc(fs->blksz, VM_WAIT);
+	do {
+		lbn = path.frame[path.levels - 1].at->block;
+		err = ext2_dx_bread(fs, dir, lbn, &pbn, leaf);
+		if(err == 0) {
+			err = ext2_dx_check_leaf(fs, dir, leaf);
+		}
+		if(err) {
+			break;
+		}
+
+		err = ext2_dx_leaf_namei(fs, dir, leaf, lbn, pbn, name,
+			namelen, op, first, ino);
+		if(err != -ENOENT) {
+			break;
+		}
+
+		first = false;
+		err = ext2_dx_next(fs, dir, &path, path.hash);
+		if(err == 0) {
+			err = -ENOENT;
+		}
+	} while(err > 0);
+
+	kfree(leaf);
+out:
+	ext2_dx_release(&path);
+	if(err == -EAGAIN && op != VNAMEI_LOOKUP) {
+		/*
+		 * The linear search used instead may find a hole for a new
+		 * entry anywhere in the directory.
+		 */
+		ext2_dx_clear(dir);
+	}
+
+	return err;
+}
+
+/*
+ * Add an entry to a leaf, if there is enough space, see ext2_add_dent.
+ */
+static bool ext2_dx_leaf_add(ext2_fs_t *fs, vnode_t *dir, void *leaf,
+	uint32_t lbn, blkno_t pbn, const char *name, size_t namelen,
+	vnode_t *node)
+{
+	vnamei_aux_t *aux = EXT2_VTONAMEI(dir);
+	size_t rec_len = EXT2_RECLEN(namelen), off, len;
+	ext2_dent_t *dent = NULL, *next;
+
+	for(off = 0; off < fs->blksz; off += dent->rec_len) {
+		dent = leaf + off;
+		if(dent->inode == 0 && dent->rec_len >= rec_len) {
+			break;
+		} else if(dent->inode != 0 && EXT2_DENT_HOLE(dent) >= rec_len) {
+			len = EXT2_RECLEN(dent->name_len);
+
+			/*
+			 * Keep the information about the entry looked up
+			 * for removal up to date (see ext2_add_dent).
+			 */
+			if(aux->blkno == pbn) {
+				size_t cur = aux->off & (fs->blksz - 1);
+
+				if(cur == off) {
+					aux->size = len;
+				} else if(cur == off + dent->rec_len) {
+					aux->prev_off = EXT2_DX_OFF(fs, lbn,
+						off + len);
+					aux->prev_size = dent->rec_len - len;
+				}
+			}
+
+			next = leaf + off + len;
+			next->rec_len = dent->rec_len - len;
+			dent->rec_len = len;
+			dent = next;
+			break;
+		}
+	}
+
+	if(off >= fs->blksz || dent == NULL) {
+		return false;
+	}
+
+	dent->inode = node->ino;
+	dent->name_len = namelen;
+	dent->file_type = ext2_dt_from_mode(VN_TYPE(node));
+	memcpy(dent->name, name, namelen);
+
+	return true;
+}
+
+static size_t ext2_dx_map_leaf(ext2_fs_t *fs, uint8_t version, void *leaf,
+	size_t off, ext2_dx_map_t *map)
+{
+	ext2_dent_t *dent;
+	size_t num = 0;
+
+	for(; off < fs->blksz; off += dent->rec_len) {
+		dent = leaf + off;
+		if(dent->inode == 0) {
+			continue;
+		}
+
+		map[num].hash = ext2_dx_hash(fs, version, dent->name,
+			dent->name_len);
+		map[num].off = off;
+		map[num].size = EXT2_RECLEN(dent->name_len);
+		num++;
+	}
+
+	return num;
+}
+
+static void ext2_dx_sort(ext2_dx_map_t *map, size_t num) {
+	ext2_dx_map_t tmp;
+	size_t j;
+
+	for(size_t i = 1; i < num; i++) {
+		tmp = map[i];
+		for(j = i; j > 0 && map[j - 1].hash > tmp.hash; j--) {
+			map[j] = map[j - 1];
+		}
+
+		map[j] = tmp;
+	}
+}
+
+/*
+ * Find the entry looked up for removal in a map of block @p pbn.
+ */
+static ssize_t ext2_dx_track(ext2_fs_t *fs, vnode_t *dir, blkno_t pbn,
+	ext2_dx_map_t *map, size_t num)
+{
+	vnamei_aux_t *aux = EXT2_VTONAMEI(dir);
+
+	if(aux->blkno == pbn) {
+		for(size_t i = 0; i < num; i++) {
+			if(map[i].off == (aux->off & (fs->blksz - 1))) {
+				return i;
+			}
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Copy the entries of @p map from @p src to the start of the leaf @p dst,
+ * the last entry covering the rest of the block. The entry @p track is
+ * the one looked up for removal, which may be the old entry of a rename
+ * in the same directory.
+ */
+static void ext2_dx_pack(ext2_fs_t *fs, vnode_t *dir, void *dst, uint32_t lbn,
+	blkno_t pbn, const void *src, ext2_dx_map_t *map, size_t num,
+	ssize_t track)
+{
+	vnamei_aux_t *aux = EXT2_VTONAMEI(dir);
+	ext2_dent_t *dent = dst, *tracked = NULL;
+	size_t off = 0, prev = 0;
+
+	for(size_t i = 0; i < num; i++) {
+		dent = dst + off;
+		memcpy(dent, src + map[i].off, map[i].size);
+		dent->rec_len = map[i].size;
+
+		if((ssize_t)i == track) {
+			aux->off = EXT2_DX_OFF(fs, lbn, off);
+			aux->blkno = pbn;
+			aux->prev_off = EXT2_DX_OFF(fs, lbn, prev);
+			aux->prev_size = off - prev;
+			tracked = dent;
+		}
+
+		prev = off;
+		off += map[i].size;
+	}
+
+	if(num == 0) {
+		dent->inode = 0;
+		dent->name_len = 0;
+		dent->file_type = EXT2_FT_UNKNOWN;
+		dent->rec_len = fs->blksz;
+	} else {
+		dent->rec_len += fs->blksz - off;
+	}
+
+	if(tracked) {
+		aux->size = tracked->rec_len;
+	}
+}
+
+/*
+ * Add an entry to an index node after the entry followed.
+ */
+static void ext2_dx_insert(ext2_dx_frame_t *frame, uint32_t hash,
+	uint32_t block)
+{
+	ext2_dx_countlimit_t *cl = EXT2_DX_CL(frame->entries);
+	ext2_dx_entry_t *new = frame->at + 1;
+
+	assert(cl->count < cl->limit);
+	memmove(new + 1, new, (frame->entries + cl->count - new) *
+		sizeof(*new));
+	new->hash = hash;
+	new->block = block;
+	cl->count++;
+}
+
+/*
+ * Make sure that the index node the path ends in can hold another entry.
+ */
+static int ext2_dx_grow(ext2_fs_t *fs, vnode_t *dir, ext2_dx_path_t *path) {
+	ext2_dx_frame_t *root = &path->frame[0];
+	ext2_dx_frame_t *frame = &path->frame[path->levels - 1];
+	ext2_dx_countlimit_t *cl = EXT2_DX_CL(frame->entries);
+	ext2_dx_countlimit_t *rootcl = EXT2_DX_CL(root->entries);
+	size_t count = cl->count, split;
+	ext2_dx_node_t *node;
+	uint32_t lbn, hash;
+	blkno_t pbn;
+	int err;
+
+	if(cl->count < cl->limit) {
+		return 0;
+	} else if(path->levels == EXT2_DX_MAXLEVELS &&
+		rootcl->count == rootcl->limit)
+	{
+		kprintf("[ext2] htree: directory index full: ino: %lld\n",
+			dir->ino);
+		return -ENOSPC;
+	}
+
+	err = ext2_dx_append(fs, dir, &lbn, &pbn);
+	if(err) {
+		return err;
+	}
+
+	node = kmalloc(fs->blksz, VM_WAIT);
+	memset(node, 0x00, fs->blksz);
+	node->fake.rec_len = fs->blksz;
+
+	if(path->levels == 1) {
+		/*
+		 * The root is full, move its entries to a new index node
+		 * and add a level to the tree.
+		 */
+		memcpy(node->entries, root->entries, count *
+			sizeof(ext2_dx_entry_t));
+		EXT2_DX_CL(node->entries)->limit = EXT2_DX_NODE_LIMIT(fs);
+
+		frame = &path->frame[path->levels++];
+		frame->buf = node;
+		frame->pbn = pbn;
+		frame->entries = node->entries;
+		frame->at = node->entries + (root->at - root->entries);
+
+		rootcl->count = 1;
+		root->entries[0].block = lbn;
+		root->at = root->entries;
+		((ext2_dx_root_t *)root->buf)->info.indirect_levels = 1;
+
+		err = ext2_dx_bwrite(fs, pbn, node);
+	} else {
+		/*
+		 * Split the index node and add the new half to the root.
+		 */
+		split = count / 2;
+		hash = frame->entries[split].hash;
+		memcpy(node->entries, frame->entries + split, (count - split) *
+			sizeof(ext2_dx_entry_t));
+		EXT2_DX_CL(node->entries)->limit = EXT2_DX_NODE_LIMIT(fs);
+		EXT2_DX_CL(node->entries)->count = count - split;
+		cl->count = split;
+		ext2_dx_insert(root, hash, lbn);
+
+		err = ext2_dx_bwrite(fs, pbn, node);
+		if(!err) {
+			err = ext2_dx_bwrite(fs, frame->pbn, frame->buf);
+		}
+
+		if(frame->at >= frame->entries + split) {
+			frame->at = node->entries + (frame->at -
+				frame->entries - split);
+			kfree(frame->buf);
+			frame->buf = node;
+			frame->pbn = pbn;
+			frame->entries = node->entries;
+			root->at++;
+		} else {
+			kfree(node);
+		}
+	}
+
+	if(!err) {
+		err = ext2_dx_bwrite(fs, root->pbn, root->buf);
+	}
+
+	return err;
+}
+
+int ext2_dx_add_dent(ext2_fs_t *fs, vnode_t *dir, const char *name,
+	size_t namelen, vnode_t *node)
+{
+	size_t rec_len = EXT2_RECLEN(namelen), size, num, split;
+	void *leaf = NULL, *tmp = NULL, *new = NULL;
+	ext2_dx_map_t *map = NULL;
+	ext2_dx_frame_t *frame;
+	ext2_dx_path_t path;
+	uint32_t lbn, nlbn, hash;
+	blkno_t pbn, npbn;
+	ssize_t track;
+	bool added;
+	int err;
+
+	VN_ASSERT_LOCK_WR(dir);
+
+	err = ext2_dx_probe(fs, dir, name, namelen, &path);
+	if(err) {
+		goto out;
+	}
+
+	frame = &path.frame[path.levels - 1];
+	lbn = frame->at->block;
+	leaf = kmalloc(fs->blksz, VM_WAIT);
+	err = ext2_dx_bread(fs, dir, lbn, &pbn, leaf);
+	if(err == 0) {
+		err = ext2_dx_check_leaf(fs, dir, leaf);
+	}
+	if(err) {
+		goto out;
+	}
+
+	if(ext2_dx_leaf_add(fs, dir, leaf, lbn, pbn, name, namelen, node)) {
+		err = ext2_dx_bwrite(fs, pbn, leaf);
+		goto out;
+	}
+
+	tmp = kmalloc(fs->blksz, VM_WAIT);
+	memcpy(tmp, leaf, fs->blksz);
+	map = kmalloc(sizeof(*map) * (fs->blksz / EXT2_RECLEN(1)), VM_WAIT);
+	num = ext2_dx_map_leaf(fs, path.version, tmp, 0, map);
+	ext2_dx_sort(map, num);
+	track = ext2_dx_track(fs, dir, pbn, map, num);
+
+	size = 0;
+	for(size_t i = 0; i < num; i++) {
+		size += map[i].size;
+	}
+
+	/*
+	 * The free space of the leaf is scattered across deleted entries,
+	 * compacting the leaf is enough.
+	 */
+	if(size + rec_len <= fs->blksz) {
+		ext2_dx_pack(fs, dir, leaf, lbn, pbn, tmp, map, num, track);
+		added = ext2_dx_leaf_add(fs, dir, leaf, lbn, pbn, name,
+			namelen, node);
+		assert(added);
+		err = ext2_dx_bwrite(fs, pbn, leaf);
+		goto out;
+	}
+
+	/*
+	 * The leaf has to be split, make room for the new leaf in the
+	 * index first.
+	 */
+	err = ext2_dx_grow(fs, dir, &path);
+	if(err) {
+		goto out;
+	}
+
+	frame = &path.frame[path.levels - 1];
+	err = ext2_dx_append(fs, dir, &nlbn, &npbn);
+	if(err) {
+		goto out;
+	}
+
+	/*
+	 * Move the upper half of the entries (by size) to the new leaf.
+	 */
+	size = 0;
+	for(split = num; split > 0; split--) {
+		if(size + map[split - 1].size / 2 > fs->blksz / 2) {
+			break;
+		}
+
+		size += map[split - 1].size;
+	}
+
+	assert(split > 0 && split < num);
+	hash = map[split].hash;
+
+	new = kmalloc(fs->blksz, VM_WAIT);
+	ext2_dx_pack(fs, dir, leaf, lbn, pbn, tmp, map, split,
+		track < (ssize_t)split ? track : -1);
+	ext2_dx_pack(fs, dir, new, nlbn, npbn, tmp, map + split, num - split,
+		track >= (ssize_t)split ? track - (ssize_t)split : -1);
+
+	if(path.hash >= hash) {
+		added = ext2_dx_leaf_add(fs, dir, new, nlbn, npbn, name,
+			namelen, node);
+	} else {
+		added = ext2_dx_leaf_add(fs, dir, leaf, lbn, pbn, name,
+			namelen, node);
+	}
+	assert(added);
+
+	/*
+	 * Set the continuation bit if entries with the same hash ended up
+	 * in both leaves.
+	 */
+	if(hash == map[split - 1].hash) {
+		hash |= 1;
+	}
+
+	ext2_dx_insert(frame, hash, nlbn);
+	err = ext2_dx_bwrite(fs, npbn, new);
+	if(!err) {
+		err = ext2_dx_bwrite(fs, pbn, leaf);
+	}
+	if(!err) {
+		err = ext2_dx_bwrite(fs, frame->pbn, frame->buf);
+	}
+
+out:
+	if(new) {
+		kfree(new);
+	}
+	if(map) {
+		kfree(map);
+		kfree(tmp);
+	}
+	if(leaf) {
+		kfree(leaf);
+	}
+
+	ext2_dx_release(&path);
+	if(err == -EAGAIN) {
+		ext2_dx_clear(dir);
+	} else if(!err) {
+		err = vnode_sync(dir);
+	}
+
+	return err;
+}
+
+int ext2_dx_create(ext2_fs_t *fs, vnode_t *dir) {
+	ext2_dx_entry_t *entries;
+	ext2_dx_root_t *root;
+	ext2_dx_map_t *map;
+	size_t num, off;
+	uint8_t version;
+	blkno_t pbn, lpbn;
+	uint32_t llbn;
+	ssize_t track;
+	void *leaf;
+	int err;
+
+	VN_ASSERT_LOCK_WR(dir);
+	assert(dir->size == fs->blksz);
+
+	root = kmalloc(fs->blksz, VM_WAIT);
+	err = ext2_dx_bread(fs, dir, 0, &pbn, root);
+	if(err == 0) {
+		err = ext2_dx_check_leaf(fs, dir, root);
+	}
+	if(err) {
+		goto out;
+	}
+
+	off = sizeof(root->dot) + sizeof(root->dot_name);
+	if(root->dot.rec_len != off || root->dot.name_len != 1 ||
+		root->dot_name[0] != '.' || root->dotdot.name_len != 2 ||
+		root->dotdot_name[0] != '.' || root->dotdot_name[1] != '.')
+	{
+		err = -EAGAIN;
+		goto out;
+	}
+
+	/*
+	 * Move the entries following ".." into a new leaf.
+	 */
+	version = ext2_dx_def_version(fs);
+	map = kmalloc(sizeof(*map) * (fs->blksz / EXT2_RECLEN(1)), VM_WAIT);
+	num = ext2_dx_map_leaf(fs, version + fs->dx_unsigned, root,
+		off + root->dotdot.rec_len, map);
+	track = ext2_dx_track(fs, dir, pbn, map, num);
+
+	err = ext2_dx_append(fs, dir, &llbn, &lpbn);
+	if(err) {
+		goto out_map;
+	}
+
+	leaf = kmalloc(fs->blksz, VM_WAIT);
+	ext2_dx_pack(fs, dir, leaf, llbn, lpbn, root, map, num, track);
+	err = ext2_dx_bwrite(fs, lpbn, leaf);
+	kfree(leaf);
+	if(err) {
+		goto out_trunc;
+	}
+
+	/*
+	 * Turn the first block into the root of the index.
+	 */
+	root->dotdot.rec_len = fs->blksz - off;
+	memset(&root->info, 0x00, fs->blksz - offsetof(ext2_dx_root_t, info));
+	root->info.hash_version = version;
+	root->info.info_length = sizeof(root->info);
+
+	entries = (void *)root + sizeof(*root);
+	EXT2_DX_CL(entries)->limit = EXT2_DX_ROOT_LIMIT(fs, root);
+	EXT2_DX_CL(entries)->count = 1;
+	entries[0].block = llbn;
+
+	err = ext2_dx_bwrite(fs, pbn, root);
+	if(err) {
+		goto out_trunc;
+	}
+
+	wrlocked(&dir->statlock) {
+		EXT2_VTOI(dir)->i_flags |= EXT2_INDEX_FL;
+		vnode_dirty(dir);
+	}
+
+	goto out_map;
+
+out_trunc:
+	ext2_inode_truncate(fs, dir, fs->blksz);
+out_map:
+	kfree(map);
+out:
+	kfree(root);
+	return err;
+}
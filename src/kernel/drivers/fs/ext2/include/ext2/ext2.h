@@ -147,6 +147,17 @@ typedef struct ext2_sblock {
 	 */
 	uint32_t s_default_mount_options;
 	uint32_t s_first_meta_bg;
+	uint32_t s_mkfs_time;
+	uint32_t s_jnl_blocks[17];
+	uint32_t s_blocks_count_hi;
+	uint32_t s_r_blocks_count_hi;
+	uint32_t s_free_blocks_hi;
+	uint16_t s_min_extra_isize;
+	uint16_t s_want_extra_isize;
+
+#define EXT2_FLAGS_SIGNED_HASH		0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+	uint32_t s_flags;
 } __packed ext2_sblock_t;
 
 typedef struct ext2_bgd {
@@ -185,9 +196,9 @@ typedef struct ext2_inode {
 #define EXT2_NOCOMPR_FL		0x00000400
 #define EXT2_ECOMPR_FL		0x00000800
 #define EXT2_BTREE_FL		0x00001000
-#define EXT2_INDEX_FL		0x00002000
-#define EXT2_IMAGIC_FL		0x00004000
-#define EXT3_JOURNAL_DATA_FL	0x00008000
+#define EXT2_INDEX_FL		0x00001000 /* HTree directory (same as BTREE) */
+#define EXT2_IMAGIC_FL		0x00002000
+#define EXT3_JOURNAL_DATA_FL	0x00004000
 	uint32_t i_flags;
 	uint32_t i_osd1;
 	uint32_t i_block[EXT2_N_BLOCKS];
@@ -226,21 +237,112 @@ typedef struct ext2_dent {
 	char name[EXT2_NAMELEN + 1];
 } __packed ext2_dent_t;
 
+/*
+ * HTree (dir_index) directories. The first block of an indexed directory
+ * contains the "." and ".." entries followed by the root of the index,
+ * which is hidden from ext2 implementations without HTree support by
+ * making ".." cover the rest of the block. The blocks of the interior
+ * index nodes start with an empty directory entry covering the whole
+ * block. Every other block of the directory is a leaf containing regular
+ * directory entries.
+ */
+#define EXT2_DX_LEGACY		0
+#define EXT2_DX_HALF_MD4	1
+#define EXT2_DX_TEA		2
+#define EXT2_DX_UNSIGNED	3 /* add to get the unsigned char variant */
+#define EXT2_DX_TEA_UNSIGNED	(EXT2_DX_TEA + EXT2_DX_UNSIGNED)
+#define EXT2_DX_MAXLEVELS	2 /* root + one level of interior nodes */
+
+typedef struct ext2_dx_entry {
+	uint32_t hash;
+	uint32_t block; /* logical block number */
+} __packed ext2_dx_entry_t;
+
+/*
+ * The count and limit of an index node are stored in place of the
+ * hash of the first entry.
+ */
+typedef struct ext2_dx_countlimit {
+	uint16_t limit;
+	uint16_t count;
+} __packed ext2_dx_countlimit_t;
+
+typedef struct ext2_dx_dent {
+	uint32_t inode;
+	uint16_t rec_len;
+	uint8_t  name_len;
+	uint8_t  file_type;
+} __packed ext2_dx_dent_t;
+
+typedef struct ext2_dx_root {
+	ext2_dx_dent_t dot;
+	char dot_name[4];
+	ext2_dx_dent_t dotdot;
+	char dotdot_name[4];
+
+	struct {
+		uint32_t reserved_zero;
+		uint8_t  hash_version;
+		uint8_t  info_length; /* 8 */
+		uint8_t  indirect_levels;
+		uint8_t  unused_flags;
+	} __packed info;
+} __packed ext2_dx_root_t;
+
+typedef struct ext2_dx_node {
+	ext2_dx_dent_t fake;
+	ext2_dx_entry_t entries[];
+} __packed ext2_dx_node_t;
+
+/**
+ * A window of blocks reserved for the next allocations of a file, so
+ * that files written concurrently do not interleave their blocks. The
+ * blocks are only reserved in memory. Protected by the lock of the vm
+ * object of the vnode and the lock of the block group.
+ */
+typedef struct ext2_rsv {
+	uint32_t group;
+	uint32_t start; /* the window is [start, end), empty if start == end */
+	uint32_t end;
+	uint32_t size; /* the size of the next window */
+} ext2_rsv_t;
+
 #define EXT2_VTOPRIV(vn)	((ext2_priv_t *)vnode_priv(vn))
 #define EXT2_VTOI(vn) 		(&EXT2_VTOPRIV(vn)->inode)
 #define EXT2_VTONAMEI(vn)	(&EXT2_VTOPRIV(vn)->namei)
 typedef struct ext2_priv {
 	ext2_inode_t inode;
 	vnamei_aux_t namei;
+
+	/*
+	 * The last block allocated, the goal for the next allocation
+	 * if the file is written sequentially.
+	 */
+	uint32_t alloc_lbn;
+	uint32_t alloc_pbn;
+	ext2_rsv_t rsv;
 } ext2_priv_t;
 
+/**
+ * The in-memory state of a block group used for allocation.
+ */
+typedef struct ext2_group {
+	sync_t lock;
+	uint32_t *bmap; /* block bitmap, NULL if not read yet */
+	uint32_t *rmap; /* blocks allocated or reserved */
+	uint32_t *imap; /* inode bitmap, NULL if not read yet */
+	uint32_t nblocks; /* the last group may be smaller */
+	uint32_t bfirst; /* there is no free block below this one */
+	uint32_t bextent; /* upper bound of the largest free extent */
+} ext2_group_t;
+
 /**
  * Maybe consider storing some free blocks numbers in memory. SEARCH free
  * blocks when running idle.
  */
 typedef struct ext2_fs {
 	ext2_sblock_t super;
-	sync_t alloc_lock;
+	sync_t alloc_lock; /* protects the free counts of the superblock */
 
 	struct blk_provider *dev;
 	size_t blksz;
@@ -258,8 +360,11 @@ typedef struct ext2_fs {
 	size_t bgd_blks; /* number of blocks containing bg descriptors */
 	size_t nbgd;
 	ext2_bgd_t *bgds;
+	ext2_group_t *groups;
+	size_t orlov_rotor;
 
 	uint64_t maxlen;
+	uint8_t dx_unsigned; /* EXT2_DX_UNSIGNED if hashing unsigned chars */
 } ext2_fs_t;
 
 #if 1
@@ -281,16 +386,42 @@ int ext2_set_inode(ext2_fs_t *fs, uint32_t ino, ext2_inode_t *inode);
 int ext2_get_bgd(ext2_fs_t *fs, uint32_t id, ext2_bgd_t *bgd);
 int ext2_set_bgd(ext2_fs_t *fs, uint32_t id, ext2_bgd_t *bgd);
 
-int ext2_balloc(ext2_fs_t *fs, vnode_t *node, uint32_t *blkp);
+void ext2_alloc_init(ext2_fs_t *fs);
+void ext2_alloc_destroy(ext2_fs_t *fs);
+
+/**
+ * @brief Allocate a block for an inode.
+ *
+ * @param goal	The block preferred, usually the one following the
+ *		previous block of the file. 0 if there is no goal.
+ */
+int ext2_balloc(ext2_fs_t *fs, vnode_t *node, uint32_t goal, uint32_t *blkp);
 void ext2_bfree(ext2_fs_t *fs, uint32_t blk);
 
+static inline void ext2_rsv_init(ext2_rsv_t *rsv) {
+	rsv->group = 0;
+	rsv->start = rsv->end = 0;
+	rsv->size = 0;
+}
+
+/**
+ * @brief Release the reservation window of a file.
+ *
+ * The caller has to hold the lock of the vm object of the vnode.
+ */
+void ext2_rsv_discard(ext2_fs_t *fs, vnode_t *node);
+
 /**
  * @brief Zero a block.
  */
 int ext2_bclr(ext2_fs_t *fs, uint32_t blk);
 
-int ext2_ialloc(ext2_fs_t *fs, uint32_t *res);
-void ext2_ifree(ext2_fs_t *fs, uint32_t ino);
+/**
+ * @brief Allocate an inode for a new file of type @p mode in the directory
+ *	  @p parent.
+ */
+int ext2_ialloc(ext2_fs_t *fs, vnode_t *parent, mode_t mode, uint32_t *res);
+void ext2_ifree(ext2_fs_t *fs, uint32_t ino, bool dir);
 
 int ext2_inode_truncate(ext2_fs_t *fs, vnode_t *node, vnode_size_t length);
 int ext2_inode_bmap(ext2_fs_t *fs, vnode_t *node, bool alloc, blkno_t lbn,
@@ -305,6 +436,8 @@ int ext2_inode_bmap(ext2_fs_t *fs, vnode_t *node, bool alloc, blkno_t lbn,
 int ext2_getdent(ext2_fs_t *fs, vnode_t *node, vnode_size_t off, blkno_t *lbn,
 	blkno_t *pbn, ext2_dent_t *dent);
 
+uint8_t ext2_dt_from_mode(mode_t mode);
+
 int ext2_add_dent(ext2_fs_t *fs, vnode_t *dir, const char *name, size_t namelen,
 	vnode_t *node);
 
@@ -317,4 +450,50 @@ int ext2_add_dent(ext2_fs_t *fs, vnode_t *dir, const char *name, size_t namelen,
 int ext2_dirempty(ext2_fs_t *fs, vnode_t *dir);
 int ext2_rmdent(ext2_fs_t *fs, vnode_t *node);
 
+/**
+ * @brief Check whether a directory is indexed using an HTree.
+ */
+static inline bool ext2_dx_indexed(ext2_fs_t *fs, vnode_t *dir) {
+	return (fs->super.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+		(EXT2_VTOI(dir)->i_flags & EXT2_INDEX_FL);
+}
+
+/**
+ * @brief Look up a directory entry using the HTree of a directory.
+ *
+ * Fills in the vnamei_aux_t of @p dir just like the linear search
+ * in ext2_namei does.
+ *
+ * @retval -EAGAIN	The index cannot be used, fall back to a linear
+ *			search.
+ */
+int ext2_dx_namei(ext2_fs_t *fs, vnode_t *dir, const char *name,
+	size_t namelen, enum vnamei_op op, ino_t *ino);
+
+/**
+ * @brief Add a directory entry to an indexed directory.
+ *
+ * Splits the leaf the new entry hashes to if it is full.
+ *
+ * @retval -EAGAIN	The index is broken and was dropped, fall back
+ *			to adding the entry to the end of the directory.
+ */
+int ext2_dx_add_dent(ext2_fs_t *fs, vnode_t *dir, const char *name,
+	size_t namelen, vnode_t *node);
+
+/**
+ * @brief Turn a full directory consisting of a single block into an
+ *	  indexed directory.
+ *
+ * @retval -EAGAIN	The directory cannot be indexed.
+ */
+int ext2_dx_create(ext2_fs_t *fs, vnode_t *dir);
+
+/**
+ * @brief Drop the index of a directory.
+ *
+ * Used if the directory is modified in a way not maintaining the index.
+ */
+void ext2_dx_clear(vnode_t *dir);
+
 #endif
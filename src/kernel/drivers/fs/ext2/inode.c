@@ -63,7 +63,7 @@ static void ext2_inc_blockcnt(ext2_fs_t *fs, vnode_t *node) {
 }
 
 static int ext2_read_blkaddr(ext2_fs_t *fs, vnode_t *node, uint32_t block,
-	size_t index, bool alloc, uint32_t *blkp)
+	size_t index, bool alloc, uint32_t *goal, uint32_t *blkp)
 {
 	off_t off = EXT2_BOFF(fs, block, index << 2);
 	int err;
@@ -74,11 +74,13 @@ static int ext2_read_blkaddr(ext2_fs_t *fs, vnode_t *node, uint32_t block,
 	}
 
 	if(*blkp == 0 && alloc) {
-		err = ext2_balloc(fs, node, blkp);
+		err = ext2_balloc(fs, node, *goal, blkp);
 		if(err) {
 			return err;
 		}
 
+		*goal = *blkp + 1;
+
 		/*
 		 * Have to clear that block before using it.
 		 */
@@ -98,11 +100,36 @@ static int ext2_read_blkaddr(ext2_fs_t *fs, vnode_t *node, uint32_t block,
 	return err;
 }
 
+/*
+ * Find the preferred block for allocating block @p lbn of a file: the
+ * block following the last one allocated if the file is written
+ * sequentially, otherwise a block close to the preceding blocks.
+ */
+static uint32_t ext2_bmap_goal(vnode_t *node, blkno_t lbn, uint32_t idx) {
+	ext2_priv_t *priv = EXT2_VTOPRIV(node);
+	ext2_inode_t *inode = &priv->inode;
+
+	if(priv->alloc_pbn != 0 && lbn == (blkno_t)priv->alloc_lbn + 1) {
+		return priv->alloc_pbn + 1;
+	}
+
+	for(uint32_t i = idx + 1; i-- > 0;) {
+		if(inode->i_block[i] != 0) {
+			return inode->i_block[i] + (idx < EXT2_NDIR_BLOCKS ?
+				idx - i : 1);
+		}
+	}
+
+	return 0;
+}
+
 int ext2_inode_bmap(ext2_fs_t *fs, vnode_t *node, bool alloc, blkno_t lbn,
 	blkno_t *pbn)
 {
-	ext2_inode_t *inode = vnode_priv(node);
-	uint32_t block, idx;
+	ext2_priv_t *priv = EXT2_VTOPRIV(node);
+	ext2_inode_t *inode = &priv->inode;
+	uint32_t block, idx, goal = 0;
+	blkno_t orig = lbn;
 	int err = 0;
 
 	if(lbn < EXT2_NDIR_BLOCKS) {
@@ -120,12 +147,19 @@ int ext2_inode_bmap(ext2_fs_t *fs, vnode_t *node, bool alloc, blkno_t lbn,
 		}
 	}
 
+	if(alloc) {
+		goal = ext2_bmap_goal(node, orig, idx);
+	}
+
 	block = inode->i_block[idx];
 	if(block == 0 && alloc) {
-		err = ext2_balloc(fs, node, &block);
+		err = ext2_balloc(fs, node, goal, &block);
 		if(err) {
 			return err;
-		} else if(idx >= EXT2_NDIR_BLOCKS) {
+		}
+
+		goal = block + 1;
+		if(idx >= EXT2_NDIR_BLOCKS) {
 			err = ext2_bclr(fs, block);
 			if(err) {
 				ext2_bfree(fs, block);
@@ -143,14 +177,13 @@ int ext2_inode_bmap(ext2_fs_t *fs, vnode_t *node, bool alloc, blkno_t lbn,
 	 * Direct blocks are easy.
 	 */
 	if(idx < EXT2_NDIR_BLOCKS) {
-		*pbn = block;
-		return 0;
+		goto out;
 	}
 
 	switch(idx) {
 	case EXT2_TIND_BLOCK:
 		err = ext2_read_blkaddr(fs, node, block,
-			lbn >> fs->log_naddr_sq, alloc, &block);
+			lbn >> fs->log_naddr_sq, alloc, &goal, &block);
 		if(err || block == 0) {
 			*pbn = block;
 			return err;
@@ -160,7 +193,7 @@ int ext2_inode_bmap(ext2_fs_t *fs, vnode_t *node, bool alloc, blkno_t lbn,
 	/* FALLTHROUGH */
 	case EXT2_DIND_BLOCK:
 		err = ext2_read_blkaddr(fs, node, block, lbn >> fs->log_naddr,
-			alloc, &block);
+			alloc, &goal, &block);
 		if(err || block == 0) {
 			*pbn = block;
 			return err;
@@ -169,7 +202,14 @@ int ext2_inode_bmap(ext2_fs_t *fs, vnode_t *node, bool alloc, blkno_t lbn,
 		lbn &= (1ULL << fs->log_naddr) - 1;
 	/* FALLTHROUGH */
 	case EXT2_IND_BLOCK:
-		err = ext2_read_blkaddr(fs, node, block, lbn, alloc, &block);
+		err = ext2_read_blkaddr(fs, node, block, lbn, alloc, &goal,
+			&block);
+	}
+
+out:
+	if(alloc && err == 0 && block != 0) {
+		priv->alloc_lbn = orig;
+		priv->alloc_pbn = block;
 	}
 
 	*pbn = block;
@@ -246,6 +286,14 @@ int ext2_inode_truncate(ext2_fs_t *fs, vnode_t *node, vnode_size_t length) {
 	blkcnt_t count = 0;
 	size_t i;
 
+	/*
+	 * The blocks reserved for the file are most likely not needed
+	 * anymore.
+	 */
+	synchronized(&VNTOVM(node)->lock) {
+		ext2_rsv_discard(fs, node);
+	}
+
 	vnode_set_size(node, length);
 	if(length > oldsz) {
 		size_t off;
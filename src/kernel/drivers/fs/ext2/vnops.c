@@ -54,10 +54,13 @@ static vop_truncate_t	ext2_truncate;
 static vop_bmap_t 	ext2_bmap;
 static vop_sync_t	ext2_vn_sync;
 static vop_readlink_t 	ext2_readlink;
+static vop_close_t	ext2_close;
 vnode_ops_t ext2_vnops = {
+	.close =	ext2_close,
 	.read =		vop_generic_rdwr,
 	.write =	vop_generic_rdwr,
 	.pagein =	vop_generic_pagein,
+	.readahead =	vop_generic_readahead,
 	.pageout =	vop_generic_pageout,
 	.set_exe =	vop_generic_set_exe,
 	.unset_exe =	vop_generic_unset_exe,
@@ -126,6 +129,19 @@ static int ext2_vn_sync(vnode_t *node) {
 	return ext2_set_inode(fs, node->ino, inode);
 }
 
+static void ext2_close(vnode_t *node, __unused int flags) {
+	ext2_fs_t *fs = filesys_get_priv(node->fs);
+
+	/*
+	 * Release the reservation window once the last writer is gone.
+	 */
+	if(node->writecnt == 0) {
+		synchronized(&VNTOVM(node)->lock) {
+			ext2_rsv_discard(fs, node);
+		}
+	}
+}
+
 static int ext2_truncate(vnode_t *node, vnode_size_t length) {
 	ext2_fs_t *fs = filesys_get_priv(node->fs);
 	return ext2_inode_truncate(fs, node, length);
@@ -205,6 +221,13 @@ static int ext2_namei(vnode_t *node, const char *name, size_t namelen,
 	vnode_size_t off;
 	int err;
 
+	if(ext2_dx_indexed(fs, node)) {
+		err = ext2_dx_namei(fs, node, name, namelen, op, ino);
+		if(err != -EAGAIN) {
+			return err;
+		}
+	}
+
 	/*
 	 * TODO it would be pretty cool if the block device cache
 	 * interface was able to give us a buffer.
@@ -310,7 +333,7 @@ static int ext2_create(vnode_t *node, const char *name, size_t namelen,
 		return -ENAMETOOLONG;
 	}
 
-	err = ext2_ialloc(fs, &ino);
+	err = ext2_ialloc(fs, node, args->mode, &ino);
 	if(err) {
 		return err;
 	}
@@ -401,10 +424,6 @@ static int ext2_create(vnode_t *node, const char *name, size_t namelen,
 		goto error2;
 	}
 
-	if(VN_ISDIR(child)) {
-		ext2_ino_bgd(fs, ino)->bg_used_dirs_count++;
-	}
-
 	/*
 	 * Add a link to the directory, because the child directory
 	 * contains a  ".." entry.
@@ -437,7 +456,7 @@ error2:
 		ext2_bfree(fs, blk);
 	}
 error:
-	ext2_ifree(fs, ino);
+	ext2_ifree(fs, ino, S_ISDIR(args->mode));
 	ext2_vfree(child);
 	return err;
 }
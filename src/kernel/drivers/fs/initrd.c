@@ -130,6 +130,7 @@ static int initrd_pagein(vnode_t *node, vm_objoff_t off, vm_page_t *page) {
 	memcpy(map, inode->buffer + off, size);
 	memset(map + size, 0x0, PAGE_SZ - size);
 	vm_kern_unmap_quick(map);
+	vm_page_unbusy(page);
 
 	return 0;
 }
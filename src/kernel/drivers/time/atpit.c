@@ -23,6 +23,7 @@
  */
 
 #include <kern/system.h>
+#include <kern/vdso.h>
 #include <kern/time.h>
 #include <device/device.h>
 #include <device/evtimer.h>
@@ -191,7 +192,7 @@ static int atpit_attach(device_t *device) {
 
 	pit->ev.name = "atpit";
 	pit->ev.priv = pit;
-	pit->ev.flags = EV_F_PERIODIC | EV_F_ONESHOT;
+	pit->ev.flags = EV_F_PERIODIC; /* TODO one-shot mode */
 	pit->ev.cpu = CPU_ID_ANY;
 	pit->ev.max_period = (0xfffeULL * SEC_NANOSECS) / FREQ;
 	pit->ev.min_period = MINPERIOD;
@@ -208,6 +209,7 @@ static int atpit_attach(device_t *device) {
 	pit->tc.freq = FREQ;
 	pit->tc.mask = (uint64_t)-1;
 	pit->tc.quality = 0;
+	pit->tc.vdso = VDSO_CLOCK_NONE;
 	pit->tc.read = atpit_counter;
 
 	evtimer_register(&pit->ev);
@@ -23,6 +23,7 @@
  */
 
 #include <kern/system.h>
+#include <kern/vdso.h>
 #include <device/device.h>
 #include <device/timecounter.h>
 #include <drivers/bus/isa.h>
@@ -83,8 +84,9 @@ static int hpet_attach(device_t *device) {
 
 	hpet->tc.name = "hpet";
 	hpet->tc.freq = (uint32_t)(1000000000000000ULL / period);
-	hpet->tc.mask = UINT64_MAX;
+	hpet->tc.mask = HPET_CNTSZ(cap) ? UINT64_MAX : UINT32_MAX;
 	hpet->tc.quality = 100;
+	hpet->tc.vdso = VDSO_CLOCK_NONE;
 	hpet->tc.priv = hpet;
 	hpet->tc.read = hpet_tc_read;
 
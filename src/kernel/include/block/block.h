@@ -4,6 +4,7 @@
 #include <kern/rwlock.h>
 #include <kern/atomic.h>
 #include <kern/sync.h>
+#include <kern/workqueue.h>
 #include <vm/flags.h>
 #include <lib/list.h>
 
@@ -28,7 +29,7 @@ struct blk_object;
 typedef void (*blk_callback_t) (void *);
 
 typedef struct blk_event {
-	list_node_t node;
+	work_t work;
 	blk_callback_t callback;
 	void *arg;
 } blk_event_t;
@@ -56,6 +57,7 @@ typedef struct blk_object {
 	void *priv;
 	uint8_t blk_shift; /**< The logical block size */
 	uint8_t pblk_shift; /**< The physical block size (pblk_shift >= blk_shift) */
+	blkcnt_t max_cnt; /**< Max. logical blocks per request (0: no limit) */
 } blk_object_t;
 
 typedef struct blk_provider {
@@ -103,6 +105,7 @@ typedef struct blk_handler {
 
 #define BLK_HAND_SETUP	(1 << 0)
 #define BLK_HAND_ASYNC	(1 << 1)
+#define BLK_HAND_EVENT	(1 << 2) /* event was created by blk_handler_async */
 	int flags;
 	size_t num;
 	size_t done;
@@ -110,6 +113,17 @@ typedef struct blk_handler {
 
 #define BLK_REQ_AUTOFREE (1 << 0)
 #define BLK_REQ_PHYS	(1 << 1)
+#define BLK_REQ_SG	(1 << 2) /* the memory is described by io.seg */
+
+/*
+ * The maximum number of scatter/gather segments of a request.
+ */
+#define BLK_REQ_NSEG	16
+
+typedef struct blk_seg {
+	vm_paddr_t paddr;
+	size_t size;
+} blk_seg_t;
 
 typedef struct blk_req {
 	/*
@@ -131,6 +145,14 @@ typedef struct blk_req {
 			blkcnt_t cnt;
 			void *map; /* For mapped I/O */
 			vm_paddr_t paddr; /* physical address */
+
+			/*
+			 * The physical memory of a BLK_REQ_SG request. The
+			 * sizes of the segments add up to the size of the
+			 * request.
+			 */
+			blk_seg_t seg[BLK_REQ_NSEG];
+			size_t nseg;
 		} io;
 	};
 } blk_req_t;
@@ -194,20 +216,59 @@ void blk_handler_free(blk_handler_t *hand);
 int blk_handler_start(blk_handler_t *hand);
 void blk_abort(blk_handler_t *hand);
 
+/**
+ * @brief Complete the requests of a handler asynchronously.
+ *
+ * Has to be called before any request is added to the handler. Once
+ * every request finished, @p callback is called with @p arg by a worker
+ * thread of the block subsystem. blk_handler_start() does not wait for
+ * the requests anymore and the callback is responsible for freeing the
+ * handler.
+ */
+void blk_handler_async(blk_handler_t *hand, blk_callback_t callback,
+	void *arg);
+
+/**
+ * @brief Get the error of the requests of a finished handler.
+ */
+static inline int blk_handler_error(blk_handler_t *hand) {
+	return hand->err;
+}
+
 int blk_req_launch(blk_req_t *req);
 
 /**
  * Perform cached I/O on a block device, which is not restricted to sector
  * aligned access. This type of I/O is usually used for reading/writing
  * filesystem structures. However the contents of a file are cached by
- * using the vm-object of a vnode. Writes are immediately written to disk,
- * to not break any key filesystem structures after a system failure.
+ * using the vm-object of a vnode. Writes only modify the cache and are
+ * written to disk by a flusher thread after a while, by blk_cache_flush
+ * or when the provider is no longer mounted.
  */
 int bio(blk_provider_t *pr, blk_rtype_t type, off_t off, size_t size,
 	void *ptr);
 #define bread(pr, off, sz, ptr)  bio(pr, BLK_RD, off, sz, ptr)
 #define bwrite(pr, off, sz, ptr) bio(pr, BLK_WR, off, sz, ptr)
 
+/**
+ * @brief Write the dirty cache buffers of a mounted provider to disk.
+ */
+int blk_cache_flush(blk_provider_t *pr);
+
+/**
+ * @brief Write every dirty cache buffer to disk.
+ */
+int blk_cache_flush_all(void);
+
+/**
+ * @brief Forget the modifications of the cache buffers in a range.
+ *
+ * Used when a filesystem frees a block, so that a dirty buffer of the
+ * block is not written over the data of the next user. Only the buffers
+ * lying completely inside of the range are affected.
+ */
+void blk_cache_discard(blk_provider_t *pr, off_t off, size_t size);
+
 /*
  * TODO remember that the data is always cached in the physical-sector size
  * of the device (not not necessarily the legacy 512-byte sectors).
@@ -278,6 +339,15 @@ static inline blksize_t blk_get_blkshift(blk_provider_t *pr) {
 	return pr->obj->blk_shift;
 }
 
+/**
+ * @brief Get the maximum number of logical blocks of one request.
+ *
+ * @return The maximum number of blocks or 0 if there is no limit.
+ */
+static inline blkcnt_t blk_get_max_cnt(blk_provider_t *pr) {
+	return pr->obj->max_cnt;
+}
+
 static inline blkno_t blk_off_to_blk(blk_provider_t *pr, uint64_t off) {
 	return off >> pr->obj->blk_shift;
 }
@@ -36,6 +36,7 @@ typedef struct blk_dev {
 	uint8_t blk_shift; /* log2(logical block size) */
 	uint8_t pblk_shift; /* log2(physical block size) */
 	blkcnt_t blkcnt; /* total number of logical blocks */
+	blkcnt_t max_cnt; /* max. logical blocks per request (0: no limit) */
 
 	blk_req_queue_t *req_queue;
 } blk_dev_t;
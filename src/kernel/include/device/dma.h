@@ -4,6 +4,7 @@
 struct bus_dma_buf;
 struct bus_dma_engine;
 struct blk_req;
+struct blk_seg;
 
 typedef enum bus_dma_sync {
 	BUS_DMA_SYNC_DEV, /* Make dma memory available to device */
@@ -19,6 +20,7 @@ typedef struct bus_dma_ops {
 	void (*free_mem)	(struct bus_dma_buf *);
 	int  (*load)		(struct bus_dma_buf *, void *, size_t);
 	int  (*load_phys)	(struct bus_dma_buf *, vm_paddr_t, size_t);
+	int  (*load_sg)		(struct bus_dma_buf *, struct blk_seg *, size_t);
 	void (*unload)		(struct bus_dma_buf *);
 	void (*sync) 		(struct bus_dma_buf *, bus_dma_sync_t);
 } bus_dma_ops_t;
@@ -8,6 +8,7 @@ typedef struct timecounter {
 	frequency_t freq;
 	uint64_t mask;
 	int quality;
+	int vdso; /* how userspace reads the counter (VDSO_CLOCK_*) */
 	void *priv;
 	uint64_t (*read) (struct timecounter *);
 } timecounter_t;
@@ -22,10 +23,21 @@ static inline void *tc_priv(timecounter_t *tc) {
 void tc_register(timecounter_t *tc);
 
 /**
- * @brief Unregister a new time counter.
+ * @brief Unregister a time counter.
+ *
+ * If the counter is currently used, the timekeeping switches to the best
+ * remaining counter. The counter may still be read until the next two
+ * updates of the timehands.
+ *
+ * @retval -EBUSY	The counter is the only one left.
  */
 int tc_unregister(timecounter_t *tc);
 
+/**
+ * @brief Get the time counter used for timekeeping.
+ */
+timecounter_t *tc_get(void);
+
 /**
  * @brief Read the counter of a time counter device.
  */
@@ -1,6 +1,8 @@
 #ifndef KERN_ATOMIC_H
 #define KERN_ATOMIC_H
 
+#include <arch/atomic.h>
+
 #define __atomic _Atomic
 
 #define atomic_thread_fence(type) \
@@ -129,6 +131,26 @@ static inline uint32_t ref_inc(ref_t *ref) {
 	return retv;
 }
 
+/*
+ * Increment the counter unless it is zero. Returns false if the counter
+ * was zero, i.e. the object is about to be destroyed.
+ */
+static inline bool ref_inc_not_zero(ref_t *ref) {
+	uint32_t old, cur = atomic_load_relaxed(ref);
+
+	do {
+		if(cur == 0) {
+			return false;
+		}
+
+		kassert(cur < UINT32_MAX, "[atomic] refcnt: overflow");
+		old = cur;
+		cur = atomic_cmpxchg_relaxed_val(ref, old, old + 1);
+	} while(cur != old);
+
+	return true;
+}
+
 /* Returns true if there is no reference left */
 static inline bool ref_dec(ref_t *ref) {
 	uint32_t retv = atomic_dec_relaxed(ref);
@@ -3,6 +3,7 @@
 
 #include <kern/section.h>
 #include <lib/list.h>
+#include <lib/rhashtab.h>
 
 #define DRIVER_SECTION	section(driver, driver_entry_t)
 #define __driver	section_entry(DRIVER_SECTION)
@@ -17,7 +18,7 @@ typedef struct driver_entry {
 	struct module *module; /* TODO */
 	void *driver;
 
-	list_node_t node;
+	rhash_node_t node;
 	size_t ref;
 	size_t hash;
 } driver_entry_t;
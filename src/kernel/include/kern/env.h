@@ -3,6 +3,7 @@
 
 #include <kern/section.h>
 #include <lib/list.h>
+#include <lib/rhashtab.h>
 
 #define ENV_SECTION section(kernenv, env_var_t)
 #define ENV_STRSZ 32
@@ -15,7 +16,7 @@ typedef enum env_var_type {
 } env_var_type_t;
 
 typedef struct env_var {
-	list_node_t node;
+	rhash_node_t node;
 	size_t hash;
 
 	const char *name;
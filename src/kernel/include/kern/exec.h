@@ -6,6 +6,7 @@
 struct thread;
 struct vnode;
 struct kstack;
+struct spawn_action;
 enum vm_seg;
 
 #define EXEC_OK		(0)
@@ -127,6 +128,23 @@ int exec_lock_map_node(exec_img_t *image);
  */
 int exec_interp(exec_img_t *img, const char *interp, size_t len);
 
+/**
+ * @brief Lookup the executable and copy the arguments into the kernel.
+ *
+ * On failure the caller has to call exec_cleanup().
+ */
+int exec_prepare(exec_img_t *image, const char *path, const char **argv,
+	const char **envp, enum vm_seg seg);
+
+/**
+ * @brief Replace the image of the current process.
+ *
+ * The image has to be prepared using exec_prepare() and is cleaned up
+ * by this function, even if the process could not be loaded. The image
+ * may have been prepared by a different process.
+ */
+int exec_load(exec_img_t *image, const char *path);
+
 /**
  * @brief Execute a file.
  */
@@ -138,4 +156,38 @@ int kern_execve(const char *path, const char **argv, const char **envp,
  */
 int sys_execve(const char *path, const char **argv, const char **env);
 
+/**
+ * @brief A spawn request passed from the parent to the new child.
+ *
+ * The structure is allocated by the parent, which waits until the child
+ * sets done and frees it afterwards. If the parent is interrupted while
+ * waiting, it sets detached and the child frees the structure instead.
+ */
+typedef struct spawn {
+	exec_img_t image;
+	const char *path;
+	struct spawn_action *actions;
+	size_t nactions;
+	int err;
+	bool done;
+	bool detached; /* the parent was interrupted, the child frees this */
+} spawn_t;
+
+/**
+ * @brief Apply the file actions of a spawn request and load the image.
+ *
+ * Called by the child in thread_fork_ret(). Does not return if the
+ * image could not be loaded.
+ */
+void proc_spawn_child(void);
+
+/**
+ * @brief spawn syscall.
+ *
+ * Create a child process executing @p path, without duplicating the
+ * address space of the caller.
+ */
+pid_t sys_spawn(const char *path, const char **argv, const char **envp,
+	const struct spawn_action *actions, size_t nactions);
+
 #endif
@@ -37,6 +37,14 @@ int kern_wake(void *addr, int num, int flags);
 int sys_futex(int *uaddr, int op, int val, const struct timespec *timeout,
 	int *uaddr2, int val3);
 
+/**
+ * @brief Release the priority-inheritance futexes owned by the current
+ *	  thread, which is exiting.
+ *
+ * The futexes are handed over to their waiters with FUTEX_OWNER_DIED set.
+ */
+void futex_exit(void);
+
 void init_futex(void);
 
 #endif
\ No newline at end of file
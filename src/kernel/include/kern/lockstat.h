@@ -0,0 +1,129 @@
+#ifndef KERN_LOCKSTAT_H
+#define KERN_LOCKSTAT_H
+
+#include <config.h>
+
+/*
+ * Lock contention statistics. When the kernel is configured with LOCKSTAT,
+ * every acquisition of a sync_t, rwlock_t and spinlock_t is accounted to
+ * its acquisition site (lock class + file + line). The statistics can be
+ * read from /dev/lockstat and are reset by writing to that file.
+ */
+
+typedef enum lockstat_class {
+	LOCKSTAT_SPIN = 0, /* sync_t (SYNC_SPINLOCK) */
+	LOCKSTAT_MUTEX, /* sync_t (SYNC_MUTEX) */
+	LOCKSTAT_SPINLOCK, /* spinlock_t */
+	LOCKSTAT_RDLOCK, /* rwlock_t (read) */
+	LOCKSTAT_WRLOCK, /* rwlock_t (write) */
+	LOCKSTAT_NCLASS,
+} lockstat_class_t;
+
+struct lockstat_site;
+
+/**
+ * @brief Contention information collected while acquiring a lock.
+ *
+ * Lives on the stack of the thread acquiring the lock.
+ */
+typedef struct lockstat_wait {
+	uint64_t start; /* first failed attempt, 0 if not contended */
+	uint64_t sleep; /* total time spent sleeping */
+	uint64_t sleep_start;
+} lockstat_wait_t;
+
+#if CONFIGURED(LOCKSTAT)
+
+/**
+ * @brief Declare a variable only present in a LOCKSTAT build.
+ */
+#define LOCKSTAT_VAR(type, name) type name
+
+#define LOCKSTAT_WAIT_INIT (lockstat_wait_t) { 0, 0, 0 }
+
+/**
+ * @brief Note that an attempt to acquire a lock failed.
+ *
+ * Only the first call per acquisition has an effect.
+ */
+void lockstat_contended(lockstat_wait_t *wait);
+
+/**
+ * @brief Note that the thread goes to sleep waiting for a lock.
+ */
+void lockstat_sleep_begin(lockstat_wait_t *wait);
+
+/**
+ * @brief Note that the thread woke up while waiting for a lock.
+ */
+void lockstat_sleep_end(lockstat_wait_t *wait);
+
+/**
+ * @brief Account a successful lock acquisition.
+ *
+ * @param[out] sitep The site of the acquisition, which has to be passed
+ *		     to lockstat_released() later. May be NULL if the
+ *		     hold time is not tracked.
+ * @return The cpu_ticks() of the acquisition or 0 if the site is not
+ *	   accounted.
+ */
+uint64_t lockstat_acquired(lockstat_wait_t *wait, lockstat_class_t cls,
+	const void *lock, const char *file, int line,
+	struct lockstat_site **sitep);
+
+/**
+ * @brief Account the release of a lock.
+ *
+ * @param site	The site returned by lockstat_acquired().
+ * @param time	The time returned by lockstat_acquired().
+ */
+void lockstat_released(struct lockstat_site *site, uint64_t time);
+
+/**
+ * @brief Account the acquisition of a lock tracking its hold time.
+ *
+ * The lock structure @p obj needs the lst_site and lst_time fields.
+ */
+#define lockstat_acquired_obj(wait, cls, obj, file, line)		\
+	((obj)->lst_time = lockstat_acquired(wait, cls, obj, file, line, \
+		&(obj)->lst_site))
+
+/**
+ * @brief Account the release of a lock acquired using
+ *	  lockstat_acquired_obj().
+ */
+#define lockstat_released_obj(obj) \
+	lockstat_released((obj)->lst_site, (obj)->lst_time)
+
+#else
+
+#define LOCKSTAT_VAR(type, name)
+#define LOCKSTAT_WAIT_INIT (lockstat_wait_t) { }
+
+static inline void lockstat_contended(__unused lockstat_wait_t *wait) {
+}
+
+static inline void lockstat_sleep_begin(__unused lockstat_wait_t *wait) {
+}
+
+static inline void lockstat_sleep_end(__unused lockstat_wait_t *wait) {
+}
+
+static inline uint64_t lockstat_acquired(__unused lockstat_wait_t *wait,
+	__unused lockstat_class_t cls, __unused const void *lock,
+	__unused const char *file, __unused int line,
+	__unused struct lockstat_site **sitep)
+{
+	return 0;
+}
+
+static inline void lockstat_released(__unused struct lockstat_site *site,
+	__unused uint64_t time)
+{
+}
+
+#define lockstat_acquired_obj(wait, cls, obj, file, line) (void) (wait)
+#define lockstat_released_obj(obj)
+
+#endif
+#endif
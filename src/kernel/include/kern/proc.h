@@ -6,6 +6,7 @@
 #include <kern/wait.h>
 #include <kern/atomic.h>
 #include <lib/list.h>
+#include <lib/rhashtab.h>
 #include <arch/thread.h>
 
 /*
@@ -28,6 +29,7 @@ struct vm_vas;
 struct trapframe;
 struct rusage;
 struct user_desc;
+struct cpu;
 struct rlimit;
 
 typedef struct session {
@@ -41,7 +43,7 @@ typedef struct pgrp {
 	sync_t lock;
 
 	struct session *session; /* (c) */
-	list_node_t node;
+	rhash_node_t node;
 	list_t members; /* protected by proc_tree_lock */
 	pid_t id; /* (c) */
 } pgrp_t;
@@ -100,7 +102,7 @@ typedef struct proc {
 	list_node_t node_pgrp;
 	struct pgrp *pgrp; /* also protected by proc_list_lock */
 
-	list_node_t node_proc;
+	rhash_node_t node_proc;
 
 	/* protected by proc_tree_lock */
 	struct proc *parent; /* also protected by lock */
@@ -199,6 +201,16 @@ typedef struct thread {
 	size_t numlock;
 	uint8_t saved_prio;
 
+	/*
+	 * Priority inheritance (kern/futex.c), protected by futex_pi_lock.
+	 * pi_prio is the priority of the most important thread waiting
+	 * for a futex owned by this thread or SCHED_PRIO_NUM.
+	 */
+	uint8_t pi_prio;
+	bool pi_exiting;
+	struct futex_pi_wait *pi_blocked;
+	list_t pi_owned;
+
 	pid_t tid;
 
 	union {
@@ -217,6 +229,11 @@ typedef struct thread {
 		};
 	};
 
+	/*
+	 * Set for the first thread of a process created by sys_spawn.
+	 */
+	struct spawn *spawn;
+
 	struct proc *proc; /* constant until exit */
 	list_node_t proc_node;
 
@@ -323,6 +340,14 @@ static inline bool thread_test_flags(thread_t *thread, int flags) {
 	return (atomic_load_relaxed(&thread->flags) & flags) == flags;
 }
 
+/**
+ * @brief Get the priority of a thread including the boost inherited from
+ *	  the waiters of priority-inheritance futexes.
+ */
+static inline uint8_t thread_prio(thread_t *thread) {
+	return min(thread->prio, thread->pi_prio);
+}
+
 static inline bool thread_mayfault(void) {
 	return cur_thread()->onfault != NULL;
 }
@@ -528,6 +553,12 @@ thread_t *kthread_alloc(int (*func) (void *), void *arg);
 thread_t *kthread_spawn_prio(int (*func) (void *), void *arg, uint8_t prio);
 thread_t *kthread_spawn(int (*func) (void *), void *arg);
 
+/**
+ * @brief Spawn a kernel thread, which always runs on @p cpu.
+ */
+thread_t *kthread_spawn_cpu(int (*func) (void *), void *arg, uint8_t prio,
+	struct cpu *cpu);
+
 void thread_clear_tid(void);
 void __noreturn thread_do_exit(void);
 void __noreturn kern_exit(int ret);
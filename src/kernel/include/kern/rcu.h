@@ -0,0 +1,81 @@
+#ifndef KERN_RCU_H
+#define KERN_RCU_H
+
+#include <kern/atomic.h>
+
+/* Example:
+ *
+ * Reader:
+ * rcu_read_lock();
+ * hashtab_search_rcu(entry, hash, &table) {
+ *	...
+ * }
+ * rcu_read_unlock();
+ *
+ * Writer (still serialized by a lock):
+ * synchronized(&table_lock) {
+ *	hashtab_remove_rcu(&table, hash, &entry->node);
+ * }
+ * call_rcu(&entry->rcu, entry_free);
+ */
+
+/**
+ * @brief Load a pointer protected by RCU.
+ */
+#define rcu_dereference(ptr) atomic_load_acquire(&(ptr))
+
+/**
+ * @brief Publish a pointer protected by RCU.
+ *
+ * Any initialization of the object pointed to by @p val is visible
+ * to readers seeing the new pointer.
+ */
+#define rcu_assign_pointer(ptr, val) atomic_store_release(&(ptr), val)
+
+typedef struct rcu_head {
+	struct rcu_head *next;
+	void (*func) (struct rcu_head *);
+} rcu_head_t;
+
+/**
+ * @brief Enter an RCU read-side critical section.
+ *
+ * Objects reached through RCU protected pointers stay valid until the
+ * matching rcu_read_unlock(). Read-side critical sections may be nested
+ * and may be used in interrupt handlers, but the thread must not sleep
+ * inside of them.
+ */
+void rcu_read_lock(void);
+
+/**
+ * @brief Leave an RCU read-side critical section.
+ */
+void rcu_read_unlock(void);
+
+/**
+ * @brief Wait for a grace period.
+ *
+ * Wait until every RCU read-side critical section, which was started
+ * before the call, has completed. May sleep.
+ */
+void synchronize_rcu(void);
+
+/**
+ * @brief Call @p func after a grace period.
+ *
+ * The callback is invoked by a kernel thread, which means that @p func
+ * may sleep. call_rcu may be called from any context.
+ */
+void call_rcu(rcu_head_t *head, void (*func) (rcu_head_t *));
+
+/**
+ * @brief Report a quiescent state of the current cpu.
+ *
+ * Called by the scheduler on every context switch. @p idle is true if
+ * the cpu is switching to its idle thread.
+ */
+void rcu_sched_qs(bool idle);
+
+void init_rcu(void);
+
+#endif
@@ -2,6 +2,7 @@
 #define KERN_RWLOCK_H
 
 #include <kern/spinlock.h>
+#include <kern/lockstat.h>
 
 #define RWLOCK_INIT (rwlock_t) {	\
 	.lock = SPINLOCK_INIT,		\
@@ -35,6 +36,12 @@ typedef struct rwlock {
 		};
 		uint32_t wfutex;
 	};
+
+	/*
+	 * The hold time is only tracked for writers.
+	 */
+	LOCKSTAT_VAR(struct lockstat_site *, lst_site);
+	LOCKSTAT_VAR(uint64_t, lst_time);
 } rwlock_t;
 
 void rwlock_init(rwlock_t *lock);
@@ -42,8 +49,12 @@ static inline void rwlock_destroy(rwlock_t *lock) {
 	(void) lock;
 }
 
-void wrlock(rwlock_t *lock);
-void rdlock(rwlock_t *lock);
+#define wrlock(l) __wrlock(l, __FILE__, __LINE__)
+void __wrlock(rwlock_t *lock, const char *file, int line);
+
+#define rdlock(l) __rdlock(l, __FILE__, __LINE__)
+void __rdlock(rwlock_t *lock, const char *file, int line);
+
 void rwunlock(rwlock_t *lock);
 void rwlock_cleanup(rwlock_t **lock);
 
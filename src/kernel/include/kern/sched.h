@@ -67,6 +67,14 @@ void sched_set_inactive(bool interruptable);
  */
 void sched_wakeup(struct thread *thread, sched_prio_t prio);
 
+/**
+ * @brief Move a runnable thread to the runqueue matching its priority.
+ *
+ * Called after the priority of a thread was raised (e.g. by priority
+ * inheritance), which does not affect a thread already queued otherwise.
+ */
+void sched_requeue(struct thread *thread);
+
 /**
  * @brief Interrupt a thread (software interrupt).
  *
@@ -123,6 +131,11 @@ void sched_intr_preempt(void);
  */
 void sched_add_thread(struct thread *thread);
 
+/**
+ * @brief Add a thread to the scheduler of a specific processor.
+ */
+void sched_add_thread_cpu(struct thread *thread, struct cpu *cpu);
+
 void init_sched(void);
 void sched_init_ap(struct cpu *cpu);
 
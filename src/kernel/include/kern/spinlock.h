@@ -11,9 +11,12 @@ static inline void spinlock_init(spinlock_t *lock) {
 	*lock = SPINLOCK_INIT;
 }
 
-bool spin_try_lock(spinlock_t *lock);
+#define spin_try_lock(l) __spin_try_lock(l, __FILE__, __LINE__)
+bool __spin_try_lock(spinlock_t *lock, const char *file, int line);
 bool spin_locked(spinlock_t *lock);
-void spin_lock(spinlock_t *lock);
+
+#define spin_lock(l) __spin_lock(l, __FILE__, __LINE__)
+void __spin_lock(spinlock_t *lock, const char *file, int line);
 
 #define spin_unlock(l)	__spin_unlock(l, __FILE__, __LINE__)
 void __spin_unlock(spinlock_t *lock, char *file, int line);
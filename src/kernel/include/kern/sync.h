@@ -2,6 +2,7 @@
 #define KERN_SYNC_H
 
 #include <lib/development.h>
+#include <kern/lockstat.h>
 
 /* Example:
  *
@@ -59,6 +60,8 @@ typedef struct sync {
 
 	DEVEL_VAR(short, line);
 	DEVEL_VAR(const char *, file);
+	LOCKSTAT_VAR(struct lockstat_site *, lst_site);
+	LOCKSTAT_VAR(uint64_t, lst_time);
 	MAGIC(magic);
 } sync_t;
 
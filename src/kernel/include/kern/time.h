@@ -63,6 +63,12 @@ void realtime(struct timespec *time);
 
 nanosec_t timekeep_tick(void);
 
+/**
+ * @brief Get the maximum time allowed between two calls
+ *	  to timekeep_tick().
+ */
+nanosec_t timekeep_max_interval(void);
+
 nanosec_t nanouptime(void);
 
 nanosec_t getnanouptime(void);
@@ -73,6 +79,11 @@ void gettsuptime(struct timespec *time);
 
 void gettsboottime(struct timespec *time);
 
+/**
+ * @brief Get the real time of the boot.
+ */
+void getboottime(struct timespec *time);
+
 void ndelay(nanosec_t nsec);
 
 /**
@@ -2,6 +2,7 @@
 #define KERN_TIMER_H
 
 #include <lib/list.h>
+#include <lib/rbtree.h>
 
 /**
  * The period in milliseconds of the periodick
@@ -17,9 +18,16 @@
 
 typedef void (timer_func_t) (void *arg);
 
+/**
+ * The value of timer_t::wheel if the timer is not queued.
+ */
+#define TIMER_WHEEL_NONE UINT32_MAX
+
 typedef struct timer {
 	list_node_t node;
+	rb_node_t tree_node; /* overflow tree of the timing wheel */
 	struct timerq *tq;
+	uint32_t wheel; /* position in the timing wheel */
 
 	int flags;
 	nanosec_t time;
@@ -31,12 +39,15 @@ typedef struct timer {
 
 static inline void timer_init(timer_t *timer, timer_func_t *func, void *arg) {
 	list_node_init(timer, &timer->node);
+	rb_node_init(timer, &timer->tree_node);
+	timer->wheel = TIMER_WHEEL_NONE;
 	timer->func = func;
 	timer->arg = arg;
 }
 
 static inline void timer_destroy(timer_t *timer) {
 	list_node_destroy(&timer->node);
+	rb_node_destroy(&timer->tree_node);
 }
 
 void timer_start(timer_t *timer, nanosec_t time, int flags);
@@ -49,4 +49,11 @@ int copyin_atomic(void *buf, const void *ubuf, size_t size);
  */
 int copyout_atomic(void *ubuf, const void *buf, size_t size);
 
+/**
+ * @brief	Atomically compare and exchange a 32bit value in user memory.
+ *
+ * @param[out] cur The value found in user memory.
+ */
+int ucmpxchg32(uint32_t *uaddr, uint32_t old, uint32_t new, uint32_t *cur);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef KERN_VDSO_H
+#define KERN_VDSO_H
+
+/*
+ * The vDSO is a small ELF shared object in the shared page, which allows
+ * userspace to read the time without entering the kernel. The time is
+ * computed using the timekeeping parameters exported in vdso_data_t. If
+ * the counter cannot be read from userspace the vDSO falls back to the
+ * clock_gettime system call.
+ */
+
+/*
+ * How userspace reads the timecounter (timecounter_t::vdso).
+ */
+#define VDSO_CLOCK_NONE		0 /* use the system call */
+#define VDSO_CLOCK_TSC		1 /* rdtsc */
+
+/*
+ * The layout of vdso_data_t, which is used by the assembly code.
+ */
+#define VDSO_DATA_GEN		0
+#define VDSO_DATA_MODE		4
+#define VDSO_DATA_COUNT		8
+#define VDSO_DATA_MULT		16
+#define VDSO_DATA_SHIFT		20
+#define VDSO_DATA_UP_SEC	24
+#define VDSO_DATA_UP_NSEC	28
+#define VDSO_DATA_BOOT_SEC	32
+#define VDSO_DATA_BOOT_NSEC	36
+
+/*
+ * The data directly precedes the code of the vDSO.
+ */
+#define VDSO_DATA_SIZE		64
+
+#ifndef __ASSEMBLER__
+
+struct timecounter;
+struct timespec;
+
+/**
+ * @brief The timekeeping data of the vDSO.
+ *
+ * The generation is odd while the data is updated. The time elapsed
+ * since the last update is ((counter - count) * mult) >> shift.
+ */
+typedef struct vdso_data {
+	uint32_t gen;
+	uint32_t mode;
+	uint64_t count;
+	uint32_t mult;
+	uint32_t shift;
+	int32_t up_sec;
+	int32_t up_nsec;
+	int32_t boot_sec;
+	int32_t boot_nsec;
+} vdso_data_t;
+
+/**
+ * @brief Update the timekeeping data of the vDSO.
+ *
+ * Called by timekeep_tick() after the timehands have been updated.
+ *
+ * @param count	 The counter value at @p uptime.
+ */
+void vdso_update(struct timecounter *tc, uint64_t count,
+	struct timespec *uptime, struct timespec *boottime);
+
+/**
+ * @brief Get the userspace address of the vDSO (AT_SYSINFO_EHDR).
+ */
+vm_vaddr_t vdso_addr(void);
+
+/**
+ * @brief Get the userspace address of a symbol exported by the vDSO.
+ */
+vm_vaddr_t vdso_sym(const char *name);
+
+/**
+ * @brief Get the userspace address of a label inside of the vDSO code.
+ */
+vm_vaddr_t vdso_text_addr(const char *text);
+
+void init_vdso(void);
+
+#endif /* __ASSEMBLER__ */
+#endif
@@ -0,0 +1,155 @@
+#ifndef KERN_WORKQUEUE_H
+#define KERN_WORKQUEUE_H
+
+#include <kern/timer.h>
+#include <lib/list.h>
+
+/* Example:
+ *
+ * INIT:
+ * wq = workqueue_create("foo", SCHED_KERNEL, 2);
+ * work_init(&x->work, foo_func, x);
+ *
+ * QUEUE (any context):
+ * work_queue(wq, &x->work);
+ *
+ * DESTROY:
+ * work_cancel(&x->work);
+ * work_flush(&x->work);
+ * work_destroy(&x->work);
+ */
+
+struct workqueue;
+struct wq_pool;
+
+typedef void (*work_func_t) (void *arg);
+
+typedef struct work {
+	list_node_t node;
+	struct wq_pool *pool; /* the pool the work is pending on or NULL */
+	struct workqueue *wq; /* the workqueue the work was last queued on */
+	work_func_t func;
+	void *arg;
+} work_t;
+
+typedef struct delayed_work {
+	work_t work;
+	struct workqueue *wq;
+	timer_t timer;
+	bool armed;
+} delayed_work_t;
+
+/**
+ * @brief The workqueue used for async_call().
+ */
+extern struct workqueue *system_wq;
+
+/**
+ * @brief Create a new workqueue.
+ *
+ * Every cpu has its own pool of @p max_active worker threads running
+ * with priority @p prio. Work is executed on the cpu it was queued on
+ * and at most @p max_active work items of a workqueue run concurrently
+ * on one cpu. Workqueues are never destroyed.
+ */
+struct workqueue *workqueue_create(const char *name, uint8_t prio,
+	size_t max_active);
+
+/**
+ * @brief Wait until every pool of a workqueue is idle.
+ *
+ * Delayed work, whose timer did not expire yet, is not waited for.
+ */
+void workqueue_flush(struct workqueue *wq);
+
+static inline void work_init(work_t *work, work_func_t func, void *arg) {
+	list_node_init(work, &work->node);
+	work->pool = NULL;
+	work->wq = NULL;
+	work->func = func;
+	work->arg = arg;
+}
+
+static inline void work_destroy(work_t *work) {
+	assert(work->pool == NULL);
+	list_node_destroy(&work->node);
+}
+
+/**
+ * @brief Queue work on the pool of the current cpu.
+ *
+ * May be called from any context. The work structure is not accessed
+ * by the workqueue while and after the function is called, which means
+ * that it may be freed or queued again by the function.
+ *
+ * @retval true		The work was queued.
+ * @retval false	The work was already pending.
+ */
+bool work_queue(struct workqueue *wq, work_t *work);
+
+/**
+ * @brief Remove pending work from its workqueue.
+ *
+ * The work may still be running after this call, use work_flush()
+ * to wait for it.
+ *
+ * @retval true		The work was pending and will not run.
+ * @retval false	The work was not pending.
+ */
+bool work_cancel(work_t *work);
+
+/**
+ * @brief Wait until the work is neither pending nor running.
+ *
+ * The work must not be freed by its function and the caller must make
+ * sure that the work is not queued again concurrently. May sleep.
+ */
+void work_flush(work_t *work);
+
+/**
+ * @brief The timer callback of delayed work. Do not use directly.
+ */
+timer_func_t delayed_work_timer;
+
+static inline void delayed_work_init(delayed_work_t *dwork, work_func_t func,
+	void *arg)
+{
+	work_init(&dwork->work, func, arg);
+	timer_init(&dwork->timer, delayed_work_timer, dwork);
+	dwork->wq = NULL;
+	dwork->armed = false;
+}
+
+static inline void delayed_work_destroy(delayed_work_t *dwork) {
+	assert(!dwork->armed);
+	timer_destroy(&dwork->timer);
+	work_destroy(&dwork->work);
+}
+
+/**
+ * @brief Queue work after @p delay nanoseconds.
+ *
+ * The work is queued on the cpu calling this function.
+ *
+ * @retval true		The timer was started.
+ * @retval false	The work is already waiting for its timer or pending.
+ */
+bool delayed_work_queue(struct workqueue *wq, delayed_work_t *dwork,
+	nanosec_t delay);
+
+/**
+ * @brief Cancel delayed work.
+ *
+ * @retval true		The work was cancelled before it could run.
+ * @retval false	The work was neither waiting for its timer nor pending.
+ */
+bool delayed_work_cancel(delayed_work_t *dwork);
+
+void init_workqueue(void);
+
+/**
+ * @brief Start the worker pools of the application processors.
+ */
+void init_workqueue_mp(void);
+
+#endif
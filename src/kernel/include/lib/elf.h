@@ -30,6 +30,8 @@
 #define AT_RANDOM_NUM	16
 #define AT_HWCAP2 26	/* extension of AT_HWCAP */
 #define AT_EXECFN  31	/* filename of program */
+#define AT_SYSINFO 32	/* address of __kernel_vsyscall */
+#define AT_SYSINFO_EHDR 33	/* address of the vDSO */
 
 /* 32-bit ELF base types. */
 typedef uint32_t	elf32_addr_t;
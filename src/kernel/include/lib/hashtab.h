@@ -2,6 +2,7 @@
 #define LIB_HASHTABLE_H
 
 #include <lib/list.h>
+#include <lib/list-rcu.h>
 #include <vm/flags.h>
 
 #define HASHTAB_IDX(ht, hash)	((hash) & ((ht)->nentries - 1))
@@ -10,6 +11,14 @@
 #define hashtab_search(entry, hash, tab) \
 	foreach(entry, HASHTAB_LIST(tab, hash))
 
+/**
+ * @brief Search an hashtable inside an RCU read-side critical section.
+ *
+ * The writers have to use hashtab_set_rcu() and hashtab_remove_rcu().
+ */
+#define hashtab_search_rcu(entry, hash, tab) \
+	foreach_rcu(entry, HASHTAB_LIST(tab, hash))
+
 typedef struct hashtab {
 	size_t nentries; /* Number of entries */
 	list_t *entries;
@@ -48,6 +57,27 @@ static inline void hashtab_remove(hashtab_t *tab, size_t hash,
 	list_remove(HASHTAB_LIST(tab, hash), node);
 }
 
+/**
+ * @brief Add an entry to an hashtable searched using hashtab_search_rcu().
+ */
+static inline void hashtab_set_rcu(hashtab_t *tab, size_t hash,
+	list_node_t *node)
+{
+	list_append_rcu(HASHTAB_LIST(tab, hash), node);
+}
+
+/**
+ * @brief Remove an entry from an hashtable searched using
+ *	  hashtab_search_rcu().
+ *
+ * The entry may only be freed after a grace period.
+ */
+static inline void hashtab_remove_rcu(hashtab_t *tab, size_t hash,
+	list_node_t *node)
+{
+	list_remove_rcu(HASHTAB_LIST(tab, hash), node);
+}
+
 static inline void hashtab_rehash(hashtab_t *tab, size_t ohash, size_t nhash,
 	list_node_t *node)
 {
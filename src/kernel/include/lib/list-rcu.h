@@ -0,0 +1,85 @@
+#ifndef LIB_LIST_RCU_H
+#define LIB_LIST_RCU_H
+
+#include <lib/list.h>
+#include <kern/rcu.h>
+
+/*
+ * RCU-safe variants of the lib/list.h helpers. Writers still have to be
+ * serialized by a lock, but readers may traverse a list concurrently
+ * inside an RCU read-side critical section using foreach_rcu(). The
+ * debug checks of lib/list.h are not used by readers, because a node
+ * may be removed while being looked at.
+ *
+ * A node removed using list_remove_rcu() keeps its next pointer, so that
+ * concurrent readers can continue their traversal. It may only be freed
+ * or inserted again after a grace period (see call_rcu()) and has to be
+ * passed to list_node_rcu_reinit() before it is reinserted or destroyed.
+ */
+
+static inline void list_insert_after_rcu(list_t *list, list_node_t *node,
+	list_node_t *new)
+{
+	__list_check_inserted(list, node);
+	__list_node_check_not_inserted(new);
+	__list_insert(list, new);
+	new->next = node->next;
+	new->prev = node;
+	new->next->prev = new;
+	list->node.length++;
+
+	/*
+	 * Publish the node after it was fully initialized.
+	 */
+	rcu_assign_pointer(node->next, new);
+}
+
+static inline void list_insert_before_rcu(list_t *list, list_node_t *node,
+	list_node_t *new)
+{
+	__list_check_inserted(list, node);
+	list_insert_after_rcu(list, node->prev, new);
+}
+
+static inline void list_append_rcu(list_t *list, list_node_t *node) {
+	list_insert_after_rcu(list, list->node.prev, node);
+}
+
+static inline void list_add_rcu(list_t *list, list_node_t *node) {
+	list_insert_after_rcu(list, &list->node, node);
+}
+
+static inline bool list_remove_rcu(list_t *list, list_node_t *node) {
+	__list_check_inserted(list, node);
+	__list_remove(list, node);
+	assert(list->node.length);
+	rcu_assign_pointer(node->prev->next, node->next);
+	node->next->prev = node->prev;
+	node->prev = NULL;
+	return --list->node.length == 0;
+}
+
+/**
+ * @brief Prepare a node removed by list_remove_rcu() for reuse.
+ *
+ * May only be called after a grace period elapsed since the removal.
+ */
+static inline void list_node_rcu_reinit(list_node_t *node) {
+	node->next = NULL;
+	node->prev = NULL;
+}
+
+static inline list_node_t *__list_next_rcu(list_t *list, list_node_t *node) {
+	list_node_t *next = rcu_dereference(node->next);
+	return next == &list->node ? NULL : next;
+}
+
+/**
+ * @brief Iterate over a list inside an RCU read-side critical section.
+ */
+#define foreach_rcu(item, list)						\
+	for(list_node_t *__node = __list_next_rcu(list, &(list)->node);	\
+		((item) = list_node_val(__node)) != NULL;		\
+		__node = __list_next_rcu(list, __node))
+
+#endif
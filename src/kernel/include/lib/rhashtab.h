@@ -0,0 +1,123 @@
+#ifndef LIB_RHASHTAB_H
+#define LIB_RHASHTAB_H
+
+#include <vm/flags.h>
+
+/*
+ * A hashtable, which grows and shrinks with the number of entries. The
+ * buckets are single pointers and the entries are chained using an
+ * rhash_node_t, which remembers the hash of the entry.
+ *
+ * Resizing is done incrementally: a resize allocates the new bucket array
+ * and every subsequent rhashtab_set() and rhashtab_remove() moves a few
+ * buckets of the old array into the new one. While the old array is being
+ * migrated, an entry whose old bucket was not yet migrated is found in
+ * the old array.
+ *
+ * The hashtable does not do any locking. rhashtab_set() and
+ * rhashtab_remove() may allocate or free memory and thus must not be
+ * called with a spinlock held.
+ */
+
+#define RHASHTAB_MIN	16
+
+#define rhashtab_search(entry, hash, tab)				\
+	for(rhash_node_t *__rnode = rhash_node_next(			\
+			*rhashtab_bucket(tab, hash), hash);		\
+		((entry) = __rnode ? __rnode->value : NULL) != NULL;	\
+		__rnode = rhash_node_next(__rnode->next, hash))
+
+typedef struct rhash_node {
+	struct rhash_node *next;
+	void *value;
+	size_t hash;
+} rhash_node_t;
+
+typedef struct rhashtab {
+	rhash_node_t **buckets;
+	size_t nbuckets;
+	rhash_node_t **old; /* the buckets being migrated or NULL */
+	size_t nold;
+	size_t migrated; /* the number of migrated buckets of old */
+	size_t num; /* the number of entries */
+	size_t min; /* the minimum number of buckets */
+} rhashtab_t;
+
+static inline void rhash_node_init(void *value, rhash_node_t *node) {
+	node->next = NULL;
+	node->value = value;
+	node->hash = 0;
+}
+
+static inline void rhash_node_destroy(rhash_node_t *node) {
+	node->value = NULL;
+}
+
+/*
+ * Skip the entries of a chain having a different hash.
+ */
+static inline rhash_node_t *rhash_node_next(rhash_node_t *node,
+	size_t hash)
+{
+	while(node && node->hash != hash) {
+		node = node->next;
+	}
+
+	return node;
+}
+
+/**
+ * @brief Get the bucket an entry with the hash @p hash is stored in.
+ */
+static inline rhash_node_t **rhashtab_bucket(rhashtab_t *tab, size_t hash) {
+	if(tab->old) {
+		size_t idx = hash & (tab->nold - 1);
+
+		if(idx >= tab->migrated) {
+			return &tab->old[idx];
+		}
+	}
+
+	return &tab->buckets[hash & (tab->nbuckets - 1)];
+}
+
+/**
+ * @brief Initialize a resizable hashtable.
+ *
+ * @param min	The minimum number of buckets (rounded up to a power of two).
+ *		The hashtable never shrinks below this size.
+ */
+int rhashtab_alloc(rhashtab_t *tab, size_t min, vm_flags_t flags);
+
+/**
+ * @brief Free a resizable hashtable.
+ */
+void rhashtab_free(rhashtab_t *tab);
+
+/**
+ * @brief Add an entry to a resizable hashtable.
+ */
+void rhashtab_set(rhashtab_t *tab, size_t hash, rhash_node_t *node);
+
+/**
+ * @brief Remove an entry from a resizable hashtable.
+ */
+void rhashtab_remove(rhashtab_t *tab, size_t hash, rhash_node_t *node);
+
+static inline void rhashtab_rehash(rhashtab_t *tab, size_t ohash,
+	size_t nhash, rhash_node_t *node)
+{
+	if(ohash != nhash) {
+		rhashtab_remove(tab, ohash, node);
+		rhashtab_set(tab, nhash, node);
+	}
+}
+
+/**
+ * @brief Get the number of entries of a resizable hashtable.
+ */
+static inline size_t rhashtab_num(rhashtab_t *tab) {
+	return tab->num;
+}
+
+#endif
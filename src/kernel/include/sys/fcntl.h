@@ -48,6 +48,13 @@
 #define SEEK_CUR 1
 #define SEEK_END 2
 
+#define POSIX_FADV_NORMAL	0
+#define POSIX_FADV_RANDOM	1
+#define POSIX_FADV_SEQUENTIAL	2
+#define POSIX_FADV_WILLNEED	3
+#define POSIX_FADV_DONTNEED	4
+#define POSIX_FADV_NOREUSE	5
+
 #define S_ISUID 04000
 #define S_ISGID 02000
 #define S_ISVTX 01000
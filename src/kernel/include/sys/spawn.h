@@ -0,0 +1,26 @@
+#ifndef SYS_SPAWN_H
+#define SYS_SPAWN_H
+
+#define __NEED_MODE_T
+#include <sys/alltypes.h>
+
+/*
+ * The file actions of the spawn syscall, which are applied in the child
+ * in the order given before the new image is loaded.
+ */
+#define SPAWN_CLOSE	0 /* close(fd) */
+#define SPAWN_DUP2	1 /* dup2(srcfd, fd) */
+#define SPAWN_OPEN	2 /* fd = open(path, oflag, mode) */
+
+#define SPAWN_ACTIONS_MAX 128
+
+struct spawn_action {
+	int cmd;
+	int fd;
+	int srcfd;
+	int oflag;
+	mode_t mode;
+	const char *path;
+};
+
+#endif
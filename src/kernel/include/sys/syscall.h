@@ -353,4 +353,9 @@
 #define SYS_kcmp		349
 #define SYS_finit_module	350
 
+/*
+ * ELOS specific syscalls.
+ */
+#define SYS_spawn		351
+
 #endif
\ No newline at end of file
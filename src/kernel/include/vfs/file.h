@@ -4,6 +4,7 @@
 #include <kern/atomic.h>
 #include <kern/sync.h>
 #include <vfs/_vpath.h>
+#include <vfs/readahead.h>
 #include <vfs/uio.h>
 #include <lib/list.h>
 #include <vm/flags.h>
@@ -94,6 +95,7 @@ typedef struct file {
 #define FOFF_WAITING	(1 << 1)
 	uint8_t foff_flags;
 	off_t foff;
+	file_ra_t ra;
 
 	sync_t pollq_lock;
 	list_t pollq;
@@ -0,0 +1,64 @@
+#ifndef VFS_READAHEAD_H
+#define VFS_READAHEAD_H
+
+/*
+ * Sequential readahead for the page cache of vnodes. Every open file
+ * keeps a readahead window, which is read asynchronously ahead of the
+ * reader:
+ *
+ * |<---------------- size ---------------->|
+ * |                   |<------ async ----->|
+ * +-------------------+--------------------+
+ * start               marker
+ *
+ * Once the reader hits the marker page, the next (larger) window is read
+ * while the reader is still consuming the current one. Cache misses,
+ * which are not part of a sequential stream, only read the requested
+ * pages.
+ */
+
+#define RA_DEFAULT_MAX	32U /* pages */
+#define RA_SEQUENTIAL_MAX 128U /* pages for POSIX_FADV_SEQUENTIAL */
+
+struct file;
+struct vnode;
+
+/*
+ * The offsets are page indices. Protected by the lock of the vm object
+ * of the vnode.
+ */
+typedef struct file_ra {
+	vm_objoff_t start; /* the first page of the current window */
+	size_t size; /* the size of the current window */
+	size_t async; /* the number of pages starting at the marker */
+	vm_objoff_t prev; /* the last page read */
+	size_t max; /* the maximum size of a window, 0 disables readahead */
+} file_ra_t;
+
+static inline void file_ra_init(file_ra_t *ra) {
+	ra->start = 0;
+	ra->size = 0;
+	ra->async = 0;
+	ra->prev = -1;
+	ra->max = RA_DEFAULT_MAX;
+}
+
+/**
+ * @brief Update the readahead state of a file before reading a page.
+ *
+ * Called by vop_generic_rdwr for every page read. The caller has to hold
+ * the lock of the vm object of @p node.
+ *
+ * @param off	The page aligned offset of the page read.
+ * @param size	The number of bytes the reader requested, starting at
+ *		@p off.
+ */
+void vnode_readahead(struct vnode *node, file_ra_t *ra, vm_objoff_t off,
+	size_t size);
+
+/**
+ * @brief Apply a posix_fadvise() hint to a file.
+ */
+int vnode_fadvise(struct file *file, off_t off, off_t len, int advice);
+
+#endif
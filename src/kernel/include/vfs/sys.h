@@ -89,6 +89,9 @@ int sys_mount(const char *usource, const char *utarget, const char *ufstype,
 	unsigned long flags, const void *data);
 
 int sys_fadvise64_64(int fd, SYSARG_LL(off), SYSARG_LL(len), int advice);
+int sys_sync(void);
+int sys_fsync(int fd);
+int sys_fdatasync(int fd);
 
 int sys_poll(struct pollfd *fds, nfds_t nfds, int timeout);
 int sys_ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout,
@@ -5,6 +5,7 @@
 
 struct kdirent;
 struct vm_page;
+struct file_ra;
 
 typedef enum uio_rw {
 	UIO_WR,
@@ -21,6 +22,7 @@ typedef struct uio {
 #define UIO_KERN	(1 << 1)
 #define UIO_USER	(0)
 	int flags;
+	struct file_ra *ra; /* readahead state of the file, may be NULL */
 } uio_t;
 
 /**
@@ -32,6 +34,7 @@ typedef struct uio {
 static inline void uio_init(uio_t *uio, off_t off, int flags, uio_rw_t rw) {
 	uio->rw = rw;
 	uio->flags = flags;
+	uio->ra = NULL;
 
 	if(off == -1) {
 		uio->off = 0;
@@ -25,12 +25,33 @@ void vnode_cache_add(struct vnode *node);
  */
 void vnode_cache_zeroref(struct vnode *node);
 
+/**
+ * Write the dirty pages and the dirty attributes of every cached vnode
+ * to disk.
+ */
+void vnode_cache_sync(void);
+
 /**
  * Retrieve a vdirent from the vdirent cache. @p node->lock has to held while
  * calling this function and has to be held until vd_cache_put is called.
+ * @p hash is the vdirent_hash() of the name. The dirent might be negative
+ * (VD_NEG).
  */
 struct vdirent *vdirent_cache_lookup(struct vnode *node, const char *name,
-	size_t namelen);
+	size_t namelen, size_t hash);
+
+/**
+ * Lookup a child of a directory using the vdirent cache and the vnode cache
+ * without locking the directory.
+ *
+ * @retval 0		The child was found and *childp is referenced.
+ * @retval -ENOENT	A negative dirent was found.
+ * @retval -EAGAIN	The child is not cached or a concurrent modification
+ *			of the directory was detected. The caller has to
+ *			lock the directory and retry.
+ */
+int vdirent_cache_lookup_fast(struct vnode *node, const char *name,
+	size_t namelen, size_t hash, struct vnode **childp);
 
 /**
  * Tell the vcache that this dirent is not needed anymore. 
@@ -42,26 +63,40 @@ void vdirent_cache_put(struct vnode *node, struct vdirent *dirent);
  * calling this function. 
  */
 struct vdirent *vdirent_cache_new(struct vnode *node, const char *name,
-	size_t namelen, ino_t ino, int flags);
+	size_t namelen, size_t hash, ino_t ino, int flags);
 
 /**
  * Add a dirent to the vdirent cache. @p node->lock has to held while calling
- * this function. 
+ * this function. A negative dirent of the same name is removed.
  */
 void vdirent_cache_add(struct vnode *node, struct vdirent *dirent);
 
 /**
  * Try to lookup a directory entry in the cache and remove it if it was found.
+ * Calls vdirent_cache_invalidate otherwise.
  */
 void vdirent_cache_try_rem(struct vnode *node, const char *name,
 	size_t namelen);
 
+/**
+ * Tell the lockless path walk that an entry of @p node was removed, which
+ * might have been cached before. @p node->lock has to be held (writer).
+ */
+void vdirent_cache_invalidate(struct vnode *node);
+
 /**
  * Remove a cached directory entry. After calling this, the caller must not call
  * vd_cache_put.
  */
 void vdirent_cache_rem(struct vnode *node, struct vdirent *dirent);
 
+/**
+ * Remove every cached dirent of a removed directory, including the negative
+ * ones, which keep the directory referenced. @p node->lock has to held while
+ * calling this function.
+ */
+void vdirent_cache_purge(struct vnode *node);
+
 
 /**
  * @brief Initialize the vcache.
@@ -1,13 +1,16 @@
 #ifndef VFS_VDIRENT_H
 #define VFS_VDIRENT_H
 
+#include <kern/rcu.h>
 #include <lib/list.h>
 #include <vm/flags.h>
 
 struct filesys;
+struct vnode;
 
 #define VDNAME_INLINE	32
 #define VD_PERM		(1 << 0)
+#define VD_NEG		(1 << 1) /* the name does not exist in the directory */
 
 /**
  * @brief A directory entry
@@ -16,8 +19,11 @@ typedef struct vdirent {
 	struct filesys *fs;
 	list_node_t node; /* node for name cache */
 	list_node_t lru_node;
+	rcu_head_t rcu;
 	ino_t owner; /* might not be needed */
-	ino_t ino;
+	ino_t ino; /* 0 for negative dirents */
+	struct vnode *dir; /* referenced by negative dirents */
+	size_t hash; /* vdirent_hash() of the name */
 	int flags;
 
 	size_t namelen;
@@ -27,6 +33,22 @@ typedef struct vdirent {
 	};
 } vdirent_t;
 
+/**
+ * @brief Hash the name of a directory entry.
+ *
+ * The hash of a path component is calculated once during a path walk and
+ * used for every lookup of the component in the vdirent cache.
+ */
+static inline size_t vdirent_hash(const char *name, size_t namelen) {
+	size_t hash = 5381;
+
+	while(namelen--) {
+		hash = ((hash << 5) + hash) + *name++;
+	}
+
+	return hash;
+}
+
 /**
  * @brief Get the name of a dirent.
  */
@@ -42,7 +64,8 @@ static inline const char *vdirent_name(vdirent_t *dirent) {
  * @brief Allocate a new dirent.
  */
 vdirent_t *vdirent_alloc(struct filesys *fs, const char *name, size_t length,
-		ino_t owner, ino_t ino, int flags, vm_flags_t allocflags);
+		size_t hash, ino_t owner, ino_t ino, int flags,
+		vm_flags_t allocflags);
 
 /**
  * @brief Free a dirent.
@@ -162,6 +162,23 @@ typedef struct vnode {
 	vnode_flags_t flags;
 	size_t writecnt;
 
+	/*
+	 * Incremented whenever a cached dirent of this directory is
+	 * removed (see vdirent_cache_lookup_fast).
+	 */
+	size_t dseq;
+
+	/*
+	 * The last vnode_cache_sync pass, which collected this node.
+	 */
+	size_t sync_gen;
+
+	/*
+	 * The number of cached negative dirents of this directory, each of
+	 * which references the directory (see vdirent_cache_purge).
+	 */
+	size_t nneg;
+
 	/*
 	 * blksz_shift is constant TODO MOVE TO FS?
 	 */
@@ -273,6 +290,24 @@ int vnode_sync(vnode_t *node);
  */
 void vnode_sched_sync_pages(vnode_t *node);
 
+/**
+ * @brief Write the dirty pages of a vnode to disk.
+ *
+ * Writes the dirty pages of the vnode and waits until the writes
+ * finished. Pages being written by pageout are waited for as well.
+ * The caller must not hold the object lock of the vnode.
+ */
+int vnode_write_pages(vnode_t *node);
+
+/**
+ * @brief Write a vnode and the filesystem metadata to disk.
+ *
+ * Writes the dirty pages of the vnode, the inode and the dirty block
+ * cache buffers of the filesystem to disk and waits until the data
+ * reached the device.
+ */
+int vnode_fsync(vnode_t *node);
+
 /**
  * @brief Check if the current process may access this node.
  *
@@ -52,15 +52,24 @@ typedef int 	vop_bmap_t	(struct vnode *, bool alloc, blkno_t,
 					blkno_t *);
 typedef int	vop_sync_t 		(struct vnode *);
 typedef int	vop_truncate_t	(struct vnode *, vnode_size_t size);
+/**
+ * Fill a busy page with the data of a vnode. The page has to be unbusied
+ * once it is filled, which may happen asynchronously. An asynchronous
+ * read reports its errors using vm_object_page_error.
+ */
 typedef int 	vop_pagein_t	(struct vnode *node, vm_objoff_t off,
 					struct vm_page *page);
 typedef int	vop_pageout_t	(struct vnode *, struct vm_page *);
+typedef int	vop_readahead_t	(struct vnode *node, vm_objoff_t off,
+					size_t num, size_t marker);
 typedef bool	vop_set_exe_t	(struct vnode *node);
 typedef void	vop_unset_exe_t	(struct vnode *node);
 
 typedef struct vnode_ops {
 	/*
-	 * TODO open/close are currently never called...
+	 * TODO open is currently never called. close is optional and only
+	 * called, with the vnode locked exclusively, when a file opened
+	 * for writing is closed.
 	 */
 	vop_open_t 	*open;
 	vop_close_t 	*close;
@@ -81,6 +90,13 @@ typedef struct vnode_ops {
 	vop_sync_t	*sync;
 	vop_pageout_t	*pageout;
 	vop_pagein_t	*pagein;
+
+	/*
+	 * Optional: asynchronously page in @p num pages starting at @p off
+	 * and mark the page with the index @p marker as the readahead
+	 * marker (see vfs/readahead.h).
+	 */
+	vop_readahead_t	*readahead;
 	vop_set_exe_t	*set_exe;
 	vop_unset_exe_t	*unset_exe;
 } vnode_ops_t;
@@ -100,6 +116,7 @@ void __noreturn vop_panic(struct vnode *node);
 vop_rdwr_t vop_generic_rdwr;
 vop_pagein_t vop_generic_pagein;
 vop_pageout_t vop_generic_pageout;
+vop_readahead_t vop_generic_readahead;
 vop_set_exe_t vop_generic_set_exe;
 vop_unset_exe_t vop_generic_unset_exe;
 
@@ -14,6 +14,13 @@ void vm_kern_unmap_quick(void *ptr);
 void *vm_kern_map_phys_early(vm_paddr_t addr, vm_vsize_t size);
 void vm_kern_unmap_phys_early(void *ptr, vm_vsize_t size);
 
+/**
+ * @brief Free the physical memory of a part of the kernel image.
+ *
+ * Defined by architecture code.
+ */
+void vm_kern_free_image(void *ptr, vm_vsize_t size);
+
 void *vm_mapdev(vm_paddr_t phys, vm_vsize_t size, vm_memattr_t attr);
 void vm_unmapdev(void *ptr, vm_vsize_t size);
 
@@ -62,6 +62,17 @@ void mmu_ctx_switch(mmu_ctx_t *ctx);
 
 void mmu_ctx_create(mmu_ctx_t *ctx);
 
+/**
+ * @brief Destroy an mmu context.
+ *
+ * The context must not be loaded on any processor. Any page tables still
+ * present are freed without invalidating the TLBs.
+ */
 void mmu_ctx_destroy(mmu_ctx_t *ctx);
 
+/**
+ * @brief Get the number of pages mapped in the user part of a context.
+ */
+size_t mmu_ctx_mapped(mmu_ctx_t *ctx);
+
 #endif
\ No newline at end of file
@@ -290,6 +290,19 @@ int vm_object_page_resident(vm_object_t *object, vm_objoff_t off,
  */
 void vm_object_page_error(vm_object_t *object, struct vm_page *page);
 
+/**
+ * @brief Wait until a page of an object is not busy anymore.
+ *
+ * The lock of @p object is released while waiting, so that the other
+ * pages of the object can be used while the page is being filled. The
+ * caller must hold the lock of @p object and a pin of @p page.
+ *
+ * @retval true		The page is not busy anymore.
+ * @retval false	Filling the page failed and the page was removed
+ *			from @p object.
+ */
+bool vm_object_page_wait(vm_object_t *object, struct vm_page *page);
+
 /**
  * @brief Change the size of a virtual memory object.
  *
@@ -303,6 +316,16 @@ void vm_object_page_error(vm_object_t *object, struct vm_page *page);
  */
 void vm_object_resize(vm_object_t *object, vm_objoff_t size);
 
+/**
+ * @brief Free the clean pages of an object in a range.
+ *
+ * Every page in [@p start, @p end), which is neither busy nor dirty, is
+ * unmapped and freed. Used to drop cached file data, which is not needed
+ * anymore. The caller must hold the lock of @p object.
+ */
+void vm_object_page_drop(vm_object_t *object, vm_objoff_t start,
+	vm_objoff_t end);
+
 /**
  * @brief Handle a page fault.
  *
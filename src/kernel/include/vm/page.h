@@ -25,6 +25,7 @@ struct vm_object;
 #define VM_PG_ERR	(1 << 6)
 #define VM_PG_DEALLOC	(1 << 7)
 #define VM_PG_LOCKED	(1 << 8)
+#define VM_PG_READAHEAD	(1 << 9) /* reading this page triggers readahead */
 
 /**
  * @brief Convert a page hash node into a page.
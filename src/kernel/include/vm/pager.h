@@ -5,6 +5,12 @@ struct vm_object;
 struct vm_pghash_node;
 struct vm_page;
 
+/*
+ * The pagein callback is called with the lock of the object held and
+ * unbusies the page once it is filled, which may happen asynchronously
+ * after the callback returned. If the page cannot be filled
+ * asynchronously, vm_object_page_error is called instead.
+ */
 typedef int (vm_pager_pagein_t) (struct vm_object *,
 	struct vm_pghash_node *node, struct vm_page *);
 typedef int (vm_pager_pageout_t) (struct vm_object *, struct vm_page *);
@@ -18,6 +18,40 @@ void vm_free_phys(vm_paddr_t phys);
 
 void vm_page_free(struct vm_page *page);
 
+/**
+ * @brief Free multiple pages at once, while acquiring the lock of the
+ *	  physical memory allocator only once.
+ */
+void vm_page_free_batch(struct vm_page **pages, size_t num);
+
+#define VM_PAGE_BATCH 32
+
+/*
+ * Collect pages, which are to be freed, and free them in batches.
+ */
+typedef struct vm_page_batch {
+	size_t num;
+	struct vm_page *pages[VM_PAGE_BATCH];
+} vm_page_batch_t;
+
+#define VM_PAGE_BATCH_INIT (vm_page_batch_t) { .num = 0 }
+
+static inline void vm_page_batch_flush(vm_page_batch_t *batch) {
+	if(batch->num) {
+		vm_page_free_batch(batch->pages, batch->num);
+		batch->num = 0;
+	}
+}
+
+static inline void vm_page_batch_add(vm_page_batch_t *batch,
+	struct vm_page *page)
+{
+	batch->pages[batch->num++] = page;
+	if(batch->num == VM_PAGE_BATCH) {
+		vm_page_batch_flush(batch);
+	}
+}
+
 vm_psize_t vm_page_size(struct vm_page *page);
 vm_pgaddr_t vm_page_addr(struct vm_page *page);
 
@@ -32,6 +66,25 @@ struct vm_page *vm_phys_to_page(vm_paddr_t addr);
  */
 vm_psize_t vm_phys_get_total(void);
 
+/**
+ * @brief Get the page address (atop) of the end of the highest physical
+ *	  memory segment.
+ */
+vm_pgaddr_t vm_phys_end(void);
+
+/**
+ * @brief Get the range of the physical memory segment @p i.
+ *
+ * @return false if there is no such segment
+ */
+bool vm_physeg_range(size_t i, vm_pgaddr_t *start, vm_npages_t *size);
+
+/**
+ * @brief Check whether a range of physical memory lies within one physical
+ *	  memory segment, i.e. is RAM.
+ */
+bool vm_phys_is_ram(vm_paddr_t addr, vm_psize_t size);
+
 /**
  * @brief Get the number of free physical pages in the system.
  */
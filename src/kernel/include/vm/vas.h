@@ -186,6 +186,9 @@ void vm_vas_init(vm_vas_t *vas, vm_vaddr_t start, vm_vaddr_t end,
 
 /**
  * @brief Deinitialize a virtual address space structure.
+ *
+ * Any remaining mappings are freed. The address space must not be
+ * active on any processor.
  */
 void vm_vas_destroy(vm_vas_t *vas);
 
@@ -286,6 +289,9 @@ vm_vas_t *vm_user_vas_alloc(void);
 
 /**
  * @brief Free a user virtual address space.
+ *
+ * The address space must not be active on any processor. Large address
+ * spaces are torn down asynchronously by a reaper thread.
  */
 void vm_user_vas_free(vm_vas_t *vas);
 
@@ -29,14 +29,12 @@
 #include <lib/hashtab.h>
 #include <lib/string.h>
 
-#define DRIVER_HT_SIZE 1024
-
 typedef struct driver {
 	DRIVER_COMMON;
 } driver_t;
 
 static sync_t driver_lock = SYNC_INIT(MUTEX);
-static hashtab_t driver_ht;
+static rhashtab_t driver_ht;
 
 static size_t driver_hash(const char *name, driver_type_t type) {
 	return hash_str(name) ^ type;
@@ -50,7 +48,7 @@ void *driver_get(const char *name, driver_type_t type) {
 	hash = driver_hash(name, type);
 
 	sync_scope_acquire(&driver_lock);
-	hashtab_search(entry, hash, &driver_ht) {
+	rhashtab_search(entry, hash, &driver_ht) {
 		driver = entry->driver;
 
 		if(entry->type == type && !strcmp(driver->name, name)) {
@@ -72,13 +70,13 @@ void driver_put(void *_driver) {
 void driver_add(driver_entry_t *entry) {
 	driver_t *driver = entry->driver;
 
-	list_node_init(entry, &entry->node);
+	rhash_node_init(entry, &entry->node);
 	entry->hash = driver_hash(driver->name, entry->type);
 	entry->ref = 0;
 	driver->drv_entry = entry;
 
 	sync_scope_acquire(&driver_lock);
-	hashtab_set(&driver_ht, entry->hash, &entry->node);
+	rhashtab_set(&driver_ht, entry->hash, &entry->node);
 }
 
 int driver_remove(driver_entry_t *entry) {
@@ -86,7 +84,7 @@ int driver_remove(driver_entry_t *entry) {
 	if(entry->ref != 0) {
 		return -EBUSY;
 	} else {
-		hashtab_remove(&driver_ht, entry->hash, &entry->node);
+		rhashtab_remove(&driver_ht, entry->hash, &entry->node);
 		return 0;
 	}
 }
@@ -94,7 +92,7 @@ int driver_remove(driver_entry_t *entry) {
 static __init int driver_init(void) {
 	driver_entry_t *entry;
 
-	hashtab_alloc(&driver_ht, DRIVER_HT_SIZE, VM_WAIT);
+	rhashtab_alloc(&driver_ht, RHASHTAB_MIN, VM_WAIT);
 	section_foreach(entry, DRIVER_SECTION) {
 		driver_add(entry);
 	}
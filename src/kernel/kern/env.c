@@ -26,12 +26,11 @@
 #include <kern/env.h>
 #include <kern/init.h>
 #include <lib/hashtab.h>
+#include <lib/rhashtab.h>
 #include <lib/string.h>
 
-#define ENV_HT_SIZE 1024
-
 static bool env_init = false;
-static hashtab_t env_ht;
+static rhashtab_t env_ht;
 
 void _kern_var_sets(env_var_t *var, const char *value) {
 	strlcpy(var->val_str, value, ENV_STRSZ);
@@ -54,7 +53,7 @@ static env_var_t *env_get(const char *name) {
 	size_t hash;
 
 	hash = hash_str(name);
-	hashtab_search(var, hash, &env_ht) {
+	rhashtab_search(var, hash, &env_ht) {
 		if(!strcmp(name, var->name)) {
 			return var;
 		}
@@ -83,11 +82,11 @@ env_var_t *kern_env_get(const char *name) {
 void __init init_env(void) {
 	env_var_t *cur;
 
-	hashtab_alloc(&env_ht, ENV_HT_SIZE, VM_WAIT);
+	rhashtab_alloc(&env_ht, RHASHTAB_MIN, VM_WAIT);
 	section_foreach(cur, ENV_SECTION) {
-		list_node_init(cur, &cur->node);
+		rhash_node_init(cur, &cur->node);
 		cur->hash = hash_str(cur->name);
-		hashtab_set(&env_ht, cur->hash, &cur->node);
+		rhashtab_set(&env_ht, cur->hash, &cur->node);
 	}
 
 	env_init = true;
@@ -431,32 +431,32 @@ static int exec_copyin(exec_img_t *image, const char **argv,
 	return exec_copyin_vec(image, env, seg, &image->envc, &image->envsize);
 }
 
-int kern_execve(const char *path, const char **argv, const char **envp,
-	vm_seg_t seg)
+int exec_prepare(exec_img_t *image, const char *path, const char **argv,
+	const char **envp, vm_seg_t seg)
 {
-	proc_t *proc = cur_proc();
-	proc_image_t *procimg;
-	vm_vas_t *vas, *old;
-	binfmt_t *binfmt;
-	exec_img_t image;
-	size_t pathlen;
 	int err;
 
 	/*
 	 * Initialize the image structure and lookup the path.
 	 */
-	err = exec_init_img(&image, path);
+	err = exec_init_img(image, path);
 	if(err) {
-		goto err0;
+		return err;
 	}
 
 	/*
 	 * Copy argv and envp into a kernel buffer.
 	 */
-	err = exec_copyin(&image, argv, envp, seg);
-	if(err) {
-		goto err0;
-	}
+	return exec_copyin(image, argv, envp, seg);
+}
+
+int exec_load(exec_img_t *image, const char *path) {
+	proc_t *proc = cur_proc();
+	proc_image_t *procimg;
+	vm_vas_t *vas, *old;
+	binfmt_t *binfmt;
+	size_t pathlen;
+	int err;
 
 	/*
 	 * Enter single threadding mode, but do not kill the other threads
@@ -474,12 +474,12 @@ int kern_execve(const char *path, const char **argv, const char **envp,
 	 * threads in the process are currently not running.
 	 */
 	vas = vm_user_vas_alloc();
-	image.vas = vas;
+	image->vas = vas;
 
 	/*
 	 * Map the first page of the node.
 	 */
-	err = exec_lock_map_node(&image);
+	err = exec_lock_map_node(image);
 	if(err) {
 		goto err1;
 	}
@@ -499,7 +499,7 @@ int kern_execve(const char *path, const char **argv, const char **envp,
 
 	do {
 		foreach(binfmt, &binfmt_list) {
-			err = binfmt->exec(&image);
+			err = binfmt->exec(image);
 			if(err == EXEC_NOMAG) {
 				err = -ENOEXEC;
 				continue;
@@ -523,16 +523,16 @@ int kern_execve(const char *path, const char **argv, const char **envp,
 	 * The binary has been mmaped into the memory space
 	 * of the process, so the node is not needed anymore.
 	 */
-	vnode_unlock(image.node);
+	vnode_unlock(image->node);
 
-	err = exec_init_stack(&image, binfmt);
+	err = exec_init_stack(image, binfmt);
 	binfmt = NULL; /* for safety */
 	rwunlock(&binfmt_lock);
 	if(err) {
 		goto err2;
 	}
 
-	err = vm_shpage_map(image.vas);
+	err = vm_shpage_map(image->vas);
 	if(err) {
 		goto err2;
 	}
@@ -551,19 +551,14 @@ int kern_execve(const char *path, const char **argv, const char **envp,
 	/*
 	 * Reset registers and set new IP and SP.
 	 */
-	arch_uthread_setup(cur_thread(), image.entry,
-		(uintptr_t)image.stackptr);
+	arch_uthread_setup(cur_thread(), image->entry,
+		(uintptr_t)image->stackptr);
 
 	/*
-	 * Free the old vmctx. Remember that vm_vas_unmap can only unmap
-	 * from the currently active vas.
+	 * Free the old vas. It is no longer active on any processor,
+	 * because the other threads of the process are gone.
 	 */
-	proc->vas = old;
-	vm_vas_switch(old);
-	vm_vas_unmap(old, vm_vas_start(old), vm_vas_size(old));
-	proc->vas = image.vas;
-	vm_vas_switch(proc->vas);
-	vm_user_vas_free(old);;
+	vm_user_vas_free(old);
 
 	pathlen = strlen(path);
 	procimg = kmalloc(sizeof(proc_image_t) + pathlen + 1, VM_WAIT);
@@ -573,33 +568,28 @@ int kern_execve(const char *path, const char **argv, const char **envp,
 	proc_set_image(proc, procimg);
 
 	/*
-	 * Free the resources allocated during execve(). 'image.vas' is set to
+	 * Free the resources allocated during execve(). 'image->vas' is set to
 	 * NULL in order to keep exec_cleanup from freeing it.
 	 */
-	image.vas = NULL;
-	exec_cleanup(&image);
+	image->vas = NULL;
+	exec_cleanup(image);
 
 	return 0;
 
 err2:
 	/*
-	 * Unmap everything in the new address space, while the address space
-	 * is still loaded.
-	 */
-	vm_vas_unmap(vas, vm_vas_start(vas), vm_vas_size(vas));
-
-	/*
-	 * Switch back to the old virtual address space.
+	 * Switch back to the old virtual address space, the new one is
+	 * freed by exec_cleanup.
 	 */
 	proc->vas = old;
 	vm_vas_switch(old);
 
 	/*
-	 * image.node may be NULL if the binfmt-driver called exec_interp
+	 * image->node may be NULL if the binfmt-driver called exec_interp
 	 * and exec_interp() failed while mapping the interpreter header.
 	 */
-	if(image.node) {
-		vnode_unlock(image.node);
+	if(image->node) {
+		vnode_unlock(image->node);
 	}
 err1:
 	/*
@@ -607,10 +597,25 @@ err1:
 	 */
 	proc_singlethread(PROC_ST_END);
 err0:
-	exec_cleanup(&image);
+	exec_cleanup(image);
 	return err;
 }
 
+int kern_execve(const char *path, const char **argv, const char **envp,
+	vm_seg_t seg)
+{
+	exec_img_t image;
+	int err;
+
+	err = exec_prepare(&image, path, argv, envp, seg);
+	if(err) {
+		exec_cleanup(&image);
+		return err;
+	}
+
+	return exec_load(&image, path);
+}
+
 int sys_execve(const char *upath, const char **uargv, const char **uenvp) {
 	char *path;
 	int err;
@@ -29,21 +29,25 @@
 #include <kern/user.h>
 #include <kern/atomic.h>
 #include <kern/sched.h>
-#include <lib/list-locked.h>
+#include <kern/proc.h>
+#include <kern/time.h>
 #include <lib/string.h>
 #include <vm/vas.h>
 #include <vm/object.h>
+#include <vm/malloc.h>
+#include <vm/phys.h>
 #include <sys/futex.h>
 #include <sys/pow2.h>
 
 /*
- * TODO increae that sucker
+ * The futex hash has FHT_PER_CPU buckets per cpu, but at most one
+ * bucket per FHT_PAGES_PER_BUCKET pages of physical memory.
  */
-#define FHT_SIZE 	1024 /* Must be a power of 2 */
-#define FHT_MASK	(FHT_SIZE - 1)
-#define FHT_SHIFT	8
-#define FHT_HASH(x, y)	((((x) >> FHT_SHIFT) ^ (y)) & FHT_MASK)
-#define FUTEX_SZ_MAX	sizeof(uint64_t)
+#define FHT_PER_CPU		256
+#define FHT_MIN			256
+#define FHT_PAGES_PER_BUCKET	4
+#define FUTEX_SZ_MAX		sizeof(uint64_t)
+#define FUTEX_BITSET_ANY	UINT32_MAX
 
 typedef struct futex_addr {
 	union {
@@ -56,28 +60,47 @@ typedef struct futex_addr {
 	bool shared;
 } futex_addr_t;
 
+typedef struct futex_bucket {
+	sync_t lock;
+	list_t waiters;
+
+	/*
+	 * The number of waiters, which is also updated before the waiter
+	 * is added to the list. This allows kern_wake to skip buckets
+	 * without any waiters without taking the lock.
+	 */
+	size_t nwait;
+} futex_bucket_t;
+
+/*
+ * Every waiter sleeps on its own waitqueue, which allows moving the
+ * waiter from one bucket to another (FUTEX_REQUEUE).
+ */
 typedef struct futex_wait {
-	waiter_t wait;
+	list_node_t node;
+	futex_bucket_t *bucket; /* changed with both bucket locks held */
+	bool queued; /* protected by bucket->lock */
 	futex_addr_t addr;
+	uint32_t bitset;
+	waitqueue_t wq;
+	waiter_t wait;
 } futex_wait_t;
 
-static waitqueue_t futex_khash[FHT_SIZE];
-static waitqueue_t futex_uhash[FHT_SIZE];
-
-static futex_wait_t *waiter_to_futex(waiter_t *wait) {
-	return container_of(wait, futex_wait_t, wait);
-}
+static futex_bucket_t *futex_hash;
+static size_t futex_hash_mask;
 
 /**
- * @brief Get the waitqueue on which the caller should sleep.
+ * @brief Get the bucket of a futex address.
  */
-static inline waitqueue_t *futex_waitq(futex_addr_t *addr, int flags) {
-	size_t hash = FHT_HASH(addr->addr, (uintptr_t)addr->ptr);
-	if(flags & KWAIT_USR) {
-		return &futex_uhash[hash];
-	} else {
-		return &futex_khash[hash];
-	}
+static inline futex_bucket_t *futex_bucket(futex_addr_t *addr) {
+	uint32_t hash;
+
+	hash = (uint32_t)(addr->addr >> 2) ^ (uint32_t)(addr->addr >> 32) ^
+		(uint32_t)(uintptr_t)addr->ptr;
+	hash *= 0x9e3779b1; /* golden ratio */
+	hash ^= hash >> 16;
+
+	return &futex_hash[hash & futex_hash_mask];
 }
 
 /**
@@ -146,28 +169,154 @@ static void futex_addr_done(futex_addr_t *faddr) {
 	}
 }
 
-int __kern_wait(void *addr, size_t val_size, void *val, int flags,
-	struct timespec *timeout)
+/**
+ * @brief Lock two buckets without deadlocking.
+ */
+static void futex_bucket_lock2(futex_bucket_t *b1, futex_bucket_t *b2) {
+	if(b1 == b2) {
+		sync_acquire(&b1->lock);
+	} else if(b1 < b2) {
+		sync_acquire(&b1->lock);
+		sync_acquire(&b2->lock);
+	} else {
+		sync_acquire(&b2->lock);
+		sync_acquire(&b1->lock);
+	}
+}
+
+static void futex_bucket_unlock2(futex_bucket_t *b1, futex_bucket_t *b2) {
+	sync_release(&b1->lock);
+	if(b1 != b2) {
+		sync_release(&b2->lock);
+	}
+}
+
+/**
+ * @brief Check whether there might be waiters in a bucket.
+ *
+ * The caller has already changed the futex value, so a waiter either
+ * incremented nwait before the change or sees the new value.
+ */
+static inline bool futex_bucket_waiters(futex_bucket_t *bucket) {
+	atomic_thread_fence(ATOMIC_SEQ_CST);
+	return atomic_load(&bucket->nwait) != 0;
+}
+
+static void futex_queue(futex_wait_t *fw) {
+	futex_bucket_t *bucket = futex_bucket(&fw->addr);
+
+	fw->bucket = bucket;
+	atomic_inc(&bucket->nwait);
+	synchronized(&bucket->lock) {
+		list_append(&bucket->waiters, &fw->node);
+		fw->queued = true;
+	}
+}
+
+/**
+ * @brief Remove a waiter from its bucket.
+ *
+ * This always acquires the lock of the bucket, even if the waiter was
+ * already removed, to make sure that a concurrent kern_wake() is done
+ * with the waiter.
+ *
+ * @retval true		The waiter was still queued.
+ * @retval false	The waiter was woken up.
+ */
+static bool futex_unqueue(futex_wait_t *fw) {
+	futex_bucket_t *bucket;
+	bool queued;
+
+	/*
+	 * The waiter might be requeued while waiting for the lock.
+	 */
+	for(;;) {
+		bucket = atomic_load(&fw->bucket);
+		sync_acquire(&bucket->lock);
+		if(bucket == fw->bucket) {
+			break;
+		}
+
+		sync_release(&bucket->lock);
+	}
+
+	queued = fw->queued;
+	if(queued) {
+		list_remove(&bucket->waiters, &fw->node);
+		atomic_dec(&bucket->nwait);
+		fw->queued = false;
+	}
+
+	sync_release(&bucket->lock);
+	return queued;
+}
+
+/**
+ * @brief Wake up a waiter. The caller holds the lock of the bucket.
+ */
+static void futex_wake_waiter(futex_bucket_t *bucket, futex_wait_t *fw) {
+	sync_assert(&bucket->lock);
+
+	list_remove(&bucket->waiters, &fw->node);
+	atomic_dec(&bucket->nwait);
+	fw->queued = false;
+	wakeup(&fw->wq, SCHED_NORMAL);
+}
+
+/**
+ * @brief Wake up at most @p num waiters of a futex. The caller holds
+ *	  the lock of the bucket.
+ */
+static int futex_wake_locked(futex_bucket_t *bucket, futex_addr_t *faddr,
+	int num, uint32_t bitset)
+{
+	futex_wait_t *fw;
+	int i = 0;
+
+	sync_assert(&bucket->lock);
+	foreach(fw, &bucket->waiters) {
+		if(i >= num) {
+			break;
+		}
+
+		if(futex_addr_cmp(faddr, &fw->addr) && (fw->bitset & bitset)) {
+			futex_wake_waiter(bucket, fw);
+			i++;
+		}
+	}
+
+	return i;
+}
+
+static int futex_wait(void *addr, size_t val_size, void *val, int flags,
+	uint32_t bitset, struct timespec *timeout)
 {
 	uint8_t buf[FUTEX_SZ_MAX];
-	futex_wait_t wait;
-	waitqueue_t *waitq;
+	futex_wait_t fw;
 	int err;
 
 	assert(pow2_p(val_size));
 	assert(val_size <= FUTEX_SZ_MAX);
 
-	err = futex_addr(addr, flags, &wait.addr);
+	if(bitset == 0) {
+		return -EINVAL;
+	}
+
+	err = futex_addr(addr, flags, &fw.addr);
 	if(err) {
 		return err;
 	}
 
-	waitq = futex_waitq(&wait.addr, flags);
+	fw.bitset = bitset;
+	list_node_init(&fw, &fw.node);
+	waitqueue_init(&fw.wq);
 
 	/*
-	 * Register or waiter on the waitqueue.
+	 * Register our waiter, before checking the value, so that
+	 * no kern_wake() is lost.
 	 */
-	wait_init_prep(waitq, &wait.wait);
+	wait_init_prep(&fw.wq, &fw.wait);
+	futex_queue(&fw);
 
 	/*
 	 * Check if _addr_ still contains the contents _val_.
@@ -187,111 +336,815 @@ int __kern_wait(void *addr, size_t val_size, void *val, int flags,
 		}
 	}
 
+	if(err == 0) {
+		/*
+		 * Sleep until a kern_wake() or an interrupt wakes us up again.
+		 */
+		err = wait_sleep_timeout(&fw.wq, &fw.wait,
+			(flags & KWAIT_INTR) ? WAIT_INTERRUPTABLE : 0,
+			timeout);
+		/*
+		 * TODO
+		 */
+		if(err == -ERESTART) {
+			err = -EINTR;
+		}
+	}
+
+	if(futex_unqueue(&fw)) {
+		/*
+		 * Nobody woke us up.
+		 */
+		wait_abort(&fw.wq, &fw.wait);
+	} else if(err != -EAGAIN && err != -EFAULT) {
+		/*
+		 * A wakeup raced with the timeout or the interrupt. The
+		 * wakeup must not be lost.
+		 */
+		err = 0;
+	}
+
+	futex_addr_done(&fw.addr);
+	waiter_destroy(&fw.wait);
+	waitqueue_destroy(&fw.wq);
+	list_node_destroy(&fw.node);
+	return err;
+}
+
+int __kern_wait(void *addr, size_t val_size, void *val, int flags,
+	struct timespec *timeout)
+{
+	return futex_wait(addr, val_size, val, flags, FUTEX_BITSET_ANY,
+		timeout);
+}
+
+static int futex_wake(void *addr, int num, int flags, uint32_t bitset) {
+	futex_bucket_t *bucket;
+	futex_addr_t faddr;
+	int err, i = 0;
+
+	if(num <= 0) {
+		return 0;
+	} else if(bitset == 0) {
+		return -EINVAL;
+	}
+
+	err = futex_addr(addr, flags, &faddr);
+	if(err) {
+		return err;
+	}
+
+	bucket = futex_bucket(&faddr);
+	if(futex_bucket_waiters(bucket)) {
+		synchronized(&bucket->lock) {
+			i = futex_wake_locked(bucket, &faddr, num, bitset);
+		}
+	}
+
+	futex_addr_done(&faddr);
+	return i;
+}
+
+int kern_wake(void *addr, int num, int flags) {
+	return futex_wake(addr, num, flags, FUTEX_BITSET_ANY);
+}
+
+/**
+ * @brief Wake up @p nwake waiters of @p uaddr and move at most
+ *	  @p nrequeue other waiters to @p uaddr2.
+ *
+ * If @p cmp is true, the operation is only performed if @p uaddr still
+ * contains @p cmpval. The value is checked before locking the buckets.
+ * A waiter, which changes the value in the meantime, is moved as well,
+ * which is harmless, because a waiter may always be woken up spuriously.
+ */
+static int futex_requeue(uint32_t *uaddr, uint32_t *uaddr2, int nwake,
+	int nrequeue, int flags, bool cmp, uint32_t cmpval)
+{
+	futex_addr_t faddr, faddr2;
+	futex_bucket_t *b1, *b2;
+	size_t nref = 0;
+	futex_wait_t *fw;
+	int err, i = 0;
+	uint32_t cur;
+
+	if(nwake < 0 || nrequeue < 0) {
+		return -EINVAL;
+	}
+
+	if(cmp) {
+		err = copyin_atomic(&cur, uaddr, sizeof(cur));
+		if(err) {
+			return err;
+		} else if(cur != cmpval) {
+			return -EAGAIN;
+		}
+	}
+
+	err = futex_addr(uaddr, flags, &faddr);
 	if(err) {
-		wait_abort(waitq, &wait.wait);
+		return err;
+	}
+
+	err = futex_addr(uaddr2, flags, &faddr2);
+	if(err) {
+		futex_addr_done(&faddr);
+		return err;
+	}
+
+	b1 = futex_bucket(&faddr);
+	b2 = futex_bucket(&faddr2);
+	if(!futex_bucket_waiters(b1)) {
 		goto out;
 	}
 
+	futex_bucket_lock2(b1, b2);
+	foreach(fw, &b1->waiters) {
+		if(!futex_addr_cmp(&faddr, &fw->addr)) {
+			continue;
+		}
+
+		if(i < nwake) {
+			futex_wake_waiter(b1, fw);
+		} else if(i < nwake + nrequeue) {
+			/*
+			 * The waiter owns a reference to the object of
+			 * a shared futex. The reference to the old object
+			 * is dropped below. The keys might be of different
+			 * types (private vs. shared).
+			 */
+			if(faddr2.shared) {
+				vm_object_ref(faddr2.object);
+			}
+			if(fw->addr.shared) {
+				nref++;
+			}
+
+			fw->addr = faddr2;
+			if(b1 != b2) {
+				list_remove(&b1->waiters, &fw->node);
+				atomic_dec(&b1->nwait);
+				atomic_inc(&b2->nwait);
+				list_append(&b2->waiters, &fw->node);
+				atomic_store(&fw->bucket, b2);
+			}
+		} else {
+			break;
+		}
+
+		i++;
+	}
+	futex_bucket_unlock2(b1, b2);
+
+	while(nref--) {
+		vm_object_unref(faddr.object);
+	}
+
+out:
+	futex_addr_done(&faddr);
+	futex_addr_done(&faddr2);
+	return i;
+}
+
+/**
+ * @brief Apply the operation of FUTEX_WAKE_OP.
+ *
+ * @param[out] oldval	The value before the operation.
+ */
+static int futex_atomic_op(uint32_t *uaddr, int encoded, uint32_t *oldval) {
+	uint32_t op = (encoded >> 28) & 0xf, oparg = (encoded >> 12) & 0xfff;
+	uint32_t old, new, cur;
+	int err;
+
+	if(op & FUTEX_OP_OPARG_SHIFT) {
+		if(oparg > 31) {
+			return -EINVAL;
+		}
+
+		oparg = 1U << oparg;
+		op &= ~FUTEX_OP_OPARG_SHIFT;
+	}
+
+	err = copyin_atomic(&old, uaddr, sizeof(old));
+	if(err) {
+		return err;
+	}
+
+	for(;;) {
+		switch(op) {
+		case FUTEX_OP_SET:
+			new = oparg;
+			break;
+		case FUTEX_OP_ADD:
+			new = old + oparg;
+			break;
+		case FUTEX_OP_OR:
+			new = old | oparg;
+			break;
+		case FUTEX_OP_ANDN:
+			new = old & ~oparg;
+			break;
+		case FUTEX_OP_XOR:
+			new = old ^ oparg;
+			break;
+		default:
+			return -ENOSYS;
+		}
+
+		err = ucmpxchg32(uaddr, old, new, &cur);
+		if(err) {
+			return err;
+		} else if(cur == old) {
+			*oldval = old;
+			return 0;
+		}
+
+		old = cur;
+	}
+}
+
+static int futex_op_cmp(int encoded, uint32_t oldval) {
+	int32_t cmparg = encoded & 0xfff, val = oldval;
+
 	/*
-	 * Sleep until a kern_wake() or an interrupt wakes us up again.
+	 * cmparg is a signed 12bit value.
 	 */
-	err = wait_sleep_timeout(waitq, &wait.wait,
-		(flags & KWAIT_INTR) ? WAIT_INTERRUPTABLE : 0,
-		timeout);
+	if(cmparg & 0x800) {
+		cmparg |= ~0xfff;
+	}
+
+	switch((encoded >> 24) & 0xf) {
+	case FUTEX_OP_CMP_EQ:
+		return val == cmparg;
+	case FUTEX_OP_CMP_NE:
+		return val != cmparg;
+	case FUTEX_OP_CMP_LT:
+		return val < cmparg;
+	case FUTEX_OP_CMP_LE:
+		return val <= cmparg;
+	case FUTEX_OP_CMP_GT:
+		return val > cmparg;
+	case FUTEX_OP_CMP_GE:
+		return val >= cmparg;
+	default:
+		return -ENOSYS;
+	}
+}
+
+static int futex_wake_op(uint32_t *uaddr, uint32_t *uaddr2, int nwake,
+	int nwake2, int flags, int encoded)
+{
+	futex_addr_t faddr, faddr2;
+	futex_bucket_t *b1, *b2;
+	uint32_t oldval;
+	int err, cmp, i;
+
+	if(nwake < 0 || nwake2 < 0) {
+		return -EINVAL;
+	}
+
+	err = futex_addr(uaddr, flags, &faddr);
+	if(err) {
+		return err;
+	}
+
+	err = futex_addr(uaddr2, flags, &faddr2);
+	if(err) {
+		futex_addr_done(&faddr);
+		return err;
+	}
+
 	/*
-	 * TODO
+	 * The operation may fault and thus is done before locking
+	 * the buckets. A waiter queued on uaddr2 after the operation
+	 * sees the new value.
 	 */
+	err = futex_atomic_op(uaddr2, encoded, &oldval);
+	if(err) {
+		i = err;
+		goto out;
+	}
+
+	cmp = futex_op_cmp(encoded, oldval);
+	if(cmp < 0) {
+		i = cmp;
+		goto out;
+	}
+
+	b1 = futex_bucket(&faddr);
+	b2 = futex_bucket(&faddr2);
+	futex_bucket_lock2(b1, b2);
+	i = futex_wake_locked(b1, &faddr, nwake, FUTEX_BITSET_ANY);
+	if(cmp) {
+		i += futex_wake_locked(b2, &faddr2, nwake2, FUTEX_BITSET_ANY);
+	}
+	futex_bucket_unlock2(b1, b2);
+
+out:
+	futex_addr_done(&faddr);
+	futex_addr_done(&faddr2);
+	return i;
+}
+
+/**
+ * @brief Convert the absolute timeout of FUTEX_WAIT_BITSET into a
+ *	  relative one.
+ */
+static void futex_abs_timeout(struct timespec *ts, bool real) {
+	struct timespec now;
+	nanosec_t abs, cur;
+
+	if(real) {
+		realtime(&now);
+	} else {
+		tsuptime(&now);
+	}
+
+	abs = ts_to_nsec(ts);
+	cur = ts_to_nsec(&now);
+	nsec_to_ts(abs > cur ? abs - cur : 0, ts);
+}
+
+/*
+ * Priority-inheritance futexes. A futex_pi exists while threads are
+ * waiting for a PI futex. Because the chain of owners and waiters may span
+ * several futexes, all PI futexes are protected by a single lock. The lock
+ * is a mutex, because the futex value is accessed with the lock held.
+ */
+#define FUTEX_PI_MAXDEPTH	16
+
+typedef struct futex_pi {
+	list_node_t node;
+	list_node_t owner_node;
+	futex_addr_t addr;
+	thread_t *owner; /* NULL if the owner is not known */
+	list_t waiters; /* sorted by priority */
+} futex_pi_t;
+
+typedef struct futex_pi_wait {
+	list_node_t node;
+	thread_t *thread;
+	futex_pi_t *pi;
+	bool acquired; /* the futex was handed over to the waiter */
+	bool owner_died; /* the waiter has to update the futex value */
+	waitqueue_t wq;
+	waiter_t wait;
+} futex_pi_wait_t;
+
+static DEFINE_LIST(futex_pi_list);
+static sync_t futex_pi_lock = SYNC_INIT(MUTEX);
+
+static futex_pi_t *futex_pi_lookup(futex_addr_t *addr) {
+	futex_pi_t *pi;
+
+	foreach(pi, &futex_pi_list) {
+		if(futex_addr_cmp(addr, &pi->addr)) {
+			return pi;
+		}
+	}
+
+	return NULL;
+}
+
+static futex_pi_t *futex_pi_alloc(futex_addr_t *addr, thread_t *owner) {
+	futex_pi_t *pi;
+
+	pi = kmalloc(sizeof(*pi), VM_WAIT);
+	list_node_init(pi, &pi->node);
+	list_node_init(pi, &pi->owner_node);
+	list_init(&pi->waiters);
+	pi->addr = *addr;
+	if(addr->shared) {
+		vm_object_ref(addr->object);
+	}
+
+	pi->owner = owner;
+	if(owner) {
+		list_append(&owner->pi_owned, &pi->owner_node);
+	}
+
+	list_append(&futex_pi_list, &pi->node);
+	return pi;
+}
+
+static void futex_pi_free(futex_pi_t *pi) {
+	assert(list_is_empty(&pi->waiters));
+
+	list_remove(&futex_pi_list, &pi->node);
+	if(pi->owner) {
+		list_remove(&pi->owner->pi_owned, &pi->owner_node);
+	}
+
+	futex_addr_done(&pi->addr);
+	list_destroy(&pi->waiters);
+	list_node_destroy(&pi->owner_node);
+	list_node_destroy(&pi->node);
+	kfree(pi);
+}
+
+/**
+ * @brief Find the thread owning a PI futex.
+ *
+ * Only the threads of the current process are searched, because the
+ * thread ids are not hashed globally.
+ */
+static thread_t *futex_pi_owner(pid_t tid) {
+	proc_t *proc = cur_proc();
+	thread_t *thread;
+
+	synchronized(&proc->lock) {
+		foreach(thread, &proc->threads) {
+			if(thread->tid == tid && !thread->pi_exiting) {
+				return thread;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Insert a waiter into the waiter list of a futex. Waiters with
+ *	  the same priority are queued in FIFO order.
+ */
+static void futex_pi_enqueue(futex_pi_t *pi, futex_pi_wait_t *pw) {
+	uint8_t prio = thread_prio(pw->thread);
+	futex_pi_wait_t *cur;
+
+	foreach(cur, &pi->waiters) {
+		if(prio < thread_prio(cur->thread)) {
+			list_insert_before(&pi->waiters, &cur->node, &pw->node);
+			return;
+		}
+	}
+
+	list_append(&pi->waiters, &pw->node);
+}
+
+/**
+ * @brief Recompute the inherited priority of @p thread and propagate
+ *	  the change along the chain of futexes the owners are blocked on.
+ *
+ * A boosted thread, which is already queued on a runqueue, is moved to the
+ * runqueue of its new priority. The chain ends at an owner, which is not
+ * blocked on a PI futex, because no other sleep has an owner to inherit
+ * the priority.
+ */
+static void futex_pi_adjust(thread_t *thread) {
+	futex_pi_wait_t *pw;
+	futex_pi_t *pi;
+	uint8_t prio;
+
+	sync_assert(&futex_pi_lock);
+	for(size_t i = 0; thread && i < FUTEX_PI_MAXDEPTH; i++) {
+		prio = SCHED_PRIO_NUM;
+		foreach(pi, &thread->pi_owned) {
+			pw = list_first(&pi->waiters);
+			if(pw) {
+				prio = min(prio, thread_prio(pw->thread));
+			}
+		}
+
+		if(prio == thread->pi_prio) {
+			break;
+		}
+
+		thread->pi_prio = prio;
+		sched_requeue(thread);
+
+		/*
+		 * The position of the thread in the waiter list of the
+		 * futex it is blocked on depends on its priority.
+		 */
+		pw = thread->pi_blocked;
+		if(pw == NULL) {
+			break;
+		}
+
+		list_remove(&pw->pi->waiters, &pw->node);
+		futex_pi_enqueue(pw->pi, pw);
+		thread = pw->pi->owner;
+	}
+}
+
+/**
+ * @brief Hand a PI futex over to one of its waiters.
+ *
+ * The caller has to update the inherited priority of the old owner and
+ * to wake up the waiter.
+ */
+static void futex_pi_handoff(futex_pi_t *pi, futex_pi_wait_t *pw, bool died) {
+	list_remove(&pi->waiters, &pw->node);
+	pw->thread->pi_blocked = NULL;
+
+	if(pi->owner) {
+		list_remove(&pi->owner->pi_owned, &pi->owner_node);
+	}
+
+	pi->owner = pw->thread;
+	list_append(&pw->thread->pi_owned, &pi->owner_node);
+	pw->acquired = true;
+	pw->owner_died = died;
+	futex_pi_adjust(pw->thread);
+}
+
+static int futex_lock_pi(uint32_t *uaddr, int flags, bool try,
+	struct timespec *timeout)
+{
+	thread_t *thread = cur_thread(), *owner;
+	uint32_t val, cur, tid = thread->tid;
+	futex_addr_t faddr;
+	futex_pi_wait_t pw;
+	futex_pi_t *pi;
+	int err;
+
+	err = futex_addr(uaddr, flags, &faddr);
+	if(err) {
+		return err;
+	}
+
+	sync_acquire(&futex_pi_lock);
+	for(;;) {
+		err = copyin_atomic(&val, uaddr, sizeof(val));
+		if(err) {
+			goto out;
+		}
+
+		if((val & FUTEX_TID_MASK) == 0) {
+			/*
+			 * The futex is free, but the previous owner may have
+			 * died.
+			 */
+			err = ucmpxchg32(uaddr, val, tid |
+				(val & FUTEX_OWNER_DIED), &cur);
+			if(err || cur == val) {
+				goto out;
+			}
+
+			continue;
+		} else if((val & FUTEX_TID_MASK) == tid) {
+			err = -EDEADLK;
+			goto out;
+		} else if(try) {
+			err = -EAGAIN;
+			goto out;
+		}
+
+		/*
+		 * Force the owner to call FUTEX_UNLOCK_PI.
+		 */
+		if(val & FUTEX_WAITERS) {
+			break;
+		}
+
+		err = ucmpxchg32(uaddr, val, val | FUTEX_WAITERS, &cur);
+		if(err) {
+			goto out;
+		} else if(cur == val) {
+			break;
+		}
+	}
+
+	pi = futex_pi_lookup(&faddr);
+	if(pi == NULL) {
+		owner = futex_pi_owner(val & FUTEX_TID_MASK);
+		if(owner == NULL && !faddr.shared) {
+			err = -ESRCH;
+			goto out;
+		}
+
+		pi = futex_pi_alloc(&faddr, owner);
+	}
+
+	pw.thread = thread;
+	pw.pi = pi;
+	pw.acquired = false;
+	pw.owner_died = false;
+	list_node_init(&pw, &pw.node);
+	waitqueue_init(&pw.wq);
+	wait_init_prep(&pw.wq, &pw.wait);
+
+	futex_pi_enqueue(pi, &pw);
+	thread->pi_blocked = &pw;
+	futex_pi_adjust(pi->owner);
+	sync_release(&futex_pi_lock);
+
+	err = wait_sleep_timeout(&pw.wq, &pw.wait, (flags & KWAIT_INTR) ?
+		WAIT_INTERRUPTABLE : 0, timeout);
 	if(err == -ERESTART) {
 		err = -EINTR;
 	}
 
+	sync_acquire(&futex_pi_lock);
+	if(pw.acquired) {
+		/*
+		 * The futex was handed over to us, even if the wakeup
+		 * raced with the timeout or the interrupt.
+		 */
+		err = 0;
+		if(pw.owner_died) {
+			/*
+			 * The previous owner could not update the value.
+			 */
+			val = tid | FUTEX_OWNER_DIED;
+			if(!list_is_empty(&pi->waiters)) {
+				val |= FUTEX_WAITERS;
+			}
+
+			err = copyout_atomic(uaddr, &val, sizeof(val));
+			if(list_is_empty(&pi->waiters)) {
+				futex_pi_free(pi);
+			}
+		}
+	} else {
+		wait_abort(&pw.wq, &pw.wait);
+		list_remove(&pi->waiters, &pw.node);
+		thread->pi_blocked = NULL;
+
+		owner = pi->owner;
+		if(list_is_empty(&pi->waiters)) {
+			futex_pi_free(pi);
+		}
+
+		futex_pi_adjust(owner);
+	}
+
+	waiter_destroy(&pw.wait);
+	waitqueue_destroy(&pw.wq);
+	list_node_destroy(&pw.node);
+
 out:
-	futex_addr_done(&wait.addr);
-	waiter_destroy(&wait.wait);
+	sync_release(&futex_pi_lock);
+	futex_addr_done(&faddr);
 	return err;
 }
 
-int kern_wake(void *addr, int num, int flags) {
-	waitqueue_t *waitq;
+static int futex_unlock_pi(uint32_t *uaddr, int flags) {
+	thread_t *thread = cur_thread();
+	uint32_t val, new, cur, tid = thread->tid;
+	futex_pi_wait_t *pw;
 	futex_addr_t faddr;
-	futex_wait_t *wait;
-	int err, i = 0;
-	waiter_t *cur;
+	futex_pi_t *pi;
+	int err;
 
-	if(num < 0) {
-		return 0;
+	err = futex_addr(uaddr, flags, &faddr);
+	if(err) {
+		return err;
 	}
 
-	err = futex_addr(addr, flags, &faddr);
+	sync_acquire(&futex_pi_lock);
+	err = copyin_atomic(&val, uaddr, sizeof(val));
 	if(err) {
-		return err;
+		goto out;
+	} else if((val & FUTEX_TID_MASK) != tid) {
+		err = -EPERM;
+		goto out;
+	}
+
+	pi = futex_pi_lookup(&faddr);
+	pw = pi ? list_first(&pi->waiters) : NULL;
+	if(pw == NULL) {
+		/*
+		 * Nobody is waiting in the kernel. The value cannot change
+		 * concurrently, because the waiters bit is only set with
+		 * futex_pi_lock held.
+		 */
+		err = ucmpxchg32(uaddr, val, 0, &cur);
+		if(err == 0 && cur != val) {
+			err = -EAGAIN;
+		}
+
+		goto out;
 	}
 
 	/*
-	 * Wakeup a number of sleeping threads.
+	 * Update the value before handing the futex over. If that fails,
+	 * the futex stays owned by the current thread.
 	 */
-	waitq = futex_waitq(&faddr, flags);
-	waitq_foreach(cur, waitq) {
-		wait = waiter_to_futex(cur);
-
-		if(futex_addr_cmp(&faddr, &wait->addr)) {
-			wakeup_waiter(waitq, cur, SCHED_NORMAL);
-			if(++i >= num) {
-				break;
-			}
-		}
+	new = pw->thread->tid;
+	if(list_length(&pi->waiters) > 1) {
+		new |= FUTEX_WAITERS;
+	}
+
+	err = ucmpxchg32(uaddr, val, new, &cur);
+	if(err == 0 && cur != val) {
+		err = -EAGAIN;
+	}
+	if(err) {
+		goto out;
+	}
+
+	futex_pi_handoff(pi, pw, false);
+	if(list_is_empty(&pi->waiters)) {
+		futex_pi_free(pi);
 	}
 
+	futex_pi_adjust(thread);
+	wakeup(&pw->wq, SCHED_NORMAL);
+
+out:
+	sync_release(&futex_pi_lock);
 	futex_addr_done(&faddr);
-	return i;
+	return err;
+}
+
+void futex_exit(void) {
+	thread_t *thread = cur_thread();
+	futex_pi_wait_t *pw;
+	futex_pi_t *pi;
+
+	synchronized(&futex_pi_lock) {
+		thread->pi_exiting = true;
+		while((pi = list_first(&thread->pi_owned))) {
+			pw = list_first(&pi->waiters);
+			if(pw == NULL) {
+				futex_pi_free(pi);
+				continue;
+			}
+
+			/*
+			 * The new owner updates the futex value, because
+			 * the address of a shared futex is not known here.
+			 */
+			futex_pi_handoff(pi, pw, true);
+			wakeup(&pw->wq, SCHED_NORMAL);
+		}
+
+		thread->pi_prio = SCHED_PRIO_NUM;
+	}
 }
 
 int sys_futex(int *uaddr, int op, int val, const struct timespec *utimeout,
 	int *uaddr2, int val3)
 {
-	int err, flags = KWAIT_USR | KWAIT_PRIV;
-	struct timespec ts, *timeout;
+	int err, cmd, flags = KWAIT_USR | KWAIT_PRIV | KWAIT_INTR;
+	struct timespec ts, *timeout = NULL;
 
-	if(utimeout != NULL) {
+	if(F_ISSET(op, FUTEX_PRIVATE)) {
+		F_SET(flags, KWAIT_PRIV);
+	}
+
+	cmd = op & ~(FUTEX_PRIVATE | FUTEX_CLOCK_REALTIME);
+	if(utimeout != NULL && (cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET ||
+		cmd == FUTEX_LOCK_PI))
+	{
 		err = copyin_ts(&ts, utimeout);
 		if(err) {
 			return err;
 		}
 
+		/*
+		 * The timeout of FUTEX_LOCK_PI is always measured against
+		 * CLOCK_REALTIME.
+		 */
 		timeout = &ts;
-	} else {
-		timeout = NULL;
-	}
-
-	if(F_ISSET(op, FUTEX_PRIVATE)) {
-		F_SET(flags, KWAIT_PRIV);
+		if(cmd == FUTEX_WAIT_BITSET) {
+			futex_abs_timeout(timeout,
+				F_ISSET(op, FUTEX_CLOCK_REALTIME));
+		} else if(cmd == FUTEX_LOCK_PI) {
+			futex_abs_timeout(timeout, true);
+		}
 	}
 
-	(void) uaddr2;
-	(void) val3;
-
-	switch(op & ~(FUTEX_PRIVATE | FUTEX_CLOCK_REALTIME)) {
+	switch(cmd) {
 	case FUTEX_WAIT:
+		val3 = FUTEX_BITSET_ANY;
+		/* FALLTHROUGH */
+	case FUTEX_WAIT_BITSET:
 		/*
 		 * Futexes are 32bits on all platforms, even on 64bit machines.
-		 * Thus cast the pointer into an u32-pointer so that the
-		 * kern_wait_timeout macro will interpret this futex as a 32-bit
-		 * futex. Actually the kernel can use 8, 16, 32 and 64 bit
-		 * futexes for internal kernel stuff. However the name futex
-		 * seems wrong in this case...
+		 * Thus pass the size of an u32 so that the futex is
+		 * interpreted as a 32-bit futex. Actually the kernel can
+		 * use 8, 16, 32 and 64 bit futexes for internal kernel
+		 * stuff. However the name futex seems wrong in this case...
 		 */
-		return kern_wait_timeout((uint32_t *)uaddr, (uint32_t)val, flags,
-			timeout);
+		return futex_wait(uaddr, sizeof(uint32_t), &(uint32_t){ val },
+			flags, val3, timeout);
 	case FUTEX_WAKE:
-		return kern_wake(uaddr, val, flags);
-	case FUTEX_FD: /* FALLTHROUGH */
-	case FUTEX_REQUEUE: /* FALLTHROUGH */
-	case FUTEX_CMP_REQUEUE: /* FALLTHROUGH */
-	case FUTEX_WAKE_OP: /* FALLTHROUGH */
-	case FUTEX_LOCK_PI: /* FALLTHROUGH */
-	case FUTEX_UNLOCK_PI: /* FALLTHROUGH */
-	case FUTEX_TRYLOCK_PI: /* FALLTHROUGH */
-	case FUTEX_WAIT_BITSET: /* FALLTHROUGH */
+		val3 = FUTEX_BITSET_ANY;
+		/* FALLTHROUGH */
+	case FUTEX_WAKE_BITSET:
+		return futex_wake(uaddr, val, flags, val3);
+	case FUTEX_REQUEUE:
+		/*
+		 * The timeout argument is used for passing the number
+		 * of waiters to requeue.
+		 */
+		return futex_requeue((uint32_t *)uaddr, (uint32_t *)uaddr2,
+			val, (uintptr_t)utimeout, flags, false, 0);
+	case FUTEX_CMP_REQUEUE:
+		return futex_requeue((uint32_t *)uaddr, (uint32_t *)uaddr2,
+			val, (uintptr_t)utimeout, flags, true, val3);
+	case FUTEX_WAKE_OP:
+		return futex_wake_op((uint32_t *)uaddr, (uint32_t *)uaddr2,
+			val, (uintptr_t)utimeout, flags, val3);
+	case FUTEX_LOCK_PI:
+		return futex_lock_pi((uint32_t *)uaddr, flags, false, timeout);
+	case FUTEX_TRYLOCK_PI:
+		return futex_lock_pi((uint32_t *)uaddr, flags, true, NULL);
+	case FUTEX_UNLOCK_PI:
+		return futex_unlock_pi((uint32_t *)uaddr, flags);
+	case FUTEX_FD:
 		kprintf("[futex] warning unsupported op: %d", op);
 		return -ENOTSUP;
 	default:
@@ -299,13 +1152,26 @@ int sys_futex(int *uaddr, int op, int val, const struct timespec *utimeout,
 	}
 }
 
-static void futex_hash_init(waitqueue_t *hash) {
-	for(size_t i = 0; i < FHT_SIZE; i++) {
-		waitqueue_init(&hash[i]);
+void init_futex(void) {
+	size_t size, max;
+
+	/*
+	 * Size the hash based on the number of processors, but do not
+	 * waste too much memory on small machines.
+	 */
+	size = next_pow2(FHT_PER_CPU * cpu_num());
+	max = vm_phys_get_total() / PAGE_SZ / FHT_PAGES_PER_BUCKET;
+	while(size > FHT_MIN && size > max) {
+		size >>= 1;
 	}
-}
 
-void init_futex(void) {
-	futex_hash_init(futex_khash);
-	futex_hash_init(futex_uhash);
+	futex_hash = kmalloc(size * sizeof(futex_bucket_t), VM_WAIT);
+	futex_hash_mask = size - 1;
+	for(size_t i = 0; i < size; i++) {
+		sync_init(&futex_hash[i].lock, SYNC_SPINLOCK);
+		list_init(&futex_hash[i].waiters);
+		futex_hash[i].nwait = 0;
+	}
+
+	kprintf("[futex] hash size: %d\n", size);
 }
@@ -24,7 +24,7 @@
 
 #include <kern/system.h>
 #include <kern/init.h>
-#include <vm/vmem.h>
+#include <vm/kern.h>
 
 #define INIT_DEBUG 0
 
@@ -75,5 +75,5 @@ void init_free(void) {
 	uintptr_t end = (uintptr_t) & init_end_addr;
 
 	kprintf("[init] freeing init memory: 0x%x - 0x%x\n", start, end);
-	vmem_free_backed((void *)start, end - start);
+	vm_kern_free_image((void *)start, end - start);
 }
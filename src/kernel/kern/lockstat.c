@@ -0,0 +1,382 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ * 
+ * Copyright (c) 2018, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <kern/system.h>
+#include <kern/lockstat.h>
+#include <kern/atomic.h>
+#include <kern/init.h>
+#include <kern/time.h>
+#include <kern/cpu.h>
+#include <vfs/dev.h>
+#include <vfs/file.h>
+#include <vfs/uio.h>
+#include <vm/malloc.h>
+#include <lib/string.h>
+#include <sys/stat.h>
+
+/*
+ * The size of the site table (has to be a power of two). If more sites
+ * than that acquire locks, the additional sites are not accounted.
+ */
+#define LOCKSTAT_NSITE	1024
+#define LOCKSTAT_LINE	160
+
+#define SITE_FREE	0
+#define SITE_INIT	1
+#define SITE_READY	2
+
+typedef struct lockstat_site {
+	uint32_t state;
+	lockstat_class_t cls;
+	const char *file;
+	int line;
+	const void *lock; /* the lock most recently acquired at this site */
+
+	uint64_t acquired;
+	uint64_t contended;
+	uint64_t spin; /* in cpu ticks */
+	uint64_t sleep; /* in cpu ticks */
+	uint64_t hold_max; /* in cpu ticks */
+} lockstat_site_t;
+
+static const char *lockstat_class_names[] = {
+	[LOCKSTAT_SPIN] = "spin",
+	[LOCKSTAT_MUTEX] = "mutex",
+	[LOCKSTAT_SPINLOCK] = "spinlock",
+	[LOCKSTAT_RDLOCK] = "rdlock",
+	[LOCKSTAT_WRLOCK] = "wrlock",
+};
+
+static lockstat_site_t lockstat_sites[LOCKSTAT_NSITE];
+static uint64_t lockstat_dropped = 0;
+
+/*
+ * The frequency of cpu_ticks() in MHz, calibrated during boot. Until
+ * then the times are reported in ticks.
+ */
+static uint64_t lockstat_mhz = 0;
+
+static inline size_t lockstat_hash(lockstat_class_t cls, const char *file,
+	int line)
+{
+	size_t hash = (uintptr_t)file ^ (line * 65599) ^ (cls << 24);
+	return (hash ^ (hash >> 16)) & (LOCKSTAT_NSITE - 1);
+}
+
+static inline bool lockstat_site_match(lockstat_site_t *site,
+	lockstat_class_t cls, const char *file, int line)
+{
+	return site->file == file && site->line == line && site->cls == cls;
+}
+
+/**
+ * @brief Lookup the site of a lock acquisition or allocate a new one.
+ *
+ * Locks cannot be used in here, because this function is called while
+ * acquiring any lock.
+ */
+static lockstat_site_t *lockstat_site_get(lockstat_class_t cls,
+	const char *file, int line)
+{
+	size_t i, hash = lockstat_hash(cls, file, line);
+	lockstat_site_t *site;
+	uint32_t state;
+
+	for(i = 0; i < LOCKSTAT_NSITE; i++) {
+		site = &lockstat_sites[(hash + i) & (LOCKSTAT_NSITE - 1)];
+
+		state = atomic_load_acquire(&site->state);
+		if(state == SITE_FREE) {
+			if(atomic_cmpxchg(&site->state, SITE_FREE, SITE_INIT)) {
+				site->cls = cls;
+				site->file = file;
+				site->line = line;
+				atomic_store_release(&site->state, SITE_READY);
+				return site;
+			}
+
+			state = atomic_load_acquire(&site->state);
+		}
+
+		/*
+		 * Somebody else is currently initializing the slot.
+		 */
+		while(state == SITE_INIT) {
+			cpu_relax();
+			state = atomic_load_acquire(&site->state);
+		}
+
+		if(lockstat_site_match(site, cls, file, line)) {
+			return site;
+		}
+	}
+
+	atomic64_inc(&lockstat_dropped);
+	return NULL;
+}
+
+void lockstat_contended(lockstat_wait_t *wait) {
+	if(wait->start == 0) {
+		wait->start = cpu_ticks();
+	}
+}
+
+void lockstat_sleep_begin(lockstat_wait_t *wait) {
+	wait->sleep_start = cpu_ticks();
+}
+
+void lockstat_sleep_end(lockstat_wait_t *wait) {
+	uint64_t now = cpu_ticks();
+
+	/*
+	 * The thread might have been migrated to a different cpu.
+	 */
+	if(now > wait->sleep_start) {
+		wait->sleep += now - wait->sleep_start;
+	}
+}
+
+uint64_t lockstat_acquired(lockstat_wait_t *wait, lockstat_class_t cls,
+	const void *lock, const char *file, int line,
+	lockstat_site_t **sitep)
+{
+	lockstat_site_t *site;
+	uint64_t now;
+
+	now = cpu_ticks();
+	site = lockstat_site_get(cls, file, line);
+	if(sitep) {
+		*sitep = site;
+	}
+
+	if(site == NULL) {
+		return 0;
+	}
+
+	atomic_store_relaxed(&site->lock, lock);
+	atomic64_inc(&site->acquired);
+	if(wait->start) {
+		uint64_t total = now > wait->start ? now - wait->start : 0;
+
+		atomic64_inc(&site->contended);
+		atomic64_add(&site->sleep, wait->sleep);
+		if(total > wait->sleep) {
+			atomic64_add(&site->spin, total - wait->sleep);
+		}
+	}
+
+	return now;
+}
+
+void lockstat_released(lockstat_site_t *site, uint64_t time) {
+	uint64_t now, held, max;
+
+	if(site == NULL || time == 0) {
+		return;
+	}
+
+	now = cpu_ticks();
+	if(now < time) {
+		return;
+	}
+
+	held = now - time;
+	max = atomic64_load(&site->hold_max);
+	while(held > max) {
+		max = atomic64_cmpxchg_val(&site->hold_max, max, held);
+	}
+}
+
+static void lockstat_reset(void) {
+	lockstat_site_t *site;
+	size_t i;
+
+	for(i = 0; i < LOCKSTAT_NSITE; i++) {
+		site = &lockstat_sites[i];
+		atomic64_store(&site->acquired, 0);
+		atomic64_store(&site->contended, 0);
+		atomic64_store(&site->spin, 0);
+		atomic64_store(&site->sleep, 0);
+		atomic64_store(&site->hold_max, 0);
+	}
+
+	atomic64_store(&lockstat_dropped, 0);
+}
+
+static inline uint64_t lockstat_nsec(uint64_t ticks) {
+	if(lockstat_mhz == 0) {
+		return ticks;
+	} else {
+		return ticks * 1000 / lockstat_mhz;
+	}
+}
+
+static inline uint64_t lockstat_wait_time(lockstat_site_t *site) {
+	return site->spin + site->sleep;
+}
+
+/**
+ * @brief Sort the sites with the longest waiting time first.
+ */
+static void lockstat_sort(lockstat_site_t **sites, size_t num) {
+	size_t i, j;
+
+	for(i = 1; i < num; i++) {
+		lockstat_site_t *tmp = sites[i];
+
+		for(j = i; j > 0 && lockstat_wait_time(sites[j - 1]) <
+			lockstat_wait_time(tmp); j--)
+		{
+			sites[j] = sites[j - 1];
+		}
+
+		sites[j] = tmp;
+	}
+}
+
+static ssize_t lockstat_emit(uio_t *uio, off_t *pos, const char *line,
+	size_t len)
+{
+	ssize_t res = 0;
+
+	if(*pos + (off_t)len > uio->off) {
+		size_t skip = uio->off > *pos ? uio->off - *pos : 0;
+
+		res = uiomove((char *)line + skip, len - skip, uio);
+	}
+
+	*pos += len;
+	return res;
+}
+
+static ssize_t lockstat_read(file_t *file, uio_t *uio) {
+	char line[LOCKSTAT_LINE];
+	lockstat_site_t **sites;
+	size_t i, num = 0;
+	size_t size = uio->size;
+	ssize_t res = 0;
+	off_t pos = 0;
+	int len;
+
+	sites = kmalloc(sizeof(*sites) * LOCKSTAT_NSITE, VM_WAIT);
+	if(sites == NULL) {
+		return -ENOMEM;
+	}
+
+	for(i = 0; i < LOCKSTAT_NSITE; i++) {
+		lockstat_site_t *site = &lockstat_sites[i];
+
+		if(atomic_load_acquire(&site->state) == SITE_READY &&
+			atomic64_load(&site->acquired))
+		{
+			sites[num++] = site;
+		}
+	}
+
+	lockstat_sort(sites, num);
+	foff_lock_get_uio(file, uio);
+
+	len = snprintf(line, sizeof(line), "%-8s %-10s %12s %10s %14s %14s "
+		"%12s %s\n", "class", "lock", "acquired", "contended",
+		lockstat_mhz ? "spin(ns)" : "spin(ticks)",
+		lockstat_mhz ? "sleep(ns)" : "sleep(ticks)",
+		lockstat_mhz ? "maxhold(ns)" : "maxhold(ticks)", "site");
+	res = lockstat_emit(uio, &pos, line, len);
+
+	for(i = 0; i < num && res >= 0 && uio->size; i++) {
+		lockstat_site_t *site = sites[i];
+
+		len = snprintf(line, sizeof(line), "%-8s 0x%08x %12llu %10llu "
+			"%14llu %14llu %12llu %s:%d\n",
+			lockstat_class_names[site->cls],
+			(uintptr_t)site->lock, site->acquired,
+			site->contended, lockstat_nsec(site->spin),
+			lockstat_nsec(site->sleep),
+			lockstat_nsec(site->hold_max), site->file,
+			site->line);
+		res = lockstat_emit(uio, &pos, line, min((size_t)len,
+			sizeof(line) - 1));
+	}
+
+	if(res >= 0 && uio->size && lockstat_dropped) {
+		len = snprintf(line, sizeof(line), "dropped: %llu\n",
+			lockstat_dropped);
+		res = lockstat_emit(uio, &pos, line, len);
+	}
+
+	foff_unlock_uio(file, uio);
+	kfree(sites);
+
+	return res < 0 ? res : (ssize_t)(size - uio->size);
+}
+
+static ssize_t lockstat_write(__unused file_t *file, uio_t *uio) {
+	size_t size = uio->size;
+
+	/*
+	 * Writing anything to the device resets the statistics.
+	 */
+	lockstat_reset();
+
+	return size;
+}
+
+static int lockstat_open(__unused file_t *file) {
+	return 0;
+}
+
+static fops_t lockstat_ops = {
+	.open = lockstat_open,
+	.read = lockstat_read,
+	.write = lockstat_write,
+};
+
+static __init int lockstat_init(void) {
+	uint64_t ticks;
+	nanosec_t time;
+	int err;
+
+	/*
+	 * Calibrate cpu_ticks() against the timecounter.
+	 */
+	time = nanouptime();
+	ticks = cpu_ticks();
+	ndelay(MILLI2NANO(10));
+	ticks = cpu_ticks() - ticks;
+	time = nanouptime() - time;
+	if(time) {
+		lockstat_mhz = ticks * 1000 / time;
+	}
+
+	err = makechar(NULL, MAJOR_KERN, 0600, &lockstat_ops, NULL, NULL,
+		"lockstat");
+	if(err) {
+		return INIT_ERR;
+	}
+
+	return INIT_OK;
+}
+
+late_initcall(lockstat_init);
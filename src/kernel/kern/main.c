@@ -30,10 +30,12 @@
 #include <kern/futex.h>
 #include <kern/exec.h>
 #include <kern/symbol.h>
-#include <kern/async.h>
+#include <kern/workqueue.h>
 #include <kern/mp.h>
 #include <kern/timer.h>
 #include <kern/time.h>
+#include <kern/rcu.h>
+#include <kern/vdso.h>
 #include <vfs/vfs.h>
 #include <vfs/proc.h>
 #include <vfs/file.h>
@@ -137,6 +139,8 @@ void __init __noreturn kern_main(void) {
 	init_timer();
 	kprintf("[kmain] timekeep init\n");
 	init_timekeep();
+	kprintf("[kmain] vdso init\n");
+	init_vdso();
 
 	/*
 	 * Start up multithreading.
@@ -149,6 +153,8 @@ void __init __noreturn kern_main(void) {
 	init_proc();
 	kprintf("[kmain] sched init\n");
 	init_sched();
+	kprintf("[kmain] workqueue init\n");
+	init_workqueue();
 
 	/*
 	 * Initialize the virtual file system.
@@ -186,8 +192,8 @@ void __init __noreturn kern_main(void) {
 	kprintf("[kmain] init level late\n");
 	init_level(INIT_LATE);
 
-	kprintf("[kmain] async init\n");
-	init_async();
+	kprintf("[kmain] rcu init\n");
+	init_rcu();
 
 	kprintf("[kmain] pageout init\n");
 	vm_pageout_launch();
@@ -196,6 +202,7 @@ void __init __noreturn kern_main(void) {
 
 	kprintf("[kmain] mp init\n");
 	init_mp();
+	init_workqueue_mp();
 
 	kprintf("[kmain] launching /bin/init\n");
 	proc_spawn_init();
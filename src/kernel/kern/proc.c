@@ -31,14 +31,18 @@
 #include <kern/signal.h>
 #include <kern/user.h>
 #include <kern/futex.h>
+#include <vfs/vfs.h>
+#include <vfs/proc.h>
+#include <vfs/file.h>
 #include <vm/vas.h>
 #include <vm/malloc.h>
 #include <vm/slab.h>
 #include <lib/bitset.h>
-#include <lib/hashtab.h>
+#include <lib/rhashtab.h>
 #include <lib/list-locked.h>
 #include <sys/limits.h>
 #include <sys/wait.h>
+#include <sys/spawn.h>
 
 static proc_image_t kernel_img = {
 	.ref = 1,
@@ -55,7 +59,7 @@ static DEFINE_VM_SLAB(sess_cache, sizeof(session_t), 0);
 static size_t proc_local_size;
 static proc_t *init_process;
 static sync_t proc_tree_lock = SYNC_INIT(MUTEX);
-static hashtab_t proc_list, pgrp_list;
+static rhashtab_t proc_list, pgrp_list;
 
 void *pls_get(proc_local_t *l) {
 	proc_t *proc = cur_proc();
@@ -78,7 +82,7 @@ static void proc_init(proc_t *proc, vm_vas_t *vas, proc_t *parent, pid_t pid,
 	list_init(&proc->children);
 	list_init(&proc->threads);
 	list_node_init(proc, &proc->node_child);
-	list_node_init(proc, &proc->node_proc);
+	rhash_node_init(proc, &proc->node_proc);
 	list_node_init(proc, &proc->node_pgrp);
 	sync_init(&proc->lock, SYNC_MUTEX);
 	sync_init(&proc->id_lock, SYNC_SPINLOCK);
@@ -98,7 +102,7 @@ static void proc_free(proc_t *proc) {
 	list_destroy(&proc->children);
 	list_destroy(&proc->threads);
 	list_node_destroy(&proc->node_child);
-	list_node_destroy(&proc->node_proc);
+	rhash_node_destroy(&proc->node_proc);
 	list_node_destroy(&proc->node_pgrp);
 	sync_destroy(&proc->lock);
 	sync_destroy(&proc->id_lock);
@@ -199,7 +203,7 @@ proc_t *proc_lookup(pid_t id) {
 	proc_t *proc;
 
 	sync_assert(&proc_list_lock);
-	hashtab_search(proc, id, &proc_list) {
+	rhashtab_search(proc, id, &proc_list) {
 		if(proc->pid == id) {
 			return proc;
 		}
@@ -588,7 +592,7 @@ static pgrp_t *pgrp_alloc(void) {
 	grp = vm_slab_alloc(&pgrp_cache, VM_WAIT);
 	sync_init(&grp->lock, SYNC_MUTEX);
 	list_init(&grp->members);
-	list_node_init(grp, &grp->node);
+	rhash_node_init(grp, &grp->node);
 	grp->session = NULL;
 	grp->id = 0;
 
@@ -605,7 +609,7 @@ static void pgrp_free(pgrp_t *grp) {
 
 	sync_destroy(&grp->lock);
 	list_destroy(&grp->members);
-	list_node_destroy(&grp->node);
+	rhash_node_destroy(&grp->node);
 	vm_slab_free(&pgrp_cache, grp);
 }
 
@@ -617,7 +621,7 @@ static void pgrp_setup(pgrp_t *grp, pid_t pid, session_t *sess) {
 
 	grp->session = session_ref(sess);
 	grp->id = pid;
-	hashtab_set(&pgrp_list, grp->id, &grp->node);
+	rhashtab_set(&pgrp_list, grp->id, &grp->node);
 }
 
 /**
@@ -688,7 +692,7 @@ static int pgrp_enter(proc_t *proc, pgrp_t *grp) {
 			tid_free(old->id);
 		}
 
-		hashtab_remove(&pgrp_list, old->id, &old->node);
+		rhashtab_remove(&pgrp_list, old->id, &old->node);
 		pgrp_free(old);
 	}
 
@@ -705,7 +709,7 @@ static pgrp_t *pgrp_lookup(pid_t id) {
 
 	sync_assert(&proc_list_lock);
 
-	hashtab_search(grp, id, &pgrp_list) {
+	rhashtab_search(grp, id, &pgrp_list) {
 		if(grp->id == id) {
 			return grp;
 		}
@@ -770,7 +774,14 @@ int pgrp_kill(pid_t id, int sig, int flags) {
 	return 0;
 }
 
-pid_t sys_fork(void) {
+/**
+ * @brief Create a child process of the current process.
+ *
+ * If @p spawn is NULL, the child gets a copy of the address space of the
+ * caller. Otherwise the address space of the child stays empty and the
+ * child loads the image of the spawn request in thread_fork_ret().
+ */
+static pid_t proc_fork(spawn_t *spawn) {
 	proc_t *proc = cur_proc();
 	thread_t *thread;
 	proc_t *new;
@@ -816,9 +827,14 @@ pid_t sys_fork(void) {
 	}
 
 	/*
-	 * Create a copy of the complete virtual address space.
+	 * Create a copy of the complete virtual address space, unless
+	 * the child is going to replace it anyway.
 	 */
-	vm_vas_fork(new->vas, proc->vas);
+	if(spawn == NULL) {
+		vm_vas_fork(new->vas, proc->vas);
+	} else {
+		thread->spawn = spawn;
+	}
 
 	/*
 	 * Copy the user and group ids.
@@ -846,7 +862,7 @@ pid_t sys_fork(void) {
 			err = pgrp_enter(new, proc->pgrp);
 			assert(!err);
 
-			hashtab_set(&proc_list, new->pid, &new->node_proc);
+			rhashtab_set(&proc_list, new->pid, &new->node_proc);
 
 			/*
 			 * The new thread is now ready to run.
@@ -869,6 +885,10 @@ err_new:
 	return err;
 }
 
+pid_t sys_fork(void) {
+	return proc_fork(NULL);
+}
+
 /**
  * @brief Check whether a process can be reaped.
  *
@@ -878,7 +898,7 @@ err_new:
  *			 1 process present but not a zombie
  *			 0 zombie process present
  */
-static bool proc_can_reap(pid_t pid, proc_t *parent, proc_t *child) {
+static int proc_can_reap(pid_t pid, proc_t *parent, proc_t *child) {
 	sync_assert(&proc_tree_lock);
 
 	sync_scope_acquire(&parent->lock);
@@ -1114,6 +1134,317 @@ out:
 	return retval;
 }
 
+/**
+ * @brief Wait for a child process to exit and free it.
+ *
+ * In contrast to sys_wait4 the waiting cannot be interrupted.
+ */
+static void proc_reap_pid(proc_t *proc, pid_t pid) {
+	waiter_t wait;
+	proc_t *child;
+	int res;
+
+	waiter_init(&wait);
+	do {
+		res = -1;
+
+		wait_prep(&proc->waitq, &wait);
+		foreach_locked(child, &proc->children, &proc_tree_lock) {
+			res = proc_can_reap(pid, proc, child);
+			if(res == 0) {
+				proc_reap(proc, child, NULL);
+				break;
+			} else if(res == 1) {
+				break;
+			}
+		}
+
+		/*
+		 * The child may already have been reaped by another thread.
+		 */
+		if(res == 1) {
+			wait_sleep(&proc->waitq, &wait, 0);
+		} else {
+			wait_abort(&proc->waitq, &wait);
+		}
+	} while(res == 1);
+	waiter_destroy(&wait);
+}
+
+/**
+ * @brief Copy the file actions of a spawn request into the kernel.
+ */
+static int spawn_copyin_actions(spawn_t *spawn,
+	const struct spawn_action *uactions, size_t nactions)
+{
+	struct spawn_action *actions;
+	char *path;
+	int err;
+
+	spawn->actions = NULL;
+	spawn->nactions = 0;
+	if(nactions == 0) {
+		return 0;
+	} else if(nactions > SPAWN_ACTIONS_MAX) {
+		return -EINVAL;
+	}
+
+	actions = kmalloc(nactions * sizeof(*actions), VM_NOFLAG);
+	if(actions == NULL) {
+		return -ENOMEM;
+	}
+
+	err = copyin(actions, uactions, nactions * sizeof(*actions));
+	if(err) {
+		kfree(actions);
+		return err;
+	}
+
+	/*
+	 * spawn->nactions only counts the actions whose path was copied,
+	 * so that spawn_free() knows which paths have to be freed.
+	 */
+	spawn->actions = actions;
+	for(size_t i = 0; i < nactions; i++, spawn->nactions++) {
+		switch(actions[i].cmd) {
+		case SPAWN_CLOSE:
+		case SPAWN_DUP2:
+			actions[i].path = NULL;
+			break;
+		case SPAWN_OPEN:
+			err = copyin_path(actions[i].path, &path);
+			if(err) {
+				return err;
+			}
+
+			actions[i].path = path;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void spawn_free(spawn_t *spawn) {
+	for(size_t i = 0; i < spawn->nactions; i++) {
+		if(spawn->actions[i].path) {
+			kfree(DECONST(char *, spawn->actions[i].path));
+		}
+	}
+
+	if(spawn->actions) {
+		kfree(spawn->actions);
+	}
+
+	kfree(DECONST(char *, spawn->path));
+	kfree(spawn);
+}
+
+/**
+ * @brief Apply the file actions of a spawn request.
+ */
+static int spawn_file_actions(spawn_t *spawn) {
+	struct spawn_action *action;
+	file_t *file;
+	int err;
+
+	for(size_t i = 0; i < spawn->nactions; i++) {
+		action = &spawn->actions[i];
+		switch(action->cmd) {
+		case SPAWN_CLOSE:
+			/*
+			 * Closing a file descriptor, which is not open,
+			 * is not an error.
+			 */
+			fdfree(action->fd);
+			err = 0;
+			break;
+		case SPAWN_DUP2:
+			/*
+			 * Like posix_spawn_file_actions_adddup2, duplicating a
+			 * descriptor onto itself clears FD_CLOEXEC.
+			 */
+			if(action->srcfd == action->fd) {
+				err = fd_cloexec_set(action->fd, false);
+				break;
+			}
+
+			file = fdget(action->srcfd);
+			if(file == NULL) {
+				return -EBADF;
+			}
+
+			err = fddup(file, action->fd);
+			file_unref(file);
+			break;
+		case SPAWN_OPEN:
+			err = kern_open(action->path, action->oflag,
+				action->mode, &file);
+			if(err) {
+				return err;
+			}
+
+			err = fddup(file, action->fd);
+			file_unref(file);
+			if(err >= 0 && F_ISSET(action->oflag, O_CLOEXEC)) {
+				err = fd_cloexec_set(action->fd, true);
+			}
+			break;
+		default:
+			notreached();
+		}
+
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+void proc_spawn_child(void) {
+	thread_t *thread = cur_thread();
+	spawn_t *spawn = thread->spawn;
+	proc_t *proc = cur_proc();
+	bool detached;
+	int err;
+
+	thread->spawn = NULL;
+	err = spawn_file_actions(spawn);
+	if(err) {
+		exec_cleanup(&spawn->image);
+	} else {
+		err = exec_load(&spawn->image, spawn->path);
+	}
+
+	/*
+	 * The parent may return as soon as done is set, so the request
+	 * must not be touched afterwards, unless the parent stopped waiting
+	 * for it. The parent cannot exit while the proc_tree_lock is held.
+	 */
+	synchronized(&proc_tree_lock) {
+		spawn->err = err;
+		detached = spawn->detached;
+		atomic_store_release(&spawn->done, true);
+		wakeup(&proc->parent->waitq, SCHED_NORMAL);
+	}
+
+	if(detached) {
+		spawn_free(spawn);
+	}
+
+	if(err) {
+		kern_exitproc(127, 0);
+	}
+}
+
+pid_t sys_spawn(const char *upath, const char **uargv, const char **uenvp,
+	const struct spawn_action *uactions, size_t nactions)
+{
+	proc_t *proc = cur_proc();
+	bool detached = false;
+	spawn_t *spawn;
+	waiter_t wait;
+	char *path;
+	pid_t pid;
+	int err;
+
+	err = copyin_path(upath, &path);
+	if(err) {
+		return err;
+	}
+
+	/*
+	 * The request is allocated, because the child might still use it
+	 * after an interrupted parent returned.
+	 */
+	spawn = kmalloc(sizeof(*spawn), VM_NOFLAG);
+	if(spawn == NULL) {
+		kfree(path);
+		return -ENOMEM;
+	}
+
+	spawn->path = path;
+	spawn->err = 0;
+	spawn->done = false;
+	spawn->detached = false;
+	err = spawn_copyin_actions(spawn, uactions, nactions);
+	if(err) {
+		goto out;
+	}
+
+	/*
+	 * Lookup the executable and copy the arguments, while the
+	 * address space of the caller is still active.
+	 */
+	err = exec_prepare(&spawn->image, path, uargv, uenvp, USERSPACE);
+	if(err) {
+		goto err_image;
+	}
+
+	/*
+	 * The child owns the image from now on.
+	 */
+	pid = proc_fork(spawn);
+	if(pid < 0) {
+		err = pid;
+		goto err_image;
+	}
+
+	/*
+	 * Wait for the child to load the new image.
+	 */
+	waiter_init(&wait);
+	while(true) {
+		wait_prep(&proc->waitq, &wait);
+		if(atomic_load_acquire(&spawn->done)) {
+			wait_abort(&proc->waitq, &wait);
+			break;
+		}
+
+		err = wait_sleep(&proc->waitq, &wait, WAIT_INTERRUPTABLE);
+		if(err) {
+			/*
+			 * The child already exists, so leave the request to
+			 * the child and return its pid. If loading the
+			 * image fails, the child exits with status 127.
+			 */
+			synchronized(&proc_tree_lock) {
+				detached = !spawn->done;
+				spawn->detached = detached;
+			}
+
+			break;
+		}
+	}
+	waiter_destroy(&wait);
+
+	if(detached) {
+		return pid;
+	}
+
+	/*
+	 * The child exits on failure, free it before returning the
+	 * error.
+	 */
+	err = spawn->err;
+	if(err) {
+		proc_reap_pid(proc, pid);
+	} else {
+		err = pid;
+	}
+
+	goto out;
+
+err_image:
+	exec_cleanup(&spawn->image);
+out:
+	spawn_free(spawn);
+	return err;
+}
+
 /**
  * @brief Change the parent of a process.
  *
@@ -1197,7 +1528,7 @@ static void proc_exit(int status, int sig) {
 	 * Remove the process from the global list.
 	 */
 	synchronized(&proc_list_lock) {
-		hashtab_remove(&proc_list, proc->pid, &proc->node_proc);
+		rhashtab_remove(&proc_list, proc->pid, &proc->node_proc);
 	}
 
 	synchronized(&proc->lock) {
@@ -1216,46 +1547,49 @@ static void proc_exit(int status, int sig) {
 	}
 
 	/*
-	 * Free the user parts of the virtual address of the process. The
-	 * kernel space part is still left intact.
+	 * The address space is torn down by proc_exit_final, once it is
+	 * not loaded on any processor anymore.
 	 */
 	pls_call(proc, exit);
-	vm_vas_unmap(proc->vas, vm_vas_start(proc->vas),
-		vm_vas_size(proc->vas));
 }
 
 void proc_exit_final(proc_t *proc) {
+	vm_vas_t *vas = proc->vas;
+
 	assert(proc != cur_proc());
 	assert(cur_thread()->sched);
 
-	/*
-	 * Now that no thread of this process is running anymore,
-	 * the vas structure can be freed (the userspace parts
-	 * of the vas are already freed).
-	 */
-	vm_user_vas_free(proc->vas);
-
-	sync_scope_acquire(&proc_tree_lock);
-	sync_acquire(&proc->parent->lock);
+	proc->vas = NULL;
+	synchronized(&proc_tree_lock) {
+		sync_acquire(&proc->parent->lock);
 
-	if(proc_test_flags(proc->parent, PROC_AUTOREAP)) {
-		sync_release(&proc->parent->lock);
-		proc_reap(proc->parent, proc, NULL);
-	} else {
-		sync_scope_acquire(&proc->lock);
+		if(proc_test_flags(proc->parent, PROC_AUTOREAP)) {
+			sync_release(&proc->parent->lock);
+			proc_reap(proc->parent, proc, NULL);
+		} else {
+			sync_scope_acquire(&proc->lock);
 
-		/*
-		 * The process structure can now be freed by the parent.
-		 */
-		proc_set_flag(proc, PROC_ZOMBIE);
+			/*
+			 * The process structure can now be freed by the
+			 * parent.
+			 */
+			proc_set_flag(proc, PROC_ZOMBIE);
 
-		/*
-		 * Wakeup the parent if it's sleeping due to wait4() and
-		 * send a SIGCHLD signal to the parent.
-		 */
-		proc_do_sigchld(proc);
-		sync_release(&proc->parent->lock);
+			/*
+			 * Wakeup the parent if it's sleeping due to wait4()
+			 * and send a SIGCHLD signal to the parent.
+			 */
+			proc_do_sigchld(proc);
+			sync_release(&proc->parent->lock);
+		}
 	}
+
+	/*
+	 * Now that no thread of this process is running anymore, the
+	 * address space can be freed. This is done after notifying the
+	 * parent, so that wait4() does not have to wait for the teardown.
+	 */
+	vm_user_vas_free(vas);
 }
 
 void __noreturn kern_exit(__unused int ret) {
@@ -1267,6 +1601,7 @@ void __noreturn kern_exit(__unused int ret) {
 	 * destroy the user-parts of vmctx.
 	 */
 	thread_clear_tid();
+	futex_exit();
 
 	if(thread->tid != -1 && thread->tid != proc->pid) {
 		/*
@@ -1301,6 +1636,7 @@ void __noreturn kern_exit(__unused int ret) {
 
 void __noreturn kern_exitproc(int status, int sig) {
 	thread_clear_tid();
+	futex_exit();
 	proc_exit(status, sig);
 	thread_do_exit();
 }
@@ -1494,7 +1830,7 @@ int sys_setpgid(pid_t pid, pid_t pgid) {
 		err = pgrp_enter(proc, pgrp);
 		if(pgrp == newgrp) {
 			if(err) {
-				hashtab_remove(&pgrp_list, pgrp->id,
+				rhashtab_remove(&pgrp_list, pgrp->id,
 					&pgrp->node);
 			} else {
 				newgrp = NULL;
@@ -1659,7 +1995,7 @@ void __init proc_spawn_init(void) {
 		goto err;
 	}
 
-	hashtab_set(&proc_list, proc->pid, &proc->node_proc);
+	rhashtab_set(&proc_list, proc->pid, &proc->node_proc);
 	synchronized(&proc->lock) {
 		proc_add_thread(proc, thread);
 	}
@@ -1689,8 +2025,8 @@ err:
 }
 
 void __init init_proc(void) {
-	hashtab_alloc(&pgrp_list, 64, VM_WAIT);
-	hashtab_alloc(&proc_list, 128, VM_WAIT);
+	rhashtab_alloc(&pgrp_list, RHASHTAB_MIN, VM_WAIT);
+	rhashtab_alloc(&proc_list, RHASHTAB_MIN, VM_WAIT);
 
 	proc_local_size = local_size(PROC_LOCAL, proc_local_t);
 	proc_init(&kernel_proc, &vm_kern_vas, NULL, -1, NULL);
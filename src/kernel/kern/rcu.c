@@ -0,0 +1,231 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ * 
+ * Copyright (c) 2018, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <kern/system.h>
+#include <kern/rcu.h>
+#include <kern/atomic.h>
+#include <kern/critical.h>
+#include <kern/percpu.h>
+#include <kern/sched.h>
+#include <kern/proc.h>
+#include <kern/wait.h>
+#include <kern/time.h>
+#include <kern/init.h>
+#include <kern/cpu.h>
+#include <kern/mp.h>
+
+/*
+ * Grace periods are tracked using a global generation counter. Every cpu
+ * remembers the latest generation it saw while passing through a
+ * quiescent state, i.e. a context switch while no thread on that cpu is
+ * inside an RCU read-side critical section. A grace period started at
+ * generation gen has elapsed once every running cpu either passed a
+ * quiescent state with a generation >= gen, or is idle and currently has
+ * no readers at all. Threads never change their cpu (see sched_pin()),
+ * which allows counting the readers per cpu.
+ */
+typedef struct rcu_cpu {
+	uint32_t readers;
+	uint32_t qs_gen;
+	bool idle;
+} rcu_cpu_t;
+
+static DEFINE_PERCPU(rcu_cpu_t, rcu_cpu);
+static uint32_t rcu_gen = 0;
+
+/*
+ * Callbacks waiting for the next grace period.
+ */
+static rcu_head_t *rcu_pending = NULL;
+static DEFINE_WAITQUEUE(rcu_wq);
+
+static inline rcu_cpu_t *cur_rcu_cpu(void) {
+	return PERCPU(&rcu_cpu);
+}
+
+void rcu_read_lock(void) {
+	sched_pin();
+	atomic_inc(&cur_rcu_cpu()->readers);
+}
+
+void rcu_read_unlock(void) {
+	rcu_cpu_t *rcu = cur_rcu_cpu();
+
+	kassert(atomic_load_relaxed(&rcu->readers) > 0, "[rcu] unlocking, "
+		"but not in a read-side critical section");
+	atomic_dec(&rcu->readers);
+	sched_unpin();
+}
+
+void rcu_sched_qs(bool idle) {
+	rcu_cpu_t *rcu = cur_rcu_cpu();
+
+	if(atomic_load(&rcu->readers) == 0) {
+		atomic_store(&rcu->qs_gen, atomic_load(&rcu_gen));
+	} else {
+		idle = false;
+	}
+
+	if(rcu->idle != idle) {
+		atomic_store(&rcu->idle, idle);
+		atomic_thread_fence(ATOMIC_SEQ_CST);
+	}
+}
+
+static inline bool rcu_gen_passed(uint32_t qs_gen, uint32_t gen) {
+	return (int32_t)(qs_gen - gen) >= 0;
+}
+
+static bool rcu_gp_done(uint32_t gen, bool kick) {
+	bool done = true;
+	rcu_cpu_t *rcu;
+	cpu_t *cpu;
+
+	foreach_cpu(cpu) {
+		if(!cpu->running) {
+			continue;
+		}
+
+		rcu = PERCPU_CPU(cpu, &rcu_cpu);
+		if(rcu_gen_passed(atomic_load(&rcu->qs_gen), gen)) {
+			continue;
+		}
+
+		/*
+		 * An idle cpu does not run any readers, except for
+		 * interrupt handlers, which are counted in rcu->readers.
+		 */
+		if(atomic_load(&rcu->idle) && atomic_load(&rcu->readers) == 0) {
+			continue;
+		}
+
+		/*
+		 * A cpu running a single thread does not tick and thus
+		 * might not pass through the scheduler for a long time.
+		 */
+		if(kick && cpu != cur_cpu()) {
+			ipi_preempt(cpu);
+		}
+
+		done = false;
+	}
+
+	return done;
+}
+
+/**
+ * @brief Start a new grace period.
+ *
+ * Objects unlinked before this call may be freed once
+ * rcu_gp_done() returns true for the generation returned.
+ */
+static uint32_t rcu_gp_start(void) {
+	return atomic_add(&rcu_gen, 1) + 1;
+}
+
+static void rcu_gp_wait(uint32_t gen) {
+	bool kick = false;
+
+	for(;;) {
+		/*
+		 * The caller itself is not inside a read-side critical
+		 * section, so the current cpu may report a quiescent
+		 * state right away (if no preempted thread on this cpu
+		 * is inside a read-side critical section).
+		 */
+		critical {
+			rcu_sched_qs(false);
+		}
+
+		if(rcu_gp_done(gen, kick)) {
+			break;
+		}
+
+		/*
+		 * Sleeping causes a context switch on this cpu and gives
+		 * the other cpus some time to pass a quiescent state.
+		 */
+		msleep(1);
+		kick = true;
+	}
+}
+
+void synchronize_rcu(void) {
+	assert_not_critsect("[rcu] synchronize_rcu inside critical section");
+	rcu_gp_wait(rcu_gp_start());
+}
+
+void call_rcu(rcu_head_t *head, void (*func) (rcu_head_t *)) {
+	rcu_head_t *next;
+
+	head->func = func;
+	do {
+		next = atomic_load_relaxed(&rcu_pending);
+		head->next = next;
+	} while(!atomic_cmpxchg(&rcu_pending, next, head));
+
+	wakeup(&rcu_wq, SCHED_KERNEL);
+}
+
+static int rcu_thread(__unused void *arg) {
+	rcu_head_t *head, *next;
+	waiter_t wait;
+	int err;
+
+	waiter_init(&wait);
+
+	for(;;) {
+		wait_prep(&rcu_wq, &wait);
+
+		/*
+		 * Grab every pending callback and wait for one grace
+		 * period for the whole batch.
+		 */
+		head = atomic_xchg(&rcu_pending, NULL);
+		if(head == NULL) {
+			err = wait_sleep(&rcu_wq, &wait, WAIT_INTERRUPTABLE);
+			if(err) {
+				kpanic("[rcu] thread killed");
+			}
+
+			continue;
+		}
+
+		wait_abort(&rcu_wq, &wait);
+		rcu_gp_wait(rcu_gp_start());
+
+		while(head) {
+			next = head->next;
+			head->func(head);
+			head = next;
+		}
+	}
+
+	notreached();
+}
+
+void __init init_rcu(void) {
+	kthread_spawn(rcu_thread, NULL);
+}
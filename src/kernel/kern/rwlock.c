@@ -30,16 +30,19 @@
 #include <kern/critical.h>
 #include <kern/cpu.h>
 #include <sys/limits.h>
+#include <kern/lockstat.h>
 #include <arch/barrier.h>
 
 void rwlock_init(rwlock_t *lock) {
 	*lock = RWLOCK_INIT;
 }
 
-void wrlock(rwlock_t *lock) {
+void __wrlock(rwlock_t *lock, const char *file, int line) {
+	lockstat_wait_t wait = LOCKSTAT_WAIT_INIT;
+
 	assert_not_critsect("[rwlock] called wrlock during critical section");
 
-	spin_lock(&lock->lock);
+	__spin_lock(&lock->lock, file, line);
 
 	/*
 	 * Wait until there are no writers and no
@@ -48,10 +51,13 @@ void wrlock(rwlock_t *lock) {
 	while(lock->rdnum || lock->wrlock) {
 		uint32_t val = lock->wfutex;
 
+		lockstat_contended(&wait);
 		lock->wrwait++;
 		spin_unlock(&lock->lock);
+		lockstat_sleep_begin(&wait);
 		kern_wait(&lock->wfutex, val, 0);
-		spin_lock(&lock->lock);	
+		lockstat_sleep_end(&wait);
+		__spin_lock(&lock->lock, file, line);
 		lock->wrwait--;
 	}
 
@@ -62,14 +68,17 @@ void wrlock(rwlock_t *lock) {
 	 */
 	lock->wrlock = 1;
 	lock->wrlock2 = 1;
+	lockstat_acquired_obj(&wait, LOCKSTAT_WRLOCK, lock, file, line);
 
 	spin_unlock(&lock->lock);
 }
 
-void rdlock(rwlock_t *lock) {
+void __rdlock(rwlock_t *lock, const char *file, int line) {
+	lockstat_wait_t wait = LOCKSTAT_WAIT_INIT;
+
 	assert_not_critsect("[rwlock] called wrlock during critical section");
 
- 	spin_lock(&lock->lock);
+ 	__spin_lock(&lock->lock, file, line);
 
  	/*
 	 * Wait until there is no writer.
@@ -79,15 +88,20 @@ void rdlock(rwlock_t *lock) {
 	while(lock->wrlock || lock->wrwait) {
 		uint32_t val = lock->rfutex;
 
+		lockstat_contended(&wait);
 		lock->rdwait++;
 		spin_unlock(&lock->lock);
+		lockstat_sleep_begin(&wait);
 		kern_wait(&lock->rfutex, val, 0);
-		spin_lock(&lock->lock);	
+		lockstat_sleep_end(&wait);
+		__spin_lock(&lock->lock, file, line);
 		lock->rdwait--;
 	}
 
 	lock->rdnum++;
 	spin_unlock(&lock->lock);
+
+	lockstat_acquired(&wait, LOCKSTAT_RDLOCK, lock, file, line, NULL);
 }
 
 void rwunlock(rwlock_t *lock) {
@@ -106,6 +120,7 @@ void rwunlock(rwlock_t *lock) {
 		}
 	} else {
 		kassert(lock->wrlock, "[rwlock] unlocking unlocked rwlock");
+		lockstat_released_obj(lock);
 		lock->wrlock = 0;
 		lock->wrlock2 = 0;
 	}
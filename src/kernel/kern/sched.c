@@ -36,6 +36,7 @@
 #include <kern/symbol.h>
 #include <kern/async.h>
 #include <kern/mp.h>
+#include <kern/rcu.h>
 #include <lib/list.h>
 #include <vm/vas.h>
 
@@ -265,7 +266,6 @@ out:
 	bset(&sched->not_empty, ptr);
 }
 
-#if 0
 static void scheduler_remove(scheduler_t *sched, thread_t *thread) {
 	sync_assert(&sched->lock);
 
@@ -286,14 +286,30 @@ static void scheduler_remove(scheduler_t *sched, thread_t *thread) {
 		sched->nthread--;
 	}
 }
-#endif
 
-void sched_add_thread(thread_t *thread) {
-	scheduler_t *best = NULL;
+static void sched_add_thread_sched(scheduler_t *best, thread_t *thread) {
 	bool ipi = false;
-	cpu_t *cur;
 
 	thread->runq_idx = UINT8_MAX;
+	synchronized(&best->lock) {
+		scheduler_add_thread(best, thread, thread_prio(thread));
+		if(best->timer_on == false) {
+			if(best == cur_sched()) {
+				sched_timer_start(best);
+			} else {
+				ipi = true;
+			}
+		}
+	}
+
+	if(ipi) {
+		ipi_preempt(best->cpu);
+	}
+}
+
+void sched_add_thread(thread_t *thread) {
+	scheduler_t *best = NULL;
+	cpu_t *cur;
 
 	/*
 	 * Choose the cpu with the smallest number of threads for thread on.
@@ -308,20 +324,12 @@ void sched_add_thread(thread_t *thread) {
 	}
 
 	assert(best);
-	synchronized(&best->lock) {
-		scheduler_add_thread(best, thread, thread->prio);
-		if(best->timer_on == false) {
-			if(best == cur_sched()) {
-				sched_timer_start(best);
-			} else {
-				ipi = true;
-			}
-		}
-	}
+	sched_add_thread_sched(best, thread);
+}
 
-	if(ipi) {
-		ipi_preempt(best->cpu);
-	}
+void sched_add_thread_cpu(thread_t *thread, cpu_t *cpu) {
+	assert(cpu->running);
+	sched_add_thread_sched(PERCPU_CPU(cpu, &scheduler), thread);
 }
 
 bool sched_has_runnable(void) {
@@ -364,7 +372,8 @@ static bool sched_wakeup_thread(thread_t *thread, sched_prio_t prio) {
 		 */
 		thread->sflags &= ~THREAD_DO_SLEEP;
 	} else if(thread->state == THREAD_SLEEP) {
-		scheduler_add_thread(sched, thread, min(prio, thread->prio));
+		scheduler_add_thread(sched, thread, min(prio,
+			thread_prio(thread)));
 
 		if(prio == SCHED_INTR &&
 			sched->thread->sched_prio != SCHED_INTR)
@@ -411,6 +420,23 @@ void sched_wakeup(thread_t *thread, sched_prio_t prio) {
 }
 export(sched_wakeup);
 
+void sched_requeue(thread_t *thread) {
+	scheduler_t *sched = thread->sched;
+	sched_prio_t prio;
+
+	sync_scope_acquire(&sched->lock);
+	prio = thread_prio(thread);
+
+	/*
+	 * Only boosts are applied immediately, a thread keeps a better
+	 * priority it was woken up with until it runs.
+	 */
+	if(thread->state == THREAD_RUNNABLE && prio < thread->sched_prio) {
+		scheduler_remove(sched, thread);
+		scheduler_add_thread(sched, thread, prio);
+	}
+}
+
 int sched_pending_intr(void) {
 	scheduler_t *sched = cur_sched();
 	thread_t *thread = sched->thread;
@@ -522,7 +548,8 @@ static void do_schedule(scheduler_t *sched) {
 				/*
 				 * Add current thread back on the queue.
 				 */
-				scheduler_add_thread(sched, last, last->prio);
+				scheduler_add_thread(sched, last,
+					thread_prio(last));
 			}
 		}
 
@@ -532,16 +559,27 @@ static void do_schedule(scheduler_t *sched) {
 		sched->thread = sched_choose(sched);
 	}
 
-	if(sched->thread == sched->idle) {
+	/*
+	 * Every pass through the scheduler is a quiescent state for RCU
+	 * (unless a thread on this cpu was preempted inside a read-side
+	 * critical section).
+	 */
+	rcu_sched_qs(sched->thread == sched->idle);
+
+	/*
+	 * There is no need for preemption if the cpu is idle or if there
+	 * is just one thread on this cpu. The tick is started again as soon
+	 * as another thread is added to this scheduler (see
+	 * sched_add_thread and sched_wakeup_thread), which allows the
+	 * timer queue to program its event timer for the next real
+	 * deadline only.
+	 */
+	if(sched->thread == sched->idle || sched->nthread == 0) {
 		if(sched->timer_on) {
 			sched->timer_on = false;
 			timer_stop(&sched->timer);
 		}
 	} else {
-		/*
-		 * TODO do not add the event if there is just
-		 * one thread on this cpu.
-		 */
 		sched_timer_start(sched);
 	}
 
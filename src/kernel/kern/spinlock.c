@@ -27,8 +27,10 @@
 #include <kern/atomic.h>
 #include <kern/critical.h>
 #include <kern/cpu.h>
+#include <kern/lockstat.h>
 
-bool spin_try_lock(spinlock_t *lock) {
+bool __spin_try_lock(spinlock_t *lock, const char *file, int line) {
+	lockstat_wait_t wait = LOCKSTAT_WAIT_INIT;
 	uint8_t val;
 	
 	critical_enter();
@@ -37,6 +39,8 @@ bool spin_try_lock(spinlock_t *lock) {
 		critical_leave();
 		return false;
 	} else {
+		lockstat_acquired(&wait, LOCKSTAT_SPINLOCK, lock, file, line,
+			NULL);
 		return true;
 	}
 }
@@ -45,14 +49,22 @@ bool spin_locked(spinlock_t *lock) {
 	return atomic_load_relaxed(lock) == SPIN_LOCKED;
 }
 
-void spin_lock(spinlock_t *lock) {
+void __spin_lock(spinlock_t *lock, const char *file, int line) {
+	lockstat_wait_t wait = LOCKSTAT_WAIT_INIT;
+
 	critical_enter();
 
 	while(atomic_xchg_relaxed(lock, SPIN_LOCKED) == SPIN_LOCKED) {
+		lockstat_contended(&wait);
 		critical_leave();
 		cpu_relax();
 		critical_enter();
 	}
+
+	/*
+	 * spinlock_t is a single byte, so the hold time is not tracked.
+	 */
+	lockstat_acquired(&wait, LOCKSTAT_SPINLOCK, lock, file, line, NULL);
 }
 
 void __spin_unlock(spinlock_t *lock, char *file, int line) {
@@ -31,6 +31,11 @@
 #include <kern/sched.h>
 #include <kern/futex.h>
 #include <kern/cpu.h>
+#include <kern/lockstat.h>
+
+static inline lockstat_class_t sync_lockstat_class(sync_t *sync) {
+	return sync->type == SYNC_SPINLOCK ? LOCKSTAT_SPIN : LOCKSTAT_MUTEX;
+}
 
 static void sync_check(sync_t *sync) {
 	magic_check(&sync->magic, SYNC_MAGIC);
@@ -75,8 +80,12 @@ bool __sync_trylock(sync_t *sync, const char *file, int line) {
 
 		return false;
 	} else {
+		lockstat_wait_t wait = LOCKSTAT_WAIT_INIT;
+
 		DEVEL_SET(sync->file, file);
 		DEVEL_SET(sync->line, line);
+		lockstat_acquired_obj(&wait, sync_lockstat_class(sync), sync,
+			file, line);
 		return true;
 	}
 }
@@ -88,6 +97,7 @@ export(__sync_trylock);
 #include <kern/mp.h>
 
 void __sync_acquire(sync_t *sync, const char *file, int line) {
+	lockstat_wait_t wait = LOCKSTAT_WAIT_INIT;
 	thread_t *lock, *thread = cur_thread();
 
 	sync_check(sync);
@@ -116,6 +126,8 @@ void __sync_acquire(sync_t *sync, const char *file, int line) {
 				sync->line, file, line);
 		}
 
+		lockstat_contended(&wait);
+
 		if(sync->type == SYNC_MUTEX) {
 			if(!bsp_p() && !ipi_enabled) {
 				kpanic("[sync] locked at: %s:%d; locking at "
@@ -130,7 +142,9 @@ void __sync_acquire(sync_t *sync, const char *file, int line) {
 
 			thread_numlock_dec();
 			atomic_inc_relaxed(&sync->waiting);
+			lockstat_sleep_begin(&wait);
 			kern_wait(&sync->thread, lock, 0);
+			lockstat_sleep_end(&wait);
 			atomic_dec_relaxed(&sync->waiting);
 			thread_numlock_inc();
 		} else {
@@ -142,6 +156,8 @@ void __sync_acquire(sync_t *sync, const char *file, int line) {
 
 	DEVEL_SET(sync->file, file);
 	DEVEL_SET(sync->line, line);
+	lockstat_acquired_obj(&wait, sync_lockstat_class(sync), sync, file,
+		line);
 }
 export(__sync_acquire);
 
@@ -149,6 +165,7 @@ void sync_release(sync_t *sync) {
 	sync_check(sync);
 	DEVEL_SET(sync->file, NULL);
 	DEVEL_SET(sync->line, -1);
+	lockstat_released_obj(sync);
 
 	/*
 	 * Cannot check for xchg(thread, NULL) == cur_thread(), because
@@ -79,6 +79,7 @@ static syscall_t syscalls[] = {
 	 */
 	SYSCALL_ENTRY(fork),
 	SYSCALL_ENTRY(vfork),
+	SYSCALL_ENTRY(spawn),
 	SYSCALL_ENTRY(getpid),
 	SYSCALL_ENTRY(getppid),
 	SYSCALL_ENTRY(setsid),
@@ -168,6 +169,9 @@ static syscall_t syscalls[] = {
 	SYSCALL_ENTRY(access),
 	SYSCALL_ENTRY(umask),
 	SYSCALL_ENTRY(fadvise64_64),
+	SYSCALL_ENTRY(sync),
+	SYSCALL_ENTRY(fsync),
+	SYSCALL_ENTRY(fdatasync),
 	SYSCALL_ENTRY(poll),
 	SYSCALL_ENTRY(ppoll),
 	SYSCALL_ENTRY(pselect6),
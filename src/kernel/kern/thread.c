@@ -32,6 +32,7 @@
 #include <kern/init.h>
 #include <kern/user.h>
 #include <kern/main.h>
+#include <kern/exec.h>
 #include <vm/malloc.h>
 #include <vm/vmem.h>
 #include <lib/bitset.h>
@@ -44,6 +45,7 @@ static sync_t tid_lock = SYNC_INIT(MUTEX);
 
 __initdata thread_t boot_thread = {
 	.prio = SCHED_KERNEL,
+	.pi_prio = SCHED_PRIO_NUM,
 	.state = THREAD_RUNNING,
 	.tid = KTHREAD_TID,
 	.proc = &kernel_proc,
@@ -63,6 +65,10 @@ static void thread_init(thread_t *thread, pid_t tid) {
 	thread->flags = 0;
 	thread->state = THREAD_SPAWNED;
 	thread->numlock = 0;
+	thread->pi_prio = SCHED_PRIO_NUM;
+	thread->pi_exiting = false;
+	thread->pi_blocked = NULL;
+	list_init(&thread->pi_owned);
 	thread->tid = tid;
 	thread->onfault = NULL;
 	thread->proc = NULL;
@@ -70,6 +76,7 @@ static void thread_init(thread_t *thread, pid_t tid) {
 
 	thread->set_child_tid = NULL;
 	thread->clear_child_tid = NULL;
+	thread->spawn = NULL;
 
 	arch_thread_init(thread);
 }
@@ -194,6 +201,18 @@ thread_t *kthread_spawn_prio(int (*func) (void *), void *arg, uint8_t prio) {
 	return thread;
 }
 
+thread_t *kthread_spawn_cpu(int (*func) (void *), void *arg, uint8_t prio,
+	cpu_t *cpu)
+{
+	thread_t *thread;
+
+	thread = kthread_alloc(func, arg);
+	thread->prio = prio;
+	sched_add_thread_cpu(thread, cpu);
+
+	return thread;
+}
+
 thread_t *kthread_spawn(int (*func) (void *), void *arg) {
 	return kthread_spawn_prio(func, arg, SCHED_KERNEL);
 }
@@ -400,6 +419,8 @@ void thread_fork_ret(void) {
 	thr = cur_thread();
 	if(thr->tid == INITPROC_PID) {
 		user_main();
+	} else if(thr->spawn) {
+		proc_spawn_child();
 	}
 
 	thr->trapframe = NULL;
@@ -524,5 +545,6 @@ void __init init_thread(void) {
 	 */
 	list_node_init(&boot_thread, &boot_thread.sched_node);
 	list_node_init(&boot_thread, &boot_thread.proc_node);
+	list_init(&boot_thread.pi_owned);
 	arch_thread_init(&boot_thread);
 }
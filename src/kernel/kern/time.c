@@ -203,8 +203,8 @@ int copyin_ts(struct timespec *ts, const struct timespec *uts) {
  */
 void realtime(struct timespec *time) {
 	struct timespec up, boot;
-	gettsboottime(&boot);
-	gettsuptime(&up);
+	getboottime(&boot);
+	tsuptime(&up);
 	ts_add(&up, &boot, time);
 }
 
@@ -216,7 +216,8 @@ int sys_clock_gettime(clockid_t id, struct timespec *out) {
 		realtime(&ts);
 		break;
 	case CLOCK_MONOTONIC:
-		/* FALLTHROUGH */
+		tsuptime(&ts);
+		break;
 	default:
 		kprintf("[time] warning: clock_gettime: %d\n", id);
 		return -ENOTSUP;
@@ -27,6 +27,8 @@
 #include <kern/atomic.h>
 #include <kern/time.h>
 #include <kern/critical.h>
+#include <kern/sync.h>
+#include <kern/vdso.h>
 #include <device/timecounter.h>
 #include <device/rtc.h>
 
@@ -43,6 +45,7 @@
 typedef struct timehands {
 	struct timehands *next;
 	unsigned gen;
+	timecounter_t *tc; /* the counter last_count belongs to */
 	uint64_t last_count;
 	nanosec_t nanotime;
 	struct timespec tstime;
@@ -59,6 +62,7 @@ static timehands_t th1 = {
 };
 static timehands_t *volatile timehands = &th0;
 static timecounter_t *tc_list, *timecounter;
+static sync_t tc_lock = SYNC_INIT(SPINLOCK);
 
 /**
  * @brief The real time of the boot.
@@ -72,13 +76,14 @@ static inline bool timekeep_retry(unsigned gen, timehands_t *th) {
 }
 
 static inline nanosec_t timekeep_delta(timehands_t *th) {
+	timecounter_t *tc = th->tc;
 	uint64_t delta;
 
-	assert(timecounter);
-	assert(timecounter->read);
+	assert(tc);
+	assert(tc->read);
 
-	delta = (tc_read(timecounter) - th->last_count) & timecounter->mask;
-	return ((nanosec_t)delta * SEC_NANOSECS) / timecounter->freq;
+	delta = (tc_read(tc) - th->last_count) & tc->mask;
+	return ((nanosec_t)delta * SEC_NANOSECS) / tc->freq;
 }
 
 static inline void timekeep_ts_add(struct timespec *ts, nanosec_t nsec) {
@@ -94,6 +99,7 @@ static inline void timekeep_ts_add(struct timespec *ts, nanosec_t nsec) {
 nanosec_t timekeep_tick(void) {
 	uint64_t delta, count;
 	nanosec_t nsdelta;
+	timecounter_t *tc;
 	timehands_t *th;
 	unsigned gen;
 
@@ -109,10 +115,23 @@ nanosec_t timekeep_tick(void) {
 	/*
 	 * Read the new time from the timecounter.
 	 */
-	count = tc_read(timecounter);
-	delta = (count - th->last_count) & timecounter->mask;
+	tc = th->tc;
+	count = tc_read(tc);
+	delta = (count - th->last_count) & tc->mask;
+	nsdelta = ((nanosec_t)delta * SEC_NANOSECS) / tc->freq;
+
+	/*
+	 * Switch to a new timecounter. The other timehands still use the
+	 * old counter until they are updated, which is why a counter has
+	 * to stay readable after tc_unregister().
+	 */
+	if(tc != atomic_load_relaxed(&timecounter)) {
+		tc = atomic_load_relaxed(&timecounter);
+		th->tc = tc;
+		count = tc_read(tc);
+	}
+
 	th->last_count = count;
-	nsdelta = ((nanosec_t)delta * SEC_NANOSECS) / timecounter->freq;
 
 	/*
 	 * Update the time.
@@ -125,10 +144,41 @@ nanosec_t timekeep_tick(void) {
 
 	atomic_store_release(&th->gen, gen);
 	timehands = th;
+	vdso_update(tc, count, &th->tstime, &boottime);
 
 	return th->nanotime;
 }
 
+nanosec_t timekeep_max_interval(void) {
+	timecounter_t *tc = atomic_load_relaxed(&timecounter);
+	nanosec_t interval;
+	uint64_t wrap;
+
+	assert(tc);
+
+	/*
+	 * Update the timehands at least twice per wrap around of the
+	 * counter. The interval is limited to one second, which also
+	 * keeps the multiplication in timekeep_tick from overflowing.
+	 */
+	wrap = tc->mask / tc->freq;
+	if(wrap >= 2) {
+		interval = SEC_NANOSECS;
+	} else {
+		interval = (tc->mask * SEC_NANOSECS / tc->freq) / 2;
+	}
+
+	/*
+	 * The vDSO only handles counter deltas fitting into 32 bits.
+	 */
+	if(tc->vdso != VDSO_CLOCK_NONE) {
+		interval = min(interval, (UINT32_MAX * SEC_NANOSECS /
+			tc->freq) / 2);
+	}
+
+	return interval;
+}
+
 nanosec_t nanouptime(void) {
 	nanosec_t retv;
 	timehands_t *th;
@@ -180,6 +230,10 @@ void gettsuptime(struct timespec *time) {
 	} while(timekeep_retry(gen, th));
 }
 
+void getboottime(struct timespec *time) {
+	*time = boottime;
+}
+
 void gettsboottime(struct timespec *time) {
 	struct timespec tmp;
 	gettsuptime(&tmp);
@@ -187,37 +241,75 @@ void gettsboottime(struct timespec *time) {
 }
 
 void ndelay(nanosec_t nsec) {
+	timecounter_t *tc = atomic_load_relaxed(&timecounter);
 	int64_t left;
 	uint64_t prev;
 
-	prev = tc_read(timecounter);
-	left = (nsec * timecounter->freq + (SEC_NANOSECS - 1)) / SEC_NANOSECS;
+	prev = tc_read(tc);
+	left = (nsec * tc->freq + (SEC_NANOSECS - 1)) / SEC_NANOSECS;
 
 	while(left > 0) {
 		uint64_t cntr, delta;
 
-		cntr = tc_read(timecounter);
-		delta = (cntr - prev) & timecounter->mask;
+		cntr = tc_read(tc);
+		delta = (cntr - prev) & tc->mask;
 		prev = cntr;
 		left -= delta;
 	}
 }
 
 void tc_register(timecounter_t *tc) {
+	sync_scope_acquire(&tc_lock);
 	tc->next = tc_list;
 	tc_list = tc;
 
 	/*
-	 * TODO choose the time counter based on quality
+	 * The timehands start with the first counter registered, a
+	 * better counter is picked up by timekeep_tick().
 	 */
+	if(timecounter == NULL) {
+		th0.tc = th1.tc = tc;
+	}
+
 	if(timecounter == NULL || tc->quality > timecounter->quality) {
-		timecounter = tc;
+		atomic_store_relaxed(&timecounter, tc);
 	}
 }
 
 int tc_unregister(timecounter_t *tc) {
-	(void) tc;
-	return -EBUSY;
+	timecounter_t **tcp, *cur, *best = NULL;
+
+	sync_scope_acquire(&tc_lock);
+	for(cur = tc_list; cur; cur = cur->next) {
+		if(cur != tc && (!best || cur->quality > best->quality)) {
+			best = cur;
+		}
+	}
+
+	/*
+	 * The last counter cannot be removed.
+	 */
+	if(best == NULL) {
+		return -EBUSY;
+	}
+
+	for(tcp = &tc_list; *tcp; tcp = &(*tcp)->next) {
+		if(*tcp == tc) {
+			*tcp = tc->next;
+			break;
+		}
+	}
+
+	if(timecounter == tc) {
+		kprintf("[time] switching to counter: %s\n", best->name);
+		atomic_store_relaxed(&timecounter, best);
+	}
+
+	return 0;
+}
+
+timecounter_t *tc_get(void) {
+	return atomic_load_relaxed(&timecounter);
 }
 
 void __init init_timekeep(void) {
@@ -29,6 +29,7 @@
 #include <kern/percpu.h>
 #include <kern/sync.h>
 #include <device/evtimer.h>
+#include <lib/rbtree.h>
 
 #if 0
 #define timer_debug kprintf
@@ -36,16 +37,81 @@
 #define timer_debug(a...)
 #endif
 
+/*
+ * Every cpu keeps its timers in a hierarchical timing wheel. The time is
+ * divided into ticks of 2^TW_SHIFT nanoseconds. Level 0 of the wheel has
+ * one slot per tick, every slot of level n covers TW_SLOTS slots of level
+ * n-1. A timer is put into the lowest level, where its tick shares the
+ * slot of the next higher level with the current tick (tq->clk). Once the
+ * wheel advances into a slot of a higher level, the timers of that slot
+ * are cascaded into the lower levels. Timers too far in the future for
+ * the wheel are kept in a tree sorted by time and moved into the wheel
+ * once the wheel reaches their range.
+ *
+ * Adding and cancelling a timer is O(1) (except for the overflow tree)
+ * and the next event can be found using the pending bitmaps.
+ */
+#define TW_BITS		6
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_LEVELS	4
+#define TW_SHIFT	17 /* ~131us per tick */
+#define TW_TOP_SHIFT	(TW_BITS * TW_LEVELS)
+#define TW_TICK_NONE	UINT64_MAX
+#define TW_TIME_NONE	UINT64_MAX
+
+/*
+ * Values of timer->wheel besides the slot index.
+ */
+#define TW_OVERFLOW	(TW_LEVELS * TW_SLOTS)
+#define TW_EXPIRED	(TW_OVERFLOW + 1)
+#define TW_NONE		TIMER_WHEEL_NONE
+
+/*
+ * The mode the event timer of a timer queue is programmed in.
+ */
+#define TQ_EV_STOPPED	0
+#define TQ_EV_ONESHOT	1
+#define TQ_EV_PERIODIC	2
+
 typedef struct timerq {
 	sync_t lock;
 	evtimer_t *dev;
-	list_t queue;
 	list_t ontick;
-	bool bsp;
+
+	/*
+	 * The event timer does not support one-shot mode and thus
+	 * has to tick periodically.
+	 */
+	bool periodic;
+
+	/*
+	 * The mode the event timer is currently programmed in and, in
+	 * one-shot mode, the time of the event it was configured for
+	 * (TW_TIME_NONE otherwise). The deadline alone cannot tell
+	 * whether the event timer is still running.
+	 */
+	int evmode;
+	nanosec_t deadline;
+
+	uint64_t clk;
+	uint64_t pending[TW_LEVELS];
+	list_t wheel[TW_LEVELS][TW_SLOTS];
+	rb_tree_t overflow;
+
+	/*
+	 * Timers currently being expired.
+	 */
+	list_t expired;
 } timerq_t;
 
 static DEFINE_PERCPU(timerq_t, timerq_cpu);
 
+/*
+ * The timer used for updating the timehands on the BSP.
+ */
+static timer_t timekeep_timer;
+
 static inline timerq_t *timerq_get(void) {
 	return PERCPU(&timerq_cpu);
 }
@@ -54,41 +120,270 @@ static inline bool timer_ontick_p(timer_t *timer) {
 	return !!(timer->flags & TIMER_ONTICK);
 }
 
-static void timerq_insert(timerq_t *timerq, timer_t *timer) {
+static inline uint64_t tw_tick(nanosec_t time) {
+	return time >> TW_SHIFT;
+}
+
+static inline size_t tw_shift(size_t level) {
+	return TW_BITS * level;
+}
+
+static void timerq_enqueue(timerq_t *tq, timer_t *timer) {
+	uint64_t tick = max(tw_tick(timer->time), tq->clk);
+	size_t level, slot;
 	timer_t *cur;
 
-	if(timer_ontick_p(timer)) {
-		list_append(&timerq->ontick, &timer->node);
-		if(!timerq->bsp && list_length(&timerq->ontick) == 1) {
-			evtimer_config(timerq->dev, EV_PERIODIC, TICK_PERIOD);
+	for(level = 0; level < TW_LEVELS; level++) {
+		size_t shift = tw_shift(level);
+
+		if((tick >> (shift + TW_BITS)) == (tq->clk >> (shift + TW_BITS))) {
+			slot = (tick >> shift) & TW_MASK;
+			list_append(&tq->wheel[level][slot], &timer->node);
+			bset(&tq->pending[level], slot);
+			timer->wheel = level * TW_SLOTS + slot;
+			return;
 		}
-	} else {
-		foreach(cur, &timerq->queue) {
-			if(cur->time >= timer->time) {
-				list_insert_before(&timerq->queue, &cur->node,
-					&timer->node);
-				return;
-			}
+	}
+
+	rb_insert(&tq->overflow, cur, &timer->tree_node, {
+		if(timer->time < cur->time) {
+			goto left;
+		} else {
+			goto right;
 		}
+	});
+
+	timer->wheel = TW_OVERFLOW;
+}
+
+static void timerq_dequeue(timerq_t *tq, timer_t *timer) {
+	size_t level, slot;
 
-		list_append(&timerq->queue, &timer->node);
+	if(timer->wheel == TW_OVERFLOW) {
+		rb_remove(&tq->overflow, &timer->tree_node);
+	} else if(timer->wheel == TW_EXPIRED) {
+		list_remove(&tq->expired, &timer->node);
+	} else {
+		assert(timer->wheel < TW_OVERFLOW);
+		level = timer->wheel / TW_SLOTS;
+		slot = timer->wheel % TW_SLOTS;
+		if(list_remove(&tq->wheel[level][slot], &timer->node)) {
+			bclr(&tq->pending[level], slot);
+		}
 	}
+
+	timer->wheel = TW_NONE;
 }
 
-static void timerq_reconf(timerq_t *timerq, nanosec_t curtime) {
+/**
+ * @brief Get the next tick after tq->clk, at which the wheel has
+ *	  some work to do.
+ */
+static uint64_t timerq_next_tick(timerq_t *tq, size_t *levelp) {
+	uint64_t pending, base;
+	size_t level, pos;
 	timer_t *first;
 
-	if(timerq->bsp || list_length(&timerq->ontick)) {
-		return;
+	for(level = 0; level < TW_LEVELS; level++) {
+		size_t shift = tw_shift(level);
+
+		/*
+		 * Only the slots after the current one are of interest.
+		 * The current slot of level 0 is handled by the caller
+		 * and the current slot of the higher levels is always
+		 * empty, because it was cascaded when the wheel
+		 * advanced into it.
+		 */
+		pos = (tq->clk >> shift) & TW_MASK;
+		pending = tq->pending[level] & ((~0ULL << pos) << 1);
+		if(pending) {
+			base = (tq->clk >> shift) & ~(uint64_t)TW_MASK;
+			*levelp = level;
+			return (base | (ffs(pending) - 1)) << shift;
+		}
 	}
 
-	first = list_first(&timerq->queue);
-	if(first == NULL) {
-		evtimer_stop(timerq->dev);
-		timer_debug("[timer] stopping\n");
+	first = rb_first(&tq->overflow);
+	if(first) {
+		*levelp = TW_LEVELS;
+		return (tw_tick(first->time) >> TW_TOP_SHIFT) << TW_TOP_SHIFT;
+	}
+
+	return TW_TICK_NONE;
+}
+
+/**
+ * @brief Move the timers of a slot into the lower levels.
+ */
+static void timerq_cascade(timerq_t *tq, size_t level, size_t slot) {
+	list_t *list = &tq->wheel[level][slot];
+	timer_t *timer;
+
+	while((timer = list_pop_front(list))) {
+		timer->wheel = TW_NONE;
+		timerq_enqueue(tq, timer);
+	}
+
+	bclr(&tq->pending[level], slot);
+}
+
+static void timerq_advance(timerq_t *tq, uint64_t clk) {
+	uint64_t old = tq->clk;
+	timer_t *timer;
+	size_t level;
+
+	assert(clk >= old);
+	tq->clk = clk;
+
+	if((old >> TW_TOP_SHIFT) != (clk >> TW_TOP_SHIFT)) {
+		while((timer = rb_first(&tq->overflow)) &&
+			(tw_tick(timer->time) >> TW_TOP_SHIFT) <=
+			(clk >> TW_TOP_SHIFT))
+		{
+			rb_remove(&tq->overflow, &timer->tree_node);
+			timerq_enqueue(tq, timer);
+		}
+	}
+
+	/*
+	 * Cascade from the top to the bottom, because the timers of
+	 * a higher level might end up in the current slot of a lower
+	 * level.
+	 */
+	for(level = TW_LEVELS - 1; level > 0; level--) {
+		size_t shift = tw_shift(level);
+
+		if((old >> shift) != (clk >> shift)) {
+			timerq_cascade(tq, level, (clk >> shift) & TW_MASK);
+		}
+	}
+}
+
+/**
+ * @brief Call the timers of the current slot, which are due.
+ */
+static void timerq_expire(timerq_t *tq, nanosec_t curtime) {
+	list_t *slot = &tq->wheel[0][tq->clk & TW_MASK];
+	timer_t *timer;
+
+	foreach(timer, slot) {
+		if(timer->time <= curtime) {
+			timerq_dequeue(tq, timer);
+			list_append(&tq->expired, &timer->node);
+			timer->wheel = TW_EXPIRED;
+		}
+	}
+
+	/*
+	 * A callback may stop one of the other expired timers, which
+	 * removes the timer from tq->expired.
+	 */
+	while((timer = list_pop_front(&tq->expired))) {
+		timer->wheel = TW_NONE;
+
+		timer_debug("[timer]    calling %lld\n", timer->time);
+		timer->func(timer->arg);
+
+		if(timer->flags & TIMER_PERIODIC) {
+			/*
+			 * Reinsert the timer into the queue if the timer is
+			 * a periodic one.
+			 */
+			timer->time = curtime + timer->period;
+			timerq_enqueue(tq, timer);
+		} else {
+			timer->flags |= TIMER_DONE;
+		}
+	}
+}
+
+static void timerq_run(timerq_t *tq, nanosec_t curtime) {
+	uint64_t next, target = tw_tick(curtime);
+	size_t level;
+
+	timerq_expire(tq, curtime);
+	while((next = timerq_next_tick(tq, &level)) <= target) {
+		timerq_advance(tq, next);
+		timerq_expire(tq, curtime);
+	}
+
+	/*
+	 * There is nothing to do until the target tick.
+	 */
+	if(target > tq->clk) {
+		timerq_advance(tq, target);
+	}
+}
+
+static nanosec_t timerq_slot_min(list_t *slot) {
+	nanosec_t min = TW_TIME_NONE;
+	timer_t *timer;
+
+	foreach(timer, slot) {
+		min = min(min, timer->time);
+	}
+
+	return min;
+}
+
+/**
+ * @brief Get the time of the next event of the timer queue.
+ */
+static nanosec_t timerq_next_event(timerq_t *tq) {
+	nanosec_t next;
+	uint64_t tick;
+	size_t level;
+
+	next = timerq_slot_min(&tq->wheel[0][tq->clk & TW_MASK]);
+	if(next != TW_TIME_NONE) {
+		return next;
+	}
+
+	tick = timerq_next_tick(tq, &level);
+	if(tick == TW_TICK_NONE) {
+		return TW_TIME_NONE;
+	} else if(level == 0) {
+		return timerq_slot_min(&tq->wheel[0][tick & TW_MASK]);
 	} else {
-		timer_debug("[timer] config %lld\n", first->time - curtime);
-		evtimer_config(timerq->dev, EV_ONESHOT, first->time - curtime);
+		/*
+		 * The timers have to be cascaded first.
+		 */
+		return tick << TW_SHIFT;
+	}
+}
+
+static void timerq_reconf(timerq_t *tq, nanosec_t curtime) {
+	nanosec_t next;
+
+	if(tq->periodic || list_length(&tq->ontick)) {
+		return;
+	}
+
+	next = timerq_next_event(tq);
+	if(next == TW_TIME_NONE) {
+		/*
+		 * The wheel is empty, stop the event timer if it is
+		 * still running (e.g. after the last ontick timer was
+		 * removed).
+		 */
+		tq->deadline = TW_TIME_NONE;
+		if(tq->evmode != TQ_EV_STOPPED) {
+			tq->evmode = TQ_EV_STOPPED;
+			evtimer_stop(tq->dev);
+			timer_debug("[timer] stopping\n");
+		}
+	} else if(tq->evmode != TQ_EV_ONESHOT || next != tq->deadline) {
+		tq->evmode = TQ_EV_ONESHOT;
+		tq->deadline = next;
+
+		/*
+		 * evtimer_config clamps the time to the period supported
+		 * by the device. If the event is too far away, the timer
+		 * just fires early and is reconfigured.
+		 */
+		next = next > curtime ? next - curtime : 0;
+		timer_debug("[timer] config %lld\n", next);
+		evtimer_config(tq->dev, EV_ONESHOT, next);
 	}
 }
 
@@ -104,8 +399,19 @@ void timer_start(timer_t *timer, nanosec_t time, int flags) {
 
 	sync_scope_acquire(&timerq->lock);
 	timer->tq = timerq;
-	timerq_insert(timerq, timer);
-	timerq_reconf(timerq, curtime);
+	if(timer_ontick_p(timer)) {
+		list_append(&timerq->ontick, &timer->node);
+		if(!timerq->periodic && list_length(&timerq->ontick) == 1) {
+			timerq->evmode = TQ_EV_PERIODIC;
+			timerq->deadline = TW_TIME_NONE;
+			evtimer_config(timerq->dev, EV_PERIODIC, TICK_PERIOD);
+		}
+	} else {
+		timerq_enqueue(timerq, timer);
+		if(timer->time < timerq->deadline) {
+			timerq_reconf(timerq, curtime);
+		}
+	}
 }
 
 void timer_ontick(timer_t *timer) {
@@ -127,16 +433,16 @@ nanosec_t timer_stop(timer_t *timer) {
 	sync_scope_acquire(&timerq->lock);
 	if(timer_ontick_p(timer)) {
 		reconf = list_remove(&timerq->ontick, &timer->node);
-	} else if(!(timer->flags & TIMER_DONE)) {
-		reconf = list_first(&timerq->queue) == timer;
-		list_remove(&timerq->queue, &timer->node);
+	} else if(timer->wheel != TW_NONE) {
+		reconf = timer->time <= timerq->deadline;
+		timerq_dequeue(timerq, timer);
 		timer->flags |= TIMER_DONE;
 	}
 
 	/*
 	 * We would actually need an IPI to reconfigure the timer
 	 * on another processor, so we simply do not reconfigure
-	 * and live with the possibility of one sadditional
+	 * and live with the possibility of one additional
 	 * spurious interrupt.
 	 */
 	if(reconf && timerq == timerq_get()) {
@@ -148,7 +454,6 @@ nanosec_t timer_stop(timer_t *timer) {
 
 static void timer_intr(void *arg) {
 	timerq_t *timerq = arg;
-	bool reconf = false;
 	nanosec_t curtime;
 	timer_t *timer;
 
@@ -161,68 +466,88 @@ static void timer_intr(void *arg) {
 		timer->func(timer->arg);
 	}
 
-	while((timer = list_first(&timerq->queue)) && timer->time <= curtime) {
-		reconf = true;
-
-		timer_debug("[timer]    calling %lld\n", timer->time);
-		timer->func(timer->arg);
-
-		list_remove(&timerq->queue, &timer->node);
-		if(timer->flags & TIMER_PERIODIC) {
-			/*
-			 * Reinsert the timer into the queue if the timer is
-			 * a periodic one.
-			 */
-			timer->time = curtime + timer->period;
-			timerq_insert(timerq, timer);
-		} else {
-			timer->flags |= TIMER_DONE;
-		}
-	}
-
 	/*
-	 * If at a timer was removed, the timer needs to be
-	 * reconfigured.
+	 * The event timer fired, so the one-shot event it was
+	 * configured for is gone. A periodic event timer keeps
+	 * running until timerq_reconf stops it.
 	 */
-	if(reconf) {
-		timerq_reconf(timerq, curtime);
+	if(timerq->evmode == TQ_EV_ONESHOT) {
+		timerq->evmode = TQ_EV_STOPPED;
+		timerq->deadline = TW_TIME_NONE;
 	}
+	timerq_run(timerq, curtime);
+	timerq_reconf(timerq, curtime);
 }
 
 /**
- * @brief Timer interrupt callback of the boot processor.
+ * @brief Update the timehands.
  *
- * The timer interrupt of the boot processor is used for special
- * bookkeeping (currently timekeep only) and thus is never disabled.
+ * The timehands have to be updated before the timecounter wraps around,
+ * even if every cpu is idle. This is the only periodic event left in
+ * the system, every other event timer is only programmed for the next
+ * deadline of its timer queue.
  */
-static void tick(void *arg) {
-	/* TODO time = */ timekeep_tick();
-	timer_intr(arg);
+static void timekeep_timer_tick(__unused void *arg) {
+	timekeep_tick();
+
+	/*
+	 * The timecounter may have changed. Cannot use timer_start here,
+	 * because the timer queue is locked.
+	 */
+	timekeep_timer.period = timekeep_max_interval();
 }
 
 void __init init_timer(void) {
 	timerq_t *timerq = timerq_get();
+	size_t level, slot;
 
 	sync_init(&timerq->lock, SYNC_SPINLOCK);
-	list_init(&timerq->queue);
 	list_init(&timerq->ontick);
+	list_init(&timerq->expired);
+	rb_tree_init(&timerq->overflow);
+	timerq->deadline = TW_TIME_NONE;
+
+	for(level = 0; level < TW_LEVELS; level++) {
+		timerq->pending[level] = 0;
+		for(slot = 0; slot < TW_SLOTS; slot++) {
+			list_init(&timerq->wheel[level][slot]);
+		}
+	}
 
 	/*
 	 * We need one periodic tick on one processor (actually it's the BSP)
 	 * for housekeeping.
 	 */
-	timerq->dev = evtimer_get(EV_F_ONESHOT | EV_F_PERIODIC | EV_F_CPULOCAL,
-		bsp_p() ? tick : timer_intr, timerq);
+	timerq->dev = evtimer_get(EV_F_PERIODIC | EV_F_CPULOCAL, timer_intr,
+		timerq);
 	if(timerq->dev == NULL) {
 		kpanic("[timer] no event timer for CPU%d\n", cur_cpu()->id);
 	}
 
-	if(bsp_p()) {
-		timerq->bsp = true;
+	/*
+	 * The wheel starts at the current time.
+	 */
+	timerq->clk = tw_tick(nanouptime());
 
-		/*
-		 * Configure the timer to periodically tick.
-		 */
+	/*
+	 * Without one-shot mode the timer queue cannot be tickless.
+	 */
+	if(!(timerq->dev->flags & EV_F_ONESHOT)) {
+		kprintf("[timer] %s does not support one-shot mode, "
+			"CPU%d keeps ticking\n", timerq->dev->name,
+			cur_cpu()->id);
+		timerq->periodic = true;
+		timerq->evmode = TQ_EV_PERIODIC;
 		evtimer_config(timerq->dev, EV_PERIODIC, TICK_PERIOD);
+	} else {
+		timerq->periodic = false;
+		timerq->evmode = TQ_EV_STOPPED;
+		evtimer_stop(timerq->dev);
+	}
+
+	if(bsp_p()) {
+		timer_init(&timekeep_timer, timekeep_timer_tick, NULL);
+		timer_start(&timekeep_timer, timekeep_max_interval(),
+			TIMER_PERIODIC);
 	}
 }
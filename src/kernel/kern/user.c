@@ -219,3 +219,22 @@ int copyout_atomic(void *ubuf, const void *buf, size_t size) {
 error:
 	return -EFAULT;
 }
+
+int ucmpxchg32(uint32_t *uaddr, uint32_t old, uint32_t new, uint32_t *cur) {
+	int err;
+
+	err = user_io_check(uaddr, sizeof(*uaddr), NULL);
+	if(err) {
+		return err;
+	}
+
+	assert(kwp_enabled());
+	mayfault(error) {
+		*cur = atomic_cmpxchg_val(uaddr, old, new);
+	}
+
+	return 0;
+
+error:
+	return -EFAULT;
+}
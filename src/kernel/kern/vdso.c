@@ -0,0 +1,252 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ *
+ * Copyright (c) 2017, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <kern/system.h>
+#include <kern/init.h>
+#include <kern/atomic.h>
+#include <kern/time.h>
+#include <kern/vdso.h>
+#include <device/timecounter.h>
+#include <lib/string.h>
+#include <lib/elf.h>
+#include <vm/shpage.h>
+
+#define VDSO_NDYN	6
+#define VDSO_STRSZ	64
+
+/*
+ * The code of the vDSO (arch/i386/vdso.sx).
+ */
+extern const char vdso_text_start[], vdso_text_end[];
+extern const char vdso_clock_gettime[], vdso_gettimeofday[], vdso_time[];
+extern const char vdso_vsyscall[];
+
+static const struct {
+	const char *name;
+	const char *func;
+} vdso_funcs[] = {
+	{ "__vdso_clock_gettime", vdso_clock_gettime },
+	{ "__vdso_gettimeofday", vdso_gettimeofday },
+	{ "__vdso_time", vdso_time },
+	{ "__kernel_vsyscall", vdso_vsyscall },
+};
+
+/* symbol 0 is the undefined symbol */
+#define VDSO_NSYM	(NELEM(vdso_funcs) + 1)
+
+/*
+ * The ELF image of the vDSO is generated at boot. It consists of a single
+ * PT_LOAD segment with a dynamic section, which is just enough for the
+ * dynamic linker of the C library to resolve the symbols. All addresses
+ * are relative to the ELF header.
+ */
+typedef struct vdso_image {
+	elf32_ehdr_t ehdr;
+	elf32_phdr_t phdr[2];
+	elf32_dyn_t dyn[VDSO_NDYN];
+	elf32_word_t hash[2 + 1 + VDSO_NSYM];
+	elf32_sym_t sym[VDSO_NSYM];
+	char strtab[VDSO_STRSZ];
+	union {
+		vdso_data_t data;
+		char data_pad[VDSO_DATA_SIZE];
+	} __align(16);
+	char text[];
+} vdso_image_t;
+
+ASSERT(sizeof(vdso_data_t) <= VDSO_DATA_SIZE, "vdso_data_t too large");
+ASSERT(offsetof(vdso_image_t, text) - offsetof(vdso_image_t, data) ==
+	VDSO_DATA_SIZE, "the vdso code has to follow the data");
+ASSERT(offsetof(vdso_data_t, gen) == VDSO_DATA_GEN, "");
+ASSERT(offsetof(vdso_data_t, mode) == VDSO_DATA_MODE, "");
+ASSERT(offsetof(vdso_data_t, count) == VDSO_DATA_COUNT, "");
+ASSERT(offsetof(vdso_data_t, mult) == VDSO_DATA_MULT, "");
+ASSERT(offsetof(vdso_data_t, shift) == VDSO_DATA_SHIFT, "");
+ASSERT(offsetof(vdso_data_t, up_sec) == VDSO_DATA_UP_SEC, "");
+ASSERT(offsetof(vdso_data_t, up_nsec) == VDSO_DATA_UP_NSEC, "");
+ASSERT(offsetof(vdso_data_t, boot_sec) == VDSO_DATA_BOOT_SEC, "");
+ASSERT(offsetof(vdso_data_t, boot_nsec) == VDSO_DATA_BOOT_NSEC, "");
+
+static vdso_image_t *vdso_image;
+static vdso_data_t *vdso_data;
+
+/*
+ * The scale of the timecounter, only used by timekeep_tick().
+ */
+static struct timecounter *vdso_tc;
+static uint32_t vdso_mult, vdso_shift;
+
+/**
+ * @brief Calculate mult and shift, so that nanoseconds =
+ *	  (delta * mult) >> shift with mult fitting into 32 bits.
+ */
+static void vdso_scale(frequency_t freq) {
+	uint32_t shift = 31;
+
+	while(shift > 0 && (SEC_NANOSECS << shift) / freq > UINT32_MAX) {
+		shift--;
+	}
+
+	vdso_mult = (SEC_NANOSECS << shift) / freq;
+	vdso_shift = shift;
+}
+
+void vdso_update(struct timecounter *tc, uint64_t count,
+	struct timespec *uptime, struct timespec *boottime)
+{
+	vdso_data_t *data = atomic_load_acquire(&vdso_data);
+	uint32_t gen;
+
+	if(data == NULL) {
+		return;
+	}
+
+	if(tc != vdso_tc) {
+		vdso_scale(tc->freq);
+		vdso_tc = tc;
+	}
+
+	/*
+	 * There is only one writer, so a sequence counter is
+	 * sufficient.
+	 */
+	gen = data->gen + 1;
+	atomic_store_relaxed(&data->gen, gen);
+	atomic_thread_fence(ATOMIC_RELEASE);
+
+	data->mode = tc->vdso;
+	data->count = count;
+	data->mult = vdso_mult;
+	data->shift = vdso_shift;
+	data->up_sec = uptime->tv_sec;
+	data->up_nsec = uptime->tv_nsec;
+	data->boot_sec = boottime->tv_sec;
+	data->boot_nsec = boottime->tv_nsec;
+
+	atomic_store_release(&data->gen, gen + 1);
+}
+
+vm_vaddr_t vdso_addr(void) {
+	return vm_shpage_addr(vdso_image);
+}
+
+vm_vaddr_t vdso_text_addr(const char *text) {
+	kassert(text >= vdso_text_start && text < vdso_text_end, "[vdso] "
+		"invalid text address: %p", text);
+	return vdso_addr() + offsetof(vdso_image_t, text) +
+		(text - vdso_text_start);
+}
+
+vm_vaddr_t vdso_sym(const char *name) {
+	for(size_t i = 0; i < NELEM(vdso_funcs); i++) {
+		if(!strcmp(vdso_funcs[i].name, name)) {
+			return vdso_text_addr(vdso_funcs[i].func);
+		}
+	}
+
+	kpanic("[vdso] unknown symbol: %s", name);
+}
+
+void __init init_vdso(void) {
+	size_t text_size = vdso_text_end - vdso_text_start;
+	size_t size = sizeof(vdso_image_t) + text_size;
+	vdso_image_t *image;
+	elf32_ehdr_t *ehdr;
+	size_t stroff = 1;
+
+	/*
+	 * The shared page is already zeroed.
+	 */
+	image = vm_shpage_alloc(size, PAGE_SZ);
+	memcpy(image->text, vdso_text_start, text_size);
+
+	ehdr = &image->ehdr;
+	memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+	ehdr->e_ident[EI_CLASS] = ELFCLASS32;
+	ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+	ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr->e_ident[EI_OSABI] = ELFOSABI_LINUX;
+	ehdr->e_type = ET_DYN;
+	ehdr->e_machine = EM_386;
+	ehdr->e_version = EV_CURRENT;
+	ehdr->e_phoff = offsetof(vdso_image_t, phdr);
+	ehdr->e_ehsize = sizeof(elf32_ehdr_t);
+	ehdr->e_phentsize = sizeof(elf32_phdr_t);
+	ehdr->e_phnum = NELEM(image->phdr);
+
+	image->phdr[0].p_type = PT_LOAD;
+	image->phdr[0].p_offset = 0;
+	image->phdr[0].p_vaddr = 0;
+	image->phdr[0].p_filesz = size;
+	image->phdr[0].p_memsz = size;
+	image->phdr[0].p_flags = PF_R | PF_X;
+	image->phdr[0].p_align = PAGE_SZ;
+
+	image->phdr[1].p_type = PT_DYNAMIC;
+	image->phdr[1].p_offset = offsetof(vdso_image_t, dyn);
+	image->phdr[1].p_vaddr = offsetof(vdso_image_t, dyn);
+	image->phdr[1].p_filesz = sizeof(image->dyn);
+	image->phdr[1].p_memsz = sizeof(image->dyn);
+	image->phdr[1].p_flags = PF_R;
+	image->phdr[1].p_align = sizeof(elf32_word_t);
+
+#define vdso_dyn(i, tag, val) \
+	image->dyn[i] = (elf32_dyn_t) { tag, { .d_ptr = val } }
+	vdso_dyn(0, DT_HASH, offsetof(vdso_image_t, hash));
+	vdso_dyn(1, DT_SYMTAB, offsetof(vdso_image_t, sym));
+	vdso_dyn(2, DT_STRTAB, offsetof(vdso_image_t, strtab));
+	vdso_dyn(3, DT_STRSZ, VDSO_STRSZ);
+	vdso_dyn(4, DT_SYMENT, sizeof(elf32_sym_t));
+	vdso_dyn(5, DT_NULL, 0);
+#undef vdso_dyn
+
+	/*
+	 * A hash table with a single bucket chaining all symbols.
+	 */
+	image->hash[0] = 1;
+	image->hash[1] = VDSO_NSYM;
+	image->hash[2] = VDSO_NSYM - 1;
+	for(size_t i = 1; i < VDSO_NSYM; i++) {
+		image->hash[3 + i] = i - 1;
+	}
+
+	for(size_t i = 0; i < NELEM(vdso_funcs); i++) {
+		elf32_sym_t *sym = &image->sym[i + 1];
+		size_t len = strlen(vdso_funcs[i].name) + 1;
+
+		kassert(stroff + len <= VDSO_STRSZ, "[vdso] strtab too small");
+		memcpy(&image->strtab[stroff], vdso_funcs[i].name, len);
+
+		sym->st_name = stroff;
+		sym->st_value = offsetof(vdso_image_t, text) +
+			(vdso_funcs[i].func - vdso_text_start);
+		sym->st_info = (STB_GLOBAL << 4) | STT_FUNC;
+		sym->st_shndx = 1;
+		stroff += len;
+	}
+
+	vdso_image = image;
+	atomic_store_release(&vdso_data, &image->data);
+}
@@ -0,0 +1,409 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ * 
+ * Copyright (c) 2018, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <kern/system.h>
+#include <kern/workqueue.h>
+#include <kern/atomic.h>
+#include <kern/percpu.h>
+#include <kern/sched.h>
+#include <kern/proc.h>
+#include <kern/wait.h>
+#include <kern/sync.h>
+#include <kern/init.h>
+#include <kern/cpu.h>
+#include <vm/malloc.h>
+
+/*
+ * Every workqueue has one pool of worker threads per cpu. Work is
+ * queued on the pool of the cpu calling work_queue() and the worker
+ * threads of a pool never leave their cpu, which means that work
+ * runs on the cpu it was queued on (until the application processors
+ * are started, every work is run on the boot processor).
+ *
+ * A work structure is pending as long as work->pool is not NULL. The
+ * field is only changed while holding the lock of the pool it points
+ * to, which allows work_cancel() to find the pool without any
+ * additional locking.
+ */
+#define WQ_MAX 8
+
+typedef struct wq_worker {
+	struct wq_pool *pool;
+	work_t *current; /* only compared, never dereferenced */
+} wq_worker_t;
+
+typedef struct wq_pool {
+	sync_t lock;
+	struct workqueue *wq;
+	cpu_t *cpu;
+	list_t pending;
+
+	/*
+	 * Number of pending and running work structures.
+	 */
+	size_t nactive;
+
+	waitqueue_t work_wq; /* idle workers */
+	wq_worker_t *workers;
+} wq_pool_t;
+
+typedef struct workqueue {
+	list_node_t node;
+	const char *name;
+	uint8_t prio;
+	size_t max_active;
+	size_t id;
+	wq_pool_t *boot_pool;
+
+	/*
+	 * Threads waiting in work_flush() or workqueue_flush(). The
+	 * waitqueue is only woken up if nflush is not zero.
+	 */
+	waitqueue_t flush_wq;
+	size_t nflush;
+} workqueue_t;
+
+typedef struct wq_cpu {
+	wq_pool_t *pools[WQ_MAX];
+} wq_cpu_t;
+
+static DEFINE_PERCPU(wq_cpu_t, wq_cpu);
+static DEFINE_LIST(wq_list);
+static sync_t wq_list_lock = SYNC_INIT(MUTEX);
+static size_t wq_num = 0;
+workqueue_t *system_wq;
+
+static inline wq_pool_t *wq_pool_cpu(workqueue_t *wq, cpu_t *cpu) {
+	wq_cpu_t *wcpu = PERCPU_CPU(cpu, &wq_cpu);
+	return atomic_load_acquire(&wcpu->pools[wq->id]);
+}
+
+static inline wq_pool_t *wq_pool_get(workqueue_t *wq) {
+	wq_pool_t *pool;
+
+	pool = wq_pool_cpu(wq, cur_cpu());
+	if(pool == NULL) {
+		pool = wq->boot_pool;
+	}
+
+	return pool;
+}
+
+static void wq_flush_wakeup(workqueue_t *wq) {
+	if(atomic_load(&wq->nflush)) {
+		wakeup(&wq->flush_wq, SCHED_KERNEL);
+	}
+}
+
+static int wq_worker(void *arg) {
+	wq_worker_t *worker = arg;
+	wq_pool_t *pool = worker->pool;
+	work_func_t func = NULL;
+	waiter_t wait;
+	work_t *work;
+	void *warg = NULL;
+	int err;
+
+	waiter_init(&wait);
+
+	for(;;) {
+		wait_prep(&pool->work_wq, &wait);
+
+		synchronized(&pool->lock) {
+			work = list_pop_front(&pool->pending);
+			if(work) {
+				atomic_store_relaxed(&work->pool, NULL);
+				worker->current = work;
+				func = work->func;
+				warg = work->arg;
+			}
+		}
+
+		if(work == NULL) {
+			err = wait_sleep(&pool->work_wq, &wait,
+				WAIT_INTERRUPTABLE);
+			if(err) {
+				kpanic("[workqueue] %s: worker killed",
+					pool->wq->name);
+			}
+
+			continue;
+		}
+
+		wait_abort(&pool->work_wq, &wait);
+
+		/*
+		 * The work may be freed or queued again by func.
+		 */
+		func(warg);
+
+		synchronized(&pool->lock) {
+			worker->current = NULL;
+			pool->nactive--;
+		}
+
+		wq_flush_wakeup(pool->wq);
+	}
+
+	notreached();
+}
+
+static wq_pool_t *wq_pool_alloc(workqueue_t *wq, cpu_t *cpu) {
+	wq_pool_t *pool;
+	wq_cpu_t *wcpu;
+
+	pool = kmalloc(sizeof(*pool), VM_WAIT);
+	pool->workers = kmalloc(sizeof(wq_worker_t) * wq->max_active,
+		VM_WAIT);
+	sync_init(&pool->lock, SYNC_SPINLOCK);
+	waitqueue_init(&pool->work_wq);
+	list_init(&pool->pending);
+	pool->nactive = 0;
+	pool->wq = wq;
+	pool->cpu = cpu;
+
+	for(size_t i = 0; i < wq->max_active; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].current = NULL;
+		kthread_spawn_cpu(wq_worker, &pool->workers[i], wq->prio, cpu);
+	}
+
+	wcpu = PERCPU_CPU(cpu, &wq_cpu);
+	atomic_store_release(&wcpu->pools[wq->id], pool);
+
+	return pool;
+}
+
+workqueue_t *workqueue_create(const char *name, uint8_t prio,
+	size_t max_active)
+{
+	workqueue_t *wq;
+	cpu_t *cpu;
+
+	assert(max_active > 0);
+
+	wq = kmalloc(sizeof(*wq), VM_WAIT);
+	list_node_init(wq, &wq->node);
+	wq->name = name;
+	wq->prio = prio;
+	wq->max_active = max_active;
+	waitqueue_init(&wq->flush_wq);
+	wq->nflush = 0;
+
+	sync_scope_acquire(&wq_list_lock);
+	if(wq_num == WQ_MAX) {
+		kpanic("[workqueue] too many workqueues");
+	}
+
+	wq->id = wq_num++;
+	wq->boot_pool = wq_pool_alloc(wq, &boot_cpu);
+	foreach_ap(cpu) {
+		if(cpu->running) {
+			wq_pool_alloc(wq, cpu);
+		}
+	}
+
+	list_append(&wq_list, &wq->node);
+
+	return wq;
+}
+
+static bool wq_busy(void *arg) {
+	workqueue_t *wq = arg;
+	wq_pool_t *pool;
+	cpu_t *cpu;
+
+	foreach_cpu(cpu) {
+		pool = wq_pool_cpu(wq, cpu);
+		if(pool) {
+			sync_scope_acquire(&pool->lock);
+			if(pool->nactive) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Sleep on the flush waitqueue until @p busy returns false.
+ */
+static void wq_flush_wait(workqueue_t *wq, bool (*busy) (void *),
+	void *arg)
+{
+	waiter_t wait;
+
+	waiter_init(&wait);
+	atomic_inc(&wq->nflush);
+	for(;;) {
+		wait_prep(&wq->flush_wq, &wait);
+		if(!busy(arg)) {
+			wait_abort(&wq->flush_wq, &wait);
+			break;
+		}
+
+		wait_sleep(&wq->flush_wq, &wait, 0);
+	}
+
+	atomic_dec(&wq->nflush);
+	waiter_destroy(&wait);
+}
+
+void workqueue_flush(workqueue_t *wq) {
+	wq_flush_wait(wq, wq_busy, wq);
+}
+
+bool work_queue(workqueue_t *wq, work_t *work) {
+	wq_pool_t *pool;
+
+	kassert(wq, "[workqueue] queueing work before initialization");
+
+	/*
+	 * Threads do not change their cpu (see sched_pin()).
+	 */
+	pool = wq_pool_get(wq);
+	synchronized(&pool->lock) {
+		if(!atomic_cmpxchg(&work->pool, NULL, pool)) {
+			return false;
+		}
+
+		work->wq = wq;
+		list_append(&pool->pending, &work->node);
+		pool->nactive++;
+	}
+
+	wakeup_num(&pool->work_wq, wq->prio, 1);
+
+	return true;
+}
+
+bool work_cancel(work_t *work) {
+	wq_pool_t *pool;
+
+	/*
+	 * The work might be moved to another pool (i.e. it might be run
+	 * and queued again) while waiting for the lock.
+	 */
+	while((pool = atomic_load(&work->pool))) {
+		sync_acquire(&pool->lock);
+		if(work->pool == pool) {
+			list_remove(&pool->pending, &work->node);
+			atomic_store_relaxed(&work->pool, NULL);
+			pool->nactive--;
+			sync_release(&pool->lock);
+
+			wq_flush_wakeup(pool->wq);
+			return true;
+		}
+
+		sync_release(&pool->lock);
+	}
+
+	return false;
+}
+
+static bool work_busy(void *arg) {
+	work_t *work = arg;
+	workqueue_t *wq = work->wq;
+	wq_pool_t *pool;
+	cpu_t *cpu;
+
+	if(atomic_load(&work->pool)) {
+		return true;
+	}
+
+	foreach_cpu(cpu) {
+		pool = wq_pool_cpu(wq, cpu);
+		if(pool == NULL) {
+			continue;
+		}
+
+		sync_scope_acquire(&pool->lock);
+		for(size_t i = 0; i < wq->max_active; i++) {
+			if(pool->workers[i].current == work) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void work_flush(work_t *work) {
+	/*
+	 * The work was never queued.
+	 */
+	if(work->wq != NULL) {
+		wq_flush_wait(work->wq, work_busy, work);
+	}
+}
+
+void delayed_work_timer(void *arg) {
+	delayed_work_t *dwork = arg;
+
+	if(atomic_xchg(&dwork->armed, false)) {
+		work_queue(dwork->wq, &dwork->work);
+	}
+}
+
+bool delayed_work_queue(workqueue_t *wq, delayed_work_t *dwork,
+	nanosec_t delay)
+{
+	if(atomic_load(&dwork->work.pool) || atomic_xchg(&dwork->armed, true)) {
+		return false;
+	}
+
+	dwork->wq = wq;
+	timer_start(&dwork->timer, delay, TIMER_ONESHOT);
+
+	return true;
+}
+
+bool delayed_work_cancel(delayed_work_t *dwork) {
+	if(atomic_xchg(&dwork->armed, false)) {
+		timer_stop(&dwork->timer);
+		return true;
+	} else {
+		return work_cancel(&dwork->work);
+	}
+}
+
+void __init init_workqueue(void) {
+	system_wq = workqueue_create("system", SCHED_KERNEL, 2);
+}
+
+void __init init_workqueue_mp(void) {
+	workqueue_t *wq;
+	cpu_t *cpu;
+
+	sync_scope_acquire(&wq_list_lock);
+	foreach(wq, &wq_list) {
+		foreach_ap(cpu) {
+			if(cpu->running && wq_pool_cpu(wq, cpu) == NULL) {
+				wq_pool_alloc(wq, cpu);
+			}
+		}
+	}
+}
@@ -1,52 +0,0 @@
-/*
- * ███████╗██╗      ██████╗ ███████╗
- * ██╔════╝██║     ██╔═══██╗██╔════╝
- * █████╗  ██║     ██║   ██║███████╗
- * ██╔══╝  ██║     ██║   ██║╚════██║
- * ███████╗███████╗╚██████╔╝███████║
- * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
- *
- * Copyright (c) 2018, Elias Zell
- *
- * Permission to use, copy, modify, and/or distribute this software for any
- * purpose with or without fee is hereby granted, provided that the above
- * copyright notice and this permission notice appear in all copies.
- *
- * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
- * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
- * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
- * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
- * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
- * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
- * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
- *
- */
-
-#include <kern/system.h>
-#include <kern/symbol.h>
-#include <lib/string.h>
-
-#undef memcpy
-void *memcpy(void *dst, void const *src, size_t len) {
-	uint32_t const *src32 = src;
-	uint32_t *dst32 = dst;
-	uint8_t *dst8, *src8;
-
-	if(PTR_ALIGNED(src, 4) && PTR_ALIGNED(dst, 4))  {
-		while(len >= 4)  {
-			*dst32++ = *src32++;
-			len -= 4;
-		}
-	}
-
-	dst8 = (uint8_t *)dst32;
-	src8 = (uint8_t *)src32;
-
-	while(len--) {
-		*dst8++ = *src8++;
-	}
-
-	return dst;
-}
-
-export(memcpy);
@@ -1,40 +0,0 @@
-/*
- * ███████╗██╗      ██████╗ ███████╗
- * ██╔════╝██║     ██╔═══██╗██╔════╝
- * █████╗  ██║     ██║   ██║███████╗
- * ██╔══╝  ██║     ██║   ██║╚════██║
- * ███████╗███████╗╚██████╔╝███████║
- * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
- * 
- * Copyright (c) 2018, Elias Zell
- *
- * Permission to use, copy, modify, and/or distribute this software for any
- * purpose with or without fee is hereby granted, provided that the above
- * copyright notice and this permission notice appear in all copies.
- *
- * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
- * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
- * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
- * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
- * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
- * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
- * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
- *
- */
-
-#include <kern/system.h>
-#include <kern/symbol.h>
-#include <lib/string.h>
-
-#undef memset
-void *memset(void *ptr, int c, size_t n) {
-	uint8_t *p = ptr;
-
-	while(n--) {
-		*p++ = c;
-	}
-
-	return ptr;
-}
-
-export(memset);
\ No newline at end of file
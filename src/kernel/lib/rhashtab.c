@@ -0,0 +1,176 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ *
+ * Copyright (c) 2017, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <kern/system.h>
+#include <lib/rhashtab.h>
+#include <vm/malloc.h>
+#include <sys/pow2.h>
+
+/*
+ * The hashtable is doubled if there are more than RHASHTAB_GROW entries per
+ * bucket and halved if there are less than one entry per RHASHTAB_SHRINK
+ * buckets.
+ */
+#define RHASHTAB_GROW	2
+#define RHASHTAB_SHRINK	8
+
+/*
+ * The number of old buckets migrated by every rhashtab_set and
+ * rhashtab_remove.
+ */
+#define RHASHTAB_STEP	4
+
+static rhash_node_t **rhashtab_alloc_buckets(size_t num, vm_flags_t flags) {
+	rhash_node_t **buckets;
+
+	buckets = kmalloc(sizeof(rhash_node_t *) * num, flags);
+	if(buckets) {
+		for(size_t i = 0; i < num; i++) {
+			buckets[i] = NULL;
+		}
+	}
+
+	return buckets;
+}
+
+int rhashtab_alloc(rhashtab_t *tab, size_t min, vm_flags_t flags) {
+	VM_FLAGS_CHECK(flags, VM_WAIT);
+
+	tab->min = next_pow2(max(min, (size_t)RHASHTAB_MIN));
+	tab->nbuckets = tab->min;
+	tab->buckets = rhashtab_alloc_buckets(tab->nbuckets, flags);
+	if(!tab->buckets) {
+		return -ENOMEM;
+	}
+
+	tab->old = NULL;
+	tab->nold = 0;
+	tab->migrated = 0;
+	tab->num = 0;
+
+	return 0;
+}
+
+void rhashtab_free(rhashtab_t *tab) {
+	assert(tab->num == 0);
+
+	if(tab->old) {
+		kfree(tab->old);
+	}
+
+	kfree(tab->buckets);
+}
+
+static void rhashtab_migrate(rhashtab_t *tab) {
+	for(size_t i = 0; i < RHASHTAB_STEP && tab->migrated < tab->nold;
+		i++)
+	{
+		rhash_node_t **bucket = &tab->old[tab->migrated++];
+		rhash_node_t *node, **new;
+
+		while((node = *bucket) != NULL) {
+			*bucket = node->next;
+
+			new = &tab->buckets[node->hash & (tab->nbuckets - 1)];
+			node->next = *new;
+			*new = node;
+		}
+	}
+
+	if(tab->migrated == tab->nold) {
+		kfree(tab->old);
+		tab->old = NULL;
+		tab->nold = 0;
+		tab->migrated = 0;
+	}
+}
+
+static void rhashtab_resize(rhashtab_t *tab, size_t size) {
+	rhash_node_t **buckets;
+
+	/*
+	 * The caller might hold locks needed for reclaiming memory, so
+	 * resizing is simply skipped if memory is short.
+	 */
+	buckets = rhashtab_alloc_buckets(size, VM_NOFLAG);
+	if(buckets == NULL) {
+		return;
+	}
+
+	tab->old = tab->buckets;
+	tab->nold = tab->nbuckets;
+	tab->migrated = 0;
+	tab->buckets = buckets;
+	tab->nbuckets = size;
+}
+
+/*
+ * Called after every modification of the hashtable.
+ */
+static void rhashtab_step(rhashtab_t *tab) {
+	if(tab->old) {
+		rhashtab_migrate(tab);
+	} else if(tab->num > tab->nbuckets * RHASHTAB_GROW) {
+		rhashtab_resize(tab, tab->nbuckets << 1);
+	} else if(tab->nbuckets > tab->min &&
+		tab->num < tab->nbuckets / RHASHTAB_SHRINK)
+	{
+		rhashtab_resize(tab, tab->nbuckets >> 1);
+	}
+}
+
+void rhashtab_set(rhashtab_t *tab, size_t hash, rhash_node_t *node) {
+	rhash_node_t **bucket;
+
+	kassert(node->value != NULL, "[rhashtab] set: uninitialized node");
+	node->hash = hash;
+
+	bucket = rhashtab_bucket(tab, hash);
+	node->next = *bucket;
+	*bucket = node;
+	tab->num++;
+
+	rhashtab_step(tab);
+}
+
+void rhashtab_remove(rhashtab_t *tab, size_t hash, rhash_node_t *node) {
+	rhash_node_t **cur;
+
+	kassert(node->hash == hash, "[rhashtab] remove: hash mismatch: "
+		"0x%x != 0x%x", node->hash, hash);
+
+	for(cur = rhashtab_bucket(tab, hash); *cur != node;
+		cur = &(*cur)->next)
+	{
+		kassert(*cur != NULL, "[rhashtab] remove: node not found");
+	}
+
+	*cur = node->next;
+	node->next = NULL;
+	assert(tab->num > 0);
+	tab->num--;
+
+	rhashtab_step(tab);
+}
@@ -50,6 +50,7 @@ static inline int file_do_alloc(vpath_t *path, int flags, file_t **fp) {
 	file->foff_flags = 0;
 	file->foff = 0;
 	file->priv = NULL;
+	file_ra_init(&file->ra);
 
 	if(path != NULL) {
 		vpath_cpy(&file->path, path);
@@ -26,7 +26,10 @@
 #include <vfs/vnode.h>
 #include <vfs/fs.h>
 #include <vfs/uio.h>
+#include <vfs/readahead.h>
+#include <vm/malloc.h>
 #include <vm/object.h>
+#include <vm/pghash.h>
 #include <vm/page.h>
 #include <vm/phys.h>
 #include <vm/pageout.h>
@@ -41,30 +44,129 @@ static void vop_page_zero(vnode_t *node, vm_page_t *page, vm_objoff_t off) {
 	}
 }
 
-static int vop_generic_page_rdwr(vnode_t *node, vm_page_t *page,
-	vm_objoff_t off, blk_rtype_t io)
+/*
+ * A run of contiguous device blocks, which is read or written using one
+ * scatter/gather request.
+ */
+typedef struct vop_run {
+	blk_req_t *req; /* the request of the run or NULL */
+	blkno_t next; /* the device block continuing the run */
+} vop_run_t;
+
+static inline void vop_run_init(vop_run_t *run) {
+	run->req = NULL;
+	run->next = 0;
+}
+
+/*
+ * Launch the request of a run. This does not wait for the request to
+ * finish, which is good for block devices allowing parallel requests.
+ * Furthermore the request is automatically freed on error.
+ */
+static int vop_run_launch(vop_run_t *run) {
+	blk_req_t *req = run->req;
+
+	if(req == NULL) {
+		return 0;
+	}
+
+	run->req = NULL;
+	return blk_req_launch(req);
+}
+
+/*
+ * Complete the request of a run without launching it, so that
+ * blk_abort does not wait for it.
+ */
+static void vop_run_abort(vop_run_t *run, int err) {
+	if(run->req != NULL) {
+		blk_req_done(run->req, err);
+		run->req = NULL;
+	}
+}
+
+/*
+ * Add @p cnt device blocks starting at @p blk, which are transferred
+ * from/to @p paddr, to a run. A new run is started if the blocks do not
+ * continue the current one or if the request would exceed the transfer
+ * limit of the device.
+ */
+static int vop_run_add(vop_run_t *run, blk_provider_t *dev,
+	blk_handler_t *handler, blk_rtype_t io, blkno_t blk, blkcnt_t cnt,
+	vm_paddr_t paddr)
+{
+	size_t size = cnt << blk_get_blkshift(dev);
+	blkcnt_t max = blk_get_max_cnt(dev);
+	blk_req_t *req = run->req;
+	blk_seg_t *seg = NULL;
+	int err;
+
+	assert(max == 0 || cnt <= max);
+	if(req != NULL && blk == run->next &&
+		(max == 0 || req->io.cnt + cnt <= max))
+	{
+		seg = &req->io.seg[req->io.nseg - 1];
+		if(seg->paddr + seg->size != paddr) {
+			seg = NULL;
+			if(req->io.nseg == BLK_REQ_NSEG) {
+				req = NULL;
+			}
+		}
+	} else {
+		req = NULL;
+	}
+
+	if(req == NULL) {
+		err = vop_run_launch(run);
+		if(err) {
+			return err;
+		}
+
+		req = blk_req_new(dev, handler, io,
+			BLK_REQ_SG | BLK_REQ_AUTOFREE, 0 /* TODO */);
+		req->io.blk = blk;
+		req->io.cnt = 0;
+		req->io.map = NULL;
+		req->io.paddr = 0;
+		req->io.nseg = 0;
+		run->req = req;
+	}
+
+	if(seg == NULL) {
+		seg = &req->io.seg[req->io.nseg++];
+		seg->paddr = paddr;
+		seg->size = 0;
+	}
+
+	seg->size += size;
+	req->io.cnt += cnt;
+	run->next = blk + cnt;
+
+	return 0;
+}
+
+/*
+ * Add the blocks of a page to a run. The requests complete using
+ * @p handler. The last request is not launched, so that the blocks of
+ * the next page of a multi-page operation can be merged into it. Use
+ * vop_run_launch to launch it. On error, the run is aborted.
+ */
+static int vop_page_launch(vnode_t *node, blk_handler_t *handler,
+	vm_page_t *page, vm_objoff_t off, blk_rtype_t io, vop_run_t *run)
 {
 	blk_provider_t *dev = filesys_dev(node->fs);
-	const blksize_t dev_blksz = blk_get_blksize(dev);
 	const blksize_t blksz = vnode_blksz(node);
-	blk_handler_t *handler;
 	vm_paddr_t phys;
-	int err;
+	size_t i;
 
-	assert(dev_blksz <= (blksize_t)PAGE_SZ);
-	assert(dev_blksz <= blksz);
+	assert(blk_get_blksize(dev) <= (blksize_t)PAGE_SZ);
+	assert(blk_get_blksize(dev) <= blksz);
 	VN_ASSERT_LOCK_VM(node);
 
-	handler = blk_handler_new(0);
-	if(io == BLK_WR) {
-		vop_page_zero(node, page, off);
-	}
-
 	phys = vm_page_phys(page);
-	for(size_t i = 0; i < PAGE_SZ && off + i < node->size; i += blksz) {
+	for(i = 0; i < PAGE_SZ && off + i < node->size; i += blksz) {
 		vm_objoff_t cur_off = off + i;
 		blkno_t pbn, lbn;
-		blk_req_t *req;
 		size_t boff;
 		int err;
 
@@ -76,8 +178,7 @@ static int vop_generic_page_rdwr(vnode_t *node, vm_page_t *page,
 		 */
 		err = vnode_bmap(node, io == BLK_WR, lbn, &pbn);
 		if(err) {
-			blk_abort(handler);
-			blk_handler_free(handler);
+			vop_run_abort(run, err);
 			return err;
 		}
 
@@ -87,84 +188,251 @@ static int vop_generic_page_rdwr(vnode_t *node, vm_page_t *page,
 			continue;
 		}
 
-		/*
-		 * Allocate a new request.
-		 */
-		req = blk_req_new(dev, handler, io,
-			BLK_REQ_PHYS | BLK_REQ_AUTOFREE, 0 /* TODO */);
-
 		/*
 		 * Convert the filesystem block to device blocks. Remember
 		 * that the device block size has to be smaller or equal to
 		 * the filesystem block size. Thus there should not be an
 		 * offset into the device block.
 		 */
-		req->io.blk = blk_off_to_blk(dev,
-			(pbn << node->blksz_shift) + boff);
-
-		/*
-		 * Calculate the number of device blocks that are read or
-		 * written.
-		 */
-		req->io.cnt = 1 << (node->blksz_shift - blk_get_blkshift(dev));
-
-		/*
-		 * Give the device the memory address.
-		 */
-		req->io.map = NULL;
-		req->io.paddr = phys + i;
-
-		/*
-		 * Launch the requst. This does not wait for the request to
-		 * finish, which is good for block devices allowing parallel
-		 * requests. Furthermore the requests are automatically freed
-		 * on error.
-		 */
-		err = blk_req_launch(req);
+		err = vop_run_add(run, dev, handler, io,
+			blk_off_to_blk(dev, (pbn << node->blksz_shift) + boff),
+			1 << (node->blksz_shift - blk_get_blkshift(dev)),
+			phys + i);
 		if(err) {
-			blk_abort(handler);
-			blk_handler_free(handler);
 			return err;
 		}
 	}
 
+	/*
+	 * Nothing is read beyond the last block of the file. Zero that part
+	 * now, because vop_read_done does not zero pages, which were
+	 * truncated away in the meantime.
+	 */
+	if(io == BLK_RD && i < PAGE_SZ) {
+		vm_page_zero_range(page, i, PAGE_SZ - i);
+	}
+
+	return 0;
+}
+
+static int vop_generic_page_write(vnode_t *node, vm_page_t *page,
+	vm_objoff_t off)
+{
+	blk_handler_t *handler;
+	vop_run_t run;
+	int err;
+
+	VN_ASSERT_LOCK_VM(node);
+
+	handler = blk_handler_new(0);
+	vop_page_zero(node, page, off);
+
+	vop_run_init(&run);
+	err = vop_page_launch(node, handler, page, off, BLK_WR, &run);
+	if(err == 0) {
+		err = vop_run_launch(&run);
+	}
+	if(err) {
+		blk_abort(handler);
+		blk_handler_free(handler);
+		return err;
+	}
+
 	/*
 	 * TODO asynchronous writes
 	 */
 	err = blk_handler_start(handler);
-	/* TODO not for async */
 	blk_handler_free(handler);
-
 	if(err) {
 		return err;
 	}
 
-	if(io == BLK_RD) {
-		vop_page_zero(node, page, off);
+	/*
+	 * Try syncing the vnode (the bmap-callback might have
+	 * allocated a block and thus the node might be dirty).
+	 * TODO error value?
+	 */
+	vnode_sync(node);
+
+	return 0;
+}
+
+/*
+ * A range of consecutive pages read asynchronously. The blocks of the pages
+ * are merged into as few requests as possible and the pages are unbusied
+ * by vop_read_done once every request finished.
+ */
+typedef struct vop_read {
+	vnode_t *node;
+	blk_handler_t *handler;
+	vm_page_t *marker; /* the page getting VM_PG_READAHEAD or NULL */
+	int err;
+	size_t num;
+	vm_page_t *pages[];
+} vop_read_t;
+
+static void vop_read_done(void *arg) {
+	vop_read_t *rio = arg;
+	vnode_t *node = rio->node;
+	vm_object_t *object = VNTOVM(node);
+	vm_page_t *page;
+	int err;
+
+	err = rio->err ? rio->err : blk_handler_error(rio->handler);
+	blk_handler_free(rio->handler);
+
+	if(err) {
+		for(size_t i = 0; i < rio->num; i++) {
+			vm_object_page_error(object, rio->pages[i]);
+		}
 	} else {
+		synchronized(&object->lock) {
+			for(size_t i = 0; i < rio->num; i++) {
+				vm_objoff_t off;
+
+				page = rio->pages[i];
+				off = vm_page_offset(page);
+
+				/*
+				 * The vnode might have been truncated in the
+				 * meantime. Only the rest of the last block is
+				 * left, vop_page_launch zeroed everything
+				 * beyond it.
+				 */
+				if(off < node->size) {
+					vop_page_zero(node, page, off);
+				}
+
+				if(page == rio->marker) {
+					vm_page_flag_set(page, VM_PG_READAHEAD);
+				}
+
+				vm_page_unbusy(page);
+			}
+		}
+
+		for(size_t i = 0; i < rio->num; i++) {
+			vm_page_unpin(rio->pages[i]);
+		}
+	}
+
+	kfree(rio);
+	vnode_unref(node);
+}
+
+static vop_read_t *vop_read_new(vnode_t *node, size_t num,
+	vm_flags_t flags)
+{
+	vop_read_t *rio;
+
+	rio = kmalloc(sizeof(*rio) + num * sizeof(vm_page_t *), flags);
+	if(rio == NULL) {
+		return NULL;
+	}
+
+	rio->node = vnode_ref(node);
+	rio->handler = blk_handler_new(0);
+	blk_handler_async(rio->handler, vop_read_done, rio);
+	rio->marker = NULL;
+	rio->err = 0;
+	rio->num = 0;
+
+	return rio;
+}
+
+/*
+ * Launch the last request of a range of pages and start its handler.
+ */
+static void vop_read_submit(vop_read_t *rio, vop_run_t *run) {
+	if(rio->err == 0) {
+		rio->err = vop_run_launch(run);
+	}
+
+	blk_handler_start(rio->handler);
+}
+
+int vop_generic_readahead(vnode_t *node, vm_objoff_t off, size_t num,
+	size_t marker)
+{
+	vm_object_t *object = VNTOVM(node);
+	vop_read_t *rio = NULL;
+	vm_page_t *page;
+	vop_run_t run;
+	int err = 0;
+
+	VN_ASSERT_LOCK_VM(node);
+
+	for(size_t i = 0; i < num && off < node->size; i++, off += PAGE_SZ) {
+		if(vm_pghash_lookup(object, off) != NULL) {
+			if(rio != NULL) {
+				vop_read_submit(rio, &run);
+				rio = NULL;
+			}
+
+			continue;
+		}
+
+		/*
+		 * Readahead is only a hint, so do not wait for memory.
+		 */
+		if(rio == NULL) {
+			rio = vop_read_new(node, num - i, VM_NOFLAG);
+			if(rio == NULL) {
+				return -ENOMEM;
+			}
+
+			vop_run_init(&run);
+		}
+
+		page = vm_object_page_alloc(object, off);
+		if(page == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+
+		rio->pages[rio->num++] = page;
+		if(i == marker) {
+			rio->marker = page;
+		}
+
 		/*
-		 * Try syncing the vnode (the bmap-callback might have
-		 * allocated a block and thus the node might be dirty).
-		 * TODO error value?
+		 * The pages stay busy until vop_read_done is called,
+		 * which also reports the errors of vop_page_launch.
 		 */
-		vnode_sync(node);
+		if(rio->err == 0) {
+			rio->err = vop_page_launch(node, rio->handler, page, off,
+				BLK_RD, &run);
+		}
 	}
 
-	return 0;
+	if(rio != NULL) {
+		vop_read_submit(rio, &run);
+	}
+
+	return err;
 }
 
 int vop_generic_pagein(vnode_t *node, vm_objoff_t off, vm_page_t *page) {
+	vop_read_t *rio;
+	vop_run_t run;
+
+	VN_ASSERT_LOCK_VM(node);
+
 	/*
-	 * TODO the lock is held during this.
-	 * If we'd move to an asynchronous read, we could unlock the
-	 * vm_object/vnode
+	 * The page stays busy while it is read and the caller waits for
+	 * it without holding the lock of the object, so that only the
+	 * threads needing this page have to wait for the disk.
 	 */
-	int err = vop_generic_page_rdwr(node, page, off, BLK_RD);
-	if(err) {
-		return -EIO;
-	} else {
-		return 0;
-	}
+	rio = vop_read_new(node, 1, VM_WAIT);
+	vm_page_pin(page);
+	rio->pages[rio->num++] = page;
+
+	vop_run_init(&run);
+	rio->err = vop_page_launch(node, rio->handler, page, off, BLK_RD,
+		&run);
+	vop_read_submit(rio, &run);
+
+	return 0;
 }
 
 ssize_t vop_generic_rdwr(vnode_t *node, uio_t *uio) {
@@ -218,6 +486,11 @@ ssize_t vop_generic_rdwr(vnode_t *node, uio_t *uio) {
 		 * I/O and hopefully writes larger blocks at once.
 		 */
 		synchronized(&VNTOVM(node)->lock) {
+			if(uio->ra != NULL) {
+				vnode_readahead(node, uio->ra, uio->off & PAGE_MASK,
+					pgoff + uio->size);
+			}
+
 			err = vnode_getpage(node, uio->off & PAGE_MASK,
 				access, &page);
 		}
@@ -262,7 +535,7 @@ void vop_generic_unset_exe(vnode_t *node) {
 int vop_generic_pageout(vnode_t *node, vm_page_t *page) {
 	int err;
 
-	err = vop_generic_page_rdwr(node, page, vm_page_offset(page), BLK_WR);
+	err = vop_generic_page_write(node, page, vm_page_offset(page));
 	if(err == 0) {
 		vm_page_clean(page);
 		node->dirty--;
@@ -82,12 +82,32 @@ static int vfs_reslove_mount(vpath_t *path, vnamei_op_t op) {
 	return 0;
 }
 
+/*
+ * Lookup a child without locking the parent. Only used for VNAMEI_LOOKUP.
+ * Returns -EAGAIN if vnamei_vnode has to be used instead.
+ */
+static int vnamei_vnode_fast(vpath_t *parent, const char *name,
+	size_t namelen, size_t hash, vnode_t **nodep)
+{
+	vnode_t *node = parent->node;
+
+	if(!VN_ISDIR(node)) {
+		return -ENOTDIR;
+	} else if(!vnode_access(node, VN_ACC_X)) {
+		return -EACCES;
+	}
+
+	return vdirent_cache_lookup_fast(node, name, namelen, hash, nodep);
+}
+
 static int vnamei_vnode(vpath_t *parent, const char *name, size_t namelen,
-	vnamei_op_t op, int flags, vnamei_t *namei, vnode_t **nodep)
+	size_t hash, vnamei_op_t op, int flags, vnamei_t *namei,
+	vnode_t **nodep)
 {
 	vnode_t *node = parent->node;
 	vdirent_t *dirent;
 	int err = 0, acc;
+	bool create;
 	ino_t ino;
 
 	if(!VN_ISDIR(node)) {
@@ -108,8 +128,27 @@ static int vnamei_vnode(vpath_t *parent, const char *name, size_t namelen,
 		return -EACCES;
 	}
 
-	dirent = vdirent_cache_lookup(node, name, namelen);
-	if(!dirent || op == VNAMEI_UNLINK) {
+	/*
+	 * The caller might create the name while keeping the directory
+	 * locked (e.g. initrd_mount looks up with LOCKPARENT | OPTIONAL and
+	 * creates the node without using the vdirent cache).
+	 */
+	create = op == VNAMEI_CREATE || (F_ISSET(flags, VNAMEI_LOCKPARENT) &&
+		F_ISSET(flags, VNAMEI_OPTIONAL));
+
+	dirent = vdirent_cache_lookup(node, name, namelen, hash);
+	if(dirent && F_ISSET(dirent->flags, VD_NEG) && create) {
+		/*
+		 * The caller is going to create the name and keeps the
+		 * directory locked until it's done.
+		 */
+		vdirent_cache_rem(node, dirent);
+		dirent = NULL;
+	}
+
+	if(dirent && F_ISSET(dirent->flags, VD_NEG)) {
+		err = -ENOENT;
+	} else if(!dirent || op == VNAMEI_UNLINK) {
 		/*
 		 * Ask the filesystem for help, if the dirent wasn't in
 		 * the cache or if the dirent is going to be unlinked (the
@@ -118,7 +157,12 @@ static int vnamei_vnode(vpath_t *parent, const char *name, size_t namelen,
 		 */
 		err = vnode_namei(node, name, namelen, op, &ino);
 		if(!err && op != VNAMEI_UNLINK) {
-			vdirent_cache_new(node, name, namelen, ino, 0);
+			vdirent_cache_new(node, name, namelen, hash, ino, 0);
+		} else if(err == -ENOENT && op == VNAMEI_LOOKUP && !create) {
+			/*
+			 * Remember that the name does not exist.
+			 */
+			vdirent_cache_new(node, name, namelen, hash, 0, VD_NEG);
 		}
 	} else {
 		ino = dirent->ino;
@@ -191,7 +235,7 @@ static int vfs_resolve_symlink(vpath_t *path, vnode_t *node, size_t depth) {
 }
 
 static int vfs_do_get_child(vpath_t *ipath, const char *name, size_t namelen,
-	int flags, vnamei_op_t op, size_t depth, vnamei_t *namei,
+	size_t hash, int flags, vnamei_op_t op, size_t depth, vnamei_t *namei,
 	vpath_t *path)
 {
 	bool dotdot = false;
@@ -269,9 +313,21 @@ static int vfs_do_get_child(vpath_t *ipath, const char *name, size_t namelen,
 	}
 
 	/*
-	 * Find the child node.
+	 * Find the child node. Lookups try to avoid locking the directory
+	 * first.
 	 */
-	err = vnamei_vnode(path, name, namelen, op, flags, namei, &node);
+	err = -EAGAIN;
+	if(op == VNAMEI_LOOKUP &&
+		!F_ISSET(flags, VNAMEI_LOCKPARENT | VNAMEI_OPTIONAL))
+	{
+		err = vnamei_vnode_fast(path, name, namelen, hash, &node);
+	}
+
+	if(err == -EAGAIN) {
+		err = vnamei_vnode(path, name, namelen, hash, op, flags, namei,
+			&node);
+	}
+
 	if(err) {
 		goto error;
 	}
@@ -427,7 +483,7 @@ static int vnamei_internal(vpath_t *at, const char *path, vnamei_op_t op,
 		vnamei_op_t cur_op;
 		int cur_flags;
 		char *delim;
-		size_t len;
+		size_t len, hash;
 
 		/*
 		 * vfs_do_get_child may return an empty path during the
@@ -474,6 +530,7 @@ static int vnamei_internal(vpath_t *at, const char *path, vnamei_op_t op,
 
 		memcpy(buf, cpath, len);
 		buf[len] = '\0';
+		hash = vdirent_hash(buf, len);
 
 		/*
 		 * The '+ 1' is there to skip the path separator.
@@ -501,7 +558,7 @@ static int vnamei_internal(vpath_t *at, const char *path, vnamei_op_t op,
 			cur_op = op;
 		}
 
-		err = vfs_do_get_child(&vpath, buf, len, cur_flags,
+		err = vfs_do_get_child(&vpath, buf, len, hash, cur_flags,
 			cur_op, depth, namei, &next);
 		if(err) {
 			break;
@@ -0,0 +1,206 @@
+/*
+ * ███████╗██╗      ██████╗ ███████╗
+ * ██╔════╝██║     ██╔═══██╗██╔════╝
+ * █████╗  ██║     ██║   ██║███████╗
+ * ██╔══╝  ██║     ██║   ██║╚════██║
+ * ███████╗███████╗╚██████╔╝███████║
+ * ╚══════╝╚══════╝ ╚═════╝ ╚══════╝
+ *
+ * Copyright (c) 2018, Elias Zell
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <kern/system.h>
+#include <vfs/readahead.h>
+#include <vfs/file.h>
+#include <vfs/vnode.h>
+#include <vm/object.h>
+#include <vm/page.h>
+#include <vm/pghash.h>
+#include <sys/fcntl.h>
+#include <sys/pow2.h>
+
+/*
+ * The size of the first window of a sequential stream: the request
+ * rounded up to a power of two and scaled up, if it is small compared
+ * to the maximum.
+ */
+static size_t ra_init_size(size_t req, size_t max) {
+	size_t size = req > 1 ? next_pow2(req) : 1;
+
+	if(size <= max / 32) {
+		size *= 4;
+	} else if(size <= max / 4) {
+		size *= 2;
+	} else {
+		size = max;
+	}
+
+	return min(size, max);
+}
+
+static size_t ra_next_size(size_t cur, size_t max) {
+	return min(cur < max / 16 ? cur * 4 : cur * 2, max);
+}
+
+static void ra_submit(vnode_t *node, file_ra_t *ra) {
+	/*
+	 * Readahead is only a hint, errors are ignored. The pages,
+	 * which could not be read ahead, are read on demand.
+	 */
+	node->ops->readahead(node, ptoa(ra->start), ra->size,
+		ra->async ? ra->size - ra->async : ra->size);
+}
+
+void vnode_readahead(vnode_t *node, file_ra_t *ra, vm_objoff_t off,
+	size_t size)
+{
+	vm_objoff_t idx = atop(off);
+	size_t req = max(atop(ALIGN(size, PAGE_SZ)), 1U);
+	vm_pghash_node_t *pgh;
+	vm_page_t *page;
+
+	VN_ASSERT_LOCK_VM(node);
+	if(ra->max == 0 || node->ops->readahead == NULL) {
+		goto out;
+	}
+
+	pgh = vm_pghash_lookup(VNTOVM(node), off);
+	if(pgh != NULL) {
+		if(vm_pghash_type(pgh) != VM_PGHASH_PAGE) {
+			goto out;
+		}
+
+		page = PGH2PAGE(pgh);
+		if(!vm_page_flag_test(page, VM_PG_READAHEAD)) {
+			goto out;
+		}
+
+		/*
+		 * The reader hit the marker, so read the next window while
+		 * the reader is still consuming the current one. The marker
+		 * might have been set for another file of the same vnode.
+		 */
+		vm_page_flag_clear(page, VM_PG_READAHEAD);
+		if(ra->size && idx >= ra->start && idx < ra->start + ra->size) {
+			ra->start += ra->size;
+			ra->size = ra_next_size(ra->size, ra->max);
+		} else {
+			ra->start = idx + 1;
+			ra->size = ra_init_size(req, ra->max);
+		}
+
+		ra->async = ra->size;
+	} else if(idx == 0 || idx == ra->prev || idx == ra->prev + 1) {
+		/*
+		 * A cache miss in a sequential stream: either the start of
+		 * the stream or the reader caught up with the readahead.
+		 */
+		if(ra->size && idx != 0) {
+			ra->size = ra_next_size(ra->size, ra->max);
+		} else {
+			ra->size = ra_init_size(req, ra->max);
+		}
+
+		ra->start = idx;
+		ra->size = max(ra->size, min(req, ra->max));
+		ra->async = ra->size > req ? ra->size - req : ra->size / 2;
+	} else {
+		/*
+		 * Random access, only read the requested pages at once.
+		 */
+		ra->start = idx;
+		ra->size = min(req, ra->max);
+		ra->async = 0;
+		if(ra->size <= 1) {
+			goto out;
+		}
+	}
+
+	ra_submit(node, ra);
+out:
+	ra->prev = idx;
+}
+
+/*
+ * Read a range of a file asynchronously (POSIX_FADV_WILLNEED).
+ */
+static void vnode_willneed(vnode_t *node, vm_objoff_t start,
+	vm_objoff_t end)
+{
+	size_t num;
+
+	sync_scope_acquire(&VNTOVM(node)->lock);
+	end = min(end, ALIGN(node->size, PAGE_SZ));
+	for(; start < end; start += ptoa((vm_objoff_t)num)) {
+		num = min(atop(end - start), RA_SEQUENTIAL_MAX);
+		if(node->ops->readahead(node, start, num, num)) {
+			break;
+		}
+	}
+}
+
+int vnode_fadvise(file_t *file, off_t off, off_t len, int advice) {
+	vnode_t *node = file_vnode(file);
+	vm_objoff_t start, end;
+	size_t max;
+
+	if(node == NULL || (file->type != FREG && file->type != FDIR)) {
+		return -ESPIPE;
+	} else if(off < 0 || len < 0) {
+		return -EINVAL;
+	}
+
+	start = off & PAGE_MASK;
+	if(len == 0 || (vm_objoff_t)off + len < (vm_objoff_t)off) {
+		end = (vm_objoff_t)-1 & PAGE_MASK;
+	} else {
+		end = ALIGN((vm_objoff_t)off + len, PAGE_SZ);
+	}
+
+	switch(advice) {
+	case POSIX_FADV_NORMAL:
+		max = RA_DEFAULT_MAX;
+		break;
+	case POSIX_FADV_SEQUENTIAL:
+		max = RA_SEQUENTIAL_MAX;
+		break;
+	case POSIX_FADV_RANDOM:
+		max = 0;
+		break;
+	case POSIX_FADV_NOREUSE:
+		return 0;
+	case POSIX_FADV_WILLNEED:
+		if(node->ops->readahead != NULL && file->type == FREG) {
+			vnode_willneed(node, start, end);
+		}
+		return 0;
+	case POSIX_FADV_DONTNEED:
+		synchronized(&VNTOVM(node)->lock) {
+			vm_object_page_drop(VNTOVM(node), start, end);
+		}
+		return 0;
+	default:
+		return -EINVAL;
+	}
+
+	synchronized(&VNTOVM(node)->lock) {
+		file->ra.max = max;
+		file->ra.size = min(file->ra.size, max);
+	}
+
+	return 0;
+}
@@ -37,8 +37,10 @@
 #include <vfs/proc.h>
 #include <vfs/uio.h>
 #include <vfs/vnode.h>
+#include <vfs/vcache.h>
 #include <vfs/vpath.h>
 #include <vfs/lookup.h>
+#include <block/block.h>
 #include <sys/limits.h>
 #include <sys/fcntl.h>
 #include <sys/stat.h>
@@ -1127,12 +1129,44 @@ mode_t sys_umask(mode_t mask) {
 	return vfs_set_umask(mask);
 }
 
-int sys_fadvise64_64(__unused int fd, SYSARG_LL(off), SYSARG_LL(len),
-	__unused int advice)
-{
-	(void) SYSCALL_LL(off);
-	(void) SYSCALL_LL(len);
-	return -ENOSYS;
+int sys_fadvise64_64(int fd, SYSARG_LL(off), SYSARG_LL(len), int advice) {
+	file_t *file;
+	int err;
+
+	file = fdget(fd);
+	if(file == NULL) {
+		return -EBADF;
+	}
+
+	err = vnode_fadvise(file, SYSCALL_LL(off), SYSCALL_LL(len), advice);
+	file_unref(file);
+
+	return err;
+}
+
+int sys_sync(void) {
+	vnode_cache_sync();
+	blk_cache_flush_all();
+	return 0;
+}
+
+int sys_fsync(int fd) {
+	vnode_t *node;
+	int err;
+
+	err = fd2node(fd, 0, &node);
+	if(err) {
+		return err;
+	}
+
+	err = vnode_fsync(node);
+	vnode_unref(node);
+
+	return err;
+}
+
+int sys_fdatasync(int fd) {
+	return sys_fsync(fd);
 }
 
 /*
@@ -70,6 +70,7 @@ int copyinuio(struct iovec *uiov, size_t iovc, uio_t **out) {
 	uio->off = 0;
 	uio->flags = UIO_USER;
 	uio->rw = -1;
+	uio->ra = NULL;
 	*out = uio;
 
 	return 0;
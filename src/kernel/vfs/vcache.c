@@ -25,78 +25,339 @@
 #include <kern/system.h>
 #include <kern/init.h>
 #include <kern/rwlock.h>
+#include <kern/rcu.h>
+#include <kern/atomic.h>
+#include <kern/workqueue.h>
 #include <vfs/vcache.h>
 #include <vfs/fs.h>
 #include <vfs/vnode.h>
 #include <vfs/vdirent.h>
+#include <vfs/dev.h>
+#include <vfs/file.h>
+#include <vfs/uio.h>
 #include <vm/reclaim.h>
 #include <lib/list.h>
 #include <lib/list-locked.h>
+#include <lib/list-rcu.h>
 #include <lib/hashtab.h>
 #include <lib/string.h>
+#include <sys/pow2.h>
 
-static rwlock_t vn_lock = RWLOCK_INIT;
-static DEFINE_LOCKLIST(vn_lru, MUTEX);
-static hashtab_t vn_ht;
-static rwlock_t vd_lock = RWLOCK_INIT;
-static DEFINE_LOCKLIST(vd_lru, MUTEX);
-static hashtab_t vd_ht;
+/*
+ * Both caches are split into VCACHE_SHARDS shards, each of which has its
+ * own lock, hashtable and lru. The low bits of the hash of an entry select
+ * the shard and the remaining bits select the bucket.
+ */
+#define VCACHE_SHARDS		16
+#define VCACHE_SHARD_SHIFT	4
+#define VCACHE_SHARD(hash)	((hash) & (VCACHE_SHARDS - 1))
+#define VCACHE_BUCKET(hash)	((hash) >> VCACHE_SHARD_SHIFT)
+
+/*
+ * The hashtable of a shard starts with VCACHE_MIN_BUCKETS buckets and is
+ * doubled as soon as it holds more than two entries per bucket. The
+ * shards of a cache never use more than VCACHE_MEMORY for buckets.
+ */
+#define VCACHE_MIN_BUCKETS	64
+#define VCACHE_MAX_BUCKETS	(VCACHE_MEMORY / sizeof(list_t) / VCACHE_SHARDS)
+#define VCACHE_LOAD		2
+
+/*
+ * The maximum number of entries evicted by one call of a reclaim hook.
+ */
+#define VCACHE_RECLAIM_BATCH	32
+
+/*
+ * The maximum number of vnodes referenced at once by vnode_cache_sync.
+ */
+#define VCACHE_SYNC_BATCH	16
+
+/*
+ * The counters are 32-bit on purpose, i386 cannot do 64-bit atomics
+ * without cmpxchg8b and they are only there to get a rough idea anyway.
+ */
+typedef struct vcache_stat {
+	uint32_t hit;
+	uint32_t miss;
+	uint32_t evict;
+} vcache_stat_t;
+
+typedef struct vcache_shard {
+	rwlock_t lock;
+	hashtab_t ht;
+	size_t num; /* the number of entries in ht */
+
+	/*
+	 * Set while the hashtable of a vdirent shard is being resized,
+	 * see vdirent_cache_lookup_fast.
+	 */
+	bool resizing;
+	locklist_t lru;
+	work_t resize;
+	vcache_stat_t stat;
+} vcache_shard_t;
+
+static vcache_shard_t vn_shards[VCACHE_SHARDS];
+static vcache_shard_t vd_shards[VCACHE_SHARDS];
+static size_t vn_reclaim_next = 0;
+static size_t vd_reclaim_next = 0;
+static size_t vn_sync_gen = 0; /* the last vnode_cache_sync pass */
+
+#define vcache_stat_inc(shard, field) \
+	atomic_inc_relaxed(&(shard)->stat.field)
 
 static inline size_t vnode_cache_hash(filesys_t *fs, ino_t ino) {
 	return (uintptr_t)(fs) ^ (ino);
 }
 
-static inline size_t vdirent_cache_hash(ino_t ino, const char *name) {
-	size_t hash = 5381;
-	int c;
+static inline size_t vdirent_cache_hash(ino_t ino, size_t hash) {
+	return hash ^ ino;
+}
 
-	while((c = *name++)) {
-		hash = ((hash << 5) + hash) + c;
+static inline vcache_shard_t *vn_shard(size_t hash) {
+	return &vn_shards[VCACHE_SHARD(hash)];
+}
+
+static inline vcache_shard_t *vd_shard(size_t hash) {
+	return &vd_shards[VCACHE_SHARD(hash)];
+}
+
+static size_t vnode_cache_node_hash(void *entry) {
+	vnode_t *node = entry;
+	return vnode_cache_hash(node->fs, node->ino);
+}
+
+static size_t vdirent_cache_node_hash(void *entry) {
+	vdirent_t *dirent = entry;
+	return vdirent_cache_hash(dirent->owner, dirent->hash);
+}
+
+static inline bool vdirent_cache_match(vdirent_t *dirent, vnode_t *node,
+	const char *name, size_t namelen, size_t hash)
+{
+	return dirent->owner == node->ino &&
+		dirent->fs == node->fs &&
+		dirent->hash == hash &&
+		dirent->namelen == namelen &&
+		!memcmp(vdirent_name(dirent), name, namelen);
+}
+
+static void vdirent_free_rcu(rcu_head_t *head) {
+	vdirent_t *dirent = container_of(head, vdirent_t, rcu);
+
+	if(dirent->dir) {
+		atomic_dec_relaxed(&dirent->dir->nneg);
+		vnode_unref(dirent->dir);
 	}
 
-	return hash ^ ino;
+	vdirent_free(dirent);
+}
+
+/*
+ * Called with the shard write-locked after an entry was added.
+ */
+static void vcache_shard_added(vcache_shard_t *shard) {
+	shard->num++;
+	if(shard->num > shard->ht.nentries * VCACHE_LOAD &&
+		shard->ht.nentries < VCACHE_MAX_BUCKETS)
+	{
+		/*
+		 * The new hashtable is allocated by a worker, because the
+		 * allocation might have to reclaim entries of this cache.
+		 */
+		work_queue(system_wq, &shard->resize);
+	}
+}
+
+/*
+ * Allocate a bigger hashtable for a shard. Returns false if the shard does
+ * not need a bigger one.
+ */
+static bool vcache_shard_alloc(vcache_shard_t *shard, hashtab_t *new) {
+	size_t size;
+
+	size = next_pow2(atomic_load_relaxed(&shard->num) / VCACHE_LOAD);
+	size = min(size, VCACHE_MAX_BUCKETS);
+	if(size <= atomic_load_relaxed(&shard->ht.nentries)) {
+		return false;
+	}
+
+	return hashtab_alloc(new, size, VM_WAIT) == 0;
+}
+
+/*
+ * Move every entry of a shard into @p new and swap the hashtables, i.e.
+ * @p new contains the old (empty) hashtable afterwards. @p off is the
+ * offset of the hashtable node in an entry.
+ */
+static void vcache_shard_rehash(vcache_shard_t *shard, hashtab_t *new,
+	size_t (*hashfn) (void *), size_t off)
+{
+	hashtab_t old = shard->ht;
+	void *entry;
+
+	for(size_t i = 0; i < old.nentries; i++) {
+		while((entry = list_pop_front(&old.entries[i])) != NULL) {
+			hashtab_set(new, VCACHE_BUCKET(hashfn(entry)),
+				(list_node_t *)((char *)entry + off));
+		}
+	}
+
+	shard->ht = *new;
+	*new = old;
+}
+
+static void vnode_cache_resize(void *arg) {
+	vcache_shard_t *shard = arg;
+	hashtab_t new;
+
+	if(!vcache_shard_alloc(shard, &new)) {
+		return;
+	}
+
+	wrlocked(&shard->lock) {
+		if(new.nentries > shard->ht.nentries) {
+			vcache_shard_rehash(shard, &new, vnode_cache_node_hash,
+				offsetof(vnode_t, node));
+		}
+	}
+
+	hashtab_free(&new);
+}
+
+static void vdirent_cache_resize(void *arg) {
+	vcache_shard_t *shard = arg;
+	hashtab_t new;
+
+	if(!vcache_shard_alloc(shard, &new)) {
+		return;
+	}
+
+	wrlocked(&shard->lock) {
+		if(new.nentries > shard->ht.nentries) {
+			/*
+			 * The entries cannot be moved while lockless
+			 * lookups might still walk the old hashtable.
+			 */
+			atomic_store_relaxed(&shard->resizing, true);
+			synchronize_rcu();
+			vcache_shard_rehash(shard, &new,
+				vdirent_cache_node_hash,
+				offsetof(vdirent_t, node));
+			atomic_store_release(&shard->resizing, false);
+		}
+	}
+
+	hashtab_free(&new);
 }
 
 vnode_t *vnode_cache_lookup(filesys_t *fs, ino_t ino) {
 	size_t hash = vnode_cache_hash(fs, ino);
+	vcache_shard_t *shard = vn_shard(hash);
 	vnode_t *node;
 
 	sync_assert(&fs->lock);
 
-	rdlock_scope(&vn_lock);
-	hashtab_search(node, hash, &vn_ht) {
+	rdlock_scope(&shard->lock);
+	hashtab_search(node, VCACHE_BUCKET(hash), &shard->ht) {
 		if(node->fs == fs && node->ino == ino) {
 			assert(node->nlink > 0);
+			vcache_stat_inc(shard, hit);
 
-			sync_scope_acquire(&vn_lru.lock);
+			sync_scope_acquire(&shard->lru.lock);
 			if(vnode_flags_clear(node, VN_VCLRU) & VN_VCLRU) {
-				list_remove(&vn_lru.list, &node->lru_node);
+				list_remove(&shard->lru.list, &node->lru_node);
 			}
 
 			return vnode_ref(node);
 		}
 	}
 
+	vcache_stat_inc(shard, miss);
+	return NULL;
+}
+
+/*
+ * Like vnode_cache_lookup, but the filesystem does not have to be locked.
+ * Only used by the lockless path walk, which has to check whether the
+ * dirent it found is still valid after the node was referenced.
+ */
+static vnode_t *vnode_cache_lookup_fast(filesys_t *fs, ino_t ino) {
+	size_t hash = vnode_cache_hash(fs, ino);
+	vcache_shard_t *shard = vn_shard(hash);
+	vnode_t *node;
+
+	rdlock_scope(&shard->lock);
+	hashtab_search(node, VCACHE_BUCKET(hash), &shard->ht) {
+		if(node->fs == fs && node->ino == ino) {
+			/*
+			 * The node was unlinked after the dirent was found.
+			 */
+			if(node->nlink == 0) {
+				return NULL;
+			}
+
+			sync_scope_acquire(&shard->lru.lock);
+			if(vnode_flags_clear(node, VN_VCLRU) & VN_VCLRU) {
+				list_remove(&shard->lru.list, &node->lru_node);
+				vnode_ref(node);
+			} else if(!ref_inc_not_zero(&node->object.ref)) {
+				/*
+				 * The last reference was dropped, but
+				 * vnode_cache_zeroref did not run yet. The
+				 * node might have been unlinked, in which
+				 * case that call frees it, so it must not
+				 * get a second vnode_cache_zeroref call from
+				 * our vnode_unref.
+				 */
+				return NULL;
+			}
+
+			vcache_stat_inc(shard, hit);
+			return node;
+		}
+	}
+
+	vcache_stat_inc(shard, miss);
 	return NULL;
 }
 
 void vnode_cache_add(vnode_t *node) {
+	vcache_shard_t *shard;
 	size_t hash;
 
 	sync_assert(&node->fs->lock);
 	hash = vnode_cache_hash(node->fs, node->ino);
+	shard = vn_shard(hash);
 
-	wrlock_scope(&vn_lock);
-	hashtab_set(&vn_ht, hash, &node->node);
+	wrlock_scope(&shard->lock);
+	hashtab_set(&shard->ht, VCACHE_BUCKET(hash), &node->node);
+	vcache_shard_added(shard);
 }
 
 void vnode_cache_zeroref(vnode_t *node) {
+	vcache_shard_t *shard;
+	size_t hash;
+
+	hash = vnode_cache_hash(node->fs, node->ino);
+	shard = vn_shard(hash);
+
 	if(node->nlink == 0) {
-		size_t hash;
+		wrlocked(&shard->lock) {
+			/*
+			 * vnode_cache_lookup_fast never references a node
+			 * whose reference count dropped to zero and an
+			 * unlinked node is never on the lru, but pageout
+			 * might have referenced it. The last vnode_unref
+			 * will call this again.
+			 */
+			if(ref_get(&node->object.ref) != 0) {
+				return;
+			}
 
-		hash = vnode_cache_hash(node->fs, node->ino);
-		wrlocked(&vn_lock) {
-			hashtab_remove(&vn_ht, hash, &node->node);
+			hashtab_remove(&shard->ht, VCACHE_BUCKET(hash),
+				&node->node);
+			shard->num--;
 		}
 
 		sync_scope_acquire(&node->fs->lock);
@@ -104,7 +365,7 @@ void vnode_cache_zeroref(vnode_t *node) {
 		filesys_vput(node->fs, node);
 	} else if(!vnode_flags_test(node, VN_PERM)) {
 		sync_scope_acquire(&node->object.lock);
-		sync_scope_acquire(&vn_lru.lock);
+		sync_scope_acquire(&shard->lru.lock);
 
 		if(ref_get(&node->object.ref) == 0) {
 			/*
@@ -112,37 +373,93 @@ void vnode_cache_zeroref(vnode_t *node) {
 			 * calling vnode_cache_lookup.
 			 */
 			if(!(vnode_flags_set(node, VN_VCLRU) & VN_VCLRU)) {
-				list_append(&vn_lru.list, &node->lru_node);
+				list_append(&shard->lru.list, &node->lru_node);
 			}
 		}
 	}
 }
 
+/*
+ * Lookup a dirent in a shard without accounting a hit or miss. The shard
+ * has to be locked.
+ */
+static vdirent_t *vdirent_cache_find(vcache_shard_t *shard, vnode_t *node,
+	const char *name, size_t namelen, size_t hash)
+{
+	vdirent_t *dirent;
+
+	hashtab_search(dirent, VCACHE_BUCKET(vdirent_cache_hash(node->ino,
+		hash)), &shard->ht)
+	{
+		if(vdirent_cache_match(dirent, node, name, namelen, hash)) {
+			if(!F_ISSET(dirent->flags, VD_PERM)) {
+				locklist_remove(&shard->lru, &dirent->lru_node);
+			}
+
+			return dirent;
+		}
+	}
+
+	return NULL;
+}
+
 void vdirent_cache_add(vnode_t *node, vdirent_t *dirent) {
+	vcache_shard_t *shard;
+	vdirent_t *old;
 	size_t hash;
 
 	VN_ASSERT_LOCK_WR(node);
 	assert(dirent->owner == node->ino);
 
-	hash = vdirent_cache_hash(dirent->owner, vdirent_name(dirent));
+	hash = vdirent_cache_hash(dirent->owner, dirent->hash);
+	shard = vd_shard(hash);
+
+	/*
+	 * Filesystems like devfs add dirents without asking vnamei, which
+	 * means that there might still be a negative dirent for the name.
+	 */
+	rdlocked(&shard->lock) {
+		old = vdirent_cache_find(shard, node, vdirent_name(dirent),
+			dirent->namelen, dirent->hash);
+	}
+
+	if(old) {
+		assert(F_ISSET(old->flags, VD_NEG));
+		vdirent_cache_rem(node, old);
+	}
 
-	wrlock_scope(&vd_lock);
-	hashtab_set(&vd_ht, hash, &dirent->node);
+	wrlock_scope(&shard->lock);
+	hashtab_set_rcu(&shard->ht, VCACHE_BUCKET(hash), &dirent->node);
 	if(!F_ISSET(dirent->flags, VD_PERM)) {
-		locklist_append(&vd_lru, &dirent->lru_node);
+		locklist_append(&shard->lru, &dirent->lru_node);
 	}
 
+	vcache_shard_added(shard);
 }
 
 vdirent_t *vdirent_cache_new(vnode_t *node, const char *name, size_t namelen,
-	ino_t ino, int flags)
+	size_t hash, ino_t ino, int flags)
 {
 	vdirent_t *dirent;
 
 	VN_ASSERT_LOCK_WR(node);
-	dirent = vdirent_alloc(node->fs, name, namelen, node->ino, ino,
+	if(F_ISSET(flags, VD_NEG) && node->nlink == 0) {
+		return NULL;
+	}
+
+	dirent = vdirent_alloc(node->fs, name, namelen, hash, node->ino, ino,
 		flags, 0);
 	if(likely(dirent != NULL)) {
+		/*
+		 * A negative dirent keeps its directory referenced. Otherwise
+		 * the directory could be removed and its inode number could
+		 * be reused while the dirent is still cached.
+		 */
+		if(F_ISSET(flags, VD_NEG)) {
+			atomic_inc_relaxed(&node->nneg);
+			dirent->dir = vnode_ref(node);
+		}
+
 		vdirent_cache_add(node, dirent);
 	}
 
@@ -150,104 +467,273 @@ vdirent_t *vdirent_cache_new(vnode_t *node, const char *name, size_t namelen,
 }
 
 vdirent_t *vdirent_cache_lookup(vnode_t *node, const char *name,
-	size_t namelen)
+	size_t namelen, size_t hash)
 {
-	size_t hash;
+	vcache_shard_t *shard;
 	vdirent_t *dirent;
 
 	VN_ASSERT_LOCK_RD(node);
-	hash = vdirent_cache_hash(node->ino, name);
-
-	rdlock_scope(&vd_lock);
-	hashtab_search(dirent, hash, &vd_ht) {
-		if(dirent->owner == node->ino &&
-			dirent->fs == node->fs &&
-			dirent->namelen == namelen &&
-			!strcmp(vdirent_name(dirent), name))
-		{
-			if(!F_ISSET(dirent->flags, VD_PERM)) {
-				locklist_remove(&vd_lru, &dirent->lru_node);
-			}
+	shard = vd_shard(vdirent_cache_hash(node->ino, hash));
 
-			return dirent;
+	rdlock_scope(&shard->lock);
+	dirent = vdirent_cache_find(shard, node, name, namelen, hash);
+	if(dirent) {
+		vcache_stat_inc(shard, hit);
+	} else {
+		vcache_stat_inc(shard, miss);
+	}
+
+	return dirent;
+}
+
+int vdirent_cache_lookup_fast(vnode_t *node, const char *name,
+	size_t namelen, size_t hash, vnode_t **childp)
+{
+	vcache_shard_t *shard;
+	vdirent_t *dirent;
+	bool found = false;
+	size_t seq, vhash;
+	vnode_t *child;
+	int flags = 0;
+	ino_t ino = 0;
+
+	vhash = vdirent_cache_hash(node->ino, hash);
+	shard = vd_shard(vhash);
+	seq = atomic_load_acquire(&node->dseq);
+
+	/*
+	 * The dirent is neither locked nor removed from the lru, it's only
+	 * guaranteed to stay allocated until rcu_read_unlock.
+	 */
+	rcu_read_lock();
+	if(atomic_load_acquire(&shard->resizing)) {
+		rcu_read_unlock();
+		return -EAGAIN;
+	}
+
+	hashtab_search_rcu(dirent, VCACHE_BUCKET(vhash), &shard->ht) {
+		if(vdirent_cache_match(dirent, node, name, namelen, hash)) {
+			ino = dirent->ino;
+			flags = dirent->flags;
+			found = true;
+			break;
 		}
 	}
+	rcu_read_unlock();
 
-	return NULL;
+	if(!found) {
+		vcache_stat_inc(shard, miss);
+		return -EAGAIN;
+	}
+
+	vcache_stat_inc(shard, hit);
+	if(F_ISSET(flags, VD_NEG)) {
+		return -ENOENT;
+	}
+
+	child = vnode_cache_lookup_fast(node->fs, ino);
+	if(child == NULL) {
+		return -EAGAIN;
+	}
+
+	/*
+	 * The dirent might have been removed (and the inode might have been
+	 * freed and reused) in the meantime. Every removal of a dirent
+	 * happens before the unlinked inode can be freed and increments
+	 * dseq.
+	 */
+	if(atomic_load(&node->dseq) != seq) {
+		vnode_unref(child);
+		return -EAGAIN;
+	}
+
+	*childp = child;
+	return 0;
 }
 
 void vdirent_cache_put(vnode_t *node, vdirent_t *dirent) {
+	vcache_shard_t *shard;
+
 	VN_ASSERT_LOCK_WR(node);
 
 	if(!F_ISSET(dirent->flags, VD_PERM)) {
-		locklist_append(&vd_lru, &dirent->lru_node);
+		shard = vd_shard(vdirent_cache_hash(node->ino, dirent->hash));
+		locklist_append(&shard->lru, &dirent->lru_node);
 	}
 }
 
 void vdirent_cache_rem(vnode_t *node, vdirent_t *dirent) {
+	vcache_shard_t *shard;
 	size_t hash;
 
 	VN_ASSERT_LOCK_WR(node);
-	hash = vdirent_cache_hash(node->ino, vdirent_name(dirent));
+	hash = vdirent_cache_hash(node->ino, dirent->hash);
+	shard = vd_shard(hash);
 
-	wrlocked(&vd_lock) {
-		hashtab_remove(&vd_ht, hash, &dirent->node);
+	wrlocked(&shard->lock) {
+		hashtab_remove_rcu(&shard->ht, VCACHE_BUCKET(hash),
+			&dirent->node);
+		shard->num--;
 	}
 
 	/*
-	 * TODO ADD A FLAG CALLED VM_FREE_LAZY, because we're
-	 * currently holding the lock of the node....
+	 * Tell vdirent_cache_lookup_fast that a dirent of this directory
+	 * might have become stale.
 	 */
-	vdirent_free(dirent);
+	atomic_inc(&node->dseq);
+
+	/*
+	 * The lockless path walk might still be looking at the dirent.
+	 */
+	call_rcu(&dirent->rcu, vdirent_free_rcu);
 }
 
 void vdirent_cache_try_rem(vnode_t *node, const char *name, size_t namelen) {
+	vcache_shard_t *shard;
 	vdirent_t *dirent;
+	size_t hash;
 
 	VN_ASSERT_LOCK_WR(node);
-	dirent = vdirent_cache_lookup(node, name, namelen);
+	hash = vdirent_hash(name, namelen);
+	shard = vd_shard(vdirent_cache_hash(node->ino, hash));
+
+	rdlocked(&shard->lock) {
+		dirent = vdirent_cache_find(shard, node, name, namelen, hash);
+	}
+
 	if(dirent) {
 		vdirent_cache_rem(node, dirent);
+	} else {
+		vdirent_cache_invalidate(node);
 	}
 }
 
-static bool vdirent_cache_reclaim(void) {
-	vdirent_t *dent;
-	size_t hash;
+void vdirent_cache_invalidate(vnode_t *node) {
+	VN_ASSERT_LOCK_WR(node);
+
+	/*
+	 * vdirent_cache_lookup_fast might have found the dirent before it
+	 * was evicted, so it has to notice the removal anyway.
+	 */
+	atomic_inc(&node->dseq);
+}
 
-	wrlocked(&vd_lock) {
-		dent = locklist_pop_front(&vd_lru);
+void vdirent_cache_purge(vnode_t *node) {
+	vcache_shard_t *shard;
+	vdirent_t *dirent;
+	size_t num = 0;
 
-		/*
-		 * There is no dirent, which can be freed.
-		 */
+	VN_ASSERT_LOCK_WR(node);
+	assert(node->nlink == 0);
+
+	/*
+	 * Only "." and ".." are left if there are no negative dirents.
+	 */
+	if(atomic_load_relaxed(&node->nneg) == 0) {
+		vdirent_cache_try_rem(node, ".", 1);
+		vdirent_cache_try_rem(node, "..", 2);
+		return;
+	}
+
+	/*
+	 * The hash of a dirent depends on the name, so every shard has to be
+	 * searched. The directory is locked and thus none of its dirents is
+	 * being used.
+	 */
+	for(size_t i = 0; i < VCACHE_SHARDS; i++) {
+		shard = &vd_shards[i];
+
+		wrlock_scope(&shard->lock);
+		for(size_t b = 0; b < shard->ht.nentries; b++) {
+			foreach(dirent, &shard->ht.entries[b]) {
+				if(dirent->owner != node->ino ||
+					dirent->fs != node->fs)
+				{
+					continue;
+				}
+
+				hashtab_remove_rcu(&shard->ht, b,
+					&dirent->node);
+				if(!F_ISSET(dirent->flags, VD_PERM)) {
+					locklist_remove(&shard->lru,
+						&dirent->lru_node);
+				}
+
+				shard->num--;
+				num++;
+				call_rcu(&dirent->rcu, vdirent_free_rcu);
+			}
+		}
+	}
+
+	if(num) {
+		atomic_inc(&node->dseq);
+	}
+}
+
+/*
+ * Evict up to @p max dirents from the lru of a shard.
+ */
+static size_t vdirent_cache_evict(vcache_shard_t *shard, size_t max) {
+	vdirent_t *dent;
+	size_t num;
+
+	wrlock_scope(&shard->lock);
+	for(num = 0; num < max; num++) {
+		dent = locklist_pop_front(&shard->lru);
 		if(dent == NULL) {
-			return false;
+			break;
 		}
 
+		hashtab_remove_rcu(&shard->ht,
+			VCACHE_BUCKET(vdirent_cache_node_hash(dent)),
+			&dent->node);
+		shard->num--;
+
 		/*
-		 * Remove the dirent from the hashtable.
+		 * The dirent can be freed after a grace period. Evicting a
+		 * dirent does not make it stale, so dseq is left alone. The
+		 * name might be removed later on though, which is why
+		 * unlink and rename increment dseq even if the dirent is
+		 * not cached (see vdirent_cache_invalidate).
 		 */
-		hash = vdirent_cache_hash(dent->owner, dent->name);
-		hashtab_remove(&vd_ht, hash, &dent->node);
+		call_rcu(&dent->rcu, vdirent_free_rcu);
 	}
 
+	atomic_add_relaxed(&shard->stat.evict, num);
+	return num;
+}
+
+static bool vdirent_cache_reclaim(void) {
+	size_t i, num = 0;
+
 	/*
-	 * It's safe to free the dirent now.
+	 * Start at a different shard every time, so that the lrus of
+	 * all shards shrink evenly.
 	 */
-	vdirent_free(dent);
-	return true;
+	i = atomic_inc_relaxed(&vd_reclaim_next);
+	for(size_t n = 0; n < VCACHE_SHARDS && num < VCACHE_RECLAIM_BATCH;
+		n++, i++)
+	{
+		num += vdirent_cache_evict(&vd_shards[VCACHE_SHARD(i)],
+			VCACHE_RECLAIM_BATCH - num);
+	}
+
+	return num != 0;
 }
 vm_reclaim("vdirent-cache", vdirent_cache_reclaim);
 
-static bool vnode_cache_reclaim(void) {
+/*
+ * Try to free the least recently used vnode of a shard.
+ */
+static bool vnode_cache_evict(vcache_shard_t *shard) {
 	vnode_t *node = NULL;
 	size_t hash;
 
 	/*
 	 * Choose a node from the lru.
 	 */
-	node = locklist_first(&vn_lru);
+	node = locklist_first(&shard->lru);
 
 	/*
 	 * There is no node, which can be freed.
@@ -272,6 +758,7 @@ static bool vnode_cache_reclaim(void) {
 	 * Calculate the hash.
 	 */
 	hash = vnode_cache_hash(node->fs, node->ino);
+	assert(vn_shard(hash) == shard);
 
 	/*
 	 * The filesystem needs to be locked for vput callback.
@@ -287,7 +774,8 @@ static bool vnode_cache_reclaim(void) {
 			return false;
 		}
 
-		sync_scope_acquire(&vn_lru.lock);
+		wrlock_scope(&shard->lock);
+		sync_scope_acquire(&shard->lru.lock);
 
 		/*
 		 * If the node is no longer on the LRU then the node is being
@@ -302,24 +790,226 @@ static bool vnode_cache_reclaim(void) {
 		if(vnode_flags_test(node, VN_VCLRU) == false) {
 			return false;
 		} else {
-			list_remove(&vn_lru.list, &node->lru_node);
+			list_remove(&shard->lru.list, &node->lru_node);
 		}
+
+		/*
+		 * The shard has to be locked, because vnode_cache_lookup_fast
+		 * does not lock the filesystem.
+		 */
+		hashtab_remove(&shard->ht, VCACHE_BUCKET(hash), &node->node);
+		shard->num--;
 	}
 
+	vcache_stat_inc(shard, evict);
+
 	/*
 	 * There are no references to this vnode and there can't be any more
 	 * references (except pageout, but that was explained above).
 	 * Furthermore every buffered page was written to disk.
 	 * It's safe to free the vnode now.
 	 */
-	hashtab_remove(&vn_ht, hash, &node->node);
 	filesys_vput(node->fs, node);
 
 	return true;
 }
+
+static inline bool vnode_cache_sync_p(vnode_t *node) {
+	return node->nlink > 0 && (node->dirty != 0 ||
+		vnode_flags_test(node, VN_DIRTY));
+}
+
+/*
+ * Reference up to VCACHE_SYNC_BATCH vnodes of a shard, which need to be
+ * synced and were not collected by the sync pass @p gen yet, starting at
+ * bucket *bucketp. The bucket is advanced past the last complete bucket.
+ */
+static size_t vnode_cache_sync_collect(vcache_shard_t *shard,
+	size_t *bucketp, size_t gen, vnode_t **nodes)
+{
+	size_t num = 0;
+	vnode_t *node;
+
+	/*
+	 * The hashtable only ever grows and an entry of bucket i ends up in
+	 * bucket i or in a bucket after the old ones. Thus the entries not
+	 * looked at yet cannot move behind the current bucket. The bucket
+	 * itself might have changed since the last call, which is why
+	 * it is searched from the beginning and the nodes remember the
+	 * pass which collected them.
+	 */
+	rdlock_scope(&shard->lock);
+	for(; *bucketp < shard->ht.nentries; (*bucketp)++) {
+		foreach(node, &shard->ht.entries[*bucketp]) {
+			if(atomic_load_relaxed(&node->sync_gen) >= gen ||
+				!vnode_cache_sync_p(node))
+			{
+				continue;
+			} else if(num == VCACHE_SYNC_BATCH) {
+				return num;
+			}
+
+			synchronized(&shard->lru.lock) {
+				if(vnode_flags_clear(node, VN_VCLRU) &
+					VN_VCLRU)
+				{
+					list_remove(&shard->lru.list,
+						&node->lru_node);
+				}
+			}
+
+			atomic_store_relaxed(&node->sync_gen, gen);
+			nodes[num++] = vnode_ref(node);
+		}
+	}
+
+	return num;
+}
+
+void vnode_cache_sync(void) {
+	vnode_t *nodes[VCACHE_SYNC_BATCH];
+	size_t bucket, num, gen;
+
+	gen = atomic_inc_relaxed(&vn_sync_gen) + 1;
+	for(size_t i = 0; i < VCACHE_SHARDS; i++) {
+		bucket = 0;
+		do {
+			num = vnode_cache_sync_collect(&vn_shards[i], &bucket,
+				gen, nodes);
+			for(size_t n = 0; n < num; n++) {
+				/*
+				 * Writing the pages might allocate blocks,
+				 * so sync the attributes afterwards.
+				 */
+				vnode_write_pages(nodes[n]);
+				vnode_sync(nodes[n]);
+				vnode_unref(nodes[n]);
+			}
+		} while(num == VCACHE_SYNC_BATCH);
+	}
+}
+
+static bool vnode_cache_reclaim(void) {
+	size_t i, num = 0;
+
+	i = atomic_inc_relaxed(&vn_reclaim_next);
+	for(size_t n = 0; n < VCACHE_SHARDS && num < VCACHE_RECLAIM_BATCH;
+		n++, i++)
+	{
+		vcache_shard_t *shard = &vn_shards[VCACHE_SHARD(i)];
+
+		while(num < VCACHE_RECLAIM_BATCH && vnode_cache_evict(shard)) {
+			num++;
+		}
+	}
+
+	return num != 0;
+}
 vm_reclaim("vnode-cache", vnode_cache_reclaim);
 
+static void vcache_stat_sum(vcache_shard_t *shards, vcache_stat_t *stat,
+	size_t *num, size_t *buckets)
+{
+	*stat = (vcache_stat_t) { 0, 0, 0 };
+	*num = *buckets = 0;
+
+	for(size_t i = 0; i < VCACHE_SHARDS; i++) {
+		vcache_shard_t *shard = &shards[i];
+
+		stat->hit += atomic_load_relaxed(&shard->stat.hit);
+		stat->miss += atomic_load_relaxed(&shard->stat.miss);
+		stat->evict += atomic_load_relaxed(&shard->stat.evict);
+		*num += atomic_load_relaxed(&shard->num);
+		*buckets += atomic_load_relaxed(&shard->ht.nentries);
+	}
+}
+
+static int vcache_stat_line(char *buf, size_t size, const char *name,
+	vcache_shard_t *shards)
+{
+	size_t num, buckets;
+	vcache_stat_t stat;
+
+	vcache_stat_sum(shards, &stat, &num, &buckets);
+	return snprintf(buf, size, "%-8s %10u %10u %14u %14u %12u\n",
+		name, num, buckets, stat.hit, stat.miss, stat.evict);
+}
+
+static ssize_t vcache_read(file_t *file, uio_t *uio) {
+	size_t size = uio->size;
+	ssize_t res = 0;
+	char buf[256];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%-8s %10s %10s %14s %14s %12s\n",
+		"cache", "entries", "buckets", "hits", "misses",
+		"evictions");
+	len += vcache_stat_line(buf + len, sizeof(buf) - len, "vnode",
+		vn_shards);
+	len += vcache_stat_line(buf + len, sizeof(buf) - len, "vdirent",
+		vd_shards);
+
+	foff_lock_get_uio(file, uio);
+	if(uio->off < len) {
+		res = uiomove(buf + uio->off, len - uio->off, uio);
+	}
+	foff_unlock_uio(file, uio);
+
+	return res < 0 ? res : (ssize_t)(size - uio->size);
+}
+
+static ssize_t vcache_write(__unused file_t *file, uio_t *uio) {
+	size_t size = uio->size;
+
+	/*
+	 * Writing anything to the device resets the counters.
+	 */
+	for(size_t i = 0; i < VCACHE_SHARDS; i++) {
+		vn_shards[i].stat = (vcache_stat_t) { 0, 0, 0 };
+		vd_shards[i].stat = (vcache_stat_t) { 0, 0, 0 };
+	}
+
+	return size;
+}
+
+static int vcache_open(__unused file_t *file) {
+	return 0;
+}
+
+static fops_t vcache_ops = {
+	.open = vcache_open,
+	.read = vcache_read,
+	.write = vcache_write,
+};
+
+static __init int vcache_dev_init(void) {
+	int err;
+
+	err = makechar(NULL, MAJOR_KERN, 0600, &vcache_ops, NULL, NULL,
+		"vcache");
+	if(err) {
+		return INIT_ERR;
+	}
+
+	return INIT_OK;
+}
+late_initcall(vcache_dev_init);
+
+static void __init vcache_shard_init(vcache_shard_t *shard,
+	work_func_t resize)
+{
+	rwlock_init(&shard->lock);
+	hashtab_alloc(&shard->ht, VCACHE_MIN_BUCKETS, VM_WAIT);
+	shard->num = 0;
+	shard->resizing = false;
+	locklist_init(&shard->lru, SYNC_MUTEX);
+	work_init(&shard->resize, resize, shard);
+	shard->stat = (vcache_stat_t) { 0, 0, 0 };
+}
+
 void __init vcache_init(void) {
-	hashtab_alloc(&vn_ht, VCACHE_MEMORY / sizeof(list_t), VM_WAIT);
-	hashtab_alloc(&vd_ht, VCACHE_MEMORY / sizeof(list_t), VM_WAIT);
+	for(size_t i = 0; i < VCACHE_SHARDS; i++) {
+		vcache_shard_init(&vn_shards[i], vnode_cache_resize);
+		vcache_shard_init(&vd_shards[i], vdirent_cache_resize);
+	}
 }
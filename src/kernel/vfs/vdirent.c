@@ -28,18 +28,19 @@
 #include <vfs/vdirent.h>
 #include <vfs/fs.h>
 #include <vfs/vcache.h>
+#include <lib/list-rcu.h>
 #include <lib/string.h>
 #include <vm/slab.h>
 
 static DEFINE_VM_SLAB(vdirent_cache, sizeof(vdirent_t), 0);
 
 vdirent_t *vdirent_alloc(filesys_t *fs, const char *name, size_t length,
-	ino_t owner, ino_t ino, int flags, vm_flags_t allocflags)
+	size_t hash, ino_t owner, ino_t ino, int flags, vm_flags_t allocflags)
 {
 	vdirent_t *dirent;
 	char *name_ptr;
 
-	assert(!F_ISSET(flags, ~VD_PERM));
+	assert(!F_ISSET(flags, ~(VD_PERM | VD_NEG)));
 
 	dirent = vm_slab_alloc(&vdirent_cache, allocflags);
 	if(unlikely(dirent == NULL)) {
@@ -73,6 +74,8 @@ vdirent_t *vdirent_alloc(filesys_t *fs, const char *name, size_t length,
 	dirent->owner = owner;
 	dirent->namelen = length;
 	dirent->ino = ino;
+	dirent->dir = NULL;
+	dirent->hash = hash;
 	dirent->flags = flags;
 
 	return dirent;
@@ -85,6 +88,11 @@ void vdirent_free(vdirent_t *dirent) {
 		kfree(dirent->bigname);
 	}
 
+	/*
+	 * The dirent was removed from the RCU protected hashtable of the
+	 * vcache.
+	 */
+	list_node_rcu_reinit(&dirent->node);
 	list_node_destroy(&dirent->node);
 	list_node_destroy(&dirent->lru_node);
 	vm_slab_free(&vdirent_cache, dirent);
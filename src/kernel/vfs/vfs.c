@@ -284,6 +284,8 @@ int kern_unlinkat(vpath_t *at, const char *path, int flags) {
 			 * vdirent_cache_put().
 			 */
 			namei.dirent = NULL;
+		} else {
+			vdirent_cache_invalidate(namei.parent.node);
 		}
 	}
 
@@ -118,6 +118,9 @@ void vnode_init(vnode_t *node, filesys_t *fs, vnode_ops_t *ops) {
 	node->flags = 0;
 	node->dirty = 0;
 	node->writecnt = 0;
+	node->dseq = 0;
+	node->nneg = 0;
+	node->sync_gen = 0;
 	node->size = 0;
 }
 
@@ -190,6 +193,69 @@ void vnode_sched_sync_pages(vnode_t *node) {
 	}
 }
 
+int vnode_write_pages(vnode_t *node) {
+	vm_object_t *object = VNTOVM(node);
+	vm_page_t *page;
+	int err = 0, res;
+
+	sync_scope_acquire(&object->lock);
+again:
+	foreach(page, &object->pages) {
+		if(!vm_page_is_dirty(page)) {
+			continue;
+		} else if(vm_page_is_busy(page)) {
+			/*
+			 * An erroneous page is about to be removed.
+			 */
+			if(vm_page_flags(page) & VM_PG_ERR) {
+				continue;
+			}
+
+			/*
+			 * Pageout might be writing the page. Anything might
+			 * have happened while the object was unlocked, so
+			 * start all over again.
+			 */
+			vm_page_pin(page);
+			vm_object_page_wait(object, page);
+			vm_page_unpin(page);
+			goto again;
+		}
+
+		/*
+		 * Same as vm_pager_pageout: unmap the page so that writes
+		 * during the I/O dirty the page again.
+		 */
+		vm_page_unmap(object, page);
+		vm_page_busy(page);
+		res = node->ops->pageout(node, page);
+		vm_page_unbusy(page);
+		if(res && err == 0) {
+			err = res;
+		}
+	}
+
+	return err;
+}
+
+int vnode_fsync(vnode_t *node) {
+	blk_provider_t *dev = filesys_dev(node->fs);
+	int err;
+
+	err = vnode_write_pages(node);
+	if(err == 0) {
+		/*
+		 * Writing the pages might have allocated blocks.
+		 */
+		err = vnode_sync(node);
+	}
+	if(err == 0 && dev != NULL) {
+		err = blk_cache_flush(dev);
+	}
+
+	return err;
+}
+
 bool vnode_access(vnode_t *node, int flags) {
 	mode_t mode;
 	uid_t uid;
@@ -440,13 +506,13 @@ int vnode_unlink(vnode_t *node, const char *name, size_t namelen, int flags,
 	if(flags & VNAMEI_DIR) {
 		if(!err) {
 			assert(child->nlink == 0);
-		}
 
-		/*
-		 * The directory only has the entries ".." and ".".
-		 */
-		vdirent_cache_try_rem(child, ".", 1);
-		vdirent_cache_try_rem(child, "..", 2);
+			/*
+			 * The directory only has the entries ".", ".." and
+			 * negative ones.
+			 */
+			vdirent_cache_purge(child);
+		}
 	}
 
 	return err;
@@ -669,20 +735,15 @@ static int vnode_pagein(vm_object_t *object, __unused vm_pghash_node_t *pgh,
 	vm_page_t *page)
 {
 	vnode_t *node = VMTOVN(object);
-	int err;
 
 	VN_ASSERT_LOCK_VM(node);
 	assert(pgh == NULL);
 
 	/*
-	 * Fill the page with the file data.
+	 * Fill the page with the file data. The filesystem unbusies the
+	 * page.
 	 */
-	err = node->ops->pagein(node, vm_page_offset(page), page);
-	if(!err) {
-		vm_page_unbusy(page);
-	}
-
-	return err;
+	return node->ops->pagein(node, vm_page_offset(page), page);
 }
 
 static int vnode_pageout(vm_object_t *object, vm_page_t *page) {
@@ -825,6 +886,9 @@ static void vnode_fop_close(file_t *file) {
 	if(file_writeable(file)) {
 		vnode_lock(node, VNLOCK_EXCL);
 		node->writecnt--;
+		if(node->ops->close) {
+			node->ops->close(node, file->flags);
+		}
 		vnode_unlock(node);
 	}
 }
@@ -854,6 +918,7 @@ static ssize_t vnode_fop_rdwr(file_t *file, uio_t *uio) {
 
 		size = vnode_write(node, uio);
 	} else {
+		uio->ra = &file->ra;
 		rdlock_scope(&node->lock);
 		size = vnode_read(node, uio);
 	}
@@ -84,6 +84,7 @@ void vm_object_free(vm_object_t *object) {
 }
 
 void vm_object_clear(vm_object_t *object) {
+	vm_page_batch_t batch = VM_PAGE_BATCH_INIT;
 	vm_page_t *page;
 
 	sync_assert(&object->lock);
@@ -103,8 +104,10 @@ void vm_object_clear(vm_object_t *object) {
 
 		vm_page_clean(page);
 		vm_object_page_remove(object, page);
-		vm_page_free(page);
+		vm_page_batch_add(&batch, page);
 	}
+
+	vm_page_batch_flush(&batch);
 }
 
 vm_page_t *vm_object_page_alloc(vm_object_t *object, vm_objoff_t off) {
@@ -138,6 +141,7 @@ void vm_object_page_remove(vm_object_t *object, vm_page_t *page) {
 	sync_assert(&object->lock);
 
 	vm_pghash_rem(object, &page->node);
+	vm_page_flag_clear(page, VM_PG_READAHEAD);
 	list_remove(&object->pages, &page->obj_node);
 	list_node_destroy(&page->obj_node);
 	list_node_destroy(&page->pgout_node);
@@ -282,6 +286,27 @@ again:
 	}
 }
 
+void vm_object_page_drop(vm_object_t *object, vm_objoff_t start,
+	vm_objoff_t end)
+{
+	vm_objoff_t offset;
+	vm_page_t *page;
+
+	sync_assert(&object->lock);
+	foreach(page, &object->pages) {
+		offset = vm_page_offset(page);
+		if(offset < start || offset >= end || vm_page_is_busy(page) ||
+			vm_page_is_dirty(page))
+		{
+			continue;
+		}
+
+		vm_page_unmap(object, page);
+		vm_pageout_rem(object, page);
+		vm_object_page_free(object, page);
+	}
+}
+
 void vm_object_page_error(vm_object_t *object, vm_page_t *page) {
 	/*
 	 * This type of error can only happen while filling the page
@@ -298,7 +323,7 @@ void vm_object_page_error(vm_object_t *object, vm_page_t *page) {
 	vm_page_unpin(page);
 }
 
-static bool vm_object_page_wait(vm_object_t *object, vm_page_t *page) {
+bool vm_object_page_wait(vm_object_t *object, vm_page_t *page) {
 	bool success;
 
 	vm_page_assert_pinned(page);
@@ -33,6 +33,7 @@
 #include <vm/mmu.h>
 #include <sys/limits.h>
 #include <lib/string.h>
+#include <arch/string.h>
 #include <config.h>
 
 void vm_page_zero_range(vm_page_t *page, size_t off, size_t size) {
@@ -43,7 +44,11 @@ void vm_page_zero_range(vm_page_t *page, size_t off, size_t size) {
 		" offset: %d size: %d", off, size);
 
 	ptr = vm_kern_map_quick(phys);
-	memset(ptr + off, 0x0, size);
+	if(size == PAGE_SZ) {
+		page_zero(ptr);
+	} else {
+		memset(ptr + off, 0x0, size);
+	}
 	vm_kern_unmap_quick(ptr);
 }
 
@@ -51,26 +51,28 @@ int vm_pager_pagein(vm_object_t *object, vm_objoff_t offset,
 
 
 	/*
-	 * Read the contents of the page from memory (may
-	 * be asynchronous).
+	 * Read the contents of the page from disk. The pager unbusies
+	 * the page once it is filled, which may happen asynchronously.
 	 */
 	err = pager->pagein(object, node, page);
 	if(err) {
+		sync_release(&object->lock);
 		vm_object_page_error(object, page);
+		sync_acquire(&object->lock);
+		return err;
 	}
 
-#if notyet
 	/*
-	 * In case the pagein was asynchronous.
-	 *
-	 * TODO would this be needed
+	 * In case the pagein was asynchronous, wait for the page without
+	 * holding the lock of the object, so that the other pages of the
+	 * object can still be used.
 	 */
 	if(vm_object_page_wait(object, page) == false) {
+		vm_page_unpin(page);
 		return -EIO;
-	} else
-#endif
+	}
 
-	return *pagep = page, err;
+	return *pagep = page, 0;
 }
 
 int vm_pager_pageout(vm_object_t *object, vm_page_t *page) {
@@ -327,21 +327,28 @@ vm_page_t *vm_page_alloc(vm_flags_t flags) {
 	return page;
 }
 
-void vm_page_free(vm_page_t *page) {
-	vm_physeg_t *seg = &vm_physegs[page->seg];
-	vm_pgaddr_t addr;
-	vm_npages_t size;
-	vm_page_t *buddy;
-	uint8_t order;
-
+static void vm_page_free_check(vm_page_t *page) {
 	vm_page_assert_allocated(page);
 	vm_page_assert_not_pinned(page);
 	if(page->flags & ~VM_PG_STATE_MASK) {
 		kpanic("[vm] phys: page flags were set while freeing: 0x%x",
 			page->flags & ~VM_PG_STATE_MASK);
 	}
+}
 
-	sync_acquire(&vm_phylock);
+/**
+ * @brief Return a page to the buddy allocator.
+ *
+ * The caller must hold the vm_phylock.
+ */
+static void vm_page_free_locked(vm_page_t *page) {
+	vm_physeg_t *seg = &vm_physegs[page->seg];
+	vm_pgaddr_t addr;
+	vm_npages_t size;
+	vm_page_t *buddy;
+	uint8_t order;
+
+	sync_assert(&vm_phylock);
 	vm_pressure_dec(VM_PR_MEM_PHYS, vm_page_size(page));
 
 	/*
@@ -392,7 +399,24 @@ void vm_page_free(vm_page_t *page) {
 	}
 
 	vm_freelist_add(page);
-	sync_release(&vm_phylock);
+}
+
+void vm_page_free(vm_page_t *page) {
+	vm_page_free_check(page);
+
+	sync_scope_acquire(&vm_phylock);
+	vm_page_free_locked(page);
+}
+
+void vm_page_free_batch(vm_page_t **pages, size_t num) {
+	for(size_t i = 0; i < num; i++) {
+		vm_page_free_check(pages[i]);
+	}
+
+	sync_scope_acquire(&vm_phylock);
+	for(size_t i = 0; i < num; i++) {
+		vm_page_free_locked(pages[i]);
+	}
 }
 
 vm_page_t *vm_phys_to_page(vm_paddr_t addr) {
@@ -555,6 +579,34 @@ vm_psize_t vm_phys_get_total(void) {
 	return ptoa(vm_phys_total);
 }
 
+vm_pgaddr_t vm_phys_end(void) {
+	vm_pgaddr_t end = 0;
+
+	for(size_t i = 0; i < vm_nphyseg; i++) {
+		end = max(end, vm_physegs[i].start + vm_physegs[i].size);
+	}
+
+	return end;
+}
+
+bool vm_physeg_range(size_t i, vm_pgaddr_t *start, vm_npages_t *size) {
+	if(i >= vm_nphyseg) {
+		return false;
+	}
+
+	*start = vm_physegs[i].start;
+	*size = vm_physegs[i].size;
+	return true;
+}
+
+bool vm_phys_is_ram(vm_paddr_t addr, vm_psize_t size) {
+	vm_pgaddr_t start = atop(addr), end = atop(addr + size - 1) + 1;
+	vm_physeg_t *seg;
+
+	seg = vm_physeg_get(start);
+	return seg != NULL && end - seg->start <= seg->size;
+}
+
 vm_psize_t vm_phys_get_free(void) {
 	return vm_mem_get_free(VM_PR_MEM_PHYS);
 }
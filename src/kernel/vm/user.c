@@ -23,11 +23,27 @@
  */
 
 #include <kern/system.h>
+#include <kern/init.h>
+#include <kern/sched.h>
+#include <kern/workqueue.h>
 #include <vm/layout.h>
 #include <vm/vas.h>
 #include <vm/mmu.h>
 #include <vm/malloc.h>
 
+/*
+ * Address spaces with at least this number of mapped pages are torn
+ * down by the reaper.
+ */
+#define VM_USER_REAP_PAGES 4096
+
+typedef struct vm_user_vas {
+	vm_vas_t vas;
+	work_t reap;
+} vm_user_vas_t;
+
+static struct workqueue *vm_reap_wq = NULL;
+
 static int vm_user_map(vm_vas_t *vas, vm_vsize_t size, vm_map_t *map) {
 	return mman_alloc(&vas->mman, size, PAGE_SZ, &map->node);
 }
@@ -48,16 +64,44 @@ static vm_vas_funcs_t vm_user_funcs = {
 	.unmap = vm_user_unmap,
 };
 
+static void vm_user_vas_destroy(vm_user_vas_t *uvas) {
+	vm_vas_destroy(&uvas->vas);
+	work_destroy(&uvas->reap);
+	kfree(uvas);
+}
+
+static void vm_user_vas_reap(void *arg) {
+	vm_user_vas_destroy(arg);
+}
+
 vm_vas_t *vm_user_vas_alloc(void) {
-	vm_vas_t *vas;
+	vm_user_vas_t *uvas;
 
-	vas = kmalloc(sizeof(*vas), VM_WAIT);
-	vm_vas_init(vas, USER_VM_START, USER_VM_END, &vm_user_funcs);
+	uvas = kmalloc(sizeof(*uvas), VM_WAIT);
+	vm_vas_init(&uvas->vas, USER_VM_START, USER_VM_END, &vm_user_funcs);
+	work_init(&uvas->reap, vm_user_vas_reap, uvas);
 
-	return vas;
+	return &uvas->vas;
 }
 
 void vm_user_vas_free(vm_vas_t *vas) {
-	vm_vas_destroy(vas);
-	kfree(vas);
+	vm_user_vas_t *uvas = container_of(vas, vm_user_vas_t, vas);
+
+	/*
+	 * Freeing every page of a big address space takes a while, so
+	 * leave that to the reaper instead of delaying the exit or
+	 * exec of the process.
+	 */
+	if(vm_reap_wq && mmu_ctx_mapped(&vas->mmu) >= VM_USER_REAP_PAGES) {
+		work_queue(vm_reap_wq, &uvas->reap);
+	} else {
+		vm_user_vas_destroy(uvas);
+	}
 }
+
+static int __init vm_user_init(void) {
+	vm_reap_wq = workqueue_create("vm_reap", SCHED_NORMAL, 1);
+	return INIT_OK;
+}
+
+late_initcall(vm_user_init);
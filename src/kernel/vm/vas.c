@@ -545,6 +545,25 @@ void vm_vas_init(vm_vas_t *vas, vm_vaddr_t start, vm_vaddr_t end,
 }
 
 void vm_vas_destroy(vm_vas_t *vas) {
+	vm_map_t *map, *next;
+
+	/*
+	 * Free the mappings still present. The address space is not used
+	 * anymore, so the PTEs are left alone and the page tables are freed
+	 * as a whole by mmu_ctx_destroy (without any TLB shootdowns).
+	 */
+	wrlocked(&vas->lock) {
+		map = vm_vas_first_map(vas, vm_vas_start(vas),
+			vm_vas_size(vas));
+		while(map) {
+			next = vm_map_next(map);
+			mman_free(&vas->mman, &map->node);
+			vm_object_map_rem(map->object, map);
+			vm_map_free(map);
+			map = next;
+		}
+	}
+
 	mmu_ctx_destroy(&vas->mmu);
 	rwlock_destroy(&vas->lock);
 	mman_destroy(&vas->mman);